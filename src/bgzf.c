@@ -209,16 +209,25 @@ static int bgzf_compress(void *_dst, int *dlen, void *src, int slen, int level)
 	z_stream zs;
 	uint8_t *dst = (uint8_t*)_dst;
 
-	// compress the body
-	zs.zalloc = NULL; zs.zfree = NULL;
-	zs.next_in  = (Bytef*)src;
-	zs.avail_in = slen;
-	zs.next_out = dst + BLOCK_HEADER_LENGTH;
-	zs.avail_out = *dlen - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
-	if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1; // -15 to disable zlib header/footer
-	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) return -1;
-	if (deflateEnd(&zs) != Z_OK) return -1;
-	*dlen = zs.total_out + BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
+	if (level == 0 && slen > 0) { // a single stored deflate block: copy the body (the EOF block keeps its usual bytes)
+		uint8_t *p = dst + BLOCK_HEADER_LENGTH;
+		p[0] = 1; // BFINAL, BTYPE=00
+		packInt16(&p[1], slen);
+		packInt16(&p[3], ~slen);
+		memcpy(&p[5], src, slen);
+		*dlen = slen + 5 + BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
+	} else {
+		// compress the body
+		zs.zalloc = NULL; zs.zfree = NULL;
+		zs.next_in  = (Bytef*)src;
+		zs.avail_in = slen;
+		zs.next_out = dst + BLOCK_HEADER_LENGTH;
+		zs.avail_out = *dlen - BLOCK_HEADER_LENGTH - BLOCK_FOOTER_LENGTH;
+		if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1; // -15 to disable zlib header/footer
+		if (deflate(&zs, Z_FINISH) != Z_STREAM_END) return -1;
+		if (deflateEnd(&zs) != Z_OK) return -1;
+		*dlen = zs.total_out + BLOCK_HEADER_LENGTH + BLOCK_FOOTER_LENGTH;
+	}
 	// write the header
 	memcpy(dst, g_magic, BLOCK_HEADER_LENGTH); // the last two bytes are a place holder for the length of the block
 	packInt16(&dst[16], *dlen - 1); // write the compressed length; -1 to fit 2 bytes
@@ -241,33 +250,42 @@ static int deflate_block(BGZF *fp, int block_length)
 	return comp_size;
 }
 
-// Inflate the block in fp->compressed_block into fp->uncompressed_block
-static int inflate_block(BGZF* fp, int block_length)
+// Inflate a BGZF block in _src_ (header included) into _dst_; return the inflated length or -1
+static int bgzf_uncompress(void *dst, const void *src, int block_length)
 {
 	z_stream zs;
+	const uint8_t *p = (const uint8_t*)src + 18;
+	if (block_length >= 26 + 5 && p[0] == 1) { // a single stored deflate block (level 0): copy it out
+		int len = unpackInt16(&p[1]);
+		if ((len ^ unpackInt16(&p[3])) == 0xffff && len + 5 == block_length - 26) {
+			memcpy(dst, &p[5], len);
+			return len;
+		}
+	}
 	zs.zalloc = NULL;
 	zs.zfree = NULL;
-	zs.next_in = (Bytef*)fp->compressed_block + 18;
+	zs.next_in = (Bytef*)src + 18;
 	zs.avail_in = block_length - 16;
-	zs.next_out = (Bytef*)fp->uncompressed_block;
+	zs.next_out = (Bytef*)dst;
 	zs.avail_out = BGZF_MAX_BLOCK_SIZE;
 
-	if (inflateInit2(&zs, -15) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
+	if (inflateInit2(&zs, -15) != Z_OK) return -1;
 	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
 		inflateEnd(&zs);
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
-	if (inflateEnd(&zs) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
 		return -1;
 	}
+	if (inflateEnd(&zs) != Z_OK) return -1;
 	return zs.total_out;
 }
 
+// Inflate the block in fp->compressed_block into fp->uncompressed_block
+static int inflate_block(BGZF* fp, int block_length)
+{
+	int ret = bgzf_uncompress(fp->uncompressed_block, fp->compressed_block, block_length);
+	if (ret < 0) fp->errcode |= BGZF_ERR_ZLIB;
+	return ret;
+}
+
 static int check_header(const uint8_t *header)
 {
 	return (header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0
@@ -335,11 +353,22 @@ static int load_block_from_cache(BGZF *fp, int64_t block_address) {return 0;}
 static void cache_block(BGZF *fp, int size) {}
 #endif
 
+#ifdef BGZF_MT
+static int mt_read_block(BGZF *fp);
+static int64_t mt_next_address(BGZF *fp);
+#define next_block_address(fp) ((fp)->mt? mt_next_address(fp) : _bgzf_tell((_bgzf_file_t)(fp)->fp))
+#else
+#define next_block_address(fp) _bgzf_tell((_bgzf_file_t)(fp)->fp)
+#endif
+
 int bgzf_read_block(BGZF *fp)
 {
 	uint8_t header[BLOCK_HEADER_LENGTH], *compressed_block;
 	int count, size = 0, block_length, remaining;
 	int64_t block_address;
+#ifdef BGZF_MT
+	if (fp->mt) return mt_read_block(fp);
+#endif
 	block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
 	if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
 	count = _bgzf_read(fp->fp, header, sizeof(header));
@@ -392,7 +421,7 @@ ssize_t bgzf_read(BGZF *fp, void *data, size_t length)
 		bytes_read += copy_length;
 	}
 	if (fp->block_offset == fp->block_length) {
-		fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		fp->block_address = next_block_address(fp);
 		fp->block_offset = fp->block_length = 0;
 	}
 	return bytes_read;
@@ -412,6 +441,13 @@ typedef struct mtaux_t {
 	volatile int proc_cnt;
 	void **blk;
 	int *len;
+	int64_t *addr; // on reading: file offset of each queued block
+	int hit, rd_err; // on reading: next block to hand out; deferred read error
+	// on reading: the batch handed out while the workers inflate the next one in blk[]
+	void **cblk;
+	int *clen;
+	int64_t *caddr;
+	int ccurr, pending;
 	worker_t *w;
 	pthread_t *tid;
 	pthread_mutex_t lock;
@@ -432,15 +468,45 @@ static int worker_aux(worker_t *w)
 	w->errcode = 0;
 	for (i = w->i; i < w->mt->curr; i += w->mt->n_threads) {
 		int clen = BGZF_MAX_BLOCK_SIZE;
+		if (!w->fp->is_write) { // inflate queued blocks in place
+			clen = bgzf_uncompress(w->buf, w->mt->blk[i], w->mt->len[i]);
+			if (clen < 0) w->errcode |= BGZF_ERR_ZLIB;
+			else memcpy(w->mt->blk[i], w->buf, clen);
+			w->mt->len[i] = clen;
+			continue;
+		}
 		if (bgzf_compress(w->buf, &clen, w->mt->blk[i], w->mt->len[i], w->fp->compress_level) != 0)
 			w->errcode |= BGZF_ERR_ZLIB;
 		memcpy(w->mt->blk[i], w->buf, clen);
 		w->mt->len[i] = clen;
 	}
-	__sync_fetch_and_add(&w->mt->proc_cnt, 1);
+	pthread_mutex_lock(&w->mt->lock);
+	++w->mt->proc_cnt;
+	pthread_cond_broadcast(&w->mt->cv);
+	pthread_mutex_unlock(&w->mt->lock);
 	return 0;
 }
 
+// start all workers on blk[0..curr)
+static void mt_signal(mtaux_t *mt)
+{
+	int i;
+	pthread_mutex_lock(&mt->lock);
+	for (i = 0; i < mt->n_threads; ++i) mt->w[i].toproc = 1;
+	mt->proc_cnt = 0;
+	pthread_cond_broadcast(&mt->cv);
+	pthread_mutex_unlock(&mt->lock);
+}
+
+// sleep until every worker has finished its share
+static void mt_wait(mtaux_t *mt)
+{
+	pthread_mutex_lock(&mt->lock);
+	while (mt->proc_cnt < mt->n_threads)
+		pthread_cond_wait(&mt->cv, &mt->lock);
+	pthread_mutex_unlock(&mt->lock);
+}
+
 static void *mt_worker(void *data)
 {
 	while (worker_aux((worker_t*)data) == 0);
@@ -452,15 +518,23 @@ int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
 	int i;
 	mtaux_t *mt;
 	pthread_attr_t attr;
-	if (!fp->is_write || fp->mt || n_threads <= 1) return -1;
+	if (fp->mt || n_threads <= 1) return -1;
 	mt = (mtaux_t*)calloc(1, sizeof(mtaux_t));
 	mt->n_threads = n_threads;
 	mt->n_blks = n_threads * n_sub_blks;
 	mt->len = (int*)calloc(mt->n_blks, sizeof(int));
 	mt->blk = (void**)calloc(mt->n_blks, sizeof(void*));
+	mt->addr = (int64_t*)calloc(mt->n_blks, sizeof(int64_t));
 	for (i = 0; i < mt->n_blks; ++i)
 		mt->blk[i] = malloc(BGZF_MAX_BLOCK_SIZE);
-	mt->tid = (pthread_t*)calloc(mt->n_threads, sizeof(pthread_t)); // tid[0] is not used, as the worker 0 is launched by the master
+	if (!fp->is_write) { // a second batch for reading ahead
+		mt->clen = (int*)calloc(mt->n_blks, sizeof(int));
+		mt->cblk = (void**)calloc(mt->n_blks, sizeof(void*));
+		mt->caddr = (int64_t*)calloc(mt->n_blks, sizeof(int64_t));
+		for (i = 0; i < mt->n_blks; ++i)
+			mt->cblk[i] = malloc(BGZF_MAX_BLOCK_SIZE);
+	}
+	mt->tid = (pthread_t*)calloc(mt->n_threads, sizeof(pthread_t)); // when writing, tid[0] is not used, as the worker 0 is launched by the master
 	mt->w = (worker_t*)calloc(mt->n_threads, sizeof(worker_t));
 	for (i = 0; i < mt->n_threads; ++i) {
 		mt->w[i].i = i;
@@ -472,7 +546,9 @@ int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
 	pthread_mutex_init(&mt->lock, 0);
 	pthread_cond_init(&mt->cv, 0);
-	for (i = 1; i < mt->n_threads; ++i) // worker 0 is effectively launched by the master thread
+	// when writing, worker 0 is effectively launched by the master thread; when
+	// reading, the master hands out blocks while all workers inflate the next batch
+	for (i = fp->is_write? 1 : 0; i < mt->n_threads; ++i)
 		pthread_create(&mt->tid[i], &attr, mt_worker, &mt->w[i]);
 	fp->mt = mt;
 	return 0;
@@ -486,11 +562,15 @@ static void mt_destroy(mtaux_t *mt)
 	mt->done = 1; mt->proc_cnt = 0;
 	pthread_cond_broadcast(&mt->cv);
 	pthread_mutex_unlock(&mt->lock);
-	for (i = 1; i < mt->n_threads; ++i) pthread_join(mt->tid[i], 0); // worker 0 is effectively launched by the master thread
+	for (i = mt->cblk? 0 : 1; i < mt->n_threads; ++i) pthread_join(mt->tid[i], 0); // worker 0 runs on the master thread when writing
 	// free other data allocated on heap
 	for (i = 0; i < mt->n_blks; ++i) free(mt->blk[i]);
+	if (mt->cblk) {
+		for (i = 0; i < mt->n_blks; ++i) free(mt->cblk[i]);
+		free(mt->cblk); free(mt->clen); free(mt->caddr);
+	}
 	for (i = 0; i < mt->n_threads; ++i) free(mt->w[i].buf);
-	free(mt->blk); free(mt->len); free(mt->w); free(mt->tid);
+	free(mt->blk); free(mt->len); free(mt->addr); free(mt->w); free(mt->tid);
 	pthread_cond_destroy(&mt->cv);
 	pthread_mutex_destroy(&mt->lock);
 	free(mt);
@@ -503,7 +583,7 @@ static void mt_queue(BGZF *fp)
 	memcpy(mt->blk[mt->curr], fp->uncompressed_block, fp->block_offset);
 	mt->len[mt->curr] = fp->block_offset;
 	fp->block_offset = 0;
-	++mt->curr;
+	++mt->curr; ++fp->n_blk;
 }
 
 static int mt_flush(BGZF *fp)
@@ -512,20 +592,19 @@ static int mt_flush(BGZF *fp)
 	mtaux_t *mt = (mtaux_t*)fp->mt;
 	if (fp->block_offset) mt_queue(fp); // guaranteed that assertion does not fail
 	// signal all the workers to compress
-	pthread_mutex_lock(&mt->lock);
-	for (i = 0; i < mt->n_threads; ++i) mt->w[i].toproc = 1;
-	mt->proc_cnt = 0;
-	pthread_cond_broadcast(&mt->cv);
-	pthread_mutex_unlock(&mt->lock);
+	mt_signal(mt);
 	// worker 0 is doing things here
 	worker_aux(&mt->w[0]);
 	// wait for all the threads to complete
-	while (mt->proc_cnt < mt->n_threads);
+	mt_wait(mt);
 	// dump data to disk
 	for (i = 0; i < mt->n_threads; ++i) fp->errcode |= mt->w[i].errcode;
-	for (i = 0; i < mt->curr; ++i)
+	for (i = 0; i < mt->curr; ++i) {
 		if (fwrite(mt->blk[i], 1, mt->len[i], (FILE*)fp->fp) != (size_t)mt->len[i])
 			fp->errcode |= BGZF_ERR_IO;
+		if (fp->blk_cb) fp->blk_cb(fp->blk_cb_data, fp->block_address);
+		fp->block_address += mt->len[i];
+	}
 	mt->curr = 0;
 	return 0;
 }
@@ -552,6 +631,102 @@ static ssize_t mt_write(BGZF *fp, const void *data, size_t length)
 	return length - rest;
 }
 
+/* Reading: blocks are handed out from cblk[] while the workers inflate the
+ * next batch in blk[]; mt_fill() swaps the two once the workers are done. */
+
+// load up to n_blks raw blocks from disk and start inflating them
+static void mt_start(BGZF *fp)
+{
+	mtaux_t *mt = (mtaux_t*)fp->mt;
+	uint8_t *blk;
+	int count, block_length;
+	mt->curr = 0;
+	while (!mt->rd_err && mt->curr < mt->n_blks) {
+		int64_t block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		blk = (uint8_t*)mt->blk[mt->curr];
+		count = _bgzf_read(fp->fp, blk, BLOCK_HEADER_LENGTH);
+		if (count == 0) break; // end of file
+		if (count != BLOCK_HEADER_LENGTH || !check_header(blk)) {
+			mt->rd_err = BGZF_ERR_HEADER;
+			break;
+		}
+		block_length = unpackInt16(&blk[16]) + 1;
+		count = _bgzf_read(fp->fp, &blk[BLOCK_HEADER_LENGTH], block_length - BLOCK_HEADER_LENGTH);
+		if (count != block_length - BLOCK_HEADER_LENGTH) {
+			mt->rd_err = BGZF_ERR_IO;
+			break;
+		}
+		mt->addr[mt->curr] = block_address;
+		mt->len[mt->curr++] = block_length;
+	}
+	if (mt->curr) {
+		mt_signal(mt);
+		mt->pending = 1;
+	}
+}
+
+// wait for the batch in flight, if any
+static void mt_drain(BGZF *fp)
+{
+	mtaux_t *mt = (mtaux_t*)fp->mt;
+	int i;
+	if (!mt->pending) return;
+	mt_wait(mt);
+	mt->pending = 0;
+	for (i = 0; i < mt->n_threads; ++i) fp->errcode |= mt->w[i].errcode;
+}
+
+static int mt_fill(BGZF *fp)
+{
+	mtaux_t *mt = (mtaux_t*)fp->mt;
+	void **tb; int *tl; int64_t *ta;
+	if (!mt->pending) mt_start(fp); // first read, or after a seek
+	mt_drain(fp);
+	tb = mt->cblk; mt->cblk = mt->blk; mt->blk = tb;
+	tl = mt->clen; mt->clen = mt->len; mt->len = tl;
+	ta = mt->caddr; mt->caddr = mt->addr; mt->addr = ta;
+	mt->ccurr = mt->curr;
+	mt->curr = mt->hit = 0;
+	if (mt->ccurr == 0) {
+		if (mt->rd_err) {
+			fp->errcode |= mt->rd_err;
+			return -1;
+		}
+		return 0;
+	}
+	mt_start(fp); // inflated while this batch is consumed
+	return 0;
+}
+
+static int mt_read_block(BGZF *fp)
+{
+	mtaux_t *mt = (mtaux_t*)fp->mt;
+	int i;
+	if (mt->hit >= mt->ccurr) {
+		if (mt_fill(fp) != 0) return -1;
+		if (mt->ccurr == 0) { // no data read
+			fp->block_length = 0;
+			return 0;
+		}
+	}
+	i = mt->hit++;
+	if (mt->clen[i] < 0) return -1;
+	memcpy(fp->uncompressed_block, mt->cblk[i], mt->clen[i]);
+	if (fp->block_length != 0) fp->block_offset = 0; // Do not reset offset if this read follows a seek.
+	fp->block_address = mt->caddr[i];
+	fp->block_length = mt->clen[i];
+	return 0;
+}
+
+// address of the block following the one being consumed
+static int64_t mt_next_address(BGZF *fp)
+{
+	mtaux_t *mt = (mtaux_t*)fp->mt;
+	if (mt->hit < mt->ccurr) return mt->caddr[mt->hit];
+	if (mt->pending) return mt->addr[0];
+	return _bgzf_tell((_bgzf_file_t)fp->fp);
+}
+
 #endif // ~ #ifdef BGZF_MT
 
 int bgzf_flush(BGZF *fp)
@@ -568,6 +743,8 @@ int bgzf_flush(BGZF *fp)
 			fp->errcode |= BGZF_ERR_IO; // possibly truncated file
 			return -1;
 		}
+		++fp->n_blk;
+		if (fp->blk_cb) fp->blk_cb(fp->blk_cb_data, fp->block_address);
 		fp->block_address += block_length;
 	}
 	return 0;
@@ -619,10 +796,10 @@ int bgzf_close(BGZF* fp)
 			fp->errcode |= BGZF_ERR_IO;
 			return -1;
 		}
+	}
 #ifdef BGZF_MT
-		if (fp->mt) mt_destroy((mtaux_t*)fp->mt);
+	if (fp->mt) mt_destroy((mtaux_t*)fp->mt);
 #endif
-	}
 	ret = fp->is_write? fclose((FILE*)fp->fp) : _bgzf_close(fp->fp);
 	if (ret != 0) return -1;
 	free(fp->uncompressed_block);
@@ -659,6 +836,13 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
 	}
 	block_offset = pos & 0xFFFF;
 	block_address = pos >> 16;
+#ifdef BGZF_MT
+	if (fp->mt) { // drop the read-ahead queue
+		mtaux_t *mt = (mtaux_t*)fp->mt;
+		mt_drain(fp);
+		mt->curr = mt->ccurr = mt->hit = mt->rd_err = 0;
+	}
+#endif
 	if (_bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
 		fp->errcode |= BGZF_ERR_IO;
 		return -1;
@@ -690,7 +874,7 @@ int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-        fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+        fp->block_address = next_block_address(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -723,7 +907,7 @@ int bgzf_getline(BGZF *fp, int delim, kstring_t *str)
 		str->l += l;
 		fp->block_offset += l + 1;
 		if (fp->block_offset >= fp->block_length) {
-			fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+			fp->block_address = next_block_address(fp);
 			fp->block_offset = 0;
 			fp->block_length = 0;
 		} 
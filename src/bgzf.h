@@ -49,6 +49,9 @@ typedef struct {
     void *uncompressed_block, *compressed_block;
 	void *cache; // a pointer to a hash table
 	void *fp; // actual file handler; FILE* on writing; FILE* or knetFile* on reading
+	int64_t n_blk; // on writing: blocks handed to the compressor so far
+	void (*blk_cb)(void *data, int64_t addr); // on writing: called as each block reaches the file
+	void *blk_cb_data;
 #ifdef BGZF_MT
 	void *mt; // only used for multi-threading
 #endif
@@ -200,10 +203,13 @@ extern "C" {
 
 #ifdef BGZF_MT
 	/**
-	 * Enable multi-threading (only effective on writing)
+	 * Enable multi-threading. On writing, blocks are deflated in batches by
+	 * the worker threads; on reading, up to n_threads*n_sub_blks blocks are
+	 * read ahead and inflated in parallel, then handed out in file order so
+	 * bgzf_read()/bgzf_tell()/bgzf_seek() behave as in the serial case.
 	 *
-	 * @param fp          BGZF file handler; must be opened for writing
-	 * @param n_threads   #threads used for writing
+	 * @param fp          BGZF file handler
+	 * @param n_threads   #threads used for compression/decompression
 	 * @param n_sub_blks  #blocks processed by each thread; a value 64-256 is recommended
 	 */
 	int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks);
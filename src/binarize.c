@@ -66,15 +66,16 @@
  * Multi-sample behavior
  * ---------------------
  * The input may contain multiple format-3 records (samples). For each record:
- *   - decompress in-place
+ *   - walk the compressed record run by run (cdata_cursor_t), deciding
+ *     each run once instead of inflating the M/U vector
  *   - build a new format-6 record of the same length
  *   - compress and write it
  *
  * Index propagation
  * -----------------
- * If an index exists for the input and -o is provided, the tool generates
- * a matching index for the output by replaying sample offsets. If output is
- * stdout, no index is written. :contentReference[oaicite:2]{index=2}
+ * If -o is provided, the output is indexed as it is written, under the
+ * input's sample names when the input has an index (Unnamed_<k> otherwise).
+ * If output is stdout, no index is written. :contentReference[oaicite:2]{index=2}
  */
 
 static int usage(void) {
@@ -106,7 +107,7 @@ static int usage(void) {
   fprintf(stderr, "\n");
   fprintf(stderr, "Notes:\n");
   fprintf(stderr, "  * Sites with depth < min_cov remain NA in format 6 (universe bit = 0).\n");
-  fprintf(stderr, "  * If the input has a sample index and -o is used, an output index is written.\n");
+  fprintf(stderr, "  * With -o an output index is written, reusing the input sample names if indexed.\n");
   fprintf(stderr, "\n");
   return 1;
 }
@@ -135,76 +136,42 @@ int main_binarize(int argc, char *argv[]) {
 
   char *fname = argv[optind];
 
-  BGZF *fp_out;
-  if (fname_out) fp_out = bgzf_open2(fname_out, "w");
-  else fp_out = bgzf_dopen(fileno(stdout), "w");
-  if (fp_out == NULL) {
-    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
-    exit(1);
-  }
-
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
   cfile_t cf = open_cfile(fname);
-  char *fname_index = get_fname_index(fname);
-  index_t *idx = loadIndex(fname_index);
-  free(fname_index);
-
-  while (1) {
-    cdata_t c = read_cdata1(&cf);
-    if (c.n == 0) break;
-    decompress_in_situ(&c);
-    if (c.fmt != '3') wzfatal("[%s:%d] Only format 3 files are supported (given %c).\n", __func__, __LINE__, c.fmt);
-
-    cdata_t c6 = {.fmt = '6', .n = c.n};
-    c6.s = calloc((c6.n+3)/4, sizeof(uint8_t));
-    for (uint64_t i=0; i<c6.n; ++i) {
-      uint64_t mu = f3_get_mu(&c, i);
-      if (MU2cov(mu) >= min_cov) {
-        if (Mmin>0) {           /* binarize by just M */
-          if ((mu>>32) >= Mmin) FMT6_SET1(c6, i);
-          else FMT6_SET0(c6, i);
-        } else {                /* binarize by Beta */
-          if (MU2beta(mu) >= Tmin) FMT6_SET1(c6, i);
-          else FMT6_SET0(c6, i);
-        }
+  snames_t snames = loadSampleNamesFromIndex(fname);
+
+  cdata_t c6 = {0};             // reused across records
+  cdata_t *c_in;
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, cdata_prep_raw, NULL);
+  for (int64_t k = 0; (c_in = cfile_prefetch_next(pf)); ++k) {
+    if (c_in->fmt != '3') wzfatal("[%s:%d] Only format 3 files are supported (given %c).\n", __func__, __LINE__, c_in->fmt);
+
+    c6.fmt = '6'; c6.n = cdata_n(c_in); c6.compressed = 0;
+    c6.s = realloc(c6.s, (c6.n+3)/4);
+    memset(c6.s, 0, (c6.n+3)/4);
+    cdata_cursor_t cur;
+    cdata_cursor_init(&cur, c_in);
+    while (cdata_cursor_next(&cur)) {
+      uint64_t mu = cur.v;
+      if (MU2cov(mu) < min_cov) continue; // stays NA
+      int set;
+      if (Mmin>0) set = (mu>>32) >= Mmin; /* binarize by just M */
+      else set = MU2beta(mu) >= Tmin;     /* binarize by Beta */
+      for (uint64_t i=cur.row; i<cur.row+cur.n; ++i) {
+        if (set) FMT6_SET1(c6, i);
+        else FMT6_SET0(c6, i);
       }
     }
     cdata_compress(&c6);
-    cdata_write1(fp_out, &c6);
-    free_cdata(&c6);
-    free_cdata(&c);
-  }
-
-  if (idx && fname_out) {              // output index
-    int npairs = 0;
-    index_pair_t *pairs = index_pairs(idx, &npairs);
-    
-    cfile_t cf2 = open_cfile(fname_out);
-    index_t *idx2 = kh_init(index);
-    int64_t addr = bgzf_tell(cf2.fh);
-    cdata_t c_tmp = {0};
-    for (int i=0; i< npairs; ++i) {
-      if (!read_cdata2(&cf2, &c_tmp))
-        wzfatal("[Error] Data is shorter than the sample name list.\n");
-      
-      insert_index(idx2, pairs[i].key, addr);
-      addr = bgzf_tell(cf2.fh);
-    }
-    free_cdata(&c_tmp);
-
-    char *fname_index2 = get_fname_index(fname_out);
-    FILE *out = fopen(fname_index2, "w");
-    writeIndex(out, idx2);
-    fclose(out);
-    free(fname_index2);
-    bgzf_close(cf2.fh);
-    freeIndex(idx2);
-    free(pairs);
-    cleanIndex(idx);
+    cfile_writer_write(w, &c6, k < snames.n ? snames.s[k] : NULL);
   }
+  cfile_prefetch_close(pf);
+  free_cdata(&c6);
+  cfile_writer_close(w);
+  cleanSampleNames(&snames);
 
   if (fname_out) free(fname_out);
-  bgzf_close(fp_out);
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
 
   return 0;
 }
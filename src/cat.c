@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+/**
+ * This file is part of YAME.
+ *
+ * Copyright (C) 2021-present Wanding Zhou
+ *
+ * YAME is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAME is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cfile.h"
+
+/**
+ * yame cat
+ * ========
+ *
+ * Concatenates .cx files without inflating them.  A .cx is a run of BGZF
+ * blocks, so the inputs are appended byte for byte, minus each one's
+ * trailing empty EOF block, and a single EOF block closes the output.
+ *
+ * A record of input i that sat at virtual offset (coffset<<16 | uoffset)
+ * now sits at ((base_i + coffset)<<16 | uoffset), base_i being the number
+ * of bytes written before input i.  The output index is the union of the
+ * input indices shifted that way, so with -o every input must be indexed
+ * and sample names must be unique across inputs.
+ */
+
+static const uint8_t bgzf_eof[28] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+
+static int usage(void) {
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  yame cat [options] <in1.cx> [in2.cx ...]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Purpose:\n");
+  fprintf(stderr, "  Concatenate .cx files block by block, without decompressing them,\n");
+  fprintf(stderr, "  and merge their sample indices.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -o <out.cx>  Write output to file and write its index (default: stdout, no index).\n");
+  fprintf(stderr, "  -h           Show this help message.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Notes:\n");
+  fprintf(stderr, "  * With -o, every input needs an index and sample names must not repeat.\n");
+  fprintf(stderr, "  * Tiled (yame retile) and flat (yame flatten) containers cannot be concatenated.\n");
+  fprintf(stderr, "\n");
+  return 1;
+}
+
+/* adds the index of fname_cx to idx, shifted to start at byte base */
+static void merge_index(index_t *idx, const char *fname_cx, uint64_t base) {
+  char *fname_index = get_fname_index(fname_cx);
+  index_t *idx_in = loadIndex(fname_index);
+  free(fname_index);
+  if (!idx_in) wzfatal("[%s:%d] %s has no index. Run yame index on it, or write to stdout.\n", __func__, __LINE__, fname_cx);
+
+  int n = 0;
+  index_pair_t *pairs = index_pairs(idx_in, &n);
+  for (int i = 0; i < n; ++i) {
+    if (getIndex(idx, pairs[i].key) >= 0)
+      wzfatal("[%s:%d] Sample %s of %s is already in an earlier input.\n", __func__, __LINE__, pairs[i].key, fname_cx);
+    insert_index(idx, pairs[i].key, pairs[i].value + (int64_t) (base<<16));
+  }
+  free(pairs);                  // keys now belong to idx
+  cleanIndex(idx_in);
+}
+
+int main_cat(int argc, char *argv[]) {
+
+  int c; char *fname_out = NULL;
+  while ((c = getopt(argc, argv, "o:h"))>=0) {
+    switch (c) {
+    case 'o': fname_out = strdup(optarg); break;
+    case 'h': return usage(); break;
+    default: usage(); wzfatal("Unrecognized option: %c.\n", c);
+    }
+  }
+
+  if (optind + 1 > argc) {
+    usage();
+    wzfatal("Please supply input files.\n");
+  }
+
+  // check the inputs and merge their indices before writing anything
+  int n = argc - optind;
+  uint64_t *sizes = calloc(n, sizeof(uint64_t));
+  index_t *idx = fname_out ? kh_init(index) : NULL;
+  uint64_t base = 0;            // output bytes before each input
+  for (int i = 0; i < n; ++i) {
+    char *fname = argv[optind+i];
+    cfile_t cf = open_cfile(fname);
+    if (cf.tl) wzfatal("[%s:%d] %s is a tiled container and cannot be concatenated.\n", __func__, __LINE__, fname);
+    if (cf.fl) wzfatal("[%s:%d] %s is a flat container; yame unflatten it first.\n", __func__, __LINE__, fname);
+
+    // drop the EOF block; a single one ends the output
+    FILE *in = (FILE*) cf.fh->fp;
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0) wzfatal("[%s:%d] Cannot stat %s.\n", __func__, __LINE__, fname);
+    sizes[i] = st.st_size;
+    uint8_t tail[28];
+    if (sizes[i] >= sizeof(tail) && pread(fileno(in), tail, sizeof(tail), sizes[i] - sizeof(tail)) == sizeof(tail) &&
+        memcmp(tail, bgzf_eof, sizeof(tail)) == 0) sizes[i] -= sizeof(tail);
+    cfile_close(&cf);
+
+    if (idx) merge_index(idx, fname, base);
+    base += sizes[i];
+  }
+
+  FILE *out = fname_out ? fopen(fname_out, "wb") : stdout;
+  if (!out) wzfatal("[%s:%d] Cannot open %s for writing.\n", __func__, __LINE__, fname_out);
+  size_t m_buf = 1<<22;
+  uint8_t *buf = malloc(m_buf);
+  for (int i = 0; i < n; ++i) {
+    char *fname = argv[optind+i];
+    FILE *in = fopen(fname, "rb");
+    if (!in) wzfatal("[%s:%d] Cannot read %s.\n", __func__, __LINE__, fname);
+    for (uint64_t left = sizes[i]; left > 0; ) {
+      size_t nb = left < m_buf ? left : m_buf;
+      if (fread(buf, 1, nb, in) != nb)
+        wzfatal("[%s:%d] Error reading %s.\n", __func__, __LINE__, fname);
+      if (fwrite(buf, 1, nb, out) != nb)
+        wzfatal("[%s:%d] Error writing output.\n", __func__, __LINE__);
+      left -= nb;
+    }
+    fclose(in);
+  }
+  if (fwrite(bgzf_eof, 1, sizeof(bgzf_eof), out) != sizeof(bgzf_eof) || fflush(out) != 0)
+    wzfatal("[%s:%d] Error writing output.\n", __func__, __LINE__);
+  free(buf); free(sizes);
+
+  if (fname_out) {
+    fclose(out);
+    char *fname_index = get_fname_index(fname_out);
+    FILE *fi = fopen(fname_index, "w");
+    if (!fi) wzfatal("[%s:%d] Cannot open index file %s.\n", __func__, __LINE__, fname_index);
+    writeIndex(fi, idx);
+    fclose(fi);
+    free(fname_index);
+    updateBinaryIndex(fname_out, idx, 0);
+    cleanIndex(idx);
+    free(fname_out);
+  }
+  return 0;
+}
@@ -37,6 +37,40 @@
 #include "bgzf.h"
 
 #define CDSIG 266563789635
+#define CDSIG2 266563789636     /* record header with extension block, see below */
+
+/**
+ * On-disk record header
+ * ---------------------
+ * CDSIG  : uint64 sig, uint8 fmt, uint64 n, then cdata_nbytes() payload bytes.
+ * CDSIG2 : uint64 sig, uint8 fmt, uint64 n, uint8 ext_len, ext_len bytes of
+ *          extension, then the payload.  The extension currently holds
+ *            uint64 nrow   number of rows after decompression
+ *            uint8  unit   inflated unit (fmt3: the inferred unit)
+ *            uint8  flags  CDFLAG_* bits
+ *          Readers skip extension bytes they do not know, so fields can be
+ *          appended without another signature.  CDSIG records are still read
+ *          and simply leave nrow unknown.
+ *
+ * With CDFLAG_CKPT the payload is followed by a row checkpoint table for the
+ * run-length formats (1-4) and fmt7, so a row window can be decoded without
+ * walking the stream from its start:
+ *            uint64 step, uint64 n, then n 16-byte words
+ * For formats 1-4 each word is (uint64 off, uint64 row): entry j gives the
+ * byte offset in s of the record holding row j*step and the first row of
+ * that record.  fmt7 words hold reader checkpoints and a chromosome
+ * directory (see format7.c).  The table is kept in memory right after the
+ * payload in cdata_t.s.
+ */
+#define CDHDR_EXT_LEN 10
+#define CDFLAG_CKPT 0x1
+/* fmt0 only: the payload holds sparse containers instead of packed bits
+   (see format0.c); n is then the payload byte count */
+#define CDFLAG_SPARSE 0x2
+/* in memory only: s points into a flat container's mapping (see cfile.h)
+   and is not owned by the cdata_t */
+#define CDFLAG_MAPPED 0x80
+#define CDATA_CKPT_STEP (1ul<<16)  /* rows between checkpoints */
 
 /**
  * cdata_t
@@ -83,9 +117,24 @@
  *         • fmt6: universe bitmask accessors
  *         • fmt7: row_reader_t for streamed BED iteration
  *
+ *   nrow :
+ *       Number of rows the compressed stream decompresses to, when known.
+ *       Filled from CDSIG2 headers on read; cdata_compress() resets it to
+ *       0 and cdata_write1() recomputes it for the header.  0 means unknown
+ *       and callers must fall back to cdata_dims()/decompress().
+ *
+ *   flags :
+ *       CDFLAG_CKPT → a checkpoint table follows the payload in `s`, see
+ *       cdata_ckpt_seek() and decompress_range().
+ *       CDFLAG_SPARSE → fmt0 payload is in sparse containers, fmt6 payload
+ *       in varint runs or covered sites; see format0.c and format6.c.
+ *       CDFLAG_MAPPED → `s` is borrowed from a flat container mapping;
+ *       free_cdata() leaves it alone.
  *
  * Special notes:
- *   • Format 0: n is the number of bits, stored bit-packed in s[].
+ *   • Format 0: n is the number of bits, stored bit-packed in s[]; sparse
+ *               records (CDFLAG_SPARSE) keep their row count in the payload.
+ *   • Format 6: 2 bits per row, packed; sparse records as for format 0.
  *   • Format 1: run-length-encoded integer stream; unit=0 and inflation is
  *               performed by format-specific helpers.
  *   • Format 7: only the *uncompressed* version has fixed-width entries;
@@ -101,13 +150,15 @@ typedef struct cdata_t {
   char fmt;         /* format code '0'..'7' */
   uint8_t unit;     /* size of each decompressed unit (0 for bit-packed fmt0/1/6) */
   void *aux;        /* optional per-format auxiliary structure */
+  uint64_t nrow;    /* #rows after decompression if known (compressed only), 0 = unknown */
+  uint8_t flags;    /* CDFLAG_* from the record header (compressed only) */
 } cdata_t;
 
 static inline uint64_t cdata_nbytes(const cdata_t *c) {
   uint64_t n = 0;
   switch(c->fmt) {
-  case '0': n = ((c->n+7)>>3); break;
-  case '6': n = ((c->n+3)>>2); break;
+  case '0': n = (c->compressed && (c->flags & CDFLAG_SPARSE)) ? c->n : ((c->n+7)>>3); break;
+  case '6': n = (c->compressed && (c->flags & CDFLAG_SPARSE)) ? c->n : ((c->n+3)>>2); break;
   default: n = c->n;
   }
 
@@ -119,51 +170,102 @@ static inline uint64_t cdata_nbytes(const cdata_t *c) {
   return n;
 }
 
+/* bytes held in s, including a trailing checkpoint table */
+static inline uint64_t cdata_stored_nbytes(const cdata_t *c) {
+  uint64_t n = cdata_nbytes(c);
+  if (c->compressed && (c->flags & CDFLAG_CKPT)) {
+    uint64_t nck; memcpy(&nck, c->s+n+8, sizeof(uint64_t));
+    n += 16 + 16*nck;
+  }
+  return n;
+}
+
 typedef struct f2_aux_t {
   uint64_t nk;                  // num keys
   char **keys;                  // pointer to keys, doesn't own memory
   uint8_t *data;                // pointer to data, doesn't own memory
+  const uint8_t *blk;           // compressed blocked stream header, see format2.c
+  uint64_t nrun;                // state runs, set by fmt2_mask_runs()
+  struct f2_run_t *runs;
 } f2_aux_t;
 
-static inline void free_cdata(cdata_t *c) {
-  if (c->s) free(c->s);
+/* a run of one state, ending (exclusive) at row end */
+typedef struct f2_run_t {
+  uint64_t end;
+  uint64_t v;
+} f2_run_t;
+
+static inline void fmt2_free_aux(cdata_t *c) {
   if (c->fmt == '2' && c->aux) {
     free(((f2_aux_t*) c->aux)->keys);
+    free(((f2_aux_t*) c->aux)->runs);
     free(c->aux);
+    c->aux = NULL;
   }
-  if (c->fmt == '7' && c->aux) free(c->aux);
-  c->s = NULL;
 }
 
-static inline size_t bit_count(cdata_t c) {
-
-  /* create a look-up table */
-  int byte2cnt[256]; int p;
-  for (p=0; p<256; ++p) {
-    unsigned char q = p; int ii, cnt = 0;
-    for (ii=0; ii<8; ++ii) { if (q&1) cnt++; q>>=1; }
-    byte2cnt[p] = cnt;
-  }
-  
-  size_t i,k,m = 0;
-  for (i=0; i<(c.n>>3); ++i) m += byte2cnt[c.s[i]];   // full bytes
-  for (k=0; k<(c.n&0x7); ++k) m += (c.s[i]>>k) & 0x1; // last byte
-  return m;
+static inline void free_cdata(cdata_t *c) {
+  if (c->s && !(c->flags & CDFLAG_MAPPED)) free(c->s);
+  fmt2_free_aux(c);
+  if (c->fmt == '7' && c->aux) free(c->aux);
+  c->s = NULL;
 }
 
 void cdata_compress(cdata_t *c);
 cdata_t decompress(cdata_t c);
 void decompress_in_situ(cdata_t *c);
+uint64_t cdata_dims(const cdata_t *c, uint8_t *unit);
+cdata_t decompress_range(const cdata_t *c, uint64_t beg, uint64_t end);
+void decompress_into(const cdata_t *c, cdata_t *out);
+void cdata_ckpt_seek(const cdata_t *c, uint64_t row, uint64_t *i, uint64_t *row0);
+uint64_t cdata_ckpt_build(const cdata_t *c, uint8_t **tab);
 
 static inline uint64_t cdata_n(cdata_t *c) {
   if (!c->compressed) return c->n;
-  cdata_t c2 = decompress(*c);
-  uint64_t n = c2.n;
-  free(c2.s);
-  return n;
+  if (c->nrow) return c->nrow;
+  uint8_t unit = 0;
+  return cdata_dims(c, &unit);
 }
 
 void convertToFmt0(cdata_t *c);
+
+static inline int fmt0_is_sparse(const cdata_t *c) {
+  return c->fmt == '0' && c->compressed && (c->flags & CDFLAG_SPARSE);
+}
+
+/**
+ * Set intervals of a fmt0 record, packed bits or sparse containers alike:
+ *
+ *   fmt0_iter_t it; uint64_t beg, end;
+ *   fmt0_iter_init(&it, c);
+ *   while (fmt0_next_range(&it, &beg, &end)) { rows [beg, end) are set }
+ *
+ * Intervals come in order and may touch each other.
+ */
+typedef struct fmt0_iter_t {
+  const cdata_t *c;
+  uint64_t nrow;
+  uint64_t r;                   // packed bits: next row to scan
+  uint64_t k, j;                // sparse: container, position inside it
+} fmt0_iter_t;
+
+void     fmt0_iter_init(fmt0_iter_t *it, const cdata_t *c);
+void     fmt0_iter_seek(fmt0_iter_t *it, uint64_t row);
+int      fmt0_next_range(fmt0_iter_t *it, uint64_t *beg, uint64_t *end);
+uint64_t fmt0_popcount(const cdata_t *c);
+uint64_t fmt0_and_popcount(const cdata_t *a, const cdata_t *b);
+uint64_t fmt0_range_popcount(const cdata_t *c, uint64_t beg, uint64_t end);
+void     fmt0_to_bits(cdata_t *c);
+/* popcount.c: fused reductions over nw 64-bit words (read unaligned) on
+   the widest popcount the CPU has. fmt6_word_counts() adds the codes of
+   fmt6 words to cnts, at all rows (sel NULL), at the rows set in packed
+   bits sel, or at code 3 of fmt6 sel (sel_f6); fmt6_su_overlap() adds the
+   shared universe of a and b, and its rows set in a, in b, and in both. */
+uint64_t bits_popcount(const uint8_t *a, uint64_t nw);
+uint64_t bits_and_popcount(const uint8_t *a, const uint8_t *b, uint64_t nw);
+void     fmt6_word_counts(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t cnts[4]);
+void     fmt6_su_overlap(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t cnt[4]);
+
 #define FMT0_IN_SET(c, i) ((c).s[(i)>>3] & (1u<<((i)&0x7)))
 #define FMT0_SET(c, i) (c.s[(i)>>3] |= (1u<<((i)&0x7)))
 
@@ -171,14 +273,45 @@ void convertToFmt0(cdata_t *c);
 #define _FMT0_SET(s, i) ((s)[(i)>>3] |= (1u<<((i)&0x7)))
 
 void fmt2_set_aux(cdata_t *c);
+/* inflated record of data_n states indexing keys (copied), as fmt2_read_raw() builds */
+cdata_t *fmt2_from_states(char **keys, uint64_t keys_n, const uint64_t *data, uint64_t data_n);
 uint8_t* fmt2_get_data(const cdata_t *c);
 uint64_t fmt2_get_keys_n(const cdata_t *c);
 uint64_t fmt2_get_keys_nbytes(const cdata_t *c);
 uint64_t f2_get_uint64(cdata_t *c, uint64_t i);
+int      fmt2_is_blocked(const cdata_t *c);
+void     fmt2_to_rle(cdata_t *c);
+f2_aux_t *fmt2_mask_runs(cdata_t *c);
 char* f2_get_string(cdata_t *c, uint64_t i);
 
 void     f3_set_mu(cdata_t *c, uint64_t i, uint64_t M, uint64_t U);
 uint64_t f3_get_mu(cdata_t *c, uint64_t i);
+int      fmt3_is_v2(const cdata_t *c);
+void     fmt3_to_v1(cdata_t *c);
+
+/* size of s deflated at the level BGZF writes by default, as a stand-in
+   for what the file will hold; encoders trial their alternatives with it */
+uint64_t deflated_nbytes(const uint8_t *s, uint64_t n);
+
+/* fmt4 quantized betas, see format4.c: inflated records of unit 1 or 2 hold
+   codes q (beta = q / F4Q_MAX), the all-ones code is NA */
+#define F4Q_HDR 16
+#define F4Q_MAX(unit) ((unit) == 1 ? 254u : 65534u)
+int      fmt4_is_quant(const cdata_t *c);
+void     fmt4_to_float(cdata_t *c);
+void     fmt4_to_plain(cdata_t *c);
+uint8_t  fmt4_quantize_exact(cdata_t *c);
+
+/* row i of an inflated fmt4 record as a float, NA as -1.0 */
+static inline float fmt4_value(const cdata_t *c, uint64_t i) {
+  if (c->unit == 1) return c->s[i] == 0xff ? -1.0f : (float) c->s[i] / F4Q_MAX(1);
+  if (c->unit == 2) {
+    uint16_t q; memcpy(&q, c->s+2*i, 2);
+    return q == 0xffff ? -1.0f : (float) q / F4Q_MAX(2);
+  }
+  float v; memcpy(&v, c->s+4*i, 4);
+  return v;
+}
 #define MU2beta(mu) (double) ((mu)>>32) / (((mu)>>32) + ((mu)&0xffffffff))
 #define MU2cov(mu) (((mu)>>32) + ((mu)&0xffffffff))
 
@@ -190,16 +323,38 @@ uint64_t f3_get_mu(cdata_t *c, uint64_t i);
 #define FMT6_SET1(c, i) ((c).s[i>>2] |= (3<<((i&0x3)*2))) // 11
 #define FMT6_SET_NA(c, i) ((c).s[i>>2] &= (~(3<<((i&0x3)*2)))) // 00
 
+/* sparse fmt6 payload, see format6.c: uint64 nrow, uint8 coding, then
+   varint records */
+#define F6_HDR   9
+#define F6_RUNS  1              /* (len-1)<<2 | code */
+#define F6_SITES 2              /* gap<<1 | set: gap NA rows, then a covered row */
+static inline int fmt6_is_sparse(const cdata_t *c) {
+  return c->fmt == '6' && c->compressed && (c->flags & CDFLAG_SPARSE);
+}
+void     fmt6_to_bits(cdata_t *c);
+void     fmt6_range_counts(const cdata_t *c, uint64_t beg, uint64_t end, uint64_t cnts[4]);
+void     fmt6_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
+
 /* this doesn't work for format 2, no copy of aux */
 static inline cdata_t cdata_duplicate(cdata_t c) {
   cdata_t cout = c;
-  cout.s = (uint8_t*) malloc(cdata_nbytes(&c));
+  cout.s = (uint8_t*) malloc(cdata_stored_nbytes(&c));
   if (cout.s==NULL) wzfatal("[cdata_duplicate] Cannot allocate memory.\n");
-  memcpy(cout.s, c.s, cdata_nbytes(&c));
+  memcpy(cout.s, c.s, cdata_stored_nbytes(&c));
   return cout;
 }
 
+/* gives a record borrowed from a flat container its own copy of s, so it
+   outlives cfile_close() */
+static inline void cdata_detach(cdata_t *c) {
+  if (!c->s || !(c->flags & CDFLAG_MAPPED)) return;
+  cdata_t t = cdata_duplicate(*c);
+  c->s = t.s;
+  c->flags &= ~CDFLAG_MAPPED;
+}
+
 uint64_t fmt7_data_length(const cdata_t *c);
+uint64_t fmt7_ckpt_build(const cdata_t *c, uint8_t **tab);
 cdata_t fmt7_sliceToBlock(cdata_t *cr, uint64_t beg, uint64_t end);
 cdata_t fmt7_sliceToIndices(cdata_t *cr, int64_t *row_indices, int64_t n_indices);
 cdata_t fmt7_sliceToMask(cdata_t *cr, cdata_t *c_mask);
@@ -321,7 +476,82 @@ static inline void free_row_finder(row_finder_t *fdr) {
 }
 
 int row_reader_next_loc(row_reader_t *rdr, const cdata_t *c);
+uint64_t row_reader_next_n(row_reader_t *rdr, const cdata_t *c, uint64_t *locs, uint64_t n);
+void fmt7_seek(row_reader_t *rdr, const cdata_t *c, uint64_t row);
+int fmt7_seek_loc(row_reader_t *rdr, const cdata_t *c, const char *chrm, uint64_t beg1);
 row_finder_t init_finder(cdata_t *cr);
 uint64_t row_finder_search(char *chrm, uint64_t beg1, row_finder_t *fdr, cdata_t *cr);
 
+/**
+ * @brief A run-by-run cursor over a compressed record.
+ *
+ * Walks the on-disk bytes of formats 0-4, 6 and 7 without inflating them.
+ * Each cdata_cursor_next() yields the rows [row, row+n) sharing one value v:
+ *
+ *   - fmt0 : the bit (0/1)
+ *   - fmt1 : the byte
+ *   - fmt2 : the state index into the keys
+ *   - fmt3 : M<<32 | U, exactly what f3_get_mu() gives after decompress()
+ *            (fitted to the record's unit); 0 on zero runs.  Setting
+ *            cur.unit = 8 after init yields the stored counts unfitted.
+ *   - fmt4 : the float's bit pattern; NA runs carry -1.0 as in decompress()
+ *            (quantized codes are expanded as fmt4_value() does)
+ *   - fmt6 : the 2-bit code, as FMT6_2BIT()
+ *   - fmt7 : the 1-based coordinate, one row per run, with chrm set
+ *
+ * Neighbouring runs may carry the same value.  Uncompressed records of
+ * formats 0-6 are walked too, one row per run (fmt0/6
+ * still merge equal rows).  The cursor does not own memory; the record
+ * must outlive it.
+ *
+ *   cdata_cursor_t cur;
+ *   cdata_cursor_init(&cur, c);
+ *   while (cdata_cursor_next(&cur)) {
+ *       // use cur.row, cur.n, cur.v
+ *   }
+ *
+ * cdata_cursor_seek() makes the next run returned the one holding a given
+ * row, starting from the nearest row checkpoint when the record has them.
+ */
+typedef struct cdata_cursor_t {
+  const cdata_t *c;
+  uint64_t row;                 // first row of the current run
+  uint64_t n;                   // rows in the current run, 0 before the first
+  uint64_t v;                   // value of the current run
+  const char *chrm;             // fmt7: chromosome of the current row
+  /* walk state */
+  uint64_t i;                   // byte offset of the next record
+  uint64_t nrow;                // rows in the record
+  uint8_t unit;                 // fmt2: value width; fmt3: inflated unit; fmt6: coding
+  int held;                     // next() returns the current run again
+  row_reader_t rdr;             // fmt7
+  struct {                      // fmt7: decoded batch, see row_reader_next_n()
+    uint64_t loc[64];
+    uint32_t k, n;
+  } f7;
+  const uint8_t *blk;           // fmt2 blocked stream header, see format2.c
+  struct {                      // sparse fmt0: pending set interval
+    fmt0_iter_t it;
+    uint64_t beg, end;
+  } f0;
+  struct {                      // fmt3 version 2 streams, see format3.c
+    uint64_t k, nnz, mc, uc, im, iu;
+    int pend;
+  } f3;
+  uint8_t f6pend;               // sparse fmt6: code of the site after a gap
+} cdata_cursor_t;
+
+void cdata_cursor_init(cdata_cursor_t *cur, const cdata_t *c);
+int cdata_cursor_next(cdata_cursor_t *cur);
+void cdata_cursor_seek(cdata_cursor_t *cur, uint64_t row);
+int fmt1_cursor_next(cdata_cursor_t *cur);
+void fmt2_cursor_init(cdata_cursor_t *cur);
+int fmt2_cursor_next(cdata_cursor_t *cur);
+void fmt3_cursor_init(cdata_cursor_t *cur);
+int fmt3_cursor_next(cdata_cursor_t *cur);
+void fmt4_cursor_init(cdata_cursor_t *cur);
+int fmt4_cursor_next(cdata_cursor_t *cur);
+void fmt6_cursor_init(cdata_cursor_t *cur);
+int fmt6_cursor_next(cdata_cursor_t *cur);
+
 #endif /* _CDATA_H */
@@ -18,27 +18,512 @@
  * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cfile.h"
 
+int cfile_n_threads = 1;
+int cfile_level = -1;
+
+/* the rest of a record whose signature has been read */
+static void read_record(BGZF *fh, uint64_t sig, cdata_t *c) {
+  if (sig != CDSIG && sig != CDSIG2) wzfatal("Unmatched signature. File corrupted.\n");
+  bgzf_read(fh, &(c->fmt), sizeof(char));
+  bgzf_read(fh, &(c->n), sizeof(uint64_t));
+  if (c->flags & CDFLAG_MAPPED) c->s = NULL; /* not ours to realloc */
+  c->nrow = 0; c->flags = 0; c->unit = 0; /* buffers are recycled across records */
+  if (sig == CDSIG2) { /* header extension; skip what we do not know */
+    uint8_t ext_len = 0, ext[255] = {0};
+    bgzf_read(fh, &ext_len, sizeof(uint8_t));
+    if (ext_len && bgzf_read(fh, ext, ext_len) != ext_len)
+      wzfatal("Truncated record header. File corrupted.\n");
+    if (ext_len >= CDHDR_EXT_LEN) {
+      memcpy(&(c->nrow), ext, sizeof(uint64_t));
+      if (c->nrow) c->unit = ext[8];
+      c->flags = ext[9];
+    }
+  }
+  c->compressed = 1;
+  uint64_t nb = cdata_nbytes(c);
+  if (c->flags & CDFLAG_CKPT) { /* checkpoint table after the payload */
+    c->s = realloc(c->s, nb + 16);
+    bgzf_read(fh, c->s, nb + 16);
+    uint64_t nck; memcpy(&nck, c->s+nb+8, sizeof(uint64_t));
+    c->s = realloc(c->s, nb + 16 + 16*nck);
+    bgzf_read(fh, c->s+nb+16, 16*nck);
+  } else {
+    c->s = realloc(c->s, nb);
+    bgzf_read(fh, c->s, nb);
+  }
+}
+
+static int tiles_read_next(cfile_t *cf, cdata_t *c);
+
+/* flat containers: hand out the mapped payload as is */
+static int flat_read_next(cfile_t *cf, cdata_t *c) {
+  cfile_flat_t *fl = cf->fl;
+  c->n = 0;
+  if (fl->i >= fl->nrec) return 0;
+  const cfile_flat_rec_t *r = &fl->dir[fl->i++];
+  if (c->s && !(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = fl->map + r->off;
+  c->n = r->n;
+  c->fmt = r->fmt;
+  c->nrow = r->nrow;
+  c->unit = r->nrow ? r->unit : 0;
+  c->flags = r->flags | CDFLAG_MAPPED;
+  c->compressed = 1;
+  cf->n++;
+  return 1;
+}
+
 int read_cdata2(cfile_t *cf, cdata_t *c) {
+  if (cf->fl) return flat_read_next(cf, c);
+  if (cf->tl) return tiles_read_next(cf, c);
   c->n = 0;
   uint64_t sig;
   int64_t size;
   if (cf->fh->block_length == 0) bgzf_read_block(cf->fh); /* somehow this is needed for concat'ed bgzipped files */
   size = bgzf_read(cf->fh, &sig, sizeof(uint64_t));
   if(size != sizeof(uint64_t)) return 0;
-  if (sig != CDSIG) wzfatal("Unmatched signature. File corrupted.\n");
-  bgzf_read(cf->fh, &(c->fmt), sizeof(char));
-  bgzf_read(cf->fh, &(c->n), sizeof(uint64_t));
-  c->compressed = 1;
-  c->s = realloc(c->s, cdata_nbytes(c));
-  bgzf_read(cf->fh, c->s, cdata_nbytes(c));
+  read_record(cf->fh, sig, c);
   cf->n++;
   return 1;
 }
 
+/* ------------------------------------------------------------------ */
+/* Tiled containers, see cfile.h                                       */
+/* ------------------------------------------------------------------ */
+
+static void tiles_open(cfile_t *cf) {
+  uint64_t hd[4];
+  if (bgzf_read(cf->fh, hd, sizeof(hd)) != sizeof(hd))
+    wzfatal("Truncated tile header. File corrupted.\n");
+  cfile_tiles_t *tl = calloc(1, sizeof(cfile_tiles_t));
+  tl->nrow = hd[1]; tl->trow = hd[2]; tl->tsmp = hd[3];
+  if (!tl->trow || tl->trow % 8 || !tl->tsmp)
+    wzfatal("Invalid tile shape %"PRIu64" x %"PRIu64". File corrupted.\n", tl->trow, tl->tsmp);
+  tl->nrb = (tl->nrow + tl->trow - 1) / tl->trow;
+  tl->blk = calloc(tl->tsmp, sizeof(cdata_t));
+  tl->off0 = bgzf_tell(cf->fh);
+  cf->tl = tl;
+}
+
+void cfile_tiles_load_dir(cfile_t *cf) {
+  cfile_tiles_t *tl = cf->tl;
+  if (!tl) wzfatal("[%s:%d] Not a tiled container.\n", __func__, __LINE__);
+  if (tl->dir) return;
+
+  /* the tail sits in the stored block before the 28-byte EOF marker,
+     followed by that block's 8-byte gzip footer */
+  struct stat st; uint64_t tail[2];
+  int fd = fileno((FILE*) cf->fh->fp);
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 28+8+16 ||
+      pread(fd, tail, sizeof(tail), st.st_size-28-8-16) != sizeof(tail) || tail[1] != CXTSIG) {
+    fprintf(stderr, "[%s:%d] Cannot locate the tile directory. Random access needs a complete tiled file.\n", __func__, __LINE__);
+    fflush(stderr);
+    exit(1);
+  }
+
+  uint64_t hd[4];
+  if (bgzf_seek(cf->fh, tail[0], SEEK_SET) != 0 ||
+      bgzf_read(cf->fh, hd, sizeof(hd)) != sizeof(hd) || hd[0] != CXTDIRSIG || hd[2] != tl->nrb)
+    wzfatal("Invalid tile directory. File corrupted.\n");
+  tl->nsmp = hd[1]; tl->nsb = hd[3];
+  tl->dir = malloc(tl->nsb*tl->nrb*sizeof(int64_t));
+  if (bgzf_read(cf->fh, tl->dir, tl->nsb*tl->nrb*sizeof(int64_t)) != (ssize_t) (tl->nsb*tl->nrb*sizeof(int64_t)))
+    wzfatal("Truncated tile directory. File corrupted.\n");
+}
+
+/* fmt2: rewrite the (value, length) records of c with u-byte values */
+static void fmt2_widen(cdata_t *c, uint8_t u) {
+  uint64_t hd = fmt2_get_keys_nbytes(c) + 2;
+  uint8_t u0 = c->s[hd-1];
+  uint64_t nr = (c->n - hd) / (u0+2);
+  uint8_t *s = calloc(hd + nr*(u+2), 1);
+  memcpy(s, c->s, hd);
+  s[hd-1] = u;
+  for (uint64_t r=0; r<nr; ++r) {
+    memcpy(s + hd + r*(u+2), c->s + hd + r*(u0+2), u0);
+    memcpy(s + hd + r*(u+2) + u, c->s + hd + r*(u0+2) + u0, 2);
+  }
+  free(c->s);
+  c->s = s;
+  c->n = hd + nr*(u+2);
+}
+
+/* append the rows of tile record t to the compressed record acc (acc->n == 0
+   starts a new one); the payloads concatenate since tiles hold whole bytes */
+static void tiles_append(cdata_t *acc, cdata_t *t) {
+  uint64_t nrow = cdata_n(t), skip = 0;
+  if (t->fmt == '3') fmt3_to_v1(t); /* only v1 streams concatenate */
+  if (t->fmt == '0') fmt0_to_bits(t); /* and packed bits */
+  if (t->fmt == '6') fmt6_to_bits(t);
+  if (t->fmt == '2') fmt2_to_rle(t);  /* and fmt2 runs */
+  if (t->fmt == '4' && acc->n && fmt4_is_quant(acc) != fmt4_is_quant(t)) {
+    fmt4_to_plain(acc);               /* and fmt4 codes of one width */
+    fmt4_to_plain(t);
+  }
+  if (!acc->n) {
+    acc->fmt = t->fmt; acc->unit = t->unit;
+    acc->compressed = 1; acc->nrow = 0; acc->flags = 0;
+  } else if (acc->fmt != t->fmt) {
+    wzfatal("[%s:%d] Tiles of a sample differ in format: %c vs %c.\n", __func__, __LINE__, acc->fmt, t->fmt);
+  } else if (acc->fmt == '2') { /* keep the keys once, values at the wider width */
+    uint64_t ha = fmt2_get_keys_nbytes(acc) + 2, ht = fmt2_get_keys_nbytes(t) + 2;
+    if (acc->s[ha-1] < t->s[ht-1]) fmt2_widen(acc, t->s[ht-1]);
+    else if (t->s[ht-1] < acc->s[ha-1]) fmt2_widen(t, acc->s[ha-1]);
+    skip = ht;
+  } else if (acc->fmt == '4' && fmt4_is_quant(t)) { /* one code header */
+    skip = F4Q_HDR;
+  }
+  uint64_t nb0 = acc->n ? cdata_nbytes(acc) : 0, nb = cdata_nbytes(t) - skip;
+  acc->s = realloc(acc->s, nb0 + nb);
+  memcpy(acc->s + nb0, t->s + skip, nb);
+  if (acc->fmt == '0' || acc->fmt == '6') acc->n += t->n;
+  else acc->n += nb;
+  acc->nrow += nrow;
+  if (acc->fmt == '4' && fmt4_is_quant(acc)) memcpy(acc->s+8, &acc->nrow, 8);
+  if (t->unit > acc->unit) acc->unit = t->unit;
+}
+
+/* reads the tile header at the current position, returns the number of
+   samples in it or 0 at the directory / end of stream */
+static uint64_t tiles_read_header(cfile_t *cf, uint64_t rb, uint64_t sb) {
+  uint64_t hd[4];
+  if (bgzf_read(cf->fh, hd, 8) != 8 || hd[0] == CXTDIRSIG) return 0;
+  if (hd[0] != CXTILESIG || bgzf_read(cf->fh, hd+1, 24) != 24 || hd[1] != rb || hd[2] != sb || !hd[3])
+    wzfatal("Unexpected tile (row block %"PRIu64", sample block %"PRIu64"). File corrupted.\n", rb, sb);
+  return hd[3];
+}
+
+static void tiles_read_record(cfile_t *cf, cdata_t *t) {
+  uint64_t sig;
+  if (bgzf_read(cf->fh, &sig, sizeof(uint64_t)) != sizeof(uint64_t))
+    wzfatal("Truncated tile. File corrupted.\n");
+  read_record(cf->fh, sig, t);
+}
+
+/* assembles the samples of the next sample block from its row tiles */
+static int tiles_load_block(cfile_t *cf) {
+  cfile_tiles_t *tl = cf->tl;
+  tl->nblk = tl->iblk = 0;
+  if (tl->dir) {           /* random reads may have moved the stream */
+    if (tl->sb >= tl->nsb) return 0;
+    bgzf_seek(cf->fh, tl->dir[tl->sb*tl->nrb], SEEK_SET);
+  }
+  cdata_t t = {0};
+  for (uint64_t rb=0; rb<tl->nrb; ++rb) {
+    uint64_t k = tiles_read_header(cf, rb, tl->sb);
+    if (!k && rb == 0) break;
+    if (!k || (rb && k != tl->nblk) || k > tl->tsmp)
+      wzfatal("Incomplete sample block %"PRIu64". File corrupted.\n", tl->sb);
+    if (rb == 0) {
+      tl->nblk = k;
+      for (uint64_t j=0; j<k; ++j) tl->blk[j].n = 0;
+    }
+    for (uint64_t j=0; j<k; ++j) {
+      tiles_read_record(cf, &t);
+      tiles_append(&tl->blk[j], &t);
+    }
+  }
+  free_cdata(&t);
+
+  for (uint64_t j=0; j<tl->nblk; ++j) { /* checkpoints over the whole sample */
+    cdata_t *b = &tl->blk[j];
+    uint8_t *tab = NULL;
+    uint64_t tab_nb = cdata_ckpt_build(b, &tab);
+    if (tab_nb) {
+      uint64_t nb = cdata_nbytes(b);
+      b->s = realloc(b->s, nb + tab_nb);
+      memcpy(b->s + nb, tab, tab_nb);
+      b->flags |= CDFLAG_CKPT;
+      free(tab);
+    }
+  }
+  tl->sb++;
+  return tl->nblk > 0;
+}
+
+static int tiles_read_next(cfile_t *cf, cdata_t *c) {
+  cfile_tiles_t *tl = cf->tl;
+  c->n = 0;
+  if (tl->iblk >= tl->nblk && !tiles_load_block(cf)) return 0;
+  cdata_t *b = &tl->blk[tl->iblk++];
+  uint8_t *s = c->s;            /* hand over the buffer, keep c's for reuse */
+  c->s = b->s; c->n = b->n; c->fmt = b->fmt; c->unit = b->unit;
+  c->compressed = 1; c->nrow = b->nrow; c->flags = b->flags;
+  b->s = s; b->n = 0;
+  cf->n++;
+  return 1;
+}
+
+cdata_v *read_cdata_tiles(cfile_t *cf, uint64_t beg, uint64_t end, uint64_t s_beg, uint64_t s_end) {
+  cfile_tiles_load_dir(cf);
+  cfile_tiles_t *tl = cf->tl;
+  cdata_v *cs = init_cdata_v(10);
+  if (!tl->nrow || !tl->nsmp) return cs;
+  if (end > tl->nrow-1) end = tl->nrow-1;
+  if (s_end > tl->nsmp-1) s_end = tl->nsmp-1;
+  if (beg > end || s_beg > s_end) return cs;
+
+  uint64_t rb0 = beg / tl->trow, rb1 = end / tl->trow, off = rb0*tl->trow;
+  cdata_t *acc = calloc(tl->tsmp, sizeof(cdata_t)), t = {0};
+  for (uint64_t sb = s_beg/tl->tsmp; sb <= s_end/tl->tsmp; ++sb) {
+    uint64_t j0 = sb*tl->tsmp, k = 0;
+    for (uint64_t rb = rb0; rb <= rb1; ++rb) {
+      bgzf_seek(cf->fh, tl->dir[sb*tl->nrb+rb], SEEK_SET);
+      k = tiles_read_header(cf, rb, sb);
+      if (!k || k > tl->tsmp) wzfatal("Missing tile (%"PRIu64", %"PRIu64"). File corrupted.\n", rb, sb);
+      for (uint64_t j=0; j<k; ++j) {
+        tiles_read_record(cf, &t);
+        if (j0+j < s_beg || j0+j > s_end) continue;
+        if (rb == rb0) acc[j].n = 0;
+        tiles_append(&acc[j], &t);
+      }
+    }
+    for (uint64_t j=0; j<k; ++j) {
+      if (j0+j < s_beg || j0+j > s_end) continue;
+      push_cdata_v(cs, decompress_range(&acc[j], beg-off, end-off));
+    }
+  }
+  for (uint64_t j=0; j<tl->tsmp; ++j) free_cdata(&acc[j]);
+  free(acc); free_cdata(&t);
+  return cs;
+}
+
+cdata_t *cdata_pool_get(cdata_pool_t *pool) {
+  if (pool->n) return pool->c[--pool->n];
+  cdata_t *c = calloc(1, sizeof(cdata_t));
+  if (!c) wzfatal("[%s:%d] Cannot allocate memory.\n", __func__, __LINE__);
+  return c;
+}
+
+void cdata_pool_put(cdata_pool_t *pool, cdata_t *c) {
+  fmt2_free_aux(c); // derived from s, which the next user overwrites
+  if (c->fmt == '7' && c->aux) free(c->aux);
+  c->aux = NULL;
+  if (pool->n == pool->m) {
+    pool->m = pool->m ? pool->m<<1 : 4;
+    pool->c = realloc(pool->c, pool->m*sizeof(cdata_t*));
+  }
+  pool->c[pool->n++] = c;
+}
+
+void cdata_pool_free(cdata_pool_t *pool) {
+  for (int i=0; i<pool->n; ++i) {
+    free_cdata(pool->c[i]);
+    free(pool->c[i]);
+  }
+  free(pool->c);
+  pool->c = NULL; pool->n = pool->m = 0;
+}
+
+struct cfile_prefetch_t {
+  cfile_t *cf;
+  cdata_prep_f prep;
+  int depth;
+  cdata_pool_t *pool;           /* where slot records come from, or NULL */
+  cdata_t **raw, **dec;         /* ring of depth slots, buffers reused */
+  int head, n_ready, held, eof, stop, threaded;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t ready, freed;
+};
+
+static void prep_decompress(cdata_t *raw, cdata_t *out) {
+  decompress_into(raw, out);
+}
+
+void cdata_prep_raw(cdata_t *raw, cdata_t *out) {
+  fmt2_free_aux(out); // left by a consumer of the last record
+  if (out->fmt == '7' && out->aux) free(out->aux);
+  out->aux = NULL;
+  cdata_t t = *out; *out = *raw; *raw = t;
+}
+
+static void *prefetch_worker(void *data) {
+  cfile_prefetch_t *pf = (cfile_prefetch_t*) data;
+  for (int tail = 0; ; tail = (tail+1) % pf->depth) {
+    pthread_mutex_lock(&pf->lock);
+    while (pf->n_ready == pf->depth && !pf->stop) pthread_cond_wait(&pf->freed, &pf->lock);
+    int stop = pf->stop;
+    pthread_mutex_unlock(&pf->lock);
+    if (stop) break;
+
+    /* slot tail is not visible to the consumer until n_ready covers it */
+    int ok = read_cdata2(pf->cf, pf->raw[tail]);
+    if (ok) pf->prep(pf->raw[tail], pf->dec[tail]);
+
+    pthread_mutex_lock(&pf->lock);
+    if (ok) pf->n_ready++;
+    else pf->eof = 1;
+    pthread_cond_signal(&pf->ready);
+    pthread_mutex_unlock(&pf->lock);
+    if (!ok) break;
+  }
+  return NULL;
+}
+
+cfile_prefetch_t *cfile_prefetch_open(cfile_t *cf, int depth, cdata_prep_f prep, cdata_pool_t *pool) {
+  cfile_prefetch_t *pf = calloc(1, sizeof(cfile_prefetch_t));
+  pf->cf = cf;
+  pf->prep = prep ? prep : prep_decompress;
+  pf->pool = pool;
+  pf->threaded = (cfile_n_threads > 1);
+  pf->depth = pf->threaded ? (depth > 0 ? depth : 4) : 1;
+  pf->raw = calloc(pf->depth, sizeof(cdata_t*));
+  pf->dec = calloc(pf->depth, sizeof(cdata_t*));
+  for (int i=0; i<pf->depth; ++i) {
+    pf->raw[i] = pool ? cdata_pool_get(pool) : calloc(1, sizeof(cdata_t));
+    pf->dec[i] = pool ? cdata_pool_get(pool) : calloc(1, sizeof(cdata_t));
+  }
+  if (pf->threaded) {
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->ready, NULL);
+    pthread_cond_init(&pf->freed, NULL);
+    if (pthread_create(&pf->tid, NULL, prefetch_worker, pf) != 0)
+      wzfatal("[%s:%d] Cannot start the read-ahead thread.\n", __func__, __LINE__);
+  }
+  return pf;
+}
+
+cdata_t *cfile_prefetch_next(cfile_prefetch_t *pf) {
+  cfile_prefetch_release(pf);
+  if (!pf->threaded) {
+    if (!read_cdata2(pf->cf, pf->raw[0])) return NULL;
+    pf->prep(pf->raw[0], pf->dec[0]);
+    pf->held = 1;
+    return pf->dec[0];
+  }
+
+  pthread_mutex_lock(&pf->lock);
+  while (pf->n_ready == 0 && !pf->eof) pthread_cond_wait(&pf->ready, &pf->lock);
+  int n_ready = pf->n_ready;
+  pthread_mutex_unlock(&pf->lock);
+  if (!n_ready) return NULL;
+  pf->held = 1;
+  return pf->dec[pf->head];
+}
+
+void cfile_prefetch_release(cfile_prefetch_t *pf) {
+  if (!pf->held) return;
+  pf->held = 0;
+  if (!pf->threaded) return;
+  pthread_mutex_lock(&pf->lock);
+  pf->head = (pf->head+1) % pf->depth;
+  pf->n_ready--;
+  pthread_cond_signal(&pf->freed);
+  pthread_mutex_unlock(&pf->lock);
+}
+
+void cfile_prefetch_close(cfile_prefetch_t *pf) {
+  if (pf->threaded) {
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_cond_signal(&pf->freed);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->tid, NULL);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->ready);
+    pthread_cond_destroy(&pf->freed);
+  }
+  for (int i=0; i<pf->depth; ++i) {
+    if (pf->pool) {
+      cdata_pool_put(pf->pool, pf->raw[i]);
+      cdata_pool_put(pf->pool, pf->dec[i]);
+    } else {
+      free_cdata(pf->raw[i]); free(pf->raw[i]);
+      free_cdata(pf->dec[i]); free(pf->dec[i]);
+    }
+  }
+  free(pf->raw); free(pf->dec);
+  free(pf);
+}
+
+/* whether the payload and checkpoint table of r lie inside the mapping */
+static int flat_rec_fits(const cfile_flat_t *fl, const cfile_flat_rec_t *r) {
+  if (r->off > fl->size) return 0;
+  uint64_t room = fl->size - r->off;
+  cdata_t c = {.n = r->n, .fmt = r->fmt, .compressed = 1, .flags = r->flags};
+  uint64_t nb = cdata_nbytes(&c);
+  if (nb > room || (r->fmt < '0' || r->fmt > '7')) return 0;
+  if (!(r->flags & CDFLAG_CKPT)) return 1;
+  if (room - nb < 16) return 0;
+  uint64_t nck; memcpy(&nck, fl->map + r->off + nb + 8, sizeof(uint64_t));
+  return nck <= (room - nb - 16) / 16;
+}
+
+/* maps fname if it is a flat container; returns 0 if it is not one */
+static int flat_open(cfile_t *cf, const char *fname) {
+  int fd = open(fname, O_RDONLY);
+  uint64_t hd[3];
+  if (fd < 0) return 0;
+  if (pread(fd, hd, sizeof(hd), 0) != sizeof(hd) || hd[0] != CXFLATSIG) {
+    close(fd);
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) wzfatal("[%s:%d] Cannot stat %s.\n", __func__, __LINE__, fname);
+  cfile_flat_t *fl = calloc(1, sizeof(cfile_flat_t));
+  fl->size = st.st_size;
+  fl->nrec = hd[1];
+  if (hd[2] > fl->size || fl->nrec > (fl->size - hd[2]) / sizeof(cfile_flat_rec_t))
+    wzfatal("[%s:%d] Truncated flat container %s.\n", __func__, __LINE__, fname);
+  fl->map = mmap(NULL, fl->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (fl->map == MAP_FAILED) wzfatal("[%s:%d] Cannot map %s.\n", __func__, __LINE__, fname);
+  fl->dir = (const cfile_flat_rec_t*) (fl->map + hd[2]);
+  for (uint64_t i = 0; i < fl->nrec; ++i)
+    if (!flat_rec_fits(fl, &fl->dir[i]))
+      wzfatal("[%s:%d] Record %"PRIu64" of %s lies outside the file. File corrupted.\n", __func__, __LINE__, i, fname);
+  cf->fl = fl;
+  return 1;
+}
+
+/* addr is a sample number; a rewind needs no directory, so a tiled stream
+   that can seek still rewinds after the last sample */
+static int tiles_seek(cfile_t *cf, int64_t addr) {
+  cfile_tiles_t *tl = cf->tl;
+  if (addr < 0) return -1;
+  tl->nblk = tl->iblk = 0;
+  if (addr == 0 && !tl->dir) {
+    if (bgzf_seek(cf->fh, tl->off0, SEEK_SET) != 0) return -1;
+    tl->sb = 0; cf->n = 0;
+    return 0;
+  }
+  cfile_tiles_load_dir(cf);
+  if ((uint64_t) addr > tl->nsmp) return -1;
+  cf->n = addr;
+  if ((uint64_t) addr == tl->nsmp) { tl->sb = tl->nsb; return 0; } /* at the end */
+  tl->sb = addr / tl->tsmp;
+  if (!tiles_load_block(cf) || (uint64_t) addr % tl->tsmp >= tl->nblk) return -1;
+  tl->iblk = addr % tl->tsmp;
+  return 0;
+}
+
+int cfile_seek(cfile_t *cf, int64_t addr) {
+  if (cf->fl) {
+    if (addr < 0 || (uint64_t) addr > cf->fl->nrec) return -1;
+    cf->fl->i = addr;
+    return 0;
+  }
+  if (cf->tl) return tiles_seek(cf, addr);
+  return bgzf_seek(cf->fh, addr, SEEK_SET);
+}
+
+int64_t cfile_tell(cfile_t *cf) {
+  if (cf->fl) return cf->fl->i;
+  if (cf->tl) return cf->n;
+  return bgzf_tell(cf->fh);
+}
+
 cfile_t open_cfile(char *fname) { /* for read */
   cfile_t cf = {0};
+  if (strcmp(fname, "-") != 0 && flat_open(&cf, fname)) return cf;
   if (strcmp(fname, "-")==0) {
     cf.fh = bgzf_dopen(fileno(stdin), "r");
   } else {
@@ -48,10 +533,32 @@ cfile_t open_cfile(char *fname) { /* for read */
     fprintf(stderr, "Error opening file %s\n", fname);
     exit(1);
   }
+  if (cfile_n_threads > 1) bgzf_mt(cf.fh, cfile_n_threads, 64);
   cf.n = 0;
+  /* a tiled container announces itself in its first block */
+  if (bgzf_read_block(cf.fh) == 0 && cf.fh->block_length >= 8) {
+    uint64_t sig; memcpy(&sig, cf.fh->uncompressed_block, sizeof(uint64_t));
+    if (sig == CXTSIG) tiles_open(&cf);
+  }
   return cf;
 }
 
+void cfile_close(cfile_t *cf) {
+  if (cf->fl) {
+    munmap(cf->fl->map, cf->fl->size);
+    free(cf->fl);
+    cf->fl = NULL;
+  }
+  if (cf->tl) {
+    for (uint64_t j = 0; j < cf->tl->tsmp; ++j) free_cdata(&cf->tl->blk[j]);
+    free(cf->tl->blk); free(cf->tl->dir);
+    free(cf->tl);
+    cf->tl = NULL;
+  }
+  if (cf->fh) bgzf_close(cf->fh);
+  cf->fh = NULL;
+}
+
 cdata_t read_cdata1(cfile_t *cf) {
   cdata_t c = {0};
   if (!read_cdata2(cf, &c)) return c;
@@ -103,7 +610,11 @@ cdata_v* read_cdata_from_head(cfile_t *cf, int64_t n) {
   return cs;
 }
 
-cdata_v* read_cdata_from_tail(cfile_t *cf, index_t *idx, int64_t n) {
+cdata_v* read_cdata_from_tail(cfile_t *cf, const bindex_t *bidx, index_t *idx, int64_t n) {
+  if (bidx) {                   // addresses are in record order
+    if ((uint64_t) n > bidx->n) n = bidx->n;
+    return read_cdata_with_indices(cf, bidx->addr + bidx->n - n, n);
+  }
   int npairs = 0;
   index_pair_t *pairs = index_pairs(idx, &npairs);
   if (n > npairs) n = npairs;
@@ -111,6 +622,7 @@ cdata_v* read_cdata_from_tail(cfile_t *cf, index_t *idx, int64_t n) {
   for (int64_t i=npairs-n; i<npairs; ++i) {
     indices[i-npairs+n] = pairs[i].value;
   }
+  clean_index_pairs(pairs, npairs);
   cdata_v *cs = read_cdata_with_indices(cf, indices, n);
   free(indices);
   return cs;
@@ -129,8 +641,8 @@ cdata_v* read_cdata_with_indices(cfile_t *cf, const int64_t* indices, int n) {
       exit(1);
     }
 
-    // Reposition the file pointer using bgzf_seek
-    if (bgzf_seek(cf->fh, index, SEEK_SET) != 0) {
+    // Reposition the file pointer
+    if (cfile_seek(cf, index) != 0) {
       fprintf(stderr, "[%s:%d] Cannot seek input.\n", __func__, __LINE__);
       fflush(stderr);
       exit(1);
@@ -147,11 +659,11 @@ cdata_v* read_cdata_with_indices(cfile_t *cf, const int64_t* indices, int n) {
   return cs;
 }
 
-cdata_v* read_cdata_with_snames(cfile_t *cf, index_t *idx, snames_t *snames) {
+cdata_v* read_cdata_with_snames(cfile_t *cf, const bindex_t *bidx, index_t *idx, snames_t *snames) {
   // check if we have all sample names in index
   int64_t* indices = malloc(snames->n * sizeof(int64_t));
   for (int i = 0; i < snames->n; i++) {
-    indices[i] = getIndex(idx, snames->s[i]);
+    indices[i] = index_lookup(bidx, idx, snames->s[i]);
     if (indices[i] == -1) {
       fprintf(stderr, "Cannot find sample %s in index.\n", snames->s[i]);
       fflush(stderr);
@@ -163,9 +675,27 @@ cdata_v* read_cdata_with_snames(cfile_t *cf, index_t *idx, snames_t *snames) {
   return cs;
 }
 
+/* stdout feeds another process: deflating it would only be undone there */
+static int stdout_is_pipe(void) {
+  struct stat st;
+  return fstat(fileno(stdout), &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+BGZF *open_cfile_write(char *fname_out, const char *mode) {
+  BGZF *fp;
+  char m[24];
+  int level = cfile_level;
+  if (level < 0 && !fname_out && stdout_is_pipe()) level = 0;
+  if (level >= 0) { snprintf(m, sizeof(m), "%.8s%d", mode, level); mode = m; }
+  if (fname_out) fp = bgzf_open2(fname_out, mode);
+  else fp = bgzf_dopen(fileno(stdout), mode);
+  if (fp && cfile_n_threads > 1 && level != 0) bgzf_mt(fp, cfile_n_threads, 64);
+  return fp;
+}
+
 void cdata_write1(BGZF *fp, cdata_t *c) {
   // Write the signature
-  uint64_t sig = CDSIG;
+  uint64_t sig = CDSIG2;
   if (bgzf_write(fp, &sig, sizeof(uint64_t)) < 0) {
     fprintf(stderr, "Error writing signature to file\n");
     return;
@@ -183,20 +713,116 @@ void cdata_write1(BGZF *fp, cdata_t *c) {
     return;
   }
 
+  // Write the header extension: nrow, unit, flags (see cdata.h)
+  uint8_t ext[1+CDHDR_EXT_LEN] = {CDHDR_EXT_LEN};
+  uint8_t *tab = NULL; uint64_t tab_nb = 0;
+  if (c->compressed) {
+    uint64_t nrow = cdata_dims(c, &ext[9]);
+    memcpy(ext+1, &nrow, sizeof(uint64_t));
+    tab_nb = cdata_ckpt_build(c, &tab);
+    if (tab_nb) ext[10] |= CDFLAG_CKPT;
+    ext[10] |= c->flags & CDFLAG_SPARSE;
+  }
+  if (bgzf_write(fp, ext, sizeof(ext)) < 0) {
+    fprintf(stderr, "Error writing header extension to file\n");
+    free(tab);
+    return;
+  }
+
   // Write the data
   if (bgzf_write(fp, c->s, cdata_nbytes(c)) < 0) {
     fprintf(stderr, "Error writing data to file\n");
+    free(tab);
     return;
   }
+
+  // Write the checkpoint table
+  if (tab_nb && bgzf_write(fp, tab, tab_nb) < 0)
+    fprintf(stderr, "Error writing checkpoint table to file\n");
+  free(tab);
+}
+
+struct cfile_writer_rec_t {
+  char *sname;
+  int64_t blk;                  // sequence number of the block it starts in
+  int off;                      // offset into the inflated block
+};
+
+/* BGZF block callback: block number w->n_blk is now on file at addr */
+static void writer_resolve(void *data, int64_t addr) {
+  cfile_writer_t *w = (cfile_writer_t*) data;
+  for (; w->i_pend < w->n_pend && w->pend[w->i_pend].blk == w->n_blk; ++w->i_pend) {
+    cfile_writer_rec_t *r = &w->pend[w->i_pend];
+    insert_index(w->idx, r->sname, addr<<16 | r->off);
+  }
+  if (w->i_pend == w->n_pend) w->i_pend = w->n_pend = 0;
+  ++w->n_blk;
+}
+
+cfile_writer_t *cfile_writer_open(char *fname_out, const char *mode) {
+  cfile_writer_t *w = calloc(1, sizeof(cfile_writer_t));
+  w->fp = open_cfile_write(fname_out, mode);
+  if (w->fp == NULL) {
+    fprintf(stderr, "[%s:%d] Error opening file for writing: %s\n", __func__, __LINE__, fname_out ? fname_out : "<stdout>");
+    fflush(stderr);
+    exit(1);
+  }
+  if (fname_out) {
+    w->fname = strdup(fname_out);
+    w->idx = kh_init(index);
+    w->fp->blk_cb = writer_resolve;
+    w->fp->blk_cb_data = w;
+  }
+  return w;
+}
+
+void cfile_writer_write(cfile_writer_t *w, cdata_t *c, const char *sname) {
+  ++w->n_rec;
+  if (w->idx) {
+    if (w->n_pend == w->m_pend) {
+      w->m_pend = w->m_pend ? w->m_pend<<1 : 16;
+      w->pend = realloc(w->pend, w->m_pend * sizeof(cfile_writer_rec_t));
+    }
+    cfile_writer_rec_t *r = &w->pend[w->n_pend++];
+    if (sname) {
+      r->sname = strdup(sname);
+    } else {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "Unnamed_%"PRId64, w->n_rec);
+      r->sname = strdup(buf);
+    }
+    r->blk = w->fp->n_blk;
+    r->off = w->fp->block_offset;
+  }
+  cdata_write1(w->fp, c);
+}
+
+void cfile_writer_close(cfile_writer_t *w) {
+  if (bgzf_close(w->fp) != 0) {
+    fprintf(stderr, "[%s:%d] Error closing %s.\n", __func__, __LINE__, w->fname ? w->fname : "<stdout>");
+    fflush(stderr);
+    exit(1);
+  }
+  if (w->idx) {
+    if (w->n_pend) wzfatal("[%s:%d] %zu records were never flushed.\n", __func__, __LINE__, w->n_pend - w->i_pend);
+    char *fname_index = get_fname_index(w->fname);
+    FILE *out = fopen(fname_index, "w");
+    if (!out) wzfatal("[%s:%d] Cannot open index file %s.\n", __func__, __LINE__, fname_index);
+    writeIndex(out, w->idx);
+    fclose(out);
+    free(fname_index);
+    updateBinaryIndex(w->fname, w->idx, 0);
+    cleanIndex(w->idx);         // the keys came from pend
+  }
+  free(w->pend);
+  free(w->fname);
+  free(w);
 }
 
 void cdata_write(char *fname_out, cdata_t *c, const char *mode, int verbose) {
 
   if (!c->compressed) cdata_compress(c);  
-  BGZF* fp;
-  if (fname_out) fp = bgzf_open2(fname_out, mode);
-  else fp = bgzf_dopen(fileno(stdout), mode);
-  
+  BGZF* fp = open_cfile_write(fname_out, mode);
   if (fp == NULL) {
     fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
     return;
@@ -31,11 +31,31 @@
  *  uint64_t: length (n_cs or n_bytes for rle)
  */
 /* cfile for reading, see cdata_write for writing */
+typedef struct cfile_tiles_t cfile_tiles_t;
+typedef struct cfile_flat_t cfile_flat_t;
 typedef struct cfile_t {
-  BGZF *fh;
+  BGZF *fh;                     /* NULL for flat containers */
   int n;                        /* number of samples read */
+  cfile_tiles_t *tl;            /* set for tiled containers, see below */
+  cfile_flat_t *fl;             /* set for flat containers, see below */
 } cfile_t;
 
+/**
+ * Number of BGZF worker threads, set by the global "yame -@ <threads>" option.
+ * When >1, open_cfile() inflates blocks ahead of the reader on that many
+ * threads; records still come back in file order. Default 1 (serial).
+ */
+extern int cfile_n_threads;
+
+/**
+ * BGZF level for written .cx streams, set by the global "yame -l <level>"
+ * option. The default (-1) deflates at the zlib default, and writes level 0
+ * only when stdout is a pipe or FIFO, so "yame a | yame b -" only frames
+ * and copies records while "yame a > out.cx" is deflated as usual. Level-0 blocks are plain BGZF: every reader
+ * opens them, and open_cfile() copies the stored payload without zlib.
+ */
+extern int cfile_level;
+
 /**
  * Opens a file and returns a cfile_t instance.
  * If the filename is "-", it will open stdin for reading. Otherwise, it opens the named file.
@@ -46,6 +66,14 @@ typedef struct cfile_t {
  */
 cfile_t open_cfile(char *fname);
 
+/**
+ * Closes a file opened by open_cfile(), releasing a flat container's mapping
+ * and a tiled container's buffers.
+ *
+ * @param cf The cfile_t instance to close.
+ */
+void cfile_close(cfile_t *cf);
+
 /**
  * Reads cdata from a cfile_t instance.
  *
@@ -57,7 +85,8 @@ cdata_t read_cdata1(cfile_t *cf);
 /**
  * Reads a cdata_t instance from a cfile_t instance. 
  * This function is a lower-level utility for reading compressed data from a file.
- * c memory will be reallocated.
+ * c memory will be reallocated, so reusing one cdata_t across a loop keeps its
+ * buffer instead of allocating a new one per record (pair with decompress_into()).
  *
  * @param cf The cfile_t instance to read from.
  * @param c The cdata_t instance to store the read data into.
@@ -67,6 +96,54 @@ int read_cdata2(cfile_t *cf, cdata_t *c);
 
 DEFINE_VECTOR(cdata_v, cdata_t)
 
+/**
+ * A small free list of record buffers.
+ * cdata_pool_get() returns a recycled cdata_t (its buffer keeps the capacity
+ * of its last use) or a new empty one; cdata_pool_put() hands it back for
+ * reuse with read_cdata2()/decompress_into(). cdata_pool_free() releases all
+ * records currently in the pool.
+ */
+typedef struct cdata_pool_t {
+  cdata_t **c;
+  int n, m;
+} cdata_pool_t;
+
+cdata_t *cdata_pool_get(cdata_pool_t *pool);
+void cdata_pool_put(cdata_pool_t *pool, cdata_t *c);
+void cdata_pool_free(cdata_pool_t *pool);
+
+/**
+ * Read-ahead over a cfile_t.
+ * With cfile_n_threads > 1 a background thread runs read_cdata2() plus a
+ * decode step on up to `depth` records ahead of the consumer, so inflate
+ * overlaps with the consumer's compute; otherwise each record is read and
+ * decoded on demand. Records come back in file order either way, and the
+ * slot buffers are reused for the whole stream.
+ *
+ * The decode step defaults to decompress_into(raw, out); pass a different
+ * one for inputs that need more (e.g. converting masks to fmt0 first), or
+ * cdata_prep_raw() to hand records on compressed, for cdata_cursor_t.
+ * The raw record may be modified by it. Slot records are taken from `pool`
+ * and returned to it on close when given (so a stream reopened many times
+ * keeps its buffers), or owned by the prefetcher otherwise.
+ *
+ *   cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, NULL, NULL);
+ *   for (cdata_t *c; (c = cfile_prefetch_next(pf)); ) { ... }
+ *   cfile_prefetch_close(pf);
+ *
+ * cfile_prefetch_next() hands the previous record back implicitly;
+ * cfile_prefetch_release() does so early. The cfile must not be read or
+ * seeked by anyone else while the prefetcher is open.
+ */
+typedef void (*cdata_prep_f)(cdata_t *raw, cdata_t *out);
+void cdata_prep_raw(cdata_t *raw, cdata_t *out);
+typedef struct cfile_prefetch_t cfile_prefetch_t;
+
+cfile_prefetch_t *cfile_prefetch_open(cfile_t *cf, int depth, cdata_prep_f prep, cdata_pool_t *pool);
+cdata_t *cfile_prefetch_next(cfile_prefetch_t *pf);
+void cfile_prefetch_release(cfile_prefetch_t *pf);
+void cfile_prefetch_close(cfile_prefetch_t *pf);
+
 /**
  * Reads cdata from a specified range in a cfile_t instance.
  * If "end" is smaller than "beg", the program will exit with an error.
@@ -99,11 +176,12 @@ cdata_v* read_cdata_from_head(cfile_t *cf, int64_t n);
  * Reads the last n cdata from a cfile_t instance.
  *
  * @param cf The cfile_t instance to read from.
+ * @param bidx The binary index of the file, or NULL to use idx.
  * @param idx The index of the data to read.
  * @param n The number of cdata to read from the tail of the file.
  * @return A cdata_v instance with the data read from the file.
  */
-cdata_v* read_cdata_from_tail(cfile_t *cf, index_t *idx, int64_t n);
+cdata_v* read_cdata_from_tail(cfile_t *cf, const bindex_t *bidx, index_t *idx, int64_t n);
 
 /**
  * Reads cdata from a cfile_t instance at specified indices.
@@ -120,11 +198,124 @@ cdata_v* read_cdata_with_indices(cfile_t *cf, const int64_t* indices, int n);
  * If any sample name is not found in the index, the program will exit with an error.
  *
  * @param cf The cfile_t instance to read from.
+ * @param bidx The binary index of the file, or NULL to use idx.
  * @param idx The index of the data to read.
  * @param snames The sample names to read.
  * @return A cdata_v instance with the data read from the file.
  */
-cdata_v* read_cdata_with_snames(cfile_t *cf, index_t *idx, snames_t *snames);
+cdata_v* read_cdata_with_snames(cfile_t *cf, const bindex_t *bidx, index_t *idx, snames_t *snames);
+
+/**
+ * Tiled containers
+ * ----------------
+ * "yame retile" stores a .cx matrix as tiles of trow rows x tsmp samples,
+ * so a row window across all samples, or a sample range across all rows,
+ * only inflates the tiles it touches.  All of it is one BGZF stream:
+ *
+ *   header : uint64 CXTSIG, uint64 nrow, uint64 trow, uint64 tsmp
+ *   tiles  : sample-block major.  Each starts a BGZF block and is
+ *            uint64 CXTILESIG, uint64 row block, uint64 sample block,
+ *            uint64 k, then k ordinary cx records holding rows
+ *            [rb*trow, rb*trow+trow) of samples [sb*tsmp, sb*tsmp+k).
+ *   dir    : uint64 CXTDIRSIG, uint64 nsmp, uint64 nrb, uint64 nsb, then
+ *            nsb*nrb tile virtual offsets, entry sb*nrb+rb.
+ *   tail   : uint64 dir offset, uint64 CXTSIG, alone in a level-0 block
+ *            right before the BGZF EOF marker, so its bytes sit at a fixed
+ *            distance from the end of the file.
+ *
+ * open_cfile() recognizes the header and read_cdata2() then returns whole
+ * samples as usual, assembled from their tiles (trow is a multiple of 8,
+ * so the run-length and bit-packed payloads concatenate as they are).
+ * read_cdata_tiles() serves windows from the directory and needs a file.
+ * The .idx of a tiled container holds sample numbers, as written by
+ * retile or yame index; cfile_seek() takes them.
+ */
+#define CXTSIG    266563789640
+#define CXTILESIG 266563789641
+#define CXTDIRSIG 266563789642
+
+struct cfile_tiles_t {
+  uint64_t nrow;                /* rows of every sample */
+  uint64_t trow, tsmp;          /* rows and samples per tile */
+  uint64_t nsmp, nrb, nsb;      /* filled when the directory is loaded */
+  int64_t *dir;                 /* tile offsets, NULL until loaded */
+  cdata_t *blk;                 /* sequential reads: samples of the current */
+  uint64_t nblk, iblk, sb;      /* sample block, assembled from its tiles */
+  int64_t off0;                 /* virtual offset of the first tile */
+};
+
+/**
+ * Reads rows [beg, end] of samples [s_beg, s_end] (0-based, inclusive; both
+ * ends are clipped) from a tiled container, decompressed, in sample order.
+ * Only the tiles overlapping the window are read.
+ */
+cdata_v *read_cdata_tiles(cfile_t *cf, uint64_t beg, uint64_t end, uint64_t s_beg, uint64_t s_end);
+
+/* Loads the tile directory; exits if the container cannot be seeked. */
+void cfile_tiles_load_dir(cfile_t *cf);
+
+/**
+ * Flat containers
+ * ---------------
+ * "yame flatten" stores records without BGZF, for datasets that are read
+ * far more often than they are written (mask libraries, row coordinates).
+ * The file is mmap'ed and each record's s points straight into the
+ * mapping: reading costs no inflate and no copy.  Sparse format 0 and 6
+ * records are stored as their packed bits, which every reader takes as is.
+ * The other formats keep their cx encoding: format 2 state runs and
+ * format 7 coordinates are still decoded on each read.  Little-endian:
+ *
+ *   header : uint64 CXFLATSIG, nrec, dir offset; zero-padded to a page
+ *   records: payload then checkpoint table (cdata_stored_nbytes() bytes),
+ *            each starting on a page boundary
+ *   dir    : nrec x cfile_flat_rec_t, page-aligned
+ *
+ * Records read from it carry CDFLAG_MAPPED.  The mapping is private, so
+ * records can be edited in place, and is released by cfile_close(); call
+ * cdata_detach() on a record that must outlive the file.  open_cfile()
+ * checks that every directory entry lies inside the file.  The .idx of a
+ * flat container holds record numbers instead of virtual offsets; use
+ * cfile_seek() with them.
+ */
+#define CXFLATSIG 266563789643
+#define CXFLAT_ALIGN 4096
+
+typedef struct cfile_flat_rec_t {
+  uint64_t off;                 /* byte offset of s in the file */
+  uint64_t n;
+  uint64_t nrow;
+  uint8_t fmt, unit, flags, pad[5];
+} cfile_flat_rec_t;
+
+struct cfile_flat_t {
+  uint8_t *map;
+  size_t size;
+  uint64_t nrec, i;             /* i: next record to read */
+  const cfile_flat_rec_t *dir;
+};
+
+/**
+ * Positions cf at a record given its index value: a virtual offset, or a
+ * record number for flat and tiled containers.
+ *
+ * @return 0 on success, -1 if the stream cannot seek there.
+ */
+int cfile_seek(cfile_t *cf, int64_t addr);
+
+/* The index value of the next record, as cfile_seek() takes it. */
+int64_t cfile_tell(cfile_t *cf);
+
+/**
+ * Opens a BGZF stream for writing cx records.
+ * If fname_out is NULL, it writes to stdout. When cfile_n_threads > 1, blocks
+ * are deflated on that many threads; the output bytes are the same as with a
+ * single thread. The level follows cfile_level (stored blocks to pipes).
+ *
+ * @param fname_out The name of the output file, or NULL for stdout.
+ * @param mode The mode to open the file, "w" for write or "a" for append.
+ * @return The BGZF handle, or NULL if the file cannot be opened.
+ */
+BGZF *open_cfile_write(char *fname_out, const char *mode);
 
 /**
  * Writes a cdata_t instance to a BGZF file stream.
@@ -138,6 +329,37 @@ cdata_v* read_cdata_with_snames(cfile_t *cf, index_t *idx, snames_t *snames);
  */
 void cdata_write1(BGZF *fp, cdata_t *c);
 
+/**
+ * A cx writer that builds the sample index as it writes.  The virtual
+ * offset of each record is taken right before the record goes out, and
+ * <fname_out>.idx is written on close, so the output is never re-read to
+ * index it.  With BGZF worker threads a record's offset is only known once
+ * its block reaches the file; it is filled in then.  Writing to stdout
+ * (fname_out NULL) keeps no index.
+ */
+typedef struct cfile_writer_rec_t cfile_writer_rec_t;
+typedef struct cfile_writer_t {
+  BGZF *fp;
+  char *fname;                  // NULL for stdout
+  index_t *idx;                 // NULL for stdout
+  cfile_writer_rec_t *pend;     // records whose block is not on file yet
+  size_t n_pend, m_pend, i_pend;
+  int64_t n_blk;                // blocks that reached the file
+  int64_t n_rec;                // records written
+} cfile_writer_t;
+
+/* Opens fname_out (NULL for stdout) as open_cfile_write does; exits on failure. */
+cfile_writer_t *cfile_writer_open(char *fname_out, const char *mode);
+
+/**
+ * Writes c as sample sname.  A NULL sname is indexed as Unnamed_<k> (1-based
+ * record number), the names "yame index" gives records without a sample list.
+ */
+void cfile_writer_write(cfile_writer_t *w, cdata_t *c, const char *sname);
+
+/* Closes the stream, writes <fname_out>.idx and frees w. */
+void cfile_writer_close(cfile_writer_t *w);
+
 /**
  * Writes the cdata to the specified file.
  *
@@ -84,10 +84,10 @@ int main_chunk(int argc, char *argv[]) {
       free(c3.s);
       free(tmp);
     }
-    free(c2.s); free(c.s);
+    free(c2.s); free_cdata(&c);
   }
   free(outdir);
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
   
   return 0;
 }
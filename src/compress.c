@@ -20,6 +20,7 @@
 
 #include "cfile.h"
 
+void fmt0_compress(cdata_t *c);
 void fmt1_compress(cdata_t *c);
 void fmt2_compress(cdata_t *c);
 void fmt3_compress(cdata_t *c);
@@ -29,8 +30,9 @@ void fmt6_compress(cdata_t *c);
 
 void cdata_compress(cdata_t *c) {
   if (c->compressed) wzfatal("Already compressed");
+  c->nrow = 0; c->flags = 0; // recomputed by cdata_write1
   switch(c->fmt) {
-  case '0': { break; }
+  case '0': { fmt0_compress(c); break; }
   case '1': { fmt1_compress(c); break; }
   case '2': { fmt2_compress(c); break; }
   case '3': { fmt3_compress(c); break; }
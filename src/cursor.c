@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+/**
+ * This file is part of YAME.
+ *
+ * Copyright (C) 2021-present Wanding Zhou
+ *
+ * YAME is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAME is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cdata.h"
+
+/**
+ * Run cursor over compressed records (see cdata_cursor_t in cdata.h).
+ *
+ * The run-length formats decode one record per step in their own files
+ * (fmt1_cursor_next() and friends), fmt7 goes through row_reader_next_n(),
+ * and the bit-packed formats 0 and 6 are scanned here, a byte at a time
+ * through uniform stretches.  Sparse fmt0 records alternate zero runs with
+ * the set intervals of fmt0_next_range(); sparse fmt6 records go through
+ * fmt6_cursor_next() and the row checkpoints.  Records that are already
+ * inflated are walked row by row.
+ */
+
+/* walk state for the start of the record; keeps an already known fmt3 unit */
+static void cursor_start(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  uint8_t unit = cur->unit;
+  memset(cur, 0, sizeof(cdata_cursor_t));
+  cur->c = c;
+  if (c->fmt == '2') {          // records (or inflated values) follow the keys
+    cur->i = fmt2_get_keys_nbytes(c) + 1;
+    if (!c->compressed) cur->unit = c->unit;
+    else if (c->s[cur->i]) cur->unit = c->s[cur->i++];
+    else fmt2_cursor_init(cur); // blocked stream
+  } else if (c->fmt == '3' && c->compressed) {
+    cur->unit = unit;
+    fmt3_cursor_init(cur);
+  } else if (c->fmt == '4' && c->compressed) {
+    fmt4_cursor_init(cur);
+  } else if (fmt0_is_sparse(c)) {
+    fmt0_iter_init(&cur->f0.it, c);
+    cur->nrow = cur->f0.it.nrow;
+  } else if (fmt6_is_sparse(c)) {
+    fmt6_cursor_init(cur);
+  }
+}
+
+void cdata_cursor_init(cdata_cursor_t *cur, const cdata_t *c) {
+  memset(cur, 0, sizeof(cdata_cursor_t));
+  cur->c = c;
+  cursor_start(cur);
+}
+
+/* bit-packed: extend the run of equal codes (1 or 2 bits wide) from cur->row */
+static int packed_next(cdata_cursor_t *cur, int bits) {
+  const cdata_t *c = cur->c;
+  uint64_t r = cur->row, e, per = 8/bits, mask = (1u<<bits)-1;
+  if (r >= c->n) return 0;
+  uint64_t v = (c->s[r/per] >> ((r%per)*bits)) & mask;
+  uint8_t full = v * (bits == 1 ? 0xff : 0x55);
+  for (e = r+1; e < c->n; ) {
+    if (!(e%per) && e+per <= c->n && c->s[e/per] == full) { e += per; continue; }
+    if (((c->s[e/per] >> ((e%per)*bits)) & mask) != v) break;
+    ++e;
+  }
+  cur->v = v;
+  cur->n = e - r;
+  return 1;
+}
+
+/* sparse fmt0: the gap before the pending interval, then the interval */
+static int sparse_next(cdata_cursor_t *cur) {
+  uint64_t r = cur->row;
+  if (r >= cur->nrow) return 0;
+  while (r >= cur->f0.end) {
+    if (!fmt0_next_range(&cur->f0.it, &cur->f0.beg, &cur->f0.end))
+      cur->f0.beg = cur->f0.end = cur->nrow;
+    if (cur->f0.beg < r) cur->f0.beg = r; /* after a seek */
+  }
+  cur->v = r >= cur->f0.beg;
+  cur->n = (cur->v ? cur->f0.end : cur->f0.beg) - r;
+  return 1;
+}
+
+/* inflated records: one row per run */
+static int inflated_next(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  uint64_t r = cur->row;
+  if (r >= c->n) return 0;
+  switch (c->fmt) {
+  case '1': case '5': cur->v = c->s[r]; break;
+  case '3': cur->v = f3_get_mu((cdata_t*) c, r); break;
+  case '2': {
+    const uint8_t *d = c->s + cur->i + r*cur->unit;
+    cur->v = 0;
+    for (uint8_t j=0; j<cur->unit; ++j) cur->v |= ((uint64_t) d[j] << (8*j));
+    break;
+  }
+  case '4': { float b = fmt4_value(c, r); uint32_t w; memcpy(&w, &b, 4); cur->v = w; break; }
+  default: wzfatal("[%s:%d] No cursor over inflated format %c.\n", __func__, __LINE__, c->fmt);
+  }
+  cur->n = 1;
+  return 1;
+}
+
+/* fmt7: coordinates are decoded a batch at a time, all on one chromosome */
+static int fmt7_cursor_next(cdata_cursor_t *cur) {
+  if (cur->f7.k == cur->f7.n) {
+    cur->f7.n = row_reader_next_n(&cur->rdr, cur->c, cur->f7.loc, 64);
+    cur->f7.k = 0;
+    if (!cur->f7.n) return 0;
+  }
+  cur->v = cur->f7.loc[cur->f7.k++];
+  cur->chrm = cur->rdr.chrm;
+  cur->n = 1;
+  return 1;
+}
+
+int cdata_cursor_next(cdata_cursor_t *cur) {
+  if (cur->held) { cur->held = 0; return cur->n > 0; }
+  const cdata_t *c = cur->c;
+  int ok;
+  do {                          // skip empty records
+    cur->row += cur->n;
+    cur->n = 0;
+    if (fmt0_is_sparse(c)) ok = sparse_next(cur);
+    else if (fmt6_is_sparse(c)) ok = fmt6_cursor_next(cur);
+    else if (c->fmt == '0') ok = packed_next(cur, 1);
+    else if (c->fmt == '6') ok = packed_next(cur, 2);
+    else if (!c->compressed) ok = inflated_next(cur);
+    else switch (c->fmt) {
+      case '1': ok = fmt1_cursor_next(cur); break;
+      case '2': ok = fmt2_cursor_next(cur); break;
+      case '3': ok = fmt3_cursor_next(cur); break;
+      case '4': ok = fmt4_cursor_next(cur); break;
+      case '7': ok = fmt7_cursor_next(cur); break;
+      default: wzfatal("[%s:%d] No cursor over compressed format %c.\n", __func__, __LINE__, c->fmt);
+      }
+  } while (ok && !cur->n);
+  return ok;
+}
+
+void cdata_cursor_seek(cdata_cursor_t *cur, uint64_t row) {
+  const cdata_t *c = cur->c;
+  cur->held = 0;
+  if (fmt0_is_sparse(c)) {      // from the container holding row
+    fmt0_iter_seek(&cur->f0.it, row);
+    cur->f0.beg = cur->f0.end = row;
+    cur->row = row;
+    cur->n = 0;
+  } else if ((c->fmt == '0' || c->fmt == '6' || !c->compressed || cur->blk) && !fmt6_is_sparse(c)) { // random access: jump
+    cur->row = row;
+    cur->n = 0;
+  } else if ((c->fmt >= '1' && c->fmt <= '4' && !cur->f3.mc) || fmt6_is_sparse(c)) {
+    uint64_t i, row0;
+    cdata_ckpt_seek(c, row, &i, &row0);
+    if (row < cur->row || row0 > cur->row + cur->n) {
+      cur->i = i;
+      cur->row = row0;
+      cur->n = 0;
+      cur->f6pend = 0;
+    }
+  } else if (c->fmt == '7') {  // within the decoded batch, or the reader jumps
+    uint64_t b0 = cur->rdr.index - cur->f7.n;
+    if (row >= b0 && row < cur->rdr.index) {
+      cur->f7.k = row - b0;
+    } else {
+      fmt7_seek(&cur->rdr, c, row);
+      cur->f7.k = cur->f7.n = 0;
+    }
+    cur->row = row;
+    cur->n = 0;
+  } else if (row < cur->row) {  // no checkpoints: back to the start
+    cursor_start(cur);
+  }
+  while (cur->row + cur->n <= row && cdata_cursor_next(cur));
+  if (cur->n && cur->row <= row) cur->held = 1;
+}
@@ -28,6 +28,15 @@ cdata_t fmt4_decompress(const cdata_t c);
 cdata_t fmt5_decompress(const cdata_t c);
 cdata_t fmt6_decompress(const cdata_t c);
 cdata_t fmt7_decompress(const cdata_t c);
+uint64_t fmt1_data_length(const cdata_t *c);
+uint64_t fmt2_data_length(const cdata_t *c, uint8_t *unit);
+uint64_t fmt3_data_length(const cdata_t *c, uint8_t *unit);
+uint64_t fmt4_data_length(const cdata_t *c);
+uint64_t fmt7_data_length(const cdata_t *c);
+void fmt1_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
+void fmt2_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
+void fmt3_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
+void fmt4_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
 
 cdata_t decompress(cdata_t c) {
   switch (c.fmt) {
@@ -44,6 +53,40 @@ cdata_t decompress(cdata_t c) {
   return c; /* shouldn't reach here */
 }
 
+/**
+ * Row count and inflated unit of a compressed record, computed by scanning
+ * the stream without allocating the inflated buffer.  The unit matches what
+ * decompress() would pick when c->unit is unset.
+ */
+uint64_t cdata_dims(const cdata_t *c, uint8_t *unit) {
+  switch (c->fmt) {
+  case '0': {
+    *unit = 1;
+    if (!fmt0_is_sparse(c)) return c->n;
+    uint64_t n; memcpy(&n, c->s, sizeof(uint64_t)); /* leads the payload */
+    return n;
+  }
+  case '1': { *unit = 1; return fmt1_data_length(c); }
+  case '2': { return fmt2_data_length(c, unit); }
+  case '3': { *unit = 1; return fmt3_data_length(c, unit); }
+  case '4': { *unit = fmt4_is_quant(c) ? fmt4_is_quant(c) : 4; return fmt4_data_length(c); }
+  case '6': {
+    *unit = 2;
+    if (!fmt6_is_sparse(c)) return c->n;
+    uint64_t n; memcpy(&n, c->s, sizeof(uint64_t)); /* leads the payload */
+    return n;
+  }
+  case '7': { *unit = 8; return fmt7_data_length(c); }
+  default: {
+    cdata_t inflated = decompress(*c);
+    uint64_t n = inflated.n;
+    *unit = inflated.unit;
+    free_cdata(&inflated);
+    return n;
+  }
+  }
+}
+
 void decompress_in_situ(cdata_t *c) {
   if (!c->compressed) {
     fprintf(stderr, "[%s:%d] Already decompressed.\n", __func__, __LINE__);
@@ -55,3 +98,231 @@ void decompress_in_situ(cdata_t *c) {
   *c = expanded;
 }
 
+/* ------------------------------------------------------------------ */
+/* Row checkpoints for the run-length formats (1-4, sparse 6), see    */
+/* cdata.h; fmt7 builds its own (format7.c)                           */
+/* ------------------------------------------------------------------ */
+
+static int has_ckpt(const cdata_t *c) {
+  return c->fmt == '1' || c->fmt == '2' || c->fmt == '3' || c->fmt == '4' || fmt6_is_sparse(c);
+}
+
+/* byte offset of the first run-length record; fmt2 also gives its value
+   width, fmt6 its coding */
+static uint64_t first_record(const cdata_t *c, uint8_t *unit) {
+  *unit = 0;
+  if (c->fmt == '4' && (*unit = fmt4_is_quant(c))) return F4Q_HDR; /* code bytes */
+  if (fmt6_is_sparse(c)) { *unit = c->s[8]; return F6_HDR; }
+  if (c->fmt != '2') return 0;
+  uint64_t keys_nb = fmt2_get_keys_nbytes(c);
+  *unit = c->s[keys_nb+1];
+  return keys_nb + 2;
+}
+
+/* rows covered by the record at c->s[*i], advancing *i past it */
+static uint64_t next_record(const cdata_t *c, uint8_t unit, uint64_t *i) {
+  switch (c->fmt) {
+  case '1': { uint16_t l; memcpy(&l, c->s+*i+1, 2); *i += 3; return l; }
+  case '2': { uint16_t l; memcpy(&l, c->s+*i+unit, 2); *i += unit+2; return l; }
+  case '3': {
+    uint8_t t = c->s[*i] & 0x3;
+    if (t == 0) { uint16_t v; memcpy(&v, c->s+*i, 2); *i += 2; return v>>2; }
+    *i += (t == 1) ? 1 : ((t == 2) ? 2 : 8);
+    return 1;
+  }
+  case '4': {
+    if (unit) {                 /* quantized: an NA code carries its run length */
+      uint32_t q = 0; memcpy(&q, c->s+*i, unit); *i += unit;
+      if (q <= F4Q_MAX(unit)) return 1;
+      uint64_t l = 0; int sh = 0; uint8_t b;
+      do { b = c->s[(*i)++]; l |= (uint64_t) (b & 0x7f) << sh; sh += 7; } while (b & 0x80);
+      return l + 1;
+    }
+    uint32_t w; memcpy(&w, c->s+*i, 4); *i += 4;
+    return (w>>31) ? (w<<1>>1) : 1;
+  }
+  case '6': {                   /* sparse: a run, or a gap and its site */
+    uint64_t v = 0; int sh = 0; uint8_t b;
+    do { b = c->s[(*i)++]; v |= (uint64_t) (b & 0x7f) << sh; sh += 7; } while (b & 0x80);
+    return unit == F6_RUNS ? (v>>2) + 1 : (v>>1) + 1;
+  }
+  default: wzfatal("Format %c has no row checkpoints.\n", c->fmt);
+  }
+  return 0;
+}
+
+/**
+ * Build the checkpoint table of a compressed record into *tab (malloc'ed,
+ * on-disk layout).  Returns its size in bytes, or 0 with *tab = NULL when
+ * the format is not run-length encoded or the record spans a single step.
+ */
+uint64_t cdata_ckpt_build(const cdata_t *c, uint8_t **tab) {
+  *tab = NULL;
+  if (c->compressed && c->fmt == '7') return fmt7_ckpt_build(c, tab);
+  if (!c->compressed || !has_ckpt(c)) return 0;
+  if (c->fmt == '3' && fmt3_is_v2(c)) return 0; /* no record boundaries to point at */
+  if (c->fmt == '2' && fmt2_is_blocked(c)) return 0; /* rows are read in place */
+
+  uint8_t unit;
+  uint64_t i = first_record(c, &unit), row = 0, n = 0, m = 64;
+  uint64_t *t = malloc(m*2*sizeof(uint64_t));
+  while (i < c->n) {
+    uint64_t i0 = i, l = next_record(c, unit, &i);
+    for (; n*CDATA_CKPT_STEP < row + l; ++n) {
+      if (n >= m) { m <<= 1; t = realloc(t, m*2*sizeof(uint64_t)); }
+      t[2*n] = i0; t[2*n+1] = row;
+    }
+    row += l;
+  }
+  if (row <= CDATA_CKPT_STEP) { free(t); return 0; }
+
+  uint64_t nb = 16 + 16*n, step = CDATA_CKPT_STEP;
+  *tab = malloc(nb);
+  memcpy(*tab, &step, sizeof(uint64_t));
+  memcpy(*tab+8, &n, sizeof(uint64_t));
+  memcpy(*tab+16, t, 16*n);
+  free(t);
+  return nb;
+}
+
+/**
+ * Where to start walking a compressed record to reach `row`: *i is the byte
+ * offset of a record and *row0 the first row it covers (*row0 <= row).  Uses
+ * the checkpoint table when there is one, the start of the stream otherwise.
+ */
+void cdata_ckpt_seek(const cdata_t *c, uint64_t row, uint64_t *i, uint64_t *row0) {
+  uint8_t unit;
+  *i = first_record(c, &unit); *row0 = 0;
+  if (!(c->flags & CDFLAG_CKPT) || !has_ckpt(c)) return;
+
+  const uint8_t *t = c->s + cdata_nbytes(c);
+  uint64_t step, n;
+  memcpy(&step, t, sizeof(uint64_t));
+  memcpy(&n, t+8, sizeof(uint64_t));
+  if (!step || !n) return;
+  uint64_t j = row / step;
+  if (j >= n) j = n-1;
+  memcpy(i, t+16+16*j, sizeof(uint64_t));
+  memcpy(row0, t+24+16*j, sizeof(uint64_t));
+}
+
+static void decompress_rows(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  switch (c->fmt) {
+  case '1': fmt1_decompress_range(c, i, row, beg, end, out); break;
+  case '2': fmt2_decompress_range(c, i, row, beg, end, out); break;
+  case '3': fmt3_decompress_range(c, i, row, beg, end, out); break;
+  case '4': fmt4_decompress_range(c, i, row, beg, end, out); break;
+  case '6': fmt6_decompress_range(c, i, row, beg, end, out); break;
+  default: wzfatal("Format %c has no row decoder.\n", c->fmt);
+  }
+}
+
+/**
+ * Decompress rows [beg, end] (0-based, inclusive; end is clipped to the
+ * last row) of a compressed record.  The result is laid out like the
+ * matching rows of decompress(*c).  Run-length formats (and sparse fmt6)
+ * start from the nearest checkpoint and stop at `end`; fmt0/6 bits are
+ * sliced directly.
+ */
+cdata_t decompress_range(const cdata_t *c, uint64_t beg, uint64_t end) {
+  uint64_t n = cdata_n((cdata_t*) c);
+  if (n == 0 || beg > n-1)
+    wzfatal("[%s:%d] Begin (%"PRIu64") is bigger than the data vector size (%"PRIu64").\n", __func__, __LINE__, beg, n);
+  if (end > n-1) end = n-1;
+  if (end < beg) wzfatal("Slicing negative span.");
+
+  cdata_t out = {0};
+  switch (c->fmt) {
+  case '0': {
+    out.n = end-beg+1;
+    out.s = calloc((out.n+7)>>3, 1);
+    if (fmt0_is_sparse(c)) {    // only the intervals reaching the window
+      fmt0_iter_t it; uint64_t b, e;
+      fmt0_iter_init(&it, c);
+      fmt0_iter_seek(&it, beg);
+      while (fmt0_next_range(&it, &b, &e) && b <= end) {
+        if (b < beg) b = beg;
+        if (e > end+1) e = end+1;
+        for (; b<e; ++b) FMT0_SET(out, b-beg);
+      }
+    } else {
+      for (uint64_t k=0; k<out.n; ++k)
+        if (FMT0_IN_SET(*c, beg+k)) FMT0_SET(out, k);
+    }
+    out.unit = 1;
+    break;
+  }
+  case '6': {
+    if (fmt6_is_sparse(c)) {
+      uint64_t i, row;
+      cdata_ckpt_seek(c, beg, &i, &row);
+      decompress_rows(c, i, row, beg, end, &out);
+      return out;
+    }
+    out.n = end-beg+1;
+    out.s = calloc((out.n+3)>>2, 1);
+    for (uint64_t k=0; k<out.n; ++k) {
+      uint64_t r = beg+k;
+      out.s[k>>2] |= FMT6_2BIT(*c, r) << ((k&0x3)*2);
+    }
+    out.unit = 2;
+    break;
+  }
+  case '1': case '2': case '3': case '4': {
+    uint64_t i, row;
+    cdata_ckpt_seek(c, beg, &i, &row);
+    decompress_rows(c, i, row, beg, end, &out);
+    return out;
+  }
+  default: {
+    cdata_t expanded = decompress(*c);
+    slice(&expanded, beg, end, &out);
+    free_cdata(&expanded);
+    return out;
+  }
+  }
+  out.fmt = c->fmt;
+  out.compressed = 0;
+  return out;
+}
+
+/**
+ * Decompress c into out, reusing out's buffer instead of allocating a new
+ * one (out must be {0} or a previous decompress_into() result).  Gives the
+ * same content as decompress(*c).  Meant for loops that decode many
+ * records of the same shape: together with read_cdata2() the steady state
+ * does no allocation at all.
+ */
+void decompress_into(const cdata_t *c, cdata_t *out) {
+  if (!c->compressed) {
+    fprintf(stderr, "[%s:%d] Already decompressed.\n", __func__, __LINE__);
+    fflush(stderr);
+    exit(1);
+  }
+  fmt2_free_aux(out); // keys point into the old buffer
+  if (out->fmt == '7' && out->aux) free(out->aux);
+  out->aux = NULL;
+  if (out->flags & CDFLAG_MAPPED) out->s = NULL; /* borrowed, not ours to realloc */
+
+  uint64_t n;
+  if (fmt0_is_sparse(c)) {
+    cdata_t expanded = decompress(*c);
+    free(out->s);
+    *out = expanded;
+  } else if ((c->fmt == '0' || c->fmt == '6') && !fmt6_is_sparse(c)) {
+    out->n = c->n;              /* compressed and inflated forms agree */
+    out->compressed = 0;
+    out->fmt = c->fmt;
+    out->s = realloc(out->s, cdata_nbytes(out));
+    memcpy(out->s, c->s, cdata_nbytes(out));
+    out->unit = (c->fmt == '0') ? 1 : 2;
+  } else if (has_ckpt(c) && (n = cdata_n((cdata_t*) c)) > 0) {
+    uint8_t unit;
+    decompress_rows(c, first_record(c, &unit), 0, 0, n-1, out);
+  } else {
+    cdata_t expanded = decompress(*c);
+    free(out->s);
+    *out = expanded;
+  }
+  out->nrow = 0; out->flags = 0;
+}
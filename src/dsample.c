@@ -196,12 +196,10 @@ cdata_t dsample_fmt6(cdata_t *c, uint64_t N,
 }
 
 /**
- * Write an index for the downsampled output, taking into account replicates.
+ * Output sample name for replicate rep of input sample i, taking into
+ * account replicates. The caller frees the returned string.
  *
- * - fname:      input .cx filename (used to load existing index, if any).
- * - fname_out:  output .cx filename; if NULL, no index is written.
- * - n_in:       number of input samples read.
- * - n_rep:      number of replicates per input sample.
+ * - snames:     input sample names, from its index (empty if unindexed).
  * - rep_prefix: the prefix to add to the output sample name
  *               ([sname]-[rep_prefix]-[rep_id])
  *
@@ -209,105 +207,33 @@ cdata_t dsample_fmt6(cdata_t *c, uint64_t N,
  * we fall back to 0-based numeric sample IDs. Replicates are suffixed with
  * `-0`, `-1`, ..., `-(n_rep-1)` when n_rep > 1.
  */
-static void write_index_with_rep(char *fname,
-                                 char *fname_out,
-                                 int64_t n_in,
-                                 int n_rep, char *rep_prefix) {
-  
-  if (!fname_out) return; // cannot index stdout
-
-  // load input index (if any)
-  int npairs = 0;
-  index_pair_t *pairs = NULL;
-  char *fname_index = get_fname_index(fname);
-  index_t *idx = loadIndex(fname_index);
-  if (idx) pairs = index_pairs(idx, &npairs);
-  free(fname_index);
-
-  // sanity: if we have an index, its size should match n_in
-  if (idx && npairs != n_in) {
-    fprintf(stderr,
-            "[Warning] write_index_with_rep: input index has %d entries, "
-            "but n_in = %" PRId64 ". Using min of the two.\n",
-            npairs, n_in);
-    fflush(stderr);
-    if (npairs < n_in) n_in = npairs;
-  }
-
-  // open output CX for reading to recover BGZF offsets
-  cfile_t cf2 = open_cfile(fname_out);
-  index_t *idx2 = kh_init(index);
-
-  int64_t addr = bgzf_tell(cf2.fh);
-  cdata_t c_tmp = (cdata_t){0};
-
-  for (int64_t i = 0; i < n_in; ++i) {
-    for (int j = 0; j < n_rep; ++j) {
-
-      if (!read_cdata2(&cf2, &c_tmp)) {
-        fprintf(stderr,
-                "[Error] write_index_with_rep: data is shorter than "
-                "expected (%" PRId64 " records, n_rep=%d).\n",
-                n_in, n_rep);
-        fflush(stderr);
-        exit(1);
-      }
-
-      // decide the base name
-      const char *base = NULL;
-      char buf[64]; // 64 characters is enough for n_in
-
-      if (pairs) {
-        base = pairs[i].key;           // input index key
-      } else {
-        // fallback: use i if input index is missing
-        snprintf(buf, sizeof(buf), "%" PRId64, i);
-        base = buf;
-      }
-
-      // construct the final key string
-      char *s = NULL;
-      if (n_rep == 1) {
-        int n = snprintf(NULL, 0, "%s", base);
-        s = (char *)malloc(n + 1);
-        snprintf(s, n + 1, "%s", base);
-      } else if (rep_prefix) {
-        int n = snprintf(NULL, 0, "%s-%s-%d", base, rep_prefix, j);
-        s = (char *)malloc(n + 1);
-        snprintf(s, n + 1, "%s-%s-%d", base, rep_prefix, j);
-      } else {
-        int n = snprintf(NULL, 0, "%s-%d", base, j);
-        s = (char *)malloc(n + 1);
-        snprintf(s, n + 1, "%s-%d", base, j);
-      }
-
-      insert_index(idx2, s, addr);
-
-      // addr for the *next* record
-      addr = bgzf_tell(cf2.fh);
-    }
+static char *rep_sname(snames_t *snames, int64_t i, int rep, int n_rep, char *rep_prefix) {
+
+  // decide the base name
+  const char *base = NULL;
+  char buf[64]; // 64 characters is enough for i
+  if (i < snames->n) {
+    base = snames->s[i];           // input index key
+  } else {
+    // fallback: use i if input index is missing
+    snprintf(buf, sizeof(buf), "%" PRId64, i);
+    base = buf;
   }
 
-  free_cdata(&c_tmp);
-  bgzf_close(cf2.fh);
-
-  // write output index file
-  char *fname_index2 = get_fname_index(fname_out);
-  FILE *out = fopen(fname_index2, "w");
-  if (!out) {
-    fprintf(stderr,
-            "[Error] write_index_with_rep: cannot open index file %s\n",
-            fname_index2);
-    fflush(stderr);
-    exit(1);
+  // construct the final key string
+  char *s = NULL;
+  if (n_rep == 1) {
+    s = strdup(base);
+  } else if (rep_prefix) {
+    int n = snprintf(NULL, 0, "%s-%s-%d", base, rep_prefix, rep);
+    s = (char *)malloc(n + 1);
+    snprintf(s, n + 1, "%s-%s-%d", base, rep_prefix, rep);
+  } else {
+    int n = snprintf(NULL, 0, "%s-%d", base, rep);
+    s = (char *)malloc(n + 1);
+    snprintf(s, n + 1, "%s-%d", base, rep);
   }
-  writeIndex(out, idx2);
-  fclose(out);
-  free(fname_index2);
-
-  cleanIndex(idx2); // free the keys too
-  if (pairs) free(pairs);
-  if (idx)   cleanIndex(idx);   // or freeIndex(idx) if needed
+  return s;
 }
 
 int main_dsample(int argc, char *argv[]) {
@@ -340,18 +266,9 @@ int main_dsample(int argc, char *argv[]) {
   }
 
   char *fname = argv[optind];
-  BGZF* fp_out;
-  if (fname_out) fp_out = bgzf_open2(fname_out, "wb");
-  else fp_out = bgzf_dopen(fileno(stdout), "wb");
-
-  if (fp_out == NULL) {
-    fprintf(stderr, "[%s:%d] Error opening file for writing: %s\n",
-            __func__, __LINE__, fname_out ? fname_out : "<stdout>");
-    fflush(stderr);
-    exit(1);
-  }
-  
+  cfile_writer_t *w = cfile_writer_open(fname_out, "wb");
   cfile_t cf = open_cfile(fname);
+  snames_t snames = loadSampleNamesFromIndex(fname);
   srand(seed);
   
   uint64_t *indices = NULL;
@@ -359,14 +276,10 @@ int main_dsample(int argc, char *argv[]) {
 
   int64_t n_samples = 0;
   
+  cdata_t c_raw = {0}, c_in = {0}; // buffers reused across records
   for (;;++n_samples) {
-    cdata_t c_in = read_cdata1(&cf);
-    if (c_in.n == 0) {
-      free_cdata(&c_in);
-      break;  // end-of-file
-    }
-    
-    decompress_in_situ(&c_in);
+    if (!read_cdata2(&cf, &c_raw)) break;  // end-of-file
+    decompress_into(&c_raw, &c_in);
     uint64_t n_positions = c_in.n;
 
     if (!indices) {
@@ -401,19 +314,19 @@ int main_dsample(int argc, char *argv[]) {
         cdata_compress(&c_out);
       }
       fflush(stderr);
-      cdata_write1(fp_out, &c_out);
+      char *sname = rep_sname(&snames, n_samples, rep, n_rep, rep_prefix);
+      cfile_writer_write(w, &c_out, sname);
+      free(sname);
       free_cdata(&c_out);
     }
-    free_cdata(&c_in);
   }
+  free_cdata(&c_in); free_cdata(&c_raw);
 
   /* free(indices); */
   /* free(to_include); */
-  bgzf_close(cf.fh);
-  bgzf_close(fp_out);
-
-  /* Only attempt to write an index when we actually wrote to a regular file. */
-  write_index_with_rep(fname, fname_out, n_samples, n_rep, rep_prefix);
+  cfile_close(&cf);
+  cfile_writer_close(w);        /* indexes the output unless it is stdout */
+  cleanSampleNames(&snames);
   if (fname_out) free(fname_out);
    
   return 0;
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+/**
+ * This file is part of YAME.
+ *
+ * Copyright (C) 2021-present Wanding Zhou
+ *
+ * YAME is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAME is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cfile.h"
+
+/**
+ * yame flatten / yame unflatten
+ * =============================
+ *
+ * flatten rewrites a .cx as a flat container (see cfile.h): records
+ * without BGZF, page-aligned, behind a record directory, so open_cfile()
+ * can mmap the file and hand out records without inflating or copying
+ * them.  Sparse format 0/6 records are expanded to packed bits; other
+ * formats keep their encoding.  Checkpoint tables are (re)built on the way,
+ * as cdata_write1() does.  The flat .idx maps each sample name to its
+ * record number.
+ *
+ * unflatten writes the records back as an indexed BGZF .cx.
+ */
+
+static int usage_flatten(void) {
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  yame flatten -o <out.cx> <in.cx>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Purpose:\n");
+  fprintf(stderr, "  Store a .cx uncompressed and memory-mappable, for datasets that are read\n");
+  fprintf(stderr, "  much more often than written (e.g. mask libraries). Every yame command\n");
+  fprintf(stderr, "  reads the output like any .cx, without inflating it.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -o <out.cx>  Output file (required); <out.cx>.idx is written with it.\n");
+  fprintf(stderr, "  -h           Show this help message.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Notes:\n");
+  fprintf(stderr, "  * Sample names come from the input index, Unnamed_<k> if there is none.\n");
+  fprintf(stderr, "  * Use yame unflatten to go back to BGZF.\n");
+  fprintf(stderr, "\n");
+  return 1;
+}
+
+static int usage_unflatten(void) {
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  yame unflatten [options] <in.cx>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Purpose:\n");
+  fprintf(stderr, "  Convert a flat container (yame flatten) back to a BGZF .cx.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -o <out.cx>  Write output to file and index it (default: stdout, no index).\n");
+  fprintf(stderr, "  -h           Show this help message.\n");
+  fprintf(stderr, "\n");
+  return 1;
+}
+
+static void write_or_die(FILE *out, const void *p, size_t nb) {
+  if (nb && fwrite(p, 1, nb, out) != nb)
+    wzfatal("[%s:%d] Error writing flat container.\n", __func__, __LINE__);
+}
+
+/* zero-fill up to the next CXFLAT_ALIGN boundary */
+static uint64_t write_pad(FILE *out, uint64_t off) {
+  static const uint8_t zeros[CXFLAT_ALIGN] = {0};
+  uint64_t pad = (CXFLAT_ALIGN - off % CXFLAT_ALIGN) % CXFLAT_ALIGN;
+  write_or_die(out, zeros, pad);
+  return off + pad;
+}
+
+int main_flatten(int argc, char *argv[]) {
+
+  int c; char *fname_out = NULL;
+  while ((c = getopt(argc, argv, "o:h"))>=0) {
+    switch (c) {
+    case 'o': fname_out = strdup(optarg); break;
+    case 'h': return usage_flatten(); break;
+    default: usage_flatten(); wzfatal("Unrecognized option: %c.\n", c);
+    }
+  }
+
+  if (optind + 1 > argc) {
+    usage_flatten();
+    wzfatal("Please supply input file.\n");
+  }
+  if (!fname_out) {
+    usage_flatten();
+    wzfatal("Flat containers are written to a file; please supply -o.\n");
+  }
+
+  cfile_t cf = open_cfile(argv[optind]);
+  if (cf.fl) wzfatal("Input is already flat.\n");
+  snames_t snames = loadSampleNamesFromIndex(argv[optind]);
+  FILE *out = fopen(fname_out, "wb");
+  if (!out) wzfatal("[%s:%d] Cannot open %s for writing.\n", __func__, __LINE__, fname_out);
+
+  uint64_t off = write_pad(out, 0) + CXFLAT_ALIGN; /* header page, filled in last */
+  fseeko(out, off, SEEK_SET);
+
+  index_t *idx = kh_init(index);
+  cfile_flat_rec_t *dir = NULL; uint64_t nrec = 0;
+  cdata_t c0 = {0};
+  while (read_cdata2(&cf, &c0)) {
+    if (c0.fmt == '0') fmt0_to_bits(&c0); /* readers take packed bits as they are */
+    else if (c0.fmt == '6') fmt6_to_bits(&c0);
+    dir = realloc(dir, (nrec+1)*sizeof(cfile_flat_rec_t));
+    cfile_flat_rec_t *r = &dir[nrec];
+    memset(r, 0, sizeof(*r));
+    r->off = off; r->n = c0.n; r->fmt = c0.fmt;
+    r->nrow = cdata_dims(&c0, &r->unit);
+    uint8_t *tab = NULL;
+    uint64_t tab_nb = cdata_ckpt_build(&c0, &tab);
+    if (tab_nb) r->flags |= CDFLAG_CKPT;
+    r->flags |= c0.flags & CDFLAG_SPARSE;
+    uint64_t nb = cdata_nbytes(&c0);
+    write_or_die(out, c0.s, nb);
+    write_or_die(out, tab, tab_nb);
+    free(tab);
+    off = write_pad(out, off + nb + tab_nb);
+
+    char buf[32]; const char *sname = buf;
+    if (nrec < (uint64_t) snames.n) sname = snames.s[nrec];
+    else snprintf(buf, sizeof(buf), "Unnamed_%"PRIu64, nrec+1);
+    insert_index(idx, strdup(sname), nrec);
+    nrec++;
+  }
+  write_or_die(out, dir, nrec*sizeof(cfile_flat_rec_t));
+
+  uint64_t hd[3] = {CXFLATSIG, nrec, off};
+  fseeko(out, 0, SEEK_SET);
+  write_or_die(out, hd, sizeof(hd));
+  if (fclose(out) != 0) wzfatal("[%s:%d] Error closing %s.\n", __func__, __LINE__, fname_out);
+
+  char *fname_index = get_fname_index(fname_out);
+  FILE *fi = fopen(fname_index, "w");
+  if (!fi) wzfatal("[%s:%d] Cannot open index file %s.\n", __func__, __LINE__, fname_index);
+  writeIndex(fi, idx);
+  fclose(fi);
+  free(fname_index);
+  updateBinaryIndex(fname_out, idx, 0);
+
+  cleanIndex(idx);
+  free(dir);
+  free_cdata(&c0);
+  cleanSampleNames(&snames);
+  cfile_close(&cf);
+  free(fname_out);
+  return 0;
+}
+
+int main_unflatten(int argc, char *argv[]) {
+
+  int c; char *fname_out = NULL;
+  while ((c = getopt(argc, argv, "o:h"))>=0) {
+    switch (c) {
+    case 'o': fname_out = strdup(optarg); break;
+    case 'h': return usage_unflatten(); break;
+    default: usage_unflatten(); wzfatal("Unrecognized option: %c.\n", c);
+    }
+  }
+
+  if (optind + 1 > argc) {
+    usage_unflatten();
+    wzfatal("Please supply input file.\n");
+  }
+
+  cfile_t cf = open_cfile(argv[optind]);
+  snames_t snames = loadSampleNamesFromIndex(argv[optind]);
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
+  cdata_t c0 = {0};
+  for (int64_t k = 0; read_cdata2(&cf, &c0); ++k)
+    cfile_writer_write(w, &c0, k < snames.n ? snames.s[k] : NULL);
+  cfile_writer_close(w);
+
+  free_cdata(&c0);
+  cleanSampleNames(&snames);
+  cfile_close(&cf);
+  if (fname_out) free(fname_out);
+  return 0;
+}
@@ -51,39 +51,370 @@
  *
  * Compressed representation
  * -------------------------
- * Format 0 does *not* define its own compression scheme.
+ * A compressed fmt0 record is stored in one of two ways:
  *
- * Rules:
- *   - If data is already in fmt0 form, it is considered uncompressed.
- *   - When c->compressed==1 and fmt=='0', it simply means:
- *         "data may have originated from a conversion (e.g., fmt1->fmt0,
- *          fmt3->fmt0) but storage remains the same packed-bit layout."
- *   - No variable-length encoding or RLE is used for fmt0.
+ *   - packed bits, exactly as above (c->n = number of CpG sites).  This is
+ *     what older files hold and what cdata_compress() keeps for dense sets.
  *
- * In other words, the on-disk and in-memory representations are identical:
+ *   - sparse containers (c->flags & CDFLAG_SPARSE), chosen by fmt0_compress()
+ *     when they deflate smaller than the packed bits.  c->n is then the
+ *     payload byte count and the row count sits in the payload:
  *
- *   Before compression:  "packed bits"
- *   After compression:   "packed bits (unchanged)"
+ *       uint64 nrow, uint32 nc, uint32 0
+ *       nc x f0_cont_t   {uint32 key, uint32 card, uint32 off,
+ *                         uint8 type, uint8 0, uint16 len}
+ *       container bodies, each starting on an 8-byte boundary
  *
+ *     Container `key` covers rows [key<<16, (key+1)<<16) and holds `card`
+ *     set rows; chunks without any set row have no container.  `off` is
+ *     the body offset from the start of the payload.  By type:
  *
- * Before / After schematic
- * ------------------------
+ *       F0_ARRAY  : len x uint16, the sorted set rows (low 16 bits)
+ *       F0_BITMAP : 1024 x uint64, one bit per row as in packed bits
+ *       F0_RUN    : len x {uint16 first, uint16 last}, sorted set intervals
  *
- *   Inflated (RAM):
- *       s = [ packed bytes ]
- *       c->n = number of logical CpG bits
+ *     Each chunk takes whichever of the three is smallest.
  *
- *   Compressed (disk):
- *       identical byte stream:
- *       [ packed bytes ]
+ * Readers that need bits call fmt0_to_bits() (convertToFmt0() does) or
+ * decompress(); fmt0_next_range(), fmt0_popcount() and fmt0_and_popcount()
+ * work on either form without inflating.
  *
  * Decompression
  * -------------
- * fmt0_decompress() simply copies the packed bytes into the expanded buffer;
- * no decoding is required.
+ * fmt0_decompress() copies packed bits, or fills them in from the
+ * containers.
  *
  */
 
+#define F0_ARRAY  1
+#define F0_BITMAP 2
+#define F0_RUN    3
+#define F0_CHUNK  (1ul<<16)      /* rows per container */
+#define F0_HDR    16             /* payload header bytes */
+
+typedef struct f0_cont_t {
+  uint32_t key, card, off;
+  uint8_t type, pad;
+  uint16_t len;
+} f0_cont_t;
+
+/* 64 bits of a packed vector of nbits rows starting at row w<<6, with the
+   bits past nbits cleared */
+static inline uint64_t bits_word(const uint8_t *s, uint64_t nbits, uint64_t w) {
+  uint64_t x = 0, b = w<<6;
+  if (b >= nbits) return 0;
+  if (b + 64 <= nbits) { memcpy(&x, s+(w<<3), 8); return x; }
+  memcpy(&x, s+(w<<3), (nbits-b+7)>>3);
+  return x & ((1ull<<(nbits-b))-1);
+}
+
+/* next set interval [beg, end) at or after row *r, *r moves past it */
+static int bits_next_range(const uint8_t *s, uint64_t nbits, uint64_t *r, uint64_t *beg, uint64_t *end) {
+  if (*r >= nbits) return 0;
+  uint64_t w = (*r)>>6, x = bits_word(s, nbits, w) & (~0ull << ((*r)&63));
+  while (!x) {
+    if ((++w)<<6 >= nbits) { *r = nbits; return 0; }
+    x = bits_word(s, nbits, w);
+  }
+  *beg = (w<<6) + __builtin_ctzll(x);
+  x = ~bits_word(s, nbits, w) & (~0ull << ((*beg)&63));
+  while (!x && (++w)<<6 < nbits) x = ~bits_word(s, nbits, w);
+  *end = x ? (w<<6) + __builtin_ctzll(x) : nbits;
+  if (*end > nbits) *end = nbits;
+  *r = *end;
+  return 1;
+}
+
+/* set rows counted in [beg, end) of a packed vector; whole words go to
+   bits_popcount() */
+static uint64_t bits_range_count(const uint8_t *s, uint64_t nbits, uint64_t beg, uint64_t end) {
+  uint64_t m = 0;
+  if (end > nbits) end = nbits;
+  while (beg < end) {
+    uint64_t o = beg&63, k = end-beg;
+    if (!o && k >= 64) {
+      m += bits_popcount(s+(beg>>3), k>>6);
+      beg += k & ~63ull;
+      continue;
+    }
+    if (k > 64-o) k = 64-o;
+    uint64_t x = bits_word(s, nbits, beg>>6) >> o;
+    if (k < 64) x &= (1ull<<k)-1;
+    m += __builtin_popcountll(x);
+    beg += k;
+  }
+  return m;
+}
+
+static void bits_set_range(uint8_t *s, uint64_t beg, uint64_t end) {
+  for (; beg < end && (beg&7); ++beg) s[beg>>3] |= 1u<<(beg&7);
+  if (end - beg >= 8) {
+    memset(s+(beg>>3), 0xff, (end-beg)>>3);
+    beg += (end-beg) & ~7ull;
+  }
+  for (; beg < end; ++beg) s[beg>>3] |= 1u<<(beg&7);
+}
+
+static inline uint64_t f0_nrow(const cdata_t *c) {
+  if (!fmt0_is_sparse(c)) return c->n;
+  uint64_t n; memcpy(&n, c->s, sizeof(uint64_t));
+  return n;
+}
+
+static inline uint32_t f0_ncont(const cdata_t *c) {
+  uint32_t nc; memcpy(&nc, c->s+8, sizeof(uint32_t));
+  return nc;
+}
+
+static inline f0_cont_t f0_cont(const cdata_t *c, uint64_t k) {
+  f0_cont_t e; memcpy(&e, c->s + F0_HDR + k*sizeof(f0_cont_t), sizeof(f0_cont_t));
+  return e;
+}
+
+/* next set interval [beg, end) of container e (rows relative to the chunk),
+   *j is the walk position inside it */
+static int cont_next_range(const uint8_t *s, const f0_cont_t *e, uint64_t *j, uint64_t *beg, uint64_t *end) {
+  const uint8_t *body = s + e->off;
+  switch (e->type) {
+  case F0_ARRAY: {
+    const uint16_t *a = (const uint16_t*) body;
+    if (*j >= e->len) return 0;
+    *beg = a[(*j)++];
+    *end = *beg + 1;
+    while (*j < e->len && a[*j] == *end) { ++*end; ++*j; }
+    return 1;
+  }
+  case F0_RUN: {
+    const uint16_t *a = (const uint16_t*) body;
+    if (*j >= e->len) return 0;
+    *beg = a[2*(*j)];
+    *end = (uint64_t) a[2*(*j)+1] + 1;
+    ++*j;
+    return 1;
+  }
+  case F0_BITMAP: return bits_next_range(body, F0_CHUNK, j, beg, end);
+  default: wzfatal("[%s:%d] Unknown fmt0 container type %u. File corrupted.\n", __func__, __LINE__, e->type);
+  }
+  return 0;
+}
+
+void fmt0_iter_init(fmt0_iter_t *it, const cdata_t *c) {
+  memset(it, 0, sizeof(fmt0_iter_t));
+  it->c = c;
+  it->nrow = f0_nrow(c);
+}
+
+/* the next range returned is the first one ending after row; on sparse
+   records it may start before row */
+void fmt0_iter_seek(fmt0_iter_t *it, uint64_t row) {
+  if (!fmt0_is_sparse(it->c)) { it->r = row; return; }
+  uint64_t lo = 0, hi = f0_ncont(it->c), key = row>>16;
+  while (lo < hi) {             // first container at or after key
+    uint64_t mid = (lo+hi)>>1;
+    if (f0_cont(it->c, mid).key < key) lo = mid+1;
+    else hi = mid;
+  }
+  it->k = lo;
+  it->j = 0;
+}
+
+int fmt0_next_range(fmt0_iter_t *it, uint64_t *beg, uint64_t *end) {
+  const cdata_t *c = it->c;
+  if (!fmt0_is_sparse(c)) return bits_next_range(c->s, it->nrow, &it->r, beg, end);
+  for (uint64_t nc = f0_ncont(c); it->k < nc; ++it->k, it->j = 0) {
+    f0_cont_t e = f0_cont(c, it->k);
+    if (cont_next_range(c->s, &e, &it->j, beg, end)) {
+      *beg += (uint64_t) e.key<<16;
+      *end += (uint64_t) e.key<<16;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+uint64_t fmt0_popcount(const cdata_t *c) {
+  uint64_t m = 0;
+  if (fmt0_is_sparse(c)) {
+    for (uint64_t k=0, nc=f0_ncont(c); k<nc; ++k) m += f0_cont(c, k).card;
+  } else {
+    m = bits_range_count(c->s, c->n, 0, c->n);
+  }
+  return m;
+}
+
+/* set rows in [beg, end) of either form */
+uint64_t fmt0_range_popcount(const cdata_t *c, uint64_t beg, uint64_t end) {
+  if (!fmt0_is_sparse(c)) return bits_range_count(c->s, c->n, beg, end);
+  fmt0_iter_t it; uint64_t b, e, m = 0;
+  fmt0_iter_init(&it, c);
+  fmt0_iter_seek(&it, beg);
+  while (fmt0_next_range(&it, &b, &e) && b < end) {
+    if (b < beg) b = beg;
+    if (e > end) e = end;
+    if (e > b) m += e - b;
+  }
+  return m;
+}
+
+/* set rows shared by container e and the packed vector s of nbits rows,
+   from row base on */
+static uint64_t cont_and_bits(const uint8_t *cs, const f0_cont_t *e, const uint8_t *s, uint64_t nbits, uint64_t base) {
+  uint64_t m = 0, j = 0, beg, end;
+  if (e->type == F0_BITMAP) {  // whole words of s fused, then the last one
+    const uint8_t *body = cs + e->off;
+    uint64_t nw = base < nbits ? (nbits-base)>>6 : 0;
+    if (nw > (F0_CHUNK>>6)) nw = F0_CHUNK>>6;
+    m = bits_and_popcount(body, s+(base>>3), nw);
+    for (uint64_t w=nw; w<(F0_CHUNK>>6); ++w)
+      m += __builtin_popcountll(bits_word(body, F0_CHUNK, w) & bits_word(s, nbits, (base>>6)+w));
+  } else {
+    while (cont_next_range(cs, e, &j, &beg, &end))
+      m += bits_range_count(s, nbits, base+beg, base+end);
+  }
+  return m;
+}
+
+/* set rows shared by two containers of the same chunk */
+static uint64_t cont_and_cont(const uint8_t *sa, const f0_cont_t *ea, const uint8_t *sb, const f0_cont_t *eb) {
+  if (ea->type == F0_BITMAP) return cont_and_bits(sb, eb, sa + ea->off, F0_CHUNK, 0);
+  if (eb->type == F0_BITMAP) return cont_and_bits(sa, ea, sb + eb->off, F0_CHUNK, 0);
+  uint64_t m = 0, ja = 0, jb = 0, ba, ea_, bb, eb_;
+  int oka = cont_next_range(sa, ea, &ja, &ba, &ea_);
+  int okb = cont_next_range(sb, eb, &jb, &bb, &eb_);
+  while (oka && okb) {          // merge the two interval lists
+    uint64_t lo = ba > bb ? ba : bb, hi = ea_ < eb_ ? ea_ : eb_;
+    if (hi > lo) m += hi - lo;
+    if (ea_ < eb_) oka = cont_next_range(sa, ea, &ja, &ba, &ea_);
+    else okb = cont_next_range(sb, eb, &jb, &bb, &eb_);
+  }
+  return m;
+}
+
+/**
+ * Number of rows set in both a and b (same length), without inflating
+ * either.  Sparse sides only visit their containers, so the cost follows
+ * the smaller set rather than the row count.
+ */
+uint64_t fmt0_and_popcount(const cdata_t *a, const cdata_t *b) {
+  uint64_t m = 0;
+  if (!fmt0_is_sparse(a) && fmt0_is_sparse(b)) { const cdata_t *t = a; a = b; b = t; }
+  if (!fmt0_is_sparse(a)) {     // both packed
+    uint64_t nw = (a->n < b->n ? a->n : b->n)>>6;
+    m = bits_and_popcount(a->s, b->s, nw);
+    for (uint64_t w=nw; w<<6 < a->n; ++w)
+      m += __builtin_popcountll(bits_word(a->s, a->n, w) & bits_word(b->s, b->n, w));
+  } else if (!fmt0_is_sparse(b)) {
+    for (uint64_t k=0, nc=f0_ncont(a); k<nc; ++k) {
+      f0_cont_t e = f0_cont(a, k);
+      m += cont_and_bits(a->s, &e, b->s, b->n, (uint64_t) e.key<<16);
+    }
+  } else {
+    uint64_t ka = 0, kb = 0, na = f0_ncont(a), nb = f0_ncont(b);
+    while (ka < na && kb < nb) {
+      f0_cont_t ea = f0_cont(a, ka), eb = f0_cont(b, kb);
+      if (ea.key < eb.key) ++ka;
+      else if (eb.key < ea.key) ++kb;
+      else { m += cont_and_cont(a->s, &ea, b->s, &eb); ++ka; ++kb; }
+    }
+  }
+  return m;
+}
+
+/* fills the zeroed packed vector s from sparse containers */
+static void fmt0_unpack(const cdata_t *c, uint8_t *s) {
+  fmt0_iter_t it; uint64_t beg, end;
+  fmt0_iter_init(&it, c);
+  while (fmt0_next_range(&it, &beg, &end)) bits_set_range(s, beg, end);
+}
+
+/* sparse record -> compressed packed bits, in place */
+void fmt0_to_bits(cdata_t *c) {
+  if (!fmt0_is_sparse(c)) return;
+  uint64_t n = f0_nrow(c);
+  uint8_t *s = calloc((n+7)>>3, 1);
+  fmt0_unpack(c, s);
+  if (!(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = s;
+  c->n = n;
+  c->nrow = n;
+  c->flags = 0;
+}
+
+/**
+ * Compress packed bits.  BGZF deflates runs of packed bits well, so the
+ * container encoding is used only when it also deflates smaller; otherwise
+ * the bits are kept as they are.
+ */
+void fmt0_compress(cdata_t *c) {
+  uint64_t n = c->n, nck = (n + F0_CHUNK - 1) / F0_CHUNK, nc = 0, nb;
+  f0_cont_t *dir = calloc(nck ? nck : 1, sizeof(f0_cont_t));
+  for (uint64_t key=0; key<nck; ++key) { // pick a container per chunk
+    uint64_t card = 0, nrun = 0, carry = 0, w0 = key<<10;
+    for (uint64_t w=0; w<(F0_CHUNK>>6); ++w) {
+      uint64_t x = bits_word(c->s, n, w0+w);
+      card += __builtin_popcountll(x);
+      nrun += __builtin_popcountll(x & ~((x<<1) | carry));
+      carry = x>>63;
+    }
+    if (!card) continue;
+    f0_cont_t *e = &dir[nc++];
+    e->key = key; e->card = card;
+    if (4*nrun <= 2*card && 4*nrun < (F0_CHUNK>>3)) { e->type = F0_RUN; e->len = nrun; }
+    else if (2*card < (F0_CHUNK>>3)) { e->type = F0_ARRAY; e->len = card; }
+    else e->type = F0_BITMAP;
+  }
+  nb = F0_HDR + nc*sizeof(f0_cont_t);
+  for (uint64_t k=0; k<nc; ++k) {
+    nb = (nb+7) & ~7ull;
+    dir[k].off = nb;
+    nb += dir[k].type == F0_BITMAP ? (F0_CHUNK>>3) : dir[k].type == F0_RUN ? 4*dir[k].len : 2*dir[k].len;
+  }
+  if (nb >= ((n+7)>>3)) {       // dense: keep the bits
+    free(dir);
+    c->compressed = 1;
+    return;
+  }
+
+  uint8_t *s = calloc(nb, 1);
+  uint32_t nc32 = nc;
+  memcpy(s, &n, sizeof(uint64_t));
+  memcpy(s+8, &nc32, sizeof(uint32_t));
+  memcpy(s+F0_HDR, dir, nc*sizeof(f0_cont_t));
+  for (uint64_t k=0; k<nc; ++k) {
+    f0_cont_t *e = &dir[k];
+    uint64_t base = (uint64_t) e->key<<16, r = base, beg, end, i = 0;
+    uint64_t last = base + F0_CHUNK < n ? base + F0_CHUNK : n;
+    if (e->type == F0_BITMAP) {
+      for (uint64_t w=0; w<(F0_CHUNK>>6); ++w) {
+        uint64_t x = bits_word(c->s, n, (base>>6)+w);
+        memcpy(s + e->off + 8*w, &x, 8);
+      }
+      continue;
+    }
+    uint16_t *a = (uint16_t*) (s + e->off);
+    while (bits_next_range(c->s, last, &r, &beg, &end)) {
+      if (e->type == F0_RUN) {
+        a[i++] = beg - base;
+        a[i++] = end - 1 - base;
+      } else {
+        for (uint64_t b=beg; b<end; ++b) a[i++] = b - base;
+      }
+    }
+  }
+  free(dir);
+  if (deflated_nbytes(s, nb) >= deflated_nbytes(c->s, (n+7)>>3)) {
+    free(s);
+    c->compressed = 1;
+    return;
+  }
+  free(c->s);
+  c->s = s;
+  c->n = nb;
+  c->nrow = n;
+  c->flags |= CDFLAG_SPARSE;
+  c->compressed = 1;
+}
+
 /* 8 bit for 8 cpgs, each is binary */
 cdata_t* fmt0_read_raw(char *fname, int verbose) {
 
@@ -113,15 +444,17 @@ cdata_t* fmt0_read_raw(char *fname, int verbose) {
   return c;
 }
 
-/* just copy, nothing done */
+/* packed bits are just copied */
 cdata_t fmt0_decompress(const cdata_t c) {
   cdata_t expanded = c;
-  expanded.s = calloc(cdata_nbytes(&c), 1);
-  memcpy(expanded.s, c.s, cdata_nbytes(&c));
+  expanded.n = f0_nrow(&c);
+  expanded.s = calloc((expanded.n+7)>>3, 1);
+  if (fmt0_is_sparse(&c)) fmt0_unpack(&c, expanded.s);
+  else memcpy(expanded.s, c.s, cdata_nbytes(&c));
   expanded.unit = 1;
-  expanded.n = c.n;
   expanded.compressed = 0;
   expanded.fmt = '0';
+  expanded.nrow = 0; expanded.flags = 0;
   return expanded;
 }
 
@@ -135,7 +468,7 @@ cdata_t fmt3_decompress(const cdata_t c);
 void convertToFmt0(cdata_t *c) {
   cdata_t c_out = {0};
   switch (c->fmt) {
-  case '0': return;
+  case '0': fmt0_to_bits(c); return;
   case '1': { // assume it's compressed.
     c_out.fmt = '0';
     c_out.compressed = 1;
@@ -175,77 +508,79 @@ void convertToFmt0(cdata_t *c) {
   }
   default: wzfatal("Format %c unsupported.\n", c->fmt);
   }
-  free(c->s);
+  free_cdata(c);
   *c = c_out;
 }
 
 // when using format 0 as query, it is treated as a set rather than a binary states.
 // TODO: maybe we should have a binary mode like the quaternary mode for format 6.
+// Query and binary masks may be sparse (see fmt0_compress()); the counts then
+// come from the containers and only the set intervals of the query are visited.
 stats_t* summarize1_queryfmt0(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
 
   stats_t *st = NULL;
+  uint64_t N = cdata_n(c), beg, end;
+  fmt0_iter_t it;
   if (c_mask->n == 0) {          // no mask
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    st[0].n_u = c->n;
-    st[0].n_m = c->n;
-    st[0].n_q = bit_count(c[0]);
+    st[0].n_u = N;
+    st[0].n_m = N;
+    st[0].n_q = fmt0_popcount(c);
     st[0].n_o = st[0].n_q;
     st[0].sm = strdup(sm);
     st[0].sq = strdup(sq);
     
   } else if (c_mask->fmt <= '1') { // binary mask
 
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), N);
       fflush(stderr);
       exit(1);
     }
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    st[0].n_u = c->n;
-    st[0].n_q = bit_count(c[0]);
-    st[0].n_m = bit_count(c_mask[0]);
-    cdata_t tmp = {0};
-    tmp.s = malloc((c->n>>3)+1); tmp.n = c->n;
-    memcpy(tmp.s, c->s, (c->n>>3)+1);
-    for (uint64_t i=0; i<(tmp.n>>3)+1; ++i) tmp.s[i] &= c_mask->s[i];
-    st[0].n_o = bit_count(tmp);
-    free(tmp.s);
+    st[0].n_u = N;
+    st[0].n_q = fmt0_popcount(c);
+    st[0].n_m = fmt0_popcount(c_mask);
+    st[0].n_o = fmt0_and_popcount(c, c_mask);
     st[0].sm = strdup(sm);
     st[0].sq = strdup(sq);
 
   } else if (c_mask->fmt == '2') { // state mask
 
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), N);
       fflush(stderr);
       exit(1);
     }
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux = fmt2_mask_runs(c_mask);
     *n_st = aux->nk;
     st = calloc((*n_st), sizeof(stats_t));
-    uint64_t nq=0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t index = f2_get_uint64(c_mask, i);
-      if (index >= (*n_st)) {
-        fprintf(stderr, "[%s:%d] State data is corrupted.\n", __func__, __LINE__);
-        fflush(stderr);
-        exit(1);
-      }
-      if (FMT0_IN_SET(*c, i)) {
-        st[index].n_o++;
-        nq++;
+    uint64_t nq = fmt0_popcount(c), r, i;
+    for (r=0, i=0; r<aux->nrun; i=aux->runs[r++].end)
+      st[aux->runs[r].v].n_m += aux->runs[r].end - i;
+    if (!fmt0_is_sparse(c)) {   // popcount over each run
+      for (r=0, i=0; r<aux->nrun; i=aux->runs[r++].end)
+        st[aux->runs[r].v].n_o += bits_range_count(c->s, N, i, aux->runs[r].end);
+    } else {                    // set intervals against the runs
+      r = 0;
+      fmt0_iter_init(&it, c);
+      while (fmt0_next_range(&it, &beg, &end)) {
+        while (beg < end) {
+          while (aux->runs[r].end <= beg) ++r;
+          uint64_t e = aux->runs[r].end < end ? aux->runs[r].end : end;
+          st[aux->runs[r].v].n_o += e - beg;
+          beg = e;
+        }
       }
-      st[index].n_m++;
     }
     for (uint64_t k=0; k < (*n_st); ++k) {
       st[k].n_q = nq;
-      st[k].n_u = c->n;
+      st[k].n_u = N;
       if (config->section_name) {
         kstring_t tmp = {0};
         ksprintf(&tmp, "%s-%s", sm, aux->keys[k]);
@@ -258,24 +593,29 @@ stats_t* summarize1_queryfmt0(
 
   } else if (c_mask->fmt == '6') { // binary mask with universe
 
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (c_mask->n != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, N);
       fflush(stderr);
       exit(1);
     }
     
     *n_st = 1;
     stats_t st1 = {0};
-    for (uint64_t i=0; i<c->n; ++i) {
-      if (FMT6_IN_UNI(*c_mask, i)) {
-        st1.n_u++;
-        int in_q = FMT0_IN_SET(*c, i);
-        int in_m = FMT6_IN_SET(*c_mask, i);
-        if (in_q) st1.n_q++;
-        if (in_m) st1.n_m++;
-        if (in_q && in_m) st1.n_o++;
-      }
+    uint64_t mc[4] = {0}, qc[4] = {0}; // mask codes overall, and at query rows
+    fmt6_range_counts(c_mask, 0, N, mc);
+    if (!fmt0_is_sparse(c)) {   // query bits select the mask rows
+      uint64_t nw = N>>5;
+      fmt6_word_counts(c_mask->s, c->s, 0, nw, qc);
+      for (uint64_t i=nw<<5; i<N; ++i)
+        if (FMT0_IN_SET(*c, i)) qc[FMT6_2BIT(*c_mask, i)]++;
+    } else {
+      fmt0_iter_init(&it, c);
+      while (fmt0_next_range(&it, &beg, &end)) fmt6_range_counts(c_mask, beg, end, qc);
     }
+    st1.n_u = mc[2] + mc[3];
+    st1.n_m = mc[3];
+    st1.n_q = qc[2] + qc[3];
+    st1.n_o = qc[3];
     st = calloc(1, sizeof(stats_t));
     st[0] = st1;
     st[0].sm = strdup(sm);
@@ -92,6 +92,16 @@
  * smaller than the original packed-bit layout.
  */
 
+/* number of rows in a compressed fmt1 stream, without inflating it */
+uint64_t fmt1_data_length(const cdata_t *c) {
+  uint64_t n = 0;
+  for (uint64_t i=0; i<c->n; i+=3) {
+    uint16_t l; memcpy(&l, c->s+i+1, 2);
+    n += l;
+  }
+  return n;
+}
+
 cdata_t fmt1_decompress(const cdata_t c) {
   cdata_t expanded = {0};
   uint64_t i=0, j=0, n=0, m=1<<20;
@@ -109,6 +119,35 @@ cdata_t fmt1_decompress(const cdata_t c) {
   return expanded;
 }
 
+/* rows [beg, end] of a compressed fmt1 stream into out (buffer reused),
+   walking from record i at row `row` */
+void fmt1_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  uint64_t n = end-beg+1;
+  out->s = realloc(out->s, n);
+  for (; i<c->n && row<=end; i+=3) {
+    uint16_t l; memcpy(&l, c->s+i+1, 2);
+    uint64_t lo = row > beg ? row : beg, hi = row+l <= end ? row+l : end+1;
+    if (lo < hi) memset(out->s+lo-beg, c->s[i], hi-lo);
+    row += l;
+  }
+  if (row <= end) memset(out->s+(row > beg ? row-beg : 0), 0, end+1-(row > beg ? row : beg));
+  out->n = n;
+  out->compressed = 0;
+  out->fmt = '1';
+  out->unit = 1;
+}
+
+/* next record of a compressed fmt1 stream as a cursor run, see cdata.h */
+int fmt1_cursor_next(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  if (cur->i+3 > c->n) return 0;
+  uint16_t l; memcpy(&l, c->s+cur->i+1, 2);
+  cur->v = c->s[cur->i];
+  cur->n = l;
+  cur->i += 3;
+  return 1;
+}
+
 
 #include <stdint.h>
 #include <stdlib.h>
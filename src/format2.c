@@ -67,6 +67,7 @@
  *     - aux->data     points to start of data section
  *     - f2_get_uint64(c,i) reads v_i from aux->data
  *     - f2_get_string(c,i) returns aux->keys[v_i]
+ *     - aux->runs     (state, end) runs of a mask, from fmt2_mask_runs()
  *
  *
  * Compressed layout (RLE on data section)
@@ -111,15 +112,122 @@
  *   - reads value_bytes
  *   - expands (value,length) pairs into a flat integer array
  *   - sets inflated.unit = value_bytes, inflated.n = number of positions
+ *
+ *
+ * Compressed layout (blocked, random access)
+ * ------------------------------------------
+ * RLE costs (value_bytes + 2) bytes per row when states change at every
+ * row (sequence contexts, dinucleotides).  fmt2_compress() therefore cuts
+ * the rows into blocks of F2_BLOCK and, per block, keeps the smaller of
+ *
+ *   - RLE  : uint32 nrun, nrun x (value: value_bytes, uint16 last row of
+ *            the run within the block)
+ *   - packed : ceil(log2(#keys)) bits per row, little-endian bit order
+ *
+ * When no block is packed the classic RLE stream above is written, so
+ * run-rich tracks (chromatin states) are unchanged.  Otherwise the bytes
+ * after the key section are
+ *
+ *   [ '\0' ][ 0 ][ value_bytes ][ bits ][ uint64 nrow ][ uint64 nblk ]
+ *   [ nblk x uint64 offset ][ blocks ... ]
+ *
+ * The 0 marker takes the place of value_bytes, which is never 0 in an RLE
+ * stream.  Offsets count from the marker; bit 63 is set on RLE blocks.
+ * Row i is read in O(1) from a packed block and by binary search over the
+ * run ends of an RLE block, so f2_get_uint64() works on the compressed
+ * record (after fmt2_set_aux()) without inflating it.
  */
 
+#define F2_BLOCK   (1ul<<16)      /* rows per block */
+#define F2_BLK_HDR 19             /* marker, value_bytes, bits, nrow, nblk */
+#define F2_BLK_RLE (1ull<<63)     /* directory: block is run-length */
+
+/* the blocked stream header h (at the marker byte): value of row i */
+static uint64_t f2b_get(const uint8_t *h, uint64_t i) {
+  uint8_t unit = h[1], bits = h[2];
+  uint64_t off, value = 0, r = i & (F2_BLOCK-1);
+  memcpy(&off, h + F2_BLK_HDR + 8*(i/F2_BLOCK), sizeof(uint64_t));
+  const uint8_t *b = h + (off & ~F2_BLK_RLE);
+  if (off & F2_BLK_RLE) {       // first run ending at or after r
+    uint32_t nrun; memcpy(&nrun, b, sizeof(uint32_t));
+    const uint8_t *e = b + 4;
+    uint64_t lo = 0, hi = nrun;
+    while (lo < hi) {
+      uint64_t mid = (lo+hi)>>1; uint16_t last;
+      memcpy(&last, e + mid*(unit+2) + unit, 2);
+      if (last < r) lo = mid+1;
+      else hi = mid;
+    }
+    memcpy(&value, e + lo*(unit+2), unit);
+  } else {
+    uint64_t p = r*bits;
+    memcpy(&value, b + (p>>3), ((p&7) + bits + 7)>>3);
+    value = (value >> (p&7)) & ((1ull<<bits)-1);
+  }
+  return value;
+}
+
+/* value of row i and the end of the rows known to share it (same run, or
+   the same packed value up to the block end) */
+static uint64_t f2b_run(const uint8_t *h, uint64_t nrow, uint64_t i, uint64_t *end) {
+  uint8_t unit = h[1];
+  uint64_t off, value, base = i & ~(F2_BLOCK-1), last = base + F2_BLOCK;
+  if (last > nrow) last = nrow;
+  memcpy(&off, h + F2_BLK_HDR + 8*(i/F2_BLOCK), sizeof(uint64_t));
+  value = f2b_get(h, i);
+  if (off & F2_BLK_RLE) {
+    const uint8_t *b = h + (off & ~F2_BLK_RLE) + 4;
+    uint32_t nrun; memcpy(&nrun, b-4, sizeof(uint32_t));
+    uint64_t lo = 0, hi = nrun, r = i - base;
+    while (lo < hi) {
+      uint64_t mid = (lo+hi)>>1; uint16_t l;
+      memcpy(&l, b + mid*(unit+2) + unit, 2);
+      if (l < r) lo = mid+1;
+      else hi = mid;
+    }
+    uint16_t l; memcpy(&l, b + lo*(unit+2) + unit, 2);
+    *end = base + l + 1;
+  } else {
+    for (*end = i+1; *end < last && f2b_get(h, *end) == value; ++*end);
+  }
+  return value;
+}
+
+/* header of the blocked stream, NULL for RLE streams and inflated data */
+static const uint8_t *f2b_header(const cdata_t *c) {
+  if (!c->compressed) return NULL;
+  const uint8_t *h = c->s + fmt2_get_keys_nbytes(c) + 1;
+  return h[0] ? NULL : h;
+}
+
+int fmt2_is_blocked(const cdata_t *c) {
+  return f2b_header(c) != NULL;
+}
+
+static uint64_t f2b_nrow(const uint8_t *h) {
+  uint64_t n; memcpy(&n, h+3, sizeof(uint64_t));
+  return n;
+}
+
+/* rows [beg, end) of a blocked stream into the inflated array d */
+static void f2b_fill(const uint8_t *h, uint64_t beg, uint64_t end, uint8_t *d) {
+  uint8_t unit = h[1];
+  uint64_t nrow = f2b_nrow(h);
+  for (uint64_t i = beg, e; i < end; i = e) {
+    uint64_t value = f2b_run(h, nrow, i, &e);
+    if (e > end) e = end;
+    for (uint64_t k = i; k < e; ++k) memcpy(d + (k-beg)*unit, &value, unit);
+  }
+}
+
 /**
  * f2_get_uint64()
  * ----------------
  * Return the state value at position index `i` for **format 2** (state data).
  *
  * Format-2 stores per-position integer states in `c->unit` bytes
- * (1, 2, 4, or 8), little-endian. Data must be decompressed.
+ * (1, 2, 4, or 8), little-endian. Data must be decompressed, or
+ * compressed in the blocked layout (read in place, see above).
  * aux->data points to the the non-key part of c->s.
  *
  * aux->data is a pointer to where data starts in c->s;
@@ -138,9 +246,12 @@
  *   • Works uniformly regardless of underlying integer width.
  */
 uint64_t f2_get_uint64(cdata_t *c, uint64_t i) {
-  assert(!c->compressed);
   if (!c->aux) fmt2_set_aux(c);
   f2_aux_t *aux = (f2_aux_t*) c->aux;
+  if (c->compressed) {
+    if (!aux->blk) wzfatal("[%s:%d] Run-length fmt2 has no random access; decompress first.\n", __func__, __LINE__);
+    return f2b_get(aux->blk, i);
+  }
   uint8_t *d = aux->data + c->unit*i;
   uint64_t value = 0;
   for (uint8_t j=0; j<c->unit; ++j) value |= (d[j] << (8*j));
@@ -148,7 +259,6 @@ uint64_t f2_get_uint64(cdata_t *c, uint64_t i) {
 }
 
 char* f2_get_string(cdata_t *c, uint64_t i) {
-  assert(!c->compressed);
   if (!c->aux) fmt2_set_aux(c);
   f2_aux_t *aux = (f2_aux_t*) c->aux;
   uint64_t val = f2_get_uint64(c, i);
@@ -160,25 +270,29 @@ char* f2_get_string(cdata_t *c, uint64_t i) {
   return aux->keys[val];
 }
 
-// Caution: this is efficient for chromatin states but
-// not efficient to encode sequence contexts like dinucleotide context
-// for dinucleotide contexts, we should use format 0 or 1
-// TODO: we should have a bit-packed, non-RLE format for this
-static uint8_t* compressDataToRLE(cdata_t *c, uint64_t *rle_n) {
-  // Calculate the maximum value from data
+static uint64_t f2_max_value(cdata_t *c) {
   uint64_t max_value = 0;
   for (uint64_t i = 0; i < c->n; ++i) {
     uint64_t value = f2_get_uint64(c, i);
     if (value > max_value) {
       max_value = value;
     }}
-  
-  // Determine the number of bytes needed to encode each value
-  int value_bytes;
-  if (max_value < (1<<8)) value_bytes = 1;
-  else if (max_value < (1<<16)) value_bytes = 2;
-  else if (max_value < (1<<24)) value_bytes = 3;
-  else value_bytes = 8;
+  return max_value;
+}
+
+// Determine the number of bytes needed to encode each value
+static int f2_value_bytes(uint64_t max_value) {
+  if (max_value < (1<<8)) return 1;
+  else if (max_value < (1<<16)) return 2;
+  else if (max_value < (1<<24)) return 3;
+  else return 8;
+}
+
+// Caution: this is efficient for chromatin states but
+// not efficient to encode sequence contexts like dinucleotide context;
+// fmt2_compress() packs those blocks with compressDataToBlocks()
+static uint8_t* compressDataToRLE(cdata_t *c, uint64_t *rle_n) {
+  int value_bytes = f2_value_bytes(f2_max_value(c));
 
   // Create a buffer for the RLE data
   // value_bytes for the value and 2 bytes for the count
@@ -248,6 +362,24 @@ cdata_t* fmt2_read_raw(char *fname, int verbose) {
   free(line);
   wzclose(fh);
 
+  cdata_t *c = fmt2_from_states(keys, keys_n, data, data_n);
+  if (verbose) {
+    fprintf(stderr, "[%s:%d] Vector of length %"PRIu64" loaded\n", __func__, __LINE__, data_n);
+    fflush(stderr);
+  }
+
+  free(data);
+
+  kh_destroy(str2int, h);  // Destroy the hashmap
+  for (uint64_t i = 0; i < keys_n; ++i) {
+    free(keys[i]);
+  }
+  free(keys);
+
+  return c;
+}
+
+cdata_t *fmt2_from_states(char **keys, uint64_t keys_n, const uint64_t *data, uint64_t data_n) {
   // Calculate key string size
   uint64_t keys_n_bytes = 0;
   for (uint64_t i = 0; i < keys_n; ++i)
@@ -285,20 +417,6 @@ cdata_t* fmt2_read_raw(char *fname, int verbose) {
     for (uint8_t j=0; j<c->unit; ++j) d1[j] = (0xff & (data[i] >> (8*j)));
   }
   /* memcpy(c->s + pos, data, data_n*sizeof(uint64_t)); */
-
-  if (verbose) {
-    fprintf(stderr, "[%s:%d] Vector of length %"PRIu64" loaded\n", __func__, __LINE__, data_n);
-    fflush(stderr);
-  }
-
-  free(data);
-
-  kh_destroy(str2int, h);  // Destroy the hashmap
-  for (uint64_t i = 0; i < keys_n; ++i) {
-    free(keys[i]);
-  }
-  free(keys);
-
   return c;
 }
 
@@ -384,10 +502,64 @@ uint8_t* fmt2_get_data(const cdata_t *c) {
   return c->s + separator_idx + 1 + 1;
 }
 
+/* the blocked stream (see above), or NULL when no block would be packed */
+static uint8_t* compressDataToBlocks(cdata_t *c, uint64_t *blk_n) {
+  uint64_t max_value = f2_max_value(c), nblk = (c->n + F2_BLOCK - 1) / F2_BLOCK;
+  uint8_t unit = f2_value_bytes(max_value), bits = 1;
+  while (bits < 64 && (max_value >> bits)) ++bits;
+  if (bits > 56 || !nblk) return NULL; /* a value must load in 8 bytes */
+
+  uint64_t *dir = calloc(nblk, sizeof(uint64_t)), *nruns = calloc(nblk, sizeof(uint64_t));
+  uint64_t nb = F2_BLK_HDR + 8*nblk, npacked = 0;
+  for (uint64_t b = 0; b < nblk; ++b) { // pick the smaller encoding per block
+    uint64_t beg = b*F2_BLOCK, end = beg + F2_BLOCK < c->n ? beg + F2_BLOCK : c->n;
+    for (uint64_t i = beg; i < end; ++i)
+      if (i == beg || f2_get_uint64(c, i) != f2_get_uint64(c, i-1)) nruns[b]++;
+    uint64_t rle_nb = 4 + nruns[b]*(unit+2), packed_nb = ((end-beg)*bits + 7) >> 3;
+    dir[b] = nb;
+    if (rle_nb <= packed_nb) { dir[b] |= F2_BLK_RLE; nb += rle_nb; }
+    else { npacked++; nb += packed_nb; }
+  }
+  if (!npacked) { free(dir); free(nruns); return NULL; }
+
+  uint8_t *h = calloc(nb, 1);
+  h[1] = unit; h[2] = bits;
+  memcpy(h+3, &c->n, sizeof(uint64_t));
+  memcpy(h+11, &nblk, sizeof(uint64_t));
+  memcpy(h+F2_BLK_HDR, dir, 8*nblk);
+  for (uint64_t b = 0; b < nblk; ++b) {
+    uint64_t beg = b*F2_BLOCK, end = beg + F2_BLOCK < c->n ? beg + F2_BLOCK : c->n;
+    uint8_t *d = h + (dir[b] & ~F2_BLK_RLE);
+    if (dir[b] & F2_BLK_RLE) {
+      uint32_t nrun = nruns[b];
+      memcpy(d, &nrun, sizeof(uint32_t));
+      d += 4;
+      for (uint64_t i = beg; i < end; ++i) {
+        uint64_t value = f2_get_uint64(c, i);
+        if (i+1 < end && f2_get_uint64(c, i+1) == value) continue;
+        uint16_t last = i - beg; // run ends here
+        memcpy(d, &value, unit);
+        memcpy(d+unit, &last, 2);
+        d += unit+2;
+      }
+    } else {
+      for (uint64_t i = beg; i < end; ++i) {
+        uint64_t value = f2_get_uint64(c, i), p = (i-beg)*bits;
+        for (uint8_t k = 0; k < bits; ++k, ++p)
+          if ((value >> k) & 1) d[p>>3] |= 1u<<(p&7);
+      }
+    }
+  }
+  free(dir); free(nruns);
+  *blk_n = nb;
+  return h;
+}
+
 void fmt2_compress(cdata_t *c) {
   uint64_t keys_nb = fmt2_get_keys_nbytes(c);
   uint64_t rle_n;
-  uint8_t *rle_data = compressDataToRLE(c, &rle_n);
+  uint8_t *rle_data = compressDataToBlocks(c, &rle_n);
+  if (!rle_data) rle_data = compressDataToRLE(c, &rle_n);
   uint8_t *s_out = calloc(keys_nb + rle_n + 1, sizeof(uint8_t));
   memcpy(s_out, c->s, keys_nb + 1);
   memcpy(s_out + keys_nb + 1, rle_data, rle_n);
@@ -399,11 +571,39 @@ void fmt2_compress(cdata_t *c) {
   c->fmt = '2';
 }
 
+/* number of rows in a compressed fmt2 stream, without inflating it */
+uint64_t fmt2_data_length(const cdata_t *c, uint8_t *unit) {
+  const uint8_t *h = f2b_header(c);
+  if (h) { *unit = h[1]; return f2b_nrow(h); }
+  uint8_t *data = fmt2_get_data(c) + 1; // skip value byte
+  uint64_t data_nbyte = fmt2c_get_data_nbytes(c) - 1;
+  *unit = fmt2c_get_unit(c);
+  uint64_t n = 0;
+  for (uint64_t i = 0; i < data_nbyte; ) {
+    i += *unit;
+    n += ((uint64_t) data[i] | (uint64_t) (data[i+1] << 8));
+    i += 2;
+  }
+  return n;
+}
+
 cdata_t fmt2_decompress(const cdata_t c) {
   
   cdata_t inflated = {0};
   uint64_t keys_nb = fmt2_get_keys_nbytes(&c);
   uint8_t *keys = c.s;
+  const uint8_t *h = f2b_header(&c);
+  if (h) {
+    inflated.unit = h[1];
+    inflated.n = f2b_nrow(h);
+    inflated.s = malloc(keys_nb + inflated.n * inflated.unit + 1);
+    memcpy(inflated.s, keys, keys_nb);
+    inflated.s[keys_nb] = '\0';
+    f2b_fill(h, 0, inflated.n, inflated.s + keys_nb + 1);
+    inflated.compressed = 0;
+    inflated.fmt = '2';
+    return inflated;
+  }
   uint8_t *data = fmt2_get_data(&c) + 1; // skip value byte
   uint64_t data_nbyte = fmt2c_get_data_nbytes(&c) - 1;
   inflated.unit = fmt2c_get_unit(&c);
@@ -447,6 +647,91 @@ cdata_t fmt2_decompress(const cdata_t c) {
   return inflated;
 }
 
+/* compressed blocks back into a run-length stream, in place (only RLE
+   streams concatenate, see tiles_append()) */
+void fmt2_to_rle(cdata_t *c) {
+  if (!fmt2_is_blocked(c)) return;
+  fmt2_free_aux(c);                 // keys point into the old buffer
+  cdata_t inflated = fmt2_decompress(*c);
+  uint64_t keys_nb = fmt2_get_keys_nbytes(&inflated), rle_n;
+  uint8_t *rle_data = compressDataToRLE(&inflated, &rle_n);
+  if (!(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = calloc(keys_nb + rle_n + 1, 1);
+  memcpy(c->s, inflated.s, keys_nb + 1);
+  memcpy(c->s + keys_nb + 1, rle_data, rle_n);
+  c->n = keys_nb + rle_n + 1;
+  c->flags &= ~CDFLAG_MAPPED;
+  free(rle_data);
+  free_cdata(&inflated);
+}
+
+/* rows [beg, end] of a compressed fmt2 stream into out (buffer reused),
+   walking from RLE entry i at row `row`.  The key section is kept, as in
+   fmt2_decompress(). */
+void fmt2_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  uint64_t keys_nb = fmt2_get_keys_nbytes(c);
+  const uint8_t *h = f2b_header(c); // blocked: rows are read in place
+  uint8_t unit = h ? h[1] : fmt2c_get_unit(c);
+  uint64_t n = end-beg+1;
+  out->s = realloc(out->s, keys_nb + n * unit + 1);
+  if (out->s == NULL) {
+    fprintf(stderr, "Memory allocation failed. Exiting.\n");
+    exit(1);
+  }
+  memcpy(out->s, c->s, keys_nb);
+  out->s[keys_nb] = '\0';  // NULL separator
+
+  uint8_t *dec_data = out->s + keys_nb + 1;
+  if (h) {
+    f2b_fill(h, beg, end+1, dec_data);
+    row = end+1;
+  }
+  for (; !h && i < c->n && row <= end; ) {
+    uint8_t *d = c->s+i;
+    i += unit;
+    uint64_t length = ((uint64_t) c->s[i] | (uint64_t) (c->s[i+1] << 8));
+    i += 2;
+    uint64_t lo = row > beg ? row : beg, hi = row+length <= end ? row+length : end+1;
+    for (uint64_t k = lo; k < hi; ++k)
+      memcpy(dec_data+(k-beg)*unit, d, unit);
+    row += length;
+  }
+  if (row <= end) memset(dec_data+(row > beg ? row-beg : 0)*unit, 0, (end+1-(row > beg ? row : beg))*unit);
+
+  out->unit = unit;
+  out->compressed = 0;
+  out->fmt = '2';
+  out->n = n;
+}
+
+/* cursor over a blocked stream: cur->i is its header */
+void fmt2_cursor_init(cdata_cursor_t *cur) {
+  cur->blk = cur->c->s + cur->i;
+  cur->unit = cur->blk[1];
+  cur->nrow = f2b_nrow(cur->blk);
+}
+
+/* next RLE entry of a compressed fmt2 stream as a cursor run; the value is
+   the state index (see cdata.h) */
+int fmt2_cursor_next(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  if (cur->blk) {               // blocked: runs are looked up from the row
+    uint64_t end;
+    if (cur->row >= cur->nrow) return 0;
+    cur->v = f2b_run(cur->blk, cur->nrow, cur->row, &end);
+    cur->n = end - cur->row;
+    return 1;
+  }
+  if (cur->i + cur->unit + 2 > c->n) return 0;
+  const uint8_t *d = c->s + cur->i;
+  uint64_t value = 0;
+  for (uint8_t j=0; j<cur->unit; ++j) value |= ((uint64_t) d[j] << (8*j));
+  cur->v = value;
+  cur->n = (uint64_t) d[cur->unit] | ((uint64_t) d[cur->unit+1] << 8);
+  cur->i += cur->unit + 2;
+  return 1;
+}
+
 /**
  * fmt2_set_aux()
  * --------------
@@ -464,7 +749,7 @@ cdata_t fmt2_decompress(const cdata_t c) {
  *   • stores aux in c->aux
  *
  * It does NOT inflate or copy the data; it only builds convenient pointers
- * into the existing buffer.  Must be called only once per c (c->aux must
+ * into the existing buffer (aux->blk for compressed blocked streams).  Must be called only once per c (c->aux must
  * be NULL).
  */
 void fmt2_set_aux(cdata_t *c) {
@@ -490,23 +775,52 @@ void fmt2_set_aux(cdata_t *c) {
     key_start = key_end + 1;
   }
   aux->data = fmt2_get_data(c);
+  aux->blk = f2b_header(c);
   c->aux = aux;
 }
 
+/**
+ * The record as runs of one state (aux->runs, aux->nrun), built once with
+ * the run cursor and kept with the aux.  Masks are aggregated a run at a
+ * time by the summarize1_queryfmt* handlers instead of a row at a time.
+ */
+f2_aux_t *fmt2_mask_runs(cdata_t *c) {
+  if (!c->aux) fmt2_set_aux(c);
+  f2_aux_t *aux = (f2_aux_t*) c->aux;
+  if (aux->runs) return aux;
+
+  uint64_t m = 1<<10;
+  aux->runs = malloc(m * sizeof(f2_run_t));
+  aux->nrun = 0;
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) {
+    if (cur.v >= aux->nk) wzfatal("[%s:%d] State data is corrupted.\n", __func__, __LINE__);
+    if (aux->nrun && aux->runs[aux->nrun-1].v == cur.v) { // merge inflated rows
+      aux->runs[aux->nrun-1].end = cur.row + cur.n;
+      continue;
+    }
+    if (aux->nrun == m) { m <<= 1; aux->runs = realloc(aux->runs, m * sizeof(f2_run_t)); }
+    aux->runs[aux->nrun++] = (f2_run_t) {.end = cur.row + cur.n, .v = cur.v};
+  }
+  return aux;
+}
+
 stats_t* summarize1_queryfmt2(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
 
   stats_t *st = NULL;
+  uint64_t N = cdata_n(c);      // blocked queries stay compressed
   if (c_mask->n == 0) {          // no mask
     
     if (!c->aux) fmt2_set_aux(c);
     f2_aux_t *aux = (f2_aux_t*) c->aux;
     *n_st = aux->nk;
     uint64_t *cnts = calloc(aux->nk, sizeof(uint64_t));
-    for (uint64_t i=0; i<c->n; ++i) cnts[f2_get_uint64(c, i)]++;
+    for (uint64_t i=0; i<N; ++i) cnts[f2_get_uint64(c, i)]++;
     st = calloc(aux->nk, sizeof(stats_t));
     for (uint64_t k=0; k<aux->nk; ++k) {
-      st[k].n_u = c->n;
+      st[k].n_u = N;
       st[k].n_q = cnts[k];
       st[k].n_m = 0;
       st[k].n_o = 0;
@@ -529,7 +843,7 @@ stats_t* summarize1_queryfmt2(
     uint64_t *cnts = calloc(aux->nk, sizeof(uint64_t));
     uint64_t *cnts_q = calloc(aux->nk, sizeof(uint64_t));
     uint64_t n_m = 0;
-    for (uint64_t i=0; i<c->n; ++i) {
+    for (uint64_t i=0; i<N; ++i) {
       if (FMT0_IN_SET(*c_mask, i)) {
         n_m++;
         cnts[f2_get_uint64(c, i)]++;
@@ -538,7 +852,7 @@ stats_t* summarize1_queryfmt2(
     }
     st = calloc(aux->nk, sizeof(stats_t));
     for (uint64_t k=0; k<aux->nk; ++k) {
-      st[k].n_u = c->n;
+      st[k].n_u = N;
       st[k].n_q = cnts_q[k];
       st[k].n_o = cnts[k];
       st[k].n_m = n_m;
@@ -558,7 +872,7 @@ stats_t* summarize1_queryfmt2(
     uint64_t *cnts = calloc(aux->nk, sizeof(uint64_t));
     uint64_t *cnts_q = calloc(aux->nk, sizeof(uint64_t));
     uint64_t n_m = 0;
-    for (uint64_t i=0; i<c->n; ++i) {
+    for (uint64_t i=0; i<N; ++i) {
       if (FMT6_IN_UNI(*c_mask,i) && FMT6_IN_SET(*c_mask, i)) {
         n_m++;
         cnts[f2_get_uint64(c, i)]++;
@@ -567,7 +881,7 @@ stats_t* summarize1_queryfmt2(
     }
     st = calloc(aux->nk, sizeof(stats_t));
     for (uint64_t k=0; k<aux->nk; ++k) {
-      st[k].n_u = c->n;
+      st[k].n_u = N;
       st[k].n_q = cnts_q[k];
       st[k].n_o = cnts[k];
       st[k].n_m = n_m;
@@ -581,14 +895,13 @@ stats_t* summarize1_queryfmt2(
     
   } else if (c_mask->fmt == '2') { // state mask
 
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), N);
       fflush(stderr);
       exit(1);
     }
 
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux_m = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux_m = fmt2_mask_runs(c_mask);
 
     if (!c->aux) fmt2_set_aux(c);
     f2_aux_t *aux_q = (f2_aux_t*) c->aux;
@@ -597,18 +910,27 @@ stats_t* summarize1_queryfmt2(
     st = calloc((*n_st), sizeof(stats_t));
     uint64_t *nq = calloc(aux_q->nk, sizeof(uint64_t));
     uint64_t *nm = calloc(aux_m->nk, sizeof(uint64_t));
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t im = f2_get_uint64(c_mask, i);
-      uint64_t iq = f2_get_uint64(c, i);
-      st[im * aux_q->nk + iq].n_o++;
-      nq[iq]++;
-      nm[im]++;
+    for (uint64_t r=0, i=0; r<aux_m->nrun; i=aux_m->runs[r++].end)
+      nm[aux_m->runs[r].v] += aux_m->runs[r].end - i;
+    cdata_cursor_t cur;         // query runs against mask runs
+    cdata_cursor_init(&cur, c);
+    uint64_t r = 0;
+    while (cdata_cursor_next(&cur)) {
+      uint64_t iq = cur.v, i = cur.row, end = cur.row + cur.n;
+      if (iq >= aux_q->nk) wzfatal("[%s:%d] State data is corrupted.\n", __func__, __LINE__);
+      nq[iq] += cur.n;
+      while (i < end) {
+        while (aux_m->runs[r].end <= i) ++r;
+        uint64_t e = aux_m->runs[r].end < end ? aux_m->runs[r].end : end;
+        st[aux_m->runs[r].v * aux_q->nk + iq].n_o += e - i;
+        i = e;
+      }
     }
     for (uint64_t im=0; im<aux_m->nk; ++im) {
       for (uint64_t iq=0; iq<aux_q->nk; ++iq) {
         stats_t *st1 = &st[im * aux_q->nk + iq];
         st1->n_o++;
-        st1->n_u = c->n;
+        st1->n_u = N;
         st1->n_q = nq[iq];
         st1->n_m = nm[im];
         if (config->section_name) {
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "cdata.h"
 #include "summary.h"
 
@@ -94,6 +95,30 @@
  *     - Type 0 into 'run_len' copies of (M=0,U=0)
  *     - Types 1/2/3 into one (M,U) pair each,
  *   and writes them back into the inflated array using f3_pack_mu().
+ *   Runs of type-1 bytes take a vectorized path when the CPU allows,
+ *   see fmt3_decode().
+ *
+ *
+ * Compressed representation, version 2
+ * -------------------------------------
+ * Meant for sparse records (single-cell): zero runs of any length cost a
+ * varint, and M and U go to separate streams that BGZF models better than
+ * the interleaved 1-byte codes.  A v2 stream starts with a zero-length
+ * zero run, which v1 never emits:
+ *
+ *     00 00 02 | unit(1) | nrow | nnz | gap_nb | m_nb | u_nb   (LEB128 varints)
+ *     gap stream : nnz varints, zero rows before each non-zero row
+ *     M ctrl     : (nnz+3)/4 bytes, 2 bits per value = byte length - 1
+ *     M data     : m_nb bytes, each value little-endian in 1-4 bytes
+ *     U ctrl, U data : same for U
+ *
+ *   The M/U streams are stream-vbyte: a control byte describes four values
+ *   and the last group is padded with zeros.  M and U are fitted to 31
+ *   bits as in type-3 records and `unit` is what fmt3_data_length() infers,
+ *   so v1 and v2 decode to the same array.  fmt3_compress() writes
+ *   whichever encoding deflates smaller for the record (dense WGBS and
+ *   binary calls usually stay v1); fmt3_is_v2() tells them apart.  v2 records carry no row checkpoints, and code walking the v1
+ *   byte stream directly converts with fmt3_to_v1() first.
  */
 
 static int is_int(char *s) {
@@ -188,18 +213,107 @@ cdata_t* fmt3_read_raw(char *fname, uint8_t unit, int verbose) {
   return c;
 }
 
-void fmt3_compress(cdata_t *c) {
-  uint8_t *s = NULL;
+/* ------------------------------------------------------------------ */
+/* Version 2 helpers                                                   */
+/* ------------------------------------------------------------------ */
+
+#define F3V2_VERSION 2
+#define F3V2_BATCH 64           /* stream-vbyte groups decoded per batch */
+
+typedef struct f3v2_hdr_t {
+  uint64_t nrow, nnz, gap_nb, m_nb, u_nb;
+  uint8_t unit;
+} f3v2_hdr_t;
+
+int fmt3_is_v2(const cdata_t *c) {
+  return c->compressed && c->n >= 3 && c->s[0] == 0 && c->s[1] == 0 && c->s[2] == F3V2_VERSION;
+}
+
+static inline uint64_t varint_len(uint64_t v) {
+  uint64_t n = 1;
+  for (; v >= 0x80; v >>= 7) ++n;
+  return n;
+}
+
+static inline uint8_t *varint_put(uint8_t *p, uint64_t v) {
+  for (; v >= 0x80; v >>= 7) *p++ = (v & 0x7f) | 0x80;
+  *p++ = v;
+  return p;
+}
+
+static inline uint64_t varint_get(const uint8_t **p) {
+  uint64_t v = 0;
+  for (int sh = 0; ; sh += 7) {
+    uint8_t b = *(*p)++;
+    v |= (uint64_t) (b & 0x7f) << sh;
+    if (!(b & 0x80)) return v;
+  }
+}
+
+/* byte length code of a stream-vbyte value */
+static inline uint8_t svb_code(uint32_t v) {
+  return (v >= (1u<<8)) + (v >= (1u<<16)) + (v >= (1u<<24));
+}
+
+/* returns the first byte after the header */
+static const uint8_t *f3v2_header(const cdata_t *c, f3v2_hdr_t *h) {
+  const uint8_t *p = c->s + 3;
+  h->unit = *p++;
+  h->nrow = varint_get(&p);
+  h->nnz = varint_get(&p);
+  h->gap_nb = varint_get(&p);
+  h->m_nb = varint_get(&p);
+  h->u_nb = varint_get(&p);
+  return p;
+}
+
+/* M and U of row i as stored by both encodings */
+static inline void f3_enc_mu(cdata_t *c, uint64_t i, uint64_t *M, uint64_t *U) {
+  uint64_t MU = f3_get_mu(c, i);
+  *M = MU>>32;
+  *U = MU<<32>>32;
+  if (*M >= 127 || *U >= 127) fitMU(M, U, 31);
+}
+
+/* v1 byte count and the v2 header of an inflated record, in one pass */
+static uint64_t f3_sizes(cdata_t *c, f3v2_hdr_t *h) {
+  uint64_t nb1 = 0, l = 0, last = 0, M, U;
+  uint8_t nbits = 1;
+  memset(h, 0, sizeof(f3v2_hdr_t));
+  h->nrow = c->n;
+  for (uint64_t i=0; i<c->n; ++i) {
+    f3_enc_mu(c, i, &M, &U);
+    if (!M && !U) { ++l; continue; }
+    nb1 += (l + (1ul<<14) - 3) / ((1ul<<14) - 2) * 2; // v1 zero runs hold 2^14-2 rows
+    nb1 += (M<7 && U<7) ? 1 : (M<127 && U<127) ? 2 : 8;
+    h->gap_nb += varint_len(i - last);
+    h->m_nb += svb_code(M) + 1;
+    h->u_nb += svb_code(U) + 1;
+    while (M >= (1ul << nbits) || U >= (1ul << nbits)) nbits++;
+    h->nnz++; last = i+1; l = 0;
+  }
+  nb1 += (l + (1ul<<14) - 3) / ((1ul<<14) - 2) * 2;
+  h->m_nb += (4 - (h->nnz & 3)) & 3; // padding of the last group
+  h->u_nb += (4 - (h->nnz & 3)) & 3;
+  h->unit = (nbits+3)>>2;
+  return nb1;
+}
+
+static uint64_t f3v2_nbytes(const f3v2_hdr_t *h) {
+  return 4 + varint_len(h->nrow) + varint_len(h->nnz) + varint_len(h->gap_nb) +
+    varint_len(h->m_nb) + varint_len(h->u_nb) + h->gap_nb + 2*((h->nnz+3)>>2) + h->m_nb + h->u_nb;
+}
+
+static uint8_t *f3_encode_v1(cdata_t *c, uint64_t nb1) {
+  uint8_t *s = malloc(nb1 ? nb1 : 1);
   uint64_t n = 0;
   uint64_t i = 0;
   uint64_t l = 0;
   for (i=0; i<c->n; i++) {
-    uint64_t MU = f3_get_mu(c, i);
-    uint64_t M = MU>>32;
-    uint64_t U = MU<<32>>32;
+    uint64_t M, U;
+    f3_enc_mu(c, i, &M, &U);
     if (M>0 || U>0 || l+2 >= (1ul<<14)) {
       if (l>0) {
-        s = realloc(s, n+2);
         pack_value(s+n, l<<2, 2);
         n += 2;
         if (M>0 || U>0) l = 0;
@@ -207,16 +321,12 @@ void fmt3_compress(cdata_t *c) {
       }
       if (M>0 || U>0) {
         if (M<7 && U<7) {
-          s = realloc(s, n+1);
           s[n] = (M<<5) | (U<<2) | 0x1;
           n++;
         } else if (M<127 && U<127) {
-          s = realloc(s, n+2);
           pack_value(s+n, (M<<9) | (U<<2) | 0x2, 2);
           n += 2;
         } else {
-          fitMU(&M, &U, 31);
-          s = realloc(s, n+8);
           pack_value(s+n, (M<<33) | (U<<2) | 3ul, 8);
           n += 8;
         }
@@ -226,17 +336,75 @@ void fmt3_compress(cdata_t *c) {
     }
   }
   if (l>0) {
-    s = realloc(s, n+2);
-    *((uint16_t*) (s+n)) = (uint16_t) l<<2;
+    pack_value(s+n, l<<2, 2);
     n += 2;
   }
+  return s;
+}
+
+static uint8_t *f3_encode_v2(cdata_t *c, const f3v2_hdr_t *h, uint64_t nb2) {
+  uint8_t *s = calloc(nb2, 1);  // zeroed: control bytes are or'ed in, padding stays 0
+  uint8_t *p = s;
+  *p++ = 0; *p++ = 0; *p++ = F3V2_VERSION; *p++ = h->unit;
+  p = varint_put(p, h->nrow);
+  p = varint_put(p, h->nnz);
+  p = varint_put(p, h->gap_nb);
+  p = varint_put(p, h->m_nb);
+  p = varint_put(p, h->u_nb);
+  uint64_t nq = (h->nnz+3)>>2;
+  uint8_t *g = p, *mc = g + h->gap_nb, *md = mc + nq, *uc = md + h->m_nb, *ud = uc + nq;
+  uint64_t k = 0, last = 0, M, U;
+  for (uint64_t i=0; i<c->n; ++i) {
+    f3_enc_mu(c, i, &M, &U);
+    if (!M && !U) continue;
+    g = varint_put(g, i - last);
+    uint8_t cm = svb_code(M), cu = svb_code(U);
+    mc[k>>2] |= cm << ((k&3)*2);
+    uc[k>>2] |= cu << ((k&3)*2);
+    pack_value(md, M, cm+1); md += cm+1;
+    pack_value(ud, U, cu+1); ud += cu+1;
+    ++k; last = i+1;
+  }
+  return s;
+}
+
+uint64_t deflated_nbytes(const uint8_t *s, uint64_t n) {
+  uLongf nz = compressBound(n);
+  uint8_t *z = malloc(nz);
+  if (compress2(z, &nz, s, n, Z_DEFAULT_COMPRESSION) != Z_OK) nz = n;
+  free(z);
+  return nz;
+}
+
+/* v2 is kept when it deflates smaller; raw sizes only decide the clear cases */
+void fmt3_compress(cdata_t *c) {
+  f3v2_hdr_t h;
+  uint64_t nb1 = f3_sizes(c, &h), nb2 = f3v2_nbytes(&h);
+  uint8_t *s;
+  uint64_t n;
+  if (nb2 >= 2*nb1) {
+    s = f3_encode_v1(c, nb1); n = nb1;
+  } else if (nb2 <= nb1) {
+    s = f3_encode_v2(c, &h, nb2); n = nb2;
+  } else {
+    uint8_t *s1 = f3_encode_v1(c, nb1), *s2 = f3_encode_v2(c, &h, nb2);
+    if (deflated_nbytes(s2, nb2) < deflated_nbytes(s1, nb1)) { s = s2; n = nb2; free(s1); }
+    else { s = s1; n = nb1; free(s2); }
+  }
   free(c->s);
   c->s = s;
   c->n = n;
   c->compressed = 1;
 }
 
-static uint64_t get_data_length(const cdata_t *c, uint8_t *unit) {
+/* number of rows and the smallest unit that holds every M/U of a compressed fmt3 stream */
+uint64_t fmt3_data_length(const cdata_t *c, uint8_t *unit) {
+  if (fmt3_is_v2(c)) {
+    f3v2_hdr_t h;
+    f3v2_header(c, &h);
+    *unit = h.unit;
+    return h.nrow;
+  }
   uint8_t nbits = 1; // half unit nbits, M or U.
   uint64_t n = 0;
   for (uint64_t i=0; i < c->n; ) {
@@ -269,65 +437,396 @@ static uint64_t get_data_length(const cdata_t *c, uint8_t *unit) {
   return n;
 }
 
-cdata_t fmt3_decompress(const cdata_t c) {
-  uint8_t unit = 1;
-  uint64_t n0 = get_data_length(&c, &unit);
-  cdata_t inflated = {0};
-  if (c.unit) inflated.unit = c.unit;
-  else inflated.unit = unit; // use inferred max unit if unset
-  uint8_t *s = calloc(inflated.unit*n0, sizeof(uint8_t));
-  uint64_t n = 0;
-  for (uint64_t i=0; i < c.n; ) {
-    if ((c.s[i] & 0x3) == 0) {
-      uint64_t l = unpack_value(c.s+i, 2)>>2; // the length is 14 bits, so unit = 2
-      memset(s+n*inflated.unit, 0, inflated.unit*l); n += l;
+/* ------------------------------------------------------------------ */
+/* Decoding.  Runs of type-1 bytes (M,U < 7, the bulk of WGBS data)    */
+/* are expanded by a kernel picked once at runtime: AVX2 where the CPU */
+/* has it, a scalar loop otherwise.  Both write exactly what           */
+/* f3_pack_mu() would: type-1 values never need fitMU().               */
+/* ------------------------------------------------------------------ */
+
+static inline void f3_store(uint8_t *d, uint64_t v, uint8_t unit) {
+  switch (unit) {
+  case 1: *d = v; break;
+  case 2: { uint16_t x = v; memcpy(d, &x, 2); break; }
+  case 4: { uint32_t x = v; memcpy(d, &x, 4); break; }
+  case 8: memcpy(d, &v, 8); break;
+  default: pack_value(d, v, unit);
+  }
+}
+
+static inline uint64_t f3_t1_value(uint8_t b, uint8_t unit) {
+  return ((uint64_t) (b>>5) << (unit*4)) | ((b>>2) & 0x7);
+}
+
+/* expand the leading type-1 bytes of src[0, k_max) into dst; returns how many */
+typedef uint64_t (*f3_dense_f)(const uint8_t *src, uint64_t k_max, uint8_t *dst, uint8_t unit);
+
+static uint64_t f3_dense_scalar(const uint8_t *src, uint64_t k_max, uint8_t *dst, uint8_t unit) {
+  uint64_t k = 0;
+  for (; k < k_max && (src[k] & 0x3) == 1; ++k)
+    f3_store(dst+k*unit, f3_t1_value(src[k], unit), unit);
+  return k;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* 32 type-1 bytes per step for units 1, 2 and 8; stops at the first other
+   record and leaves the remainder to the scalar loop */
+__attribute__((target("avx2")))
+static uint64_t f3_dense_avx2(const uint8_t *src, uint64_t k_max, uint8_t *dst, uint8_t unit) {
+  if (unit != 1 && unit != 2 && unit != 8) return f3_dense_scalar(src, k_max, dst, unit);
+  const __m256i m3 = _mm256_set1_epi8(0x3), one = _mm256_set1_epi8(0x1);
+  uint64_t k = 0;
+  for (; k + 32 <= k_max; k += 32) {
+    __m256i b = _mm256_loadu_si256((const __m256i*) (src+k));
+    uint32_t t1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(b, m3), one));
+    if (t1 != 0xffffffffu) break;
+    if (unit == 1) {           // (M<<4) | U
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(b, 1), _mm256_set1_epi8(0x70));
+      __m256i lo = _mm256_and_si256(_mm256_srli_epi16(b, 2), _mm256_set1_epi8(0x07));
+      _mm256_storeu_si256((__m256i*) (dst+k), _mm256_or_si256(hi, lo));
+    } else if (unit == 2) {    // (M<<8) | U
+      for (int h = 0; h < 2; ++h) {
+        __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (src+k+16*h)));
+        __m256i hi = _mm256_slli_epi16(_mm256_and_si256(x, _mm256_set1_epi16(0xe0)), 3);
+        __m256i lo = _mm256_and_si256(_mm256_srli_epi16(x, 2), _mm256_set1_epi16(0x07));
+        _mm256_storeu_si256((__m256i*) (dst+(k+16*h)*2), _mm256_or_si256(hi, lo));
+      }
+    } else {                   // (M<<32) | U
+      for (int q = 0; q < 8; ++q) {
+        int32_t w; memcpy(&w, src+k+4*q, 4);
+        __m256i x = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(w));
+        __m256i hi = _mm256_slli_epi64(_mm256_and_si256(x, _mm256_set1_epi64x(0xe0)), 27);
+        __m256i lo = _mm256_and_si256(_mm256_srli_epi64(x, 2), _mm256_set1_epi64x(0x07));
+        _mm256_storeu_si256((__m256i*) (dst+(k+4*q)*8), _mm256_or_si256(hi, lo));
+      }
+    }
+  }
+  return k + f3_dense_scalar(src+k, k_max-k, dst+k*unit, unit);
+}
+#endif
+
+static f3_dense_f f3_dense_kernel(void) {
+  static f3_dense_f f = NULL;
+  if (!f) {
+    f3_dense_f g = f3_dense_scalar;
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) g = f3_dense_avx2;
+#endif
+    f = g;
+  }
+  return f;
+}
+
+/* decode rows [beg, end] into s (unit bytes per row), walking from record i
+   at row `row`; zero runs are only written when s is not zeroed already */
+static void fmt3_decode(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, uint8_t *s, uint8_t unit, int zeroed) {
+  f3_dense_f dense = f3_dense_kernel();
+  while (i < c->n && row <= end) {
+    uint8_t b = c->s[i];
+    uint64_t M, U;
+    if ((b & 0x3) == 0) {       // zero run
+      uint64_t l = unpack_value(c->s+i, 2)>>2; // the length is 14 bits, so unit = 2
+      uint64_t lo = row > beg ? row : beg, hi = row+l <= end ? row+l : end+1;
+      if (!zeroed && lo < hi) memset(s+(lo-beg)*unit, 0, (hi-lo)*unit);
+      row += l;
       i += 2;
-    } else if ((c.s[i] & 0x3) == 1) {
-      uint64_t M = (c.s[i])>>5;
-      uint64_t U = ((c.s[i])>>2) & 0x7;
-      if (inflated.unit == 1) fitMU(&M, &U, 4);
-      else fitMU(&M, &U, inflated.unit<<2);
-      f3_pack_mu(s+(n++)*inflated.unit, M, U, inflated.unit);
-      i++;
-    } else if ((c.s[i] & 0x3) == 2) {
-      uint64_t M = unpack_value(c.s+i, 2)>>2;
-      uint64_t U = M & ((1ul<<7)-1);
+      continue;
+    } else if (row < beg) {     // before the window: just step over it
+      i += (b & 0x3) == 1 ? 1 : (b & 0x3) == 2 ? 2 : 8;
+      row++;
+      continue;
+    } else if ((b & 0x3) == 1) {
+      uint64_t k_max = c->n - i < end - row + 1 ? c->n - i : end - row + 1;
+      uint64_t k = dense(c->s+i, k_max, s+(row-beg)*unit, unit);
+      i += k; row += k;
+      continue;
+    } else if ((b & 0x3) == 2) {
+      M = unpack_value(c->s+i, 2)>>2;
+      U = M & ((1ul<<7)-1);
       M >>= 7;
-      if (inflated.unit == 1) fitMU(&M, &U, 4);
-      else fitMU(&M, &U, inflated.unit<<2);
-      f3_pack_mu(s+(n++)*inflated.unit, M, U, inflated.unit);
       i += 2;
     } else {
-      uint64_t M = unpack_value(c.s+i, 8)>>2;
-      uint64_t U = M & ((1ul<<31)-1);
+      M = unpack_value(c->s+i, 8)>>2;
+      U = M & ((1ul<<31)-1);
       M >>= 31;
-      if (inflated.unit == 1) fitMU(&M, &U, 4);
-      else fitMU(&M, &U, inflated.unit<<2);
-      f3_pack_mu(s+(n++)*inflated.unit, M, U, inflated.unit);
       i += 8;
     }
+    fitMU(&M, &U, unit<<2);
+    f3_store(s+(row-beg)*unit, (M<<(unit*4)) | U, unit);
+    row++;
   }
+  if (!zeroed && row <= end) memset(s+(row > beg ? row-beg : 0)*unit, 0, (end+1-(row > beg ? row : beg))*unit);
+}
+
+/* stream-vbyte: per control byte, the data length and the pshufb mask
+   spreading the four values to 32-bit lanes */
+static uint8_t svb_len[256];
+static uint8_t svb_shuf[256][16];
+
+/* decode nq groups of four values from d into out; returns the end of the data */
+typedef const uint8_t *(*svb_decode_f)(const uint8_t *ctl, const uint8_t *d, const uint8_t *d_end, uint64_t nq, uint32_t *out);
+
+static const uint8_t *svb_decode_scalar(const uint8_t *ctl, const uint8_t *d, const uint8_t *d_end, uint64_t nq, uint32_t *out) {
+  (void) d_end;
+  for (uint64_t q = 0; q < nq; ++q) {
+    for (int j = 0; j < 4; ++j) {
+      uint8_t l = ((ctl[q] >> (j*2)) & 3) + 1;
+      out[4*q+j] = unpack_value((uint8_t*) d, l);
+      d += l;
+    }
+  }
+  return d;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/* one shuffle per group while 16 bytes can be loaded inside the record */
+__attribute__((target("ssse3")))
+static const uint8_t *svb_decode_ssse3(const uint8_t *ctl, const uint8_t *d, const uint8_t *d_end, uint64_t nq, uint32_t *out) {
+  uint64_t q = 0;
+  for (; q < nq && d + 16 <= d_end; ++q) {
+    __m128i v = _mm_loadu_si128((const __m128i*) d);
+    v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*) svb_shuf[ctl[q]]));
+    _mm_storeu_si128((__m128i*) (out+4*q), v);
+    d += svb_len[ctl[q]];
+  }
+  return svb_decode_scalar(ctl+q, d, d_end, nq-q, out+4*q);
+}
+#endif
+
+static svb_decode_f svb_decode = svb_decode_scalar;
+static pthread_once_t svb_once = PTHREAD_ONCE_INIT;
+
+/* tables and kernel are set up once; summary -t decodes on several threads */
+static void svb_init(void) {
+  for (int k = 0; k < 256; ++k) {
+    uint8_t o = 0;
+    memset(svb_shuf[k], 0x80, 16);
+    for (int j = 0; j < 4; ++j) {
+      uint8_t l = ((k >> (j*2)) & 3) + 1;
+      for (uint8_t b = 0; b < l; ++b) svb_shuf[k][4*j+b] = o++;
+    }
+    svb_len[k] = o;
+  }
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) svb_decode = svb_decode_ssse3;
+#endif
+}
+
+static svb_decode_f svb_kernel(void) {
+  pthread_once(&svb_once, svb_init);
+  return svb_decode;
+}
+
+/* v2 counterpart of fmt3_decode(); v2 streams are always walked from the start */
+static void fmt3v2_decode(const cdata_t *c, uint64_t beg, uint64_t end, uint8_t *s, uint8_t unit, int zeroed) {
+  svb_decode_f svb = svb_kernel();
+  f3v2_hdr_t h;
+  const uint8_t *g = f3v2_header(c, &h), *e = c->s + c->n;
+  uint64_t nq = (h.nnz+3)>>2;
+  const uint8_t *mc = g + h.gap_nb, *md = mc + nq, *uc = md + h.m_nb, *ud = uc + nq;
+  uint32_t M[F3V2_BATCH*4], U[F3V2_BATCH*4];
+  uint64_t r[F3V2_BATCH*4], row = 0, next = beg; // next: first row of the window not yet written
+  for (uint64_t q = 0; q < nq && row <= end; q += F3V2_BATCH) {
+    uint64_t bq = nq-q < F3V2_BATCH ? nq-q : F3V2_BATCH;
+    uint64_t bv = h.nnz-4*q < 4*bq ? h.nnz-4*q : 4*bq;
+    for (uint64_t j = 0; j < bv; ++j) { row += varint_get(&g); r[j] = row++; }
+    if (r[bv-1] < beg) {        // whole batch before the window
+      for (uint64_t t = 0; t < bq; ++t) { md += svb_len[mc[q+t]]; ud += svb_len[uc[q+t]]; }
+      continue;
+    }
+    md = svb(mc+q, md, e, bq, M);
+    ud = svb(uc+q, ud, e, bq, U);
+    for (uint64_t j = 0; j < bv && r[j] <= end; ++j) {
+      if (r[j] < beg) continue;
+      if (!zeroed && r[j] > next) memset(s+(next-beg)*unit, 0, (r[j]-next)*unit);
+      uint64_t m = M[j], u = U[j];
+      fitMU(&m, &u, unit<<2);
+      f3_store(s+(r[j]-beg)*unit, (m<<(unit*4)) | u, unit);
+      next = r[j]+1;
+    }
+  }
+  if (!zeroed && next <= end) memset(s+(next-beg)*unit, 0, (end+1-next)*unit);
+}
+
+static void fmt3_decode_any(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, uint8_t *s, uint8_t unit, int zeroed) {
+  if (fmt3_is_v2(c)) fmt3v2_decode(c, beg, end, s, unit, zeroed);
+  else fmt3_decode(c, i, row, beg, end, s, unit, zeroed);
+}
+
+cdata_t fmt3_decompress(const cdata_t c) {
+  uint8_t unit = 1;
+  uint64_t n0;
+  if (c.nrow && c.unit) n0 = c.nrow; // header already carries the dimensions
+  else n0 = fmt3_data_length(&c, &unit);
+  cdata_t inflated = {0};
+  if (c.unit) inflated.unit = c.unit;
+  else inflated.unit = unit; // use inferred max unit if unset
+  uint8_t *s = calloc(inflated.unit*n0, sizeof(uint8_t));
+  if (n0) fmt3_decode_any(&c, 0, 0, 0, n0-1, s, inflated.unit, 1);
   inflated.s = s;
-  inflated.n = n;
+  inflated.n = n0;
   inflated.compressed = 0;
   inflated.fmt = '3';
   return inflated;
 }
 
+/* rows [beg, end] of a compressed fmt3 stream into out (buffer reused),
+   walking from record i at row `row` */
+void fmt3_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  uint8_t unit = 1;
+  if (!c->unit) fmt3_data_length(c, &unit);
+  else unit = c->unit;
+  uint64_t n = end-beg+1;
+  uint8_t *s = realloc(out->s, unit*n);
+  fmt3_decode_any(c, i, row, beg, end, s, unit, 0);
+  out->s = s;
+  out->n = n;
+  out->unit = unit;
+  out->compressed = 0;
+  out->fmt = '3';
+}
+
+
+/* ------------------------------------------------------------------ */
+/* Cursor (see cdata_cursor_t in cdata.h).  Values are fitted to the   */
+/* inflated unit so a run reads exactly like f3_get_mu() would after   */
+/* fmt3_decompress().  v1 zero runs are merged; v2 gaps become runs.   */
+/* ------------------------------------------------------------------ */
+
+static inline uint64_t f3_cursor_value(uint64_t M, uint64_t U, uint8_t unit) {
+  fitMU(&M, &U, unit<<2);
+  return (M<<32) | U;
+}
+
+void fmt3_cursor_init(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  if (!cur->unit) cur->unit = c->unit;
+  if (fmt3_is_v2(c)) {
+    f3v2_hdr_t h;
+    const uint8_t *g = f3v2_header(c, &h);
+    uint64_t nq = (h.nnz+3)>>2;
+    if (!cur->unit) cur->unit = h.unit;
+    cur->nrow = h.nrow;
+    cur->i = g - c->s;
+    cur->f3.nnz = h.nnz;
+    cur->f3.mc = cur->i + h.gap_nb;
+    cur->f3.im = cur->f3.mc + nq;
+    cur->f3.uc = cur->f3.im + h.m_nb;
+    cur->f3.iu = cur->f3.uc + nq;
+  } else if (!cur->unit) {
+    fmt3_data_length(c, &cur->unit);
+  }
+}
+
+/* v2: k-th non-zero row from the M and U streams */
+static void f3v2_cursor_entry(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  uint64_t k = cur->f3.k++;
+  uint8_t cm = (c->s[cur->f3.mc + (k>>2)] >> ((k&3)*2)) & 3;
+  uint8_t cu = (c->s[cur->f3.uc + (k>>2)] >> ((k&3)*2)) & 3;
+  uint64_t M = unpack_value(c->s + cur->f3.im, cm+1);
+  uint64_t U = unpack_value(c->s + cur->f3.iu, cu+1);
+  cur->f3.im += cm+1;
+  cur->f3.iu += cu+1;
+  cur->v = f3_cursor_value(M, U, cur->unit);
+  cur->n = 1;
+}
 
+static int fmt3v2_cursor_next(cdata_cursor_t *cur) {
+  if (cur->f3.pend) {
+    cur->f3.pend = 0;
+    f3v2_cursor_entry(cur);
+    return 1;
+  }
+  if (cur->f3.k < cur->f3.nnz) {
+    const uint8_t *g = cur->c->s + cur->i;
+    uint64_t gap = varint_get(&g);
+    cur->i = g - cur->c->s;
+    if (gap) {
+      cur->v = 0;
+      cur->n = gap;
+      cur->f3.pend = 1;
+    } else {
+      f3v2_cursor_entry(cur);
+    }
+    return 1;
+  }
+  if (cur->row >= cur->nrow) return 0;
+  cur->v = 0;
+  cur->n = cur->nrow - cur->row;
+  return 1;
+}
+
+int fmt3_cursor_next(cdata_cursor_t *cur) {
+  if (cur->f3.mc) return fmt3v2_cursor_next(cur);
+  const cdata_t *c = cur->c;
+  uint64_t l = 0, M, U;
+  while (cur->i < c->n && (c->s[cur->i] & 0x3) == 0) {
+    l += unpack_value(c->s+cur->i, 2)>>2;
+    cur->i += 2;
+  }
+  if (l) { cur->v = 0; cur->n = l; return 1; }
+  if (cur->i >= c->n) return 0;
+
+  uint8_t b = c->s[cur->i];
+  if ((b & 0x3) == 1) {
+    cur->v = ((uint64_t) (b>>5) << 32) | ((b>>2) & 0x7);
+    cur->n = 1;
+    cur->i++;
+    return 1;
+  } else if ((b & 0x3) == 2) {
+    M = unpack_value(c->s+cur->i, 2)>>2;
+    U = M & ((1ul<<7)-1);
+    M >>= 7;
+    cur->i += 2;
+  } else {
+    M = unpack_value(c->s+cur->i, 8)>>2;
+    U = M & ((1ul<<31)-1);
+    M >>= 31;
+    cur->i += 8;
+  }
+  cur->v = f3_cursor_value(M, U, cur->unit);
+  cur->n = 1;
+  return 1;
+}
+
+/* re-encode a v2 record as v1, for code that walks the v1 byte stream */
+void fmt3_to_v1(cdata_t *c) {
+  if (!fmt3_is_v2(c)) return;
+  cdata_t e = fmt3_decompress(*c);
+  f3v2_hdr_t h;
+  uint64_t nb1 = f3_sizes(&e, &h);
+  uint8_t *s = f3_encode_v1(&e, nb1);
+  free_cdata(&e);
+  free_cdata(c);
+  c->s = s;
+  c->n = nb1;
+  c->flags = 0;
+}
+
+/* The query may be compressed (walked run by run, zero runs skipped where
+   the mask allows) or inflated; sums are taken in row order either way. */
 stats_t* summarize1_queryfmt3(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
 
   stats_t *st = NULL;
+  uint64_t N = cdata_n(c);
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
   if (c_mask->n == 0) {            // no mask
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    st[0].n_u = c->n;
+    st[0].n_u = N;
     double sum_beta = 0.0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t mu = f3_get_mu(c, i);
-      if (mu) {
+    while (cdata_cursor_next(&cur)) {
+      uint64_t mu = cur.v;
+      if (!mu) continue;
+      for (uint64_t j=0; j<cur.n; ++j) {
         st[0].sum_depth += MU2cov(mu);
         sum_beta += MU2beta(mu);
         st[0].n_o++;
@@ -341,18 +840,19 @@ stats_t* summarize1_queryfmt3(
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    st[0].n_u = c->n;
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    st[0].n_u = N;
+    if (c_mask->n != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, N);
       fflush(stderr);
       exit(1);
     }
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t mu = f3_get_mu(c, i);
-      if (mu) st[0].n_q++;
-      if (FMT0_IN_SET(*c_mask, i)) {
-        st[0].n_m++;
-        if (mu) {
+    st[0].n_m = fmt0_popcount(c_mask);
+    while (cdata_cursor_next(&cur)) {
+      uint64_t mu = cur.v;
+      if (!mu) continue;
+      for (uint64_t i=cur.row; i<cur.row+cur.n; ++i) {
+        st[0].n_q++;
+        if (FMT0_IN_SET(*c_mask, i)) {
           st[0].sum_depth += MU2cov(mu);
           st[0].sum_beta += MU2beta(mu);
           st[0].n_o++;
@@ -365,58 +865,59 @@ stats_t* summarize1_queryfmt3(
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    st[0].n_u = c->n;
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    st[0].n_u = N;
+    if (c_mask->n != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, N);
       fflush(stderr);
       exit(1);
     }
     double sum_beta = 0.0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t mu = f3_get_mu(c, i);
-      if (mu) st[0].n_q++;
-      if (FMT6_IN_UNI(*c_mask, i) && FMT6_IN_SET(*c_mask, i)) {
-        st[0].n_m++;
-        if (mu) {
-          st[0].sum_depth += MU2cov(mu);
-          sum_beta += MU2beta(mu);
-          st[0].n_o++;
-        }}}
+    while (cdata_cursor_next(&cur)) {
+      uint64_t mu = cur.v;
+      for (uint64_t i=cur.row; i<cur.row+cur.n; ++i) {
+        if (mu) st[0].n_q++;
+        if (FMT6_IN_UNI(*c_mask, i) && FMT6_IN_SET(*c_mask, i)) {
+          st[0].n_m++;
+          if (mu) {
+            st[0].sum_depth += MU2cov(mu);
+            sum_beta += MU2beta(mu);
+            st[0].n_o++;
+          }}}}
     st[0].sm = strdup(sm);
     st[0].sq = strdup(sq);
     st[0].beta = sum_beta / st[0].n_o; // may have Inf when n_o == 0
     
   } else if (c_mask->fmt == '2') { // state mask
     
-    if (c_mask->n != c->n) {
-      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != N) {
+      fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), N);
       fflush(stderr);
       exit(1);
     }
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux = fmt2_mask_runs(c_mask);
     *n_st = aux->nk;
     st = calloc((*n_st), sizeof(stats_t));
-    uint64_t nq=0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t index = f2_get_uint64(c_mask, i);
-      uint64_t mu = f3_get_mu(c, i);
-      if (index >= (*n_st)) {
-        fprintf(stderr, "[%s:%d] State data is corrupted.\n", __func__, __LINE__);
-        fflush(stderr);
-        exit(1);
-      }
-      if (mu) {
-        st[index].sum_depth += MU2cov(mu);
-        st[index].sum_beta += MU2beta(mu);
-        st[index].n_o++;
-        nq++;
-      }
-      st[index].n_m++;
-    }
+    uint64_t nq=0, r=0, i;
+    for (i=0; r<aux->nrun; i=aux->runs[r++].end)
+      st[aux->runs[r].v].n_m += aux->runs[r].end - i;
+    r = 0;
+    while (cdata_cursor_next(&cur)) { // query runs against mask runs
+      uint64_t mu = cur.v, end = cur.row + cur.n;
+      if (!mu) continue;
+      uint64_t cov = MU2cov(mu);
+      double beta = MU2beta(mu);
+      for (i=cur.row; i<end; ) {
+        while (aux->runs[r].end <= i) ++r;
+        uint64_t e = aux->runs[r].end < end ? aux->runs[r].end : end;
+        stats_t *st1 = &st[aux->runs[r].v];
+        st1->sum_depth += cov * (e - i);
+        st1->n_o += e - i;
+        nq += e - i;
+        for (; i<e; ++i) st1->sum_beta += beta; // same rounding as row by row
+      }}
     for (uint64_t k=0; k < (*n_st); ++k) {
       st[k].n_q = nq;
-      st[k].n_u = c->n;
+      st[k].n_u = N;
       st[k].beta = st[k].sum_beta / st[k].n_o;
       if (config->section_name) {
         kstring_t tmp = {0};
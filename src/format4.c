@@ -100,10 +100,196 @@
  *
  *   The result is a flat float array (unit=4, compressed=0) matching
  *   the original uncompressed representation.
+ *
+ *
+ * Quantized layout (8/16-bit beta codes)
+ * --------------------------------------
+ * pack -f n -u 1 (or -u 2) stores each beta in [0,1] as a code
+ * q = round(beta * Q), Q = F4Q_MAX(unit) = 254 (or 65534); the all-ones
+ * code (0xff / 0xffff) is NA.  Inflated, such a record keeps its codes
+ * (c->unit = 1 or 2, little-endian) and fmt4_value() expands a row to
+ * float on demand as (float) q / Q, NA as -1.0; fmt4_to_float() expands a
+ * whole record.
+ *
+ * Compressed, the stream starts with the word 0x80000000, an NA run of
+ * length zero that the float stream never holds:
+ *
+ *   u32 0x80000000 | u8 unit | u8[3] 0 | u64 nrow | codes ...
+ *
+ * Codes are stored as they are, except that every NA code is followed by
+ * the length of its NA run minus one as a LEB128 varint, so NA runs have
+ * no length cap.  Literal stretches are found with a vectorized scan for
+ * the NA code and copied whole; quantizing and expanding to float go 8
+ * rows at a time with AVX2 when the CPU has it.
  */
 
+#define F4Q_MARK 0x80000000u
+
+void fmt4_compress(cdata_t *c);
+void fmt4_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out);
+
+/* code bytes of a quantized record (compressed or inflated), 0 for floats */
+int fmt4_is_quant(const cdata_t *c) {
+  if (c->fmt != '4') return 0;
+  if (!c->compressed) return (c->unit == 1 || c->unit == 2) ? c->unit : 0;
+  uint32_t w;
+  if (c->n < F4Q_HDR) return 0;
+  memcpy(&w, c->s, 4);
+  return w == F4Q_MARK ? c->s[4] : 0;
+}
+
+static inline uint64_t f4q_nrow(const cdata_t *c) {
+  uint64_t n; memcpy(&n, c->s+8, 8);
+  return n;
+}
+
+static inline uint32_t f4q_code(const uint8_t *s, uint8_t unit) {
+  if (unit == 1) return s[0];
+  uint16_t q; memcpy(&q, s, 2);
+  return q;
+}
+
+static inline uint64_t f4q_get_varint(const uint8_t *s, uint64_t *i) {
+  uint64_t v = 0; int sh = 0; uint8_t b;
+  do { b = s[(*i)++]; v |= (uint64_t) (b & 0x7f) << sh; sh += 7; } while (b & 0x80);
+  return v;
+}
+
+static inline uint64_t f4q_put_varint(uint8_t *s, uint64_t v) {
+  uint64_t n = 0;
+  for (; v >= 0x80; v >>= 7) s[n++] = (v & 0x7f) | 0x80;
+  s[n++] = v;
+  return n;
+}
+
+/* kernels: index of the first NA code among k codes, k if none; float
+   betas to codes (NA for anything not >= 0); codes to float betas */
+typedef uint64_t (*f4q_find_na_f)(const uint8_t *s, uint64_t k, uint8_t unit);
+typedef void (*f4q_conv_f)(const void *src, uint64_t k, void *dst, uint8_t unit);
+
+static uint64_t f4q_find_na_scalar(const uint8_t *s, uint64_t k, uint8_t unit) {
+  if (unit == 1) {
+    const uint8_t *p = memchr(s, 0xff, k);
+    return p ? (uint64_t) (p - s) : k;
+  }
+  uint64_t j = 0;
+  for (; j < k && f4q_code(s+2*j, 2) != 0xffff; ++j);
+  return j;
+}
+
+static void f4q_quantize_scalar(const void *src, uint64_t k, void *dst, uint8_t unit) {
+  const float *b = (const float*) src;
+  float Q = F4Q_MAX(unit);
+  for (uint64_t j = 0; j < k; ++j) {
+    uint32_t q = b[j] >= 0.0f ? (uint32_t) (b[j] * Q + 0.5f) : F4Q_MAX(unit)+1;
+    if (unit == 1) ((uint8_t*) dst)[j] = q;
+    else { uint16_t q2 = q; memcpy((uint8_t*) dst + 2*j, &q2, 2); }
+  }
+}
+
+static void f4q_expand_scalar(const void *src, uint64_t k, void *dst, uint8_t unit) {
+  float *b = (float*) dst, Q = F4Q_MAX(unit);
+  for (uint64_t j = 0; j < k; ++j) {
+    uint32_t q = f4q_code((const uint8_t*) src + j*unit, unit);
+    b[j] = q > F4Q_MAX(unit) ? -1.0f : (float) q / Q;
+  }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* 16 codes per compare */
+__attribute__((target("avx2")))
+static uint64_t f4q_find_na_avx2(const uint8_t *s, uint64_t k, uint8_t unit) {
+  if (unit == 1) return f4q_find_na_scalar(s, k, unit); /* memchr is vectorized */
+  const __m256i na = _mm256_set1_epi16(-1);
+  uint64_t j = 0;
+  for (; j + 16 <= k; j += 16) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (s+2*j));
+    uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi16(x, na));
+    if (m) return j + (__builtin_ctz(m)>>1);
+  }
+  return j + f4q_find_na_scalar(s+2*j, k-j, unit);
+}
+
+/* the same arithmetic as f4q_quantize_scalar(), 8 rows per step */
+__attribute__((target("avx2")))
+static void f4q_quantize_avx2(const void *src, uint64_t k, void *dst, uint8_t unit) {
+  const float *b = (const float*) src;
+  const __m256 Q = _mm256_set1_ps(F4Q_MAX(unit)), half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+  const __m256i na = _mm256_set1_epi32(F4Q_MAX(unit)+1);
+  uint64_t j = 0;
+  for (; j + 8 <= k; j += 8) {
+    __m256 v = _mm256_loadu_ps(b+j);
+    __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, Q), half));
+    __m256 ok = _mm256_cmp_ps(v, zero, _CMP_GE_OQ);
+    q = _mm256_blendv_epi8(na, q, _mm256_castps_si256(ok));
+    __m128i q16 = _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+    if (unit == 1) _mm_storel_epi64((__m128i*) ((uint8_t*) dst + j), _mm_packus_epi16(q16, q16));
+    else _mm_storeu_si128((__m128i*) ((uint8_t*) dst + 2*j), q16);
+  }
+  f4q_quantize_scalar(b+j, k-j, (uint8_t*) dst + j*unit, unit);
+}
+
+/* the same arithmetic as f4q_expand_scalar(), 8 rows per step */
+__attribute__((target("avx2")))
+static void f4q_expand_avx2(const void *src, uint64_t k, void *dst, uint8_t unit) {
+  const uint8_t *s = (const uint8_t*) src;
+  float *b = (float*) dst;
+  const __m256 Q = _mm256_set1_ps(F4Q_MAX(unit)), na = _mm256_set1_ps(-1.0f);
+  const __m256i max = _mm256_set1_epi32(F4Q_MAX(unit));
+  uint64_t j = 0;
+  for (; j + 8 <= k; j += 8) {
+    __m256i q = unit == 1 ? _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (s+j))) :
+      _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) (s+2*j)));
+    __m256 v = _mm256_div_ps(_mm256_cvtepi32_ps(q), Q);
+    __m256i isna = _mm256_cmpgt_epi32(q, max);
+    _mm256_storeu_ps(b+j, _mm256_blendv_ps(v, na, _mm256_castsi256_ps(isna)));
+  }
+  f4q_expand_scalar(s+j*unit, k-j, b+j, unit);
+}
+#endif
+
+typedef struct f4q_kernels_t {
+  f4q_find_na_f find_na;
+  f4q_conv_f quantize, expand;
+} f4q_kernels_t;
+
+static const f4q_kernels_t *f4q_kernels(void) {
+  static const f4q_kernels_t scalar = {f4q_find_na_scalar, f4q_quantize_scalar, f4q_expand_scalar};
+  static const f4q_kernels_t *f = NULL;
+  if (!f) {
+    const f4q_kernels_t *g = &scalar;
+#if defined(__x86_64__) && defined(__GNUC__)
+    static const f4q_kernels_t avx2 = {f4q_find_na_avx2, f4q_quantize_avx2, f4q_expand_avx2};
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) g = &avx2;
+#endif
+    f = g;
+  }
+  return f;
+}
+
+/* number of rows in a compressed fmt4 stream, without inflating it */
+uint64_t fmt4_data_length(const cdata_t *c) {
+  if (fmt4_is_quant(c)) return f4q_nrow(c);
+  uint64_t n = 0;
+  uint32_t *s0 = (uint32_t*) c->s;
+  for (uint64_t i=0; i< c->n>>2; ++i) {
+    if (s0[i] >> 31) n += s0[i]<<1>>1;
+    else n++;
+  }
+  return n;
+}
+
 cdata_t fmt4_decompress(const cdata_t c) {
   cdata_t expanded = {0};
+  if (fmt4_is_quant(&c)) {      // codes, see fmt4_to_float()
+    uint64_t n = f4q_nrow(&c);
+    if (n) fmt4_decompress_range(&c, F4Q_HDR, 0, 0, n-1, &expanded);
+    else expanded = (cdata_t) {.fmt = '4', .unit = c.s[4]};
+    return expanded;
+  }
 
   uint64_t i=0, m = 1<<20,n = 0, j=0, l=0;
   uint32_t *s0 = (uint32_t*) c.s;
@@ -129,6 +315,93 @@ cdata_t fmt4_decompress(const cdata_t c) {
   return expanded;
 }
 
+/* rows [beg, end] of a compressed fmt4 stream into out (buffer reused),
+   walking from word offset i at row `row` */
+void fmt4_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  uint64_t n = end-beg+1;
+  uint8_t unit = fmt4_is_quant(c);
+  if (unit) {                   // codes: literal stretches, then NA runs
+    f4q_find_na_f find_na = f4q_kernels()->find_na;
+    out->s = realloc(out->s, n*unit);
+    while (i < c->n && row <= end) {
+      uint64_t k = find_na(c->s+i, (c->n-i)/unit, unit);
+      uint64_t lo = row > beg ? row : beg, hi = row+k <= end ? row+k : end+1;
+      if (lo < hi) memcpy(out->s+(lo-beg)*unit, c->s+i+(lo-row)*unit, (hi-lo)*unit);
+      i += k*unit; row += k;
+      if (i >= c->n || row > end) break;
+      i += unit;
+      uint64_t l = f4q_get_varint(c->s, &i) + 1;
+      lo = row > beg ? row : beg; hi = row+l <= end ? row+l : end+1;
+      if (lo < hi) memset(out->s+(lo-beg)*unit, 0xff, (hi-lo)*unit);
+      row += l;
+    }
+    if (row < beg) row = beg;
+    if (row <= end) memset(out->s+(row-beg)*unit, 0, (end+1-row)*unit);
+    out->n = n;
+    out->compressed = 0;
+    out->fmt = '4';
+    out->unit = unit;
+    return;
+  }
+  out->s = realloc(out->s, n*sizeof(float_t));
+  float_t *s = (float_t*) out->s;
+  for (; i+4<=c->n && row<=end; i+=4) {
+    uint32_t w; memcpy(&w, c->s+i, 4);
+    if (w >> 31) {
+      uint64_t l = w<<1>>1;
+      uint64_t lo = row > beg ? row : beg, hi = row+l <= end ? row+l : end+1;
+      for (uint64_t k=lo; k<hi; ++k) s[k-beg] = -1.0;
+      row += l;
+    } else {
+      if (row >= beg) memcpy(s+row-beg, &w, sizeof(float_t));
+      row++;
+    }
+  }
+  for (row = row > beg ? row : beg; row <= end; ++row) s[row-beg] = 0.0;
+  out->n = n;
+  out->compressed = 0;
+  out->fmt = '4';
+  out->unit = 4;
+}
+
+/* next word of a compressed fmt4 stream as a cursor run; NA runs carry the
+   bits of -1.0, as fmt4_decompress() writes them */
+void fmt4_cursor_init(cdata_cursor_t *cur) {
+  cur->unit = fmt4_is_quant(cur->c);
+  if (cur->unit) cur->i = F4Q_HDR;
+}
+
+int fmt4_cursor_next(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  if (cur->unit) {              // quantized codes
+    if (cur->i >= c->n) return 0;
+    uint32_t q = f4q_code(c->s+cur->i, cur->unit);
+    float b = -1.0;
+    cur->i += cur->unit;
+    if (q > F4Q_MAX(cur->unit)) {
+      cur->n = f4q_get_varint(c->s, &cur->i) + 1;
+    } else {
+      b = (float) q / F4Q_MAX(cur->unit);
+      cur->n = 1;
+    }
+    uint32_t w; memcpy(&w, &b, 4);
+    cur->v = w;
+    return 1;
+  }
+  if (cur->i+4 > c->n) return 0;
+  uint32_t w; memcpy(&w, c->s+cur->i, 4);
+  cur->i += 4;
+  if (w >> 31) {
+    float na = -1.0; uint32_t b; memcpy(&b, &na, 4);
+    cur->v = b;
+    cur->n = w<<1>>1;
+  } else {
+    cur->v = w;
+    cur->n = 1;
+  }
+  return 1;
+}
+
 static int is_float(char *s) {
   size_t i;
   for (i=0; i<strlen(s); ++i) {
@@ -138,7 +411,72 @@ static int is_float(char *s) {
   return 1;
 }
 
-cdata_t* fmt4_read_raw(char *fname, int verbose) {
+/* float betas in [0,1] to codes, in place (c->unit becomes unit) */
+static void fmt4_quantize(cdata_t *c, uint8_t unit) {
+  float *b = (float*) c->s;
+  for (uint64_t i=0; i<c->n; ++i)
+    if (b[i] > 1.0f) wzfatal("[%s:%d] Value %g at row %"PRIu64" is outside [0,1] and cannot be quantized. Use -u 4.\n", __func__, __LINE__, b[i], i+1);
+  uint8_t *q = malloc(c->n*unit + 1);
+  f4q_kernels()->quantize(b, c->n, q, unit);
+  free(c->s);
+  c->s = q;
+  c->unit = unit;
+}
+
+/**
+ * Quantize inflated float betas in place to the narrowest code width that
+ * gives every value back exactly (NA included); returns that unit, or 0
+ * when neither width does and the floats are kept.
+ */
+uint8_t fmt4_quantize_exact(cdata_t *c) {
+  if (c->compressed || fmt4_is_quant(c)) return 0;
+  const float *b = (const float*) c->s;
+  for (uint64_t i=0; i<c->n; ++i) if (b[i] > 1.0f) return 0;
+  for (uint8_t unit=1; unit<=2; ++unit) {
+    cdata_t q = *c;
+    q.s = malloc(c->n*sizeof(float) + 1);
+    memcpy(q.s, c->s, c->n*sizeof(float));
+    fmt4_quantize(&q, unit);
+    uint64_t i = 0;
+    for (; i<c->n && fmt4_value(&q, i) == (b[i] < 0 ? -1.0f : b[i]); ++i);
+    if (i == c->n) {
+      free(c->s);
+      *c = q;
+      return unit;
+    }
+    free(q.s);
+  }
+  return 0;
+}
+
+/* inflated codes to float betas, in place; float records are left as they are */
+void fmt4_to_float(cdata_t *c) {
+  uint8_t unit = fmt4_is_quant(c);
+  if (c->compressed || !unit) return;
+  float *b = malloc((c->n+1) * sizeof(float));
+  f4q_kernels()->expand(c->s, c->n, b, unit);
+  if (!(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = (uint8_t*) b;
+  c->unit = 4;
+  c->flags &= ~CDFLAG_MAPPED;
+}
+
+/* compressed codes to the compressed float stream, in place (only streams
+   of one kind concatenate, see tiles_append()) */
+void fmt4_to_plain(cdata_t *c) {
+  if (!c->compressed || !fmt4_is_quant(c)) return;
+  cdata_t inflated = fmt4_decompress(*c);
+  fmt4_to_float(&inflated);
+  fmt4_compress(&inflated);
+  if (!(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = inflated.s;
+  c->n = inflated.n;
+  c->unit = 4;
+  c->nrow = 0;
+  c->flags = 0;
+}
+
+cdata_t* fmt4_read_raw(char *fname, uint8_t unit, int verbose) {
 
   gzFile fh = wzopen(fname, 1);
   char *line = NULL;
@@ -163,15 +501,45 @@ cdata_t* fmt4_read_raw(char *fname, int verbose) {
   c->n = n;
   c->compressed = 0;
   c->fmt = '4';
+  c->unit = 4;
+  if (unit == 1 || unit == 2) fmt4_quantize(c, unit);
   return c;
 }
 
+/* codes: literal stretches as they are, NA runs as the NA code + varint */
+static void fmt4_compress_codes(cdata_t *c) {
+  uint8_t unit = c->unit;
+  f4q_find_na_f find_na = f4q_kernels()->find_na;
+  uint8_t *s = malloc(F4Q_HDR + c->n*(unit+1)), *p = s + F4Q_HDR;
+  uint32_t mark = F4Q_MARK;
+  memset(s, 0, F4Q_HDR);
+  memcpy(s, &mark, 4);
+  s[4] = unit;
+  memcpy(s+8, &c->n, 8);
+  for (uint64_t i=0; i<c->n; ) {
+    uint64_t k = find_na(c->s+i*unit, c->n-i, unit), l;
+    memcpy(p, c->s+i*unit, k*unit);
+    p += k*unit; i += k;
+    if (i >= c->n) break;
+    for (l = 1; i+l < c->n && f4q_code(c->s+(i+l)*unit, unit) > F4Q_MAX(unit); ++l);
+    memset(p, 0xff, unit);
+    p += unit;
+    p += f4q_put_varint(p, l-1);
+    i += l;
+  }
+  free(c->s);
+  c->n = p - s;
+  c->s = realloc(s, c->n);
+  c->compressed = 1;
+}
+
 /* 32 bit
    1 (1bit) + run length of NA (31 bits)
    0 (1bit) + floating number (always positive) (31bit, the sign bit is always 0)
  */
 void fmt4_compress(cdata_t *c) {
 
+  if (fmt4_is_quant(c)) { fmt4_compress_codes(c); return; }
   uint64_t n=0, m=1<<20;
   uint32_t *s = calloc(sizeof(uint32_t), m);
   uint64_t i = 0; uint32_t l = 0;
@@ -211,7 +579,6 @@ stats_t* summarize1_queryfmt4(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
 
   stats_t *st = NULL;
-  float_t *vals = (float_t*) c->s;
 
   if (c_mask->n == 0) {          // no mask
 
@@ -220,7 +587,7 @@ stats_t* summarize1_queryfmt4(
     st[0].n_u = c->n;
 
     for (uint64_t i = 0; i < c->n; ++i) {
-      double b = vals[i];
+      double b = fmt4_value(c, i);
       if (b >= 0.0) {            // non-NA beta
         st[0].n_q++;
         st[0].n_o++;
@@ -246,7 +613,7 @@ stats_t* summarize1_queryfmt4(
     st[0].n_u = c->n;
 
     for (uint64_t i = 0; i < c->n; ++i) {
-      double b = vals[i];
+      double b = fmt4_value(c, i);
       if (b >= 0.0) st[0].n_q++;
       if (FMT0_IN_SET(*c_mask, i)) {
         st[0].n_m++;
@@ -275,7 +642,7 @@ stats_t* summarize1_queryfmt4(
     st[0].n_u = c->n;
 
     for (uint64_t i = 0; i < c->n; ++i) {
-      double b = vals[i];
+      double b = fmt4_value(c, i);
       if (b >= 0.0) st[0].n_q++;
       if (FMT6_IN_UNI(*c_mask, i) && FMT6_IN_SET(*c_mask, i)) {
         st[0].n_m++;
@@ -292,34 +659,30 @@ stats_t* summarize1_queryfmt4(
 
   } else if (c_mask->fmt == '2') { // state mask
 
-    if (c_mask->n != c->n) {
+    if (cdata_n(c_mask) != c->n) {
       fprintf(stderr, "[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n",
-              __func__, __LINE__, c_mask->n, c->n);
+              __func__, __LINE__, cdata_n(c_mask), c->n);
       fflush(stderr);
       exit(1);
     }
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux = fmt2_mask_runs(c_mask);
 
     *n_st = aux->nk;
     st = calloc((*n_st), sizeof(stats_t));
     uint64_t nq = 0;
 
-    for (uint64_t i = 0; i < c->n; ++i) {
-      uint64_t index = f2_get_uint64(c_mask, i);
-      if (index >= (*n_st)) {
-        fprintf(stderr, "[%s:%d] State data is corrupted.\n", __func__, __LINE__);
-        fflush(stderr);
-        exit(1);
-      }
-      double b = vals[i];
-      if (b >= 0.0) {
-        st[index].n_o++;
-        st[index].sum_beta += b;
-        nq++;
+    for (uint64_t r = 0, i = 0; r < aux->nrun; ++r) { // reduce each run
+      stats_t *st1 = &st[aux->runs[r].v];
+      st1->n_m += aux->runs[r].end - i;
+      for (; i < aux->runs[r].end; ++i) {
+        double b = fmt4_value(c, i);
+        if (b >= 0.0) {
+          st1->n_o++;
+          st1->sum_beta += b;
+        }
       }
-      st[index].n_m++;
     }
+    for (uint64_t k = 0; k < (*n_st); ++k) nq += st[k].n_o;
 
     for (uint64_t k = 0; k < (*n_st); ++k) {
       st[k].n_q = nq;
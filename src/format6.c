@@ -67,33 +67,34 @@
  *      bits7-6 bits5-4 bits3-2 bits1-0
  *
  *
- * Compressed / decompressed layout
- * --------------------------------
- * Format 6 does not introduce any additional coding. The on-disk and
- * in-memory byte layouts are identical; "compression" is just a flag.
+ * Compressed layout
+ * -----------------
+ * A compressed fmt6 record is stored in one of two ways:
  *
- * - fmt6_compress(c):
- *     sets c->compressed = 1, but does not change c->s
+ *   - packed codes, exactly as above (c->n = number of positions).  This
+ *     is what older files hold and what fmt6_compress() keeps when the
+ *     codes are dense.
  *
- * - fmt6_decompress(c):
- *     copies the packed bytes into a new cdata_t with:
- *       compressed = 0, fmt = '6', same n and byte content
+ *   - sparse (c->flags & CDFLAG_SPARSE), chosen by fmt6_compress() when it
+ *     takes less than half the packed bytes, as for single-cell records
+ *     that are mostly NA.  c->n is then the payload byte count:
  *
+ *       uint64 nrow, uint8 coding     (F6_HDR bytes)
+ *       varint records                (LEB128, 7 bits per byte)
  *
- * Before / after schematic
- * ------------------------
+ *     By coding:
  *
- *   Inflated (compressed == 0):
- *     c->s = [ packed SUSUSUSU bytes ]
- *     c->n = number of positions
+ *       F6_RUNS  : (len-1)<<2 | code, a run of len rows of one code
+ *       F6_SITES : gap<<1 | set, gap NA rows then one row of code 1<<1|set
  *
- *   Compressed (compressed == 1):
- *     same byte stream:
- *     [ packed SUSUSUSU bytes ]
+ *     Rows past the last record are NA.  F6_SITES only applies when no row
+ *     has code 01; each record takes whichever coding is smaller.  Either
+ *     way a record covers whole rows, so the generic row checkpoints,
+ *     decompress_range() and cdata_cursor_t work on it directly, and the
+ *     summary kernels below count runs without inflating.
  *
- * In other words, format 6 is always stored as 2-bit fields packed into
- * bytes; the "compression" bit only signals whether fmt6_decompress()
- * needs to be called, not a different encoding scheme.
+ * fmt6_decompress() copies packed codes, or fills them in from the
+ * records; fmt6_to_bits() turns a sparse record back into packed codes.
  */
 
 static int is_int(char *s) {
@@ -138,61 +139,237 @@ cdata_t* fmt6_read_raw(char *fname, int verbose) {
   return c;
 }
 
-// do nothing
+static inline int f6_varint_len(uint64_t v) {
+  int k = 1;
+  for (; v >= 0x80; v >>= 7) ++k;
+  return k;
+}
+
+static inline uint64_t f6_put_varint(uint8_t *s, uint64_t v) {
+  uint64_t k = 0;
+  for (; v >= 0x80; v >>= 7) s[k++] = (v & 0x7f) | 0x80;
+  s[k++] = v;
+  return k;
+}
+
+/* the record at s[*i] as gap NA rows, then len rows of code */
+static inline void f6_record(const uint8_t *s, uint64_t *i, uint8_t coding,
+                             uint64_t *gap, uint64_t *len, uint8_t *code) {
+  uint64_t v = 0; int sh = 0; uint8_t b;
+  do { b = s[(*i)++]; v |= (uint64_t) (b & 0x7f) << sh; sh += 7; } while (b & 0x80);
+  if (coding == F6_RUNS) { *gap = 0; *len = (v>>2) + 1; *code = v & 0x3; }
+  else { *gap = v>>1; *len = 1; *code = 2 | (v & 0x1); }
+}
+
+static inline uint64_t f6_nrow(const cdata_t *c) {
+  uint64_t n; memcpy(&n, c->s, sizeof(uint64_t));
+  return n;
+}
+
+/**
+ * Compress packed codes.  Both sparse codings are sized from the runs of
+ * the record; the smaller is used when it takes less than half the packed
+ * bytes, otherwise the codes are kept as they are.
+ */
 void fmt6_compress(cdata_t *c) {
+  uint64_t n = c->n, nb_runs = 0, nb_sites = 0, gap = 0;
+  int sites = 1;                // no row has code 01
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) {
+    nb_runs += f6_varint_len((cur.n-1)<<2 | cur.v);
+    if (!cur.v) { gap = cur.n; continue; }
+    if (cur.v == 1) sites = 0;
+    nb_sites += f6_varint_len(gap<<1) + cur.n - 1;
+    gap = 0;
+  }
+  uint8_t coding = (sites && nb_sites < nb_runs) ? F6_SITES : F6_RUNS;
+  uint64_t nb = F6_HDR + (coding == F6_SITES ? nb_sites : nb_runs);
+  if (nb >= ((n+3)>>2)/2) {     // dense: keep the codes
+    c->compressed = 1;
+    return;
+  }
+
+  uint8_t *s = malloc(nb);
+  uint64_t i = F6_HDR;
+  memcpy(s, &n, sizeof(uint64_t));
+  s[8] = coding;
+  cdata_cursor_init(&cur, c);
+  gap = 0;
+  while (cdata_cursor_next(&cur)) {
+    if (coding == F6_RUNS) {
+      i += f6_put_varint(s+i, (cur.n-1)<<2 | cur.v);
+    } else if (!cur.v) {
+      gap = cur.n;
+    } else {
+      for (uint64_t k=0; k<cur.n; ++k, gap=0)
+        i += f6_put_varint(s+i, gap<<1 | (cur.v & 0x1));
+    }
+  }
+  free(c->s);
+  c->s = s;
+  c->n = i;
+  c->nrow = n;
+  c->flags |= CDFLAG_SPARSE;
   c->compressed = 1;
 }
 
-// just copy, nothing else, one can just flip compressed bit if possible
+/**
+ * Rows [beg, end] of a sparse record into out, walking the records from
+ * byte offset i, whose first row is `row` (see cdata_ckpt_seek()).
+ */
+void fmt6_decompress_range(const cdata_t *c, uint64_t i, uint64_t row, uint64_t beg, uint64_t end, cdata_t *out) {
+  uint64_t n = end-beg+1;
+  uint8_t coding = c->s[8];
+  out->s = realloc(out->s, (n+3)>>2);
+  memset(out->s, 0, (n+3)>>2);
+  while (i < c->n && row <= end) {
+    uint64_t gap, len; uint8_t code;
+    f6_record(c->s, &i, coding, &gap, &len, &code);
+    row += gap;
+    uint64_t lo = row > beg ? row : beg, hi = row+len <= end ? row+len : end+1;
+    row += len;
+    if (!code || lo >= hi) continue;
+    uint64_t k = lo-beg, e = hi-beg;
+    for (; k < e && (k & 0x3); ++k) out->s[k>>2] |= code << ((k&0x3)*2);
+    if (k + 4 <= e) {           // whole bytes of the run
+      memset(out->s + (k>>2), code * 0x55, (e-k)>>2);
+      k += (e-k) & ~3ull;
+    }
+    for (; k < e; ++k) out->s[k>>2] |= code << ((k&0x3)*2);
+  }
+  out->n = n;
+  out->compressed = 0;
+  out->fmt = '6';
+  out->unit = 2;
+}
+
 cdata_t fmt6_decompress(const cdata_t c) {
   cdata_t expanded = {0};
-  expanded.s = malloc(cdata_nbytes(&c));
-  memcpy(expanded.s, c.s, cdata_nbytes(&c));
-  expanded.n = c.n;
+  if (fmt6_is_sparse(&c)) {
+    uint64_t n = f6_nrow(&c);
+    if (n) fmt6_decompress_range(&c, F6_HDR, 0, 0, n-1, &expanded);
+  } else {                      // packed codes are just copied
+    expanded.s = malloc(cdata_nbytes(&c));
+    memcpy(expanded.s, c.s, cdata_nbytes(&c));
+    expanded.n = c.n;
+  }
   expanded.compressed = 0;
   expanded.fmt = '6';
   expanded.unit = 2;
   return expanded;
 }
 
+/* sparse records back to packed codes, in place */
+void fmt6_to_bits(cdata_t *c) {
+  if (!fmt6_is_sparse(c)) return;
+  cdata_t expanded = fmt6_decompress(*c);
+  if (!(c->flags & CDFLAG_MAPPED)) free(c->s);
+  c->s = expanded.s;
+  c->n = expanded.n;
+  c->nrow = expanded.n;
+  c->flags = 0;
+}
+
+void fmt6_cursor_init(cdata_cursor_t *cur) {
+  cur->i = F6_HDR;
+  cur->nrow = f6_nrow(cur->c);
+  cur->unit = cur->c->s[8];
+}
+
+/* next run of a sparse record: a site after a gap comes as two runs */
+int fmt6_cursor_next(cdata_cursor_t *cur) {
+  const cdata_t *c = cur->c;
+  if (cur->f6pend) {
+    cur->v = cur->f6pend;
+    cur->n = 1;
+    cur->f6pend = 0;
+  } else if (cur->i < c->n) {
+    uint64_t gap, len; uint8_t code;
+    f6_record(c->s, &cur->i, cur->unit, &gap, &len, &code);
+    if (gap) { cur->v = 0; cur->n = gap; cur->f6pend = code; }
+    else { cur->v = code; cur->n = len; }
+  } else {                      // trailing NA rows
+    if (cur->row >= cur->nrow) return 0;
+    cur->v = 0;
+    cur->n = cur->nrow - cur->row;
+  }
+  return 1;
+}
+
 // as set/universe
+/* counts of each 2-bit code (FMT6_2BIT) over rows [beg, end) of a packed
+   record, whole words through fmt6_word_counts() */
+void fmt6_range_counts(const cdata_t *c, uint64_t beg, uint64_t end, uint64_t cnts[4]) {
+  for (; beg < end && (beg & 31); ++beg) cnts[FMT6_2BIT(*c, beg)]++;
+  if (beg + 32 <= end) {
+    fmt6_word_counts(c->s + (beg>>2), NULL, 0, (end-beg)>>5, cnts);
+    beg += (end-beg) & ~31ull;
+  }
+  for (; beg < end; ++beg) cnts[FMT6_2BIT(*c, beg)]++;
+}
+
+/* fmt6_range_counts() for either form; calls come with increasing ranges
+   and sparse records move cur forward through them */
+static void fmt6_counts(const cdata_t *c, cdata_cursor_t *cur, uint64_t beg, uint64_t end, uint64_t cnts[4]) {
+  if (!fmt6_is_sparse(c)) { fmt6_range_counts(c, beg, end, cnts); return; }
+  if (beg >= end) return;
+  cdata_cursor_seek(cur, beg);
+  while (cdata_cursor_next(cur)) {
+    uint64_t lo = cur->row > beg ? cur->row : beg;
+    uint64_t hi = cur->row + cur->n < end ? cur->row + cur->n : end;
+    cnts[cur->v] += hi - lo;
+    if (cur->row + cur->n >= end) break;
+  }
+}
+
+/* The kernels below take packed queries and binary masks a word at a
+   time through the popcount kernels (popcount.c). Sparse queries are
+   walked by runs (cdata_cursor_t), which skips their NA stretches, and the
+   mask is counted over each covered run. */
+
 static stats_t* summarize1_queryfmt6_SU(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
   
   stats_t *st = NULL;
+  uint64_t n = cdata_n(c);
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
   if (c_mask->n == 0) {          // no mask
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    for (uint64_t i=0; i<c->n; ++i) {
-      if (FMT6_IN_UNI(*c,i)) {
-        st[0].n_u++;
-        st[0].n_m++;
-        st[0].sum_depth++;
-        if (FMT6_IN_SET(*c,i)) {
-          st[0].n_q++;
-          st[0].n_o++;
-        }
-      }
-    }
+    uint64_t cnts[4] = {0};     // code 2: universe only, 3: universe and set
+    fmt6_counts(c, &cur, 0, n, cnts);
+    st[0].n_u = st[0].n_m = st[0].sum_depth = cnts[2] + cnts[3];
+    st[0].n_q = st[0].n_o = cnts[3];
     st[0].sm = strdup(sm);
     st[0].sq = strdup(sq);
     st[0].beta = (double) st[0].n_q / st[0].n_u;
     
   } else if (c_mask->fmt <= '1') { // binary mask
 
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (c_mask->n != n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, n);
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    for (size_t i=0; i<c->n; ++i) {
-      if (FMT6_IN_UNI(*c,i)) {
-        st[0].n_u++;
-        int in_q = FMT6_IN_SET(*c,i);
-        int in_m = FMT0_IN_SET(*c_mask,i);
-        if (in_q) st[0].n_q++;
-        if (in_m) st[0].n_m++;
-        if (in_q && in_m) st[0].n_o++;
+    if (!fmt6_is_sparse(c)) {   // query codes, and those at mask rows
+      uint64_t qc[4] = {0}, mc[4] = {0}, nw = n>>5;
+      fmt6_range_counts(c, 0, n, qc);
+      fmt6_word_counts(c->s, c_mask->s, 0, nw, mc);
+      for (uint64_t i=nw<<5; i<n; ++i)
+        if (FMT0_IN_SET(*c_mask, i)) mc[FMT6_2BIT(*c, i)]++;
+      st[0].n_u = qc[2] + qc[3];
+      st[0].n_q = qc[3];
+      st[0].n_m = mc[2] + mc[3];
+      st[0].n_o = mc[3];
+    } else {
+      while (cdata_cursor_next(&cur)) {
+        if (!(cur.v & 0x2)) continue; // not in universe
+        uint64_t m = fmt0_range_popcount(c_mask, cur.row, cur.row+cur.n);
+        st[0].n_u += cur.n;
+        st[0].n_m += m;
+        if (cur.v & 0x1) { st[0].n_q += cur.n; st[0].n_o += m; }
       }
     }
     st[0].sm = strdup(sm);
@@ -201,24 +378,19 @@ static stats_t* summarize1_queryfmt6_SU(
 
   } else if (c_mask->fmt == '2') { // state mask
 
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), n);
 
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux = fmt2_mask_runs(c_mask);
     *n_st = aux->nk;
     st = calloc((*n_st), sizeof(stats_t));
     uint64_t nq = 0, nu = 0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t index = f2_get_uint64(c_mask, i);
-      if (index >= (*n_st)) wzfatal("[%s:%d] State data is corrupted.\n", __func__, __LINE__);
-      if (FMT6_IN_UNI(*c,i)) {
-        nu++;
-        if (FMT6_IN_SET(*c,i)) {
-          nq++;
-          st[index].n_o++;
-        }
-        st[index].n_m++;
-      }
+    for (uint64_t r=0, i=0; r<aux->nrun; i=aux->runs[r++].end) {
+      uint64_t cnts[4] = {0};   // code 2: universe only, 3: universe and set
+      fmt6_counts(c, &cur, i, aux->runs[r].end, cnts);
+      nu += cnts[2] + cnts[3];
+      nq += cnts[3];
+      st[aux->runs[r].v].n_o += cnts[3];
+      st[aux->runs[r].v].n_m += cnts[2] + cnts[3];
     }
     for (uint64_t k=0; k < (*n_st); ++k) {
       st[k].n_q = nq;
@@ -235,18 +407,32 @@ static stats_t* summarize1_queryfmt6_SU(
     }
   } else if (c_mask->fmt == '6') { // binary mask with universe
 
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (c_mask->n != n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, n);
     
     *n_st = 1;
     st = calloc(1, sizeof(stats_t));
-    for (size_t i=0; i<c->n; ++i) {
-      if (FMT6_IN_UNI(*c,i) && FMT6_IN_UNI(*c_mask, i)) {
-        st[0].n_u++;
-        int in_q = FMT6_IN_SET(*c,i);
-        int in_m = FMT6_IN_SET(*c_mask,i);
-        if (in_q) st[0].n_q++;
-        if (in_m) st[0].n_m++;
-        if (in_q && in_m) st[0].n_o++;
+    if (!fmt6_is_sparse(c)) {   // over the universe both share
+      uint64_t cnt[4] = {0}, nw = n>>5;
+      fmt6_su_overlap(c->s, c_mask->s, nw, cnt);
+      for (uint64_t i=nw<<5; i<n; ++i) {
+        if (!FMT6_IN_UNI(*c, i) || !FMT6_IN_UNI(*c_mask, i)) continue;
+        cnt[0]++;
+        if (FMT6_IN_SET(*c, i)) cnt[1]++;
+        if (FMT6_IN_SET(*c_mask, i)) cnt[2]++;
+        if (FMT6_IN_SET(*c, i) && FMT6_IN_SET(*c_mask, i)) cnt[3]++;
+      }
+      st[0].n_u = cnt[0];
+      st[0].n_q = cnt[1];
+      st[0].n_m = cnt[2];
+      st[0].n_o = cnt[3];
+    } else {
+      while (cdata_cursor_next(&cur)) {
+        if (!(cur.v & 0x2)) continue; // not in universe
+        uint64_t mc[4] = {0};     // code 2: universe only, 3: universe and set
+        fmt6_range_counts(c_mask, cur.row, cur.row+cur.n, mc);
+        st[0].n_u += mc[2] + mc[3];
+        st[0].n_m += mc[3];
+        if (cur.v & 0x1) { st[0].n_q += mc[2] + mc[3]; st[0].n_o += mc[3]; }
       }
     }
     st[0].sm = strdup(sm);
@@ -264,16 +450,19 @@ static stats_t* summarize1_queryfmt6_2bit(
   cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
   
   stats_t *st = NULL;
+  uint64_t n = cdata_n(c);
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
   if (c_mask->n == 0) {          // no mask
     
     *n_st = 4;
     st = calloc(4, sizeof(stats_t));
-    for (uint64_t i=0; i<c->n; ++i) {
-      st[FMT6_2BIT(*c,i)].n_q++;
-    }
+    uint64_t cnts[4] = {0};
+    fmt6_counts(c, &cur, 0, n, cnts);
     for (uint8_t k=0; k<4; ++k) {
-      st[k].n_u = c->n;
-      st[k].n_m = c->n;
+      st[k].n_q = cnts[k];
+      st[k].n_u = n;
+      st[k].n_m = n;
       st[k].n_o = st[k].n_q;
       st[k].sm = strdup(sm);
       kstring_t tmp = {0};
@@ -282,25 +471,47 @@ static stats_t* summarize1_queryfmt6_2bit(
       st[k].beta = 1.0;
     }
     
-  } else if (c_mask->fmt <= '1') { // binary mask
+  } else if (c_mask->fmt <= '1' || c_mask->fmt == '6') { // binary mask, or with universe
 
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (c_mask->n != n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, n);
 
     *n_st = 4;
     uint64_t *cnts = calloc(*n_st, sizeof(uint64_t));
     uint64_t *cnts_q = calloc(*n_st, sizeof(uint64_t));
     uint64_t n_m = 0; // sum of 1s in mask
-    for (uint64_t i=0; i<c->n; ++i) {
-      if (FMT0_IN_SET(*c_mask, i)) {
-        n_m++;
-        cnts[FMT6_2BIT(*c,i)]++;
+    int f6 = c_mask->fmt == '6';
+    if (f6) {                   // 11: in universe and set
+      uint64_t mc[4] = {0};
+      fmt6_range_counts(c_mask, 0, n, mc);
+      n_m = mc[3];
+    } else {
+      n_m = fmt0_popcount(c_mask);
+    }
+    if (!fmt6_is_sparse(c)) {   // query codes at the mask rows
+      uint64_t nw = n>>5;
+      fmt6_range_counts(c, 0, n, cnts_q);
+      fmt6_word_counts(c->s, c_mask->s, f6, nw, cnts);
+      for (uint64_t i=nw<<5; i<n; ++i)
+        if (f6 ? FMT6_2BIT(*c_mask, i) == 3 : FMT0_IN_SET(*c_mask, i) != 0) cnts[FMT6_2BIT(*c, i)]++;
+    } else {
+      while (cdata_cursor_next(&cur)) { // NA rows are what the others leave
+        if (!cur.v) continue;
+        cnts_q[cur.v] += cur.n;
+        if (f6) {
+          uint64_t mc[4] = {0};
+          fmt6_range_counts(c_mask, cur.row, cur.row+cur.n, mc);
+          cnts[cur.v] += mc[3];
+        } else {
+          cnts[cur.v] += fmt0_range_popcount(c_mask, cur.row, cur.row+cur.n);
+        }
       }
-      cnts_q[FMT6_2BIT(*c,i)]++;
     }
+    cnts_q[0] = n - cnts_q[1] - cnts_q[2] - cnts_q[3];
+    cnts[0] = n_m - cnts[1] - cnts[2] - cnts[3];
     st = calloc(*n_st, sizeof(stats_t));
     for (uint8_t k=0; k<*n_st; ++k) {
       // only report masked
-      st[k].n_u = c->n;
+      st[k].n_u = n;
       st[k].n_q = cnts_q[k];
       st[k].n_o = cnts[k];
       st[k].n_m = n_m;
@@ -316,24 +527,25 @@ static stats_t* summarize1_queryfmt6_2bit(
     
   } else if (c_mask->fmt == '2') { // state mask
 
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+    if (cdata_n(c_mask) != n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), n);
 
-    if (!c_mask->aux) fmt2_set_aux(c_mask);
-    f2_aux_t *aux = (f2_aux_t*) c_mask->aux;
+    f2_aux_t *aux = fmt2_mask_runs(c_mask);
     *n_st = aux->nk * 4;
     st = calloc((*n_st), sizeof(stats_t));
-    uint64_t nu = 0;
-    for (uint64_t i=0; i<c->n; ++i) {
-      uint64_t index = f2_get_uint64(c_mask, i);
-      if (index >= (*n_st)) wzfatal("[%s:%d] State data is corrupted.\n", __func__, __LINE__);
-      nu++;
-      st[index*4+FMT6_2BIT(*c,i)].n_o++;
-      for (uint64_t k1 = 0; k1 < aux->nk; ++k1) st[k1*4+FMT6_2BIT(*c,i)].n_q++;
-      for (uint8_t k2 = 0; k2 < 4; ++k2) st[index*4+k2].n_m++;
+    uint64_t nu = n, nq[4] = {0};
+    for (uint64_t r=0, i=0; r<aux->nrun; i=aux->runs[r++].end) {
+      uint64_t cnts[4] = {0}, index = aux->runs[r].v;
+      fmt6_counts(c, &cur, i, aux->runs[r].end, cnts);
+      for (uint8_t k2 = 0; k2 < 4; ++k2) {
+        st[index*4+k2].n_o += cnts[k2];
+        st[index*4+k2].n_m += aux->runs[r].end - i;
+        nq[k2] += cnts[k2];
+      }
     }
     for (uint64_t k1=0; k1 < aux->nk; ++k1) {
       for (uint8_t k2=0; k2 < 4; ++k2) {
         uint64_t k = k1*4 + k2;
+        st[k].n_q = nq[k2];
         st[k].n_u = nu;
         if (config->section_name) {
           kstring_t tmp = {0};
@@ -350,38 +562,6 @@ static stats_t* summarize1_queryfmt6_2bit(
       }
     }
     
-  } else if (c_mask->fmt == '6') { // binary mask with universe
-
-    if (c_mask->n != c->n) wzfatal("[%s:%d] mask (N=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
-
-    *n_st = 4;
-    uint64_t *cnts = calloc(*n_st, sizeof(uint64_t));
-    uint64_t *cnts_q = calloc(*n_st, sizeof(uint64_t));
-    uint64_t n_m = 0; // sum of 1s in mask
-    for (uint64_t i=0; i<c->n; ++i) {
-      if (FMT6_IN_UNI(*c_mask, i) && FMT6_IN_SET(*c_mask, i)) {
-        n_m++;
-        cnts[FMT6_2BIT(*c,i)]++;
-      }
-      cnts_q[FMT6_2BIT(*c,i)]++;
-    }
-    st = calloc(*n_st, sizeof(stats_t));
-    for (uint8_t k=0; k<*n_st; ++k) {
-      // only report masked
-      st[k].n_u = c->n;
-      st[k].n_q = cnts_q[k];
-      st[k].n_o = cnts[k];
-      st[k].n_m = n_m;
-      kstring_t tmp1 = {0};
-      ksprintf(&tmp1, "%s|1", sm); // the |1 means "masked"
-      st[k].sm = tmp1.s;
-      kstring_t tmp2 = {0};
-      ksprintf(&tmp2, "%s|%u", sq, k);
-      st[k].sq = tmp2.s;
-    }
-    free(cnts);
-    free(cnts_q);
-    
   } else {                      // other masks
     wzfatal("[%s:%d] Mask format %c unsupported.\n", __func__, __LINE__, c_mask->fmt);
   }
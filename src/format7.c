@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "cdata.h"
 #include "summary.h"
 
@@ -351,7 +352,8 @@ cdata_t *fmt7_read_raw(char *fname, int verbose) {
  * Notes
  * -----
  * • `rdr->chrm` is always a pointer *into c->s* → do not free it.
- * • Decoding is strictly sequential; random access requires fmt7_decompress().
+ * • Decoding is sequential; fmt7_seek() / fmt7_seek_loc() jump to a row or
+ *   a coordinate, and fmt7_decompress() gives full random access.
  * • `rdr->value` resets to 0 whenever a new chromosome begins.
  * • The caller is expected to initialize rdr = {0} before the first call.
  */
@@ -383,6 +385,149 @@ int row_reader_next_loc(row_reader_t *rdr, const cdata_t *c) {
   return 1;
 }
 
+/**
+ * Bulk delta decoding
+ * -------------------
+ * row_reader_next_n() decodes up to n coordinates of the current chromosome
+ * block at once into an array, leaving rdr as if row_reader_next_loc() had
+ * been called that many times.  A call never crosses a 0xff marker, so every
+ * coordinate it returns lies on rdr->chrm.
+ *
+ * The kernels classify deltas by the top bits of their first byte.  The
+ * scalar kernel takes eight 1-byte deltas per 64-bit word when it can.  The
+ * AVX2 kernel looks the top-bit mask of an 8-byte window up in a table
+ * (f7_win) giving where its 1- and 2-byte deltas start, gathers them with
+ * one shuffle and turns them into positions with an 8-lane prefix sum.
+ * 8-byte deltas and the end marker go one at a time.
+ */
+typedef uint64_t (*f7_decode_f)(const uint8_t *s, uint64_t *i, uint64_t end, uint64_t *value, uint64_t *out, uint64_t n);
+
+/* one delta at s[*i] (not the end marker), as row_reader_next_loc() reads it */
+static inline uint64_t f7_delta(const uint8_t *s, uint64_t *i) {
+  uint8_t b = s[*i];
+  if ((b>>6) == 3) {
+    uint64_t dn = ((uint64_t) b & 0x3f)<<(8*7);
+    for (int j=1; j<8; ++j) dn |= ((uint64_t) s[*i+j])<<(8*(7-j));
+    *i += 8;
+    return dn;
+  } else if ((b>>6) == 2) {
+    uint64_t dn = (((uint64_t) b & 0x3f)<<8) | s[*i+1];
+    *i += 2;
+    return dn;
+  }
+  (*i)++;
+  return b;
+}
+
+static uint64_t f7_decode_scalar(const uint8_t *s, uint64_t *pi, uint64_t end, uint64_t *pv, uint64_t *out, uint64_t n) {
+  uint64_t i = *pi, v = *pv, k = 0;
+  while (k < n && i < end) {
+    if (k + 8 <= n && i + 8 <= end) {
+      uint64_t w; memcpy(&w, s+i, 8);
+      if (!(w & 0x8080808080808080ull)) { // eight 1-byte deltas
+        for (int j=0; j<8; ++j) { v += s[i+j]; out[k++] = v; }
+        i += 8;
+        continue;
+      }
+    }
+    if (s[i] == 0xff) break;
+    v += f7_delta(s, &i);
+    out[k++] = v;
+  }
+  *pi = i; *pv = v;
+  return k;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* Deltas of an 8-byte window that holds only 1- and 2-byte deltas, keyed by
+   the window's top bits: one pshufb gathers them into 16-bit lanes
+   ((hi & 0x3f) << 8 | lo, hi zeroed for 1-byte deltas). */
+typedef struct f7_win_t {
+  uint8_t shuf[16];
+  uint8_t starts;               // bytes that begin a delta
+  uint8_t nd;                   // deltas decoded
+  uint8_t nb;                   // bytes consumed (a straddling delta is left)
+} f7_win_t;
+static f7_win_t f7_win[256];
+
+static void f7_win_init(void) {
+  for (int m = 0; m < 256; ++m) {
+    f7_win_t *w = &f7_win[m];
+    int j = 0, k = 0;
+    memset(w->shuf, 0x80, 16);
+    while (j < 8) {
+      if (!((m>>j) & 1)) { w->shuf[2*k] = j; w->starts |= 1<<j; j++; }
+      else if (j+1 < 8) { w->shuf[2*k] = j+1; w->shuf[2*k+1] = j; w->starts |= 1<<j; j += 2; }
+      else break;
+      k++;
+    }
+    w->nd = k; w->nb = j;
+  }
+}
+
+__attribute__((target("avx2")))
+static uint64_t f7_decode_avx2(const uint8_t *s, uint64_t *pi, uint64_t end, uint64_t *pv, uint64_t *out, uint64_t n) {
+  uint64_t i = *pi, v = *pv, k = 0;
+  const __m128i top2 = _mm_set1_epi8((char) 0xc0), low14 = _mm_set1_epi16(0x3fff);
+  const __m256i zero = _mm256_setzero_si256(), last = _mm256_set1_epi32(3);
+  while (k < n && i < end) {
+    if (k + 8 <= n && i + 8 <= end) {
+      __m128i x = _mm_loadl_epi64((const __m128i*) (s+i));
+      const f7_win_t *w = &f7_win[_mm_movemask_epi8(x) & 0xff];
+      uint32_t c0 = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(x, top2), top2));
+      if (!(c0 & w->starts)) {  // no 8-byte delta or end marker starts here
+        __m128i d = _mm_and_si128(_mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i*) w->shuf)), low14);
+        __m256i p = _mm256_cvtepu16_epi32(d);
+        p = _mm256_add_epi32(p, _mm256_slli_si256(p, 4));
+        p = _mm256_add_epi32(p, _mm256_slli_si256(p, 8));
+        p = _mm256_add_epi32(p, _mm256_blend_epi32(zero, _mm256_permutevar8x32_epi32(p, last), 0xf0));
+        __m256i carry = _mm256_set1_epi64x(v);
+        _mm256_storeu_si256((__m256i*) (out+k), _mm256_add_epi64(carry, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(p))));
+        _mm256_storeu_si256((__m256i*) (out+k+4), _mm256_add_epi64(carry, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(p, 1))));
+        k += w->nd; i += w->nb;
+        v = out[k-1];
+        continue;
+      }
+    }
+    if (s[i] == 0xff) break;
+    v += f7_delta(s, &i);
+    out[k++] = v;
+  }
+  *pi = i; *pv = v;
+  return k;
+}
+#endif
+
+static f7_decode_f f7_decode = f7_decode_scalar;
+static pthread_once_t f7_decode_once = PTHREAD_ONCE_INIT;
+
+static void f7_decode_init(void) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    f7_win_init();
+    f7_decode = f7_decode_avx2;
+  }
+#endif
+}
+
+uint64_t row_reader_next_n(row_reader_t *rdr, const cdata_t *c, uint64_t *locs, uint64_t n) {
+  pthread_once(&f7_decode_once, f7_decode_init);
+  while (n && rdr->loc < c->n) {
+    if (c->s[rdr->loc] == 0xff || !rdr->index) { // next chromosome, see row_reader_next_loc()
+      if (c->s[rdr->loc] == 0xff) rdr->loc++;
+      rdr->chrm = (char*) c->s + rdr->loc;
+      rdr->loc += strlen(rdr->chrm)+1;
+      rdr->value = 0;
+    }
+    uint64_t k = f7_decode(c->s, &rdr->loc, c->n, &rdr->value, locs, n);
+    if (k) { rdr->index += k; return k; }
+  }
+  return 0;
+}
+
 int fmt7_next_bed(cdata_t *c) {
   row_reader_t *rdr;
   if (!c->aux) c->aux = calloc(1, sizeof(row_reader_t));
@@ -391,13 +536,145 @@ int fmt7_next_bed(cdata_t *c) {
 }
 
 /**
- * Return the CpG number from iterating the whole cdata_t
+ * Checkpoints and chromosome directory
+ * ------------------------------------
+ * cdata_write() appends a table to the delta stream (CDFLAG_CKPT, see
+ * cdata.h).  For format 7 its n 16-byte words hold
+ *
+ *     uint64 nck, uint64 nchr
+ *     nck  x (uint64 loc, uint64 index, uint64 value, uint64 chrm)
+ *     nchr x (uint64 chrm, uint64 row)
+ *
+ * Checkpoint j is the row_reader_t state just before row j*step is read:
+ * `loc`, `index` and `value` as in the reader, `chrm` the byte offset of
+ * the current chromosome name.  Directory entry k gives the byte offset of
+ * the k-th chromosome name and its first (0-based) row.  fmt7_seek() and
+ * fmt7_seek_loc() use them to jump; without a table they walk from the start.
+ */
+typedef struct f7_tab_t {
+  uint64_t step, nck, nchr;
+  const uint8_t *ck, *dir;
+} f7_tab_t;
+
+static inline uint64_t f7_u64(const uint8_t *p, uint64_t i) {
+  uint64_t v; memcpy(&v, p+8*i, sizeof(uint64_t));
+  return v;
+}
+
+static int fmt7_tab(const cdata_t *c, f7_tab_t *t) {
+  if (c->fmt != '7' || !c->compressed || !(c->flags & CDFLAG_CKPT)) return 0;
+  const uint8_t *p = c->s + c->n;
+  t->step = f7_u64(p, 0);
+  t->nck = f7_u64(p, 2);
+  t->nchr = f7_u64(p, 3);
+  t->ck = p + 32;
+  t->dir = t->ck + 32*t->nck;
+  return t->step && t->nck;
+}
+
+static void fmt7_ckpt_restore(const cdata_t *c, const f7_tab_t *t, uint64_t j, row_reader_t *rdr) {
+  const uint8_t *e = t->ck + 32*j;
+  rdr->loc = f7_u64(e, 0);
+  rdr->index = f7_u64(e, 1);
+  rdr->value = f7_u64(e, 2);
+  rdr->chrm = rdr->index ? (char*) c->s + f7_u64(e, 3) : NULL;
+}
+
+uint64_t fmt7_ckpt_build(const cdata_t *c, uint8_t **tab) {
+  *tab = NULL;
+  uint64_t step = CDATA_CKPT_STEP, nck = 0, nchr = 0, mck = 64, mchr = 64;
+  uint64_t *ck = malloc(mck*4*sizeof(uint64_t)), *dir = malloc(mchr*2*sizeof(uint64_t));
+  row_reader_t rdr = {0};
+  for (;;) {
+    row_reader_t pre = rdr;
+    if (!row_reader_next_loc(&rdr, c)) break;
+    if (pre.index == nck*step) {
+      if (nck >= mck) { mck <<= 1; ck = realloc(ck, mck*4*sizeof(uint64_t)); }
+      uint64_t *e = ck + 4*nck++;
+      e[0] = pre.loc; e[1] = pre.index; e[2] = pre.value;
+      e[3] = pre.chrm ? (uint64_t) ((uint8_t*) pre.chrm - c->s) : 0;
+    }
+    if (rdr.chrm != pre.chrm) {
+      if (nchr >= mchr) { mchr <<= 1; dir = realloc(dir, mchr*2*sizeof(uint64_t)); }
+      dir[2*nchr] = (uint8_t*) rdr.chrm - c->s;
+      dir[2*nchr+1] = pre.index;
+      nchr++;
+    }
+  }
+  if (rdr.index <= step) { free(ck); free(dir); return 0; }
+
+  uint64_t nw = 1 + 2*nck + nchr, nb = 16 + 16*nw;
+  *tab = malloc(nb);
+  memcpy(*tab, &step, sizeof(uint64_t));
+  memcpy(*tab+8, &nw, sizeof(uint64_t));
+  memcpy(*tab+16, &nck, sizeof(uint64_t));
+  memcpy(*tab+24, &nchr, sizeof(uint64_t));
+  memcpy(*tab+32, ck, 32*nck);
+  memcpy(*tab+32+32*nck, dir, 16*nchr);
+  free(ck); free(dir);
+  return nb;
+}
+
+/**
+ * Position rdr so that the next row_reader_next_loc() returns row `row`
+ * (0-based).  Starts from rdr's current state when that is closer than the
+ * nearest checkpoint.
+ */
+void fmt7_seek(row_reader_t *rdr, const cdata_t *c, uint64_t row) {
+  f7_tab_t t;
+  if (fmt7_tab(c, &t)) {
+    uint64_t j = row / t.step;
+    if (j >= t.nck) j = t.nck-1;
+    if (row < rdr->index || j*t.step > rdr->index) fmt7_ckpt_restore(c, &t, j, rdr);
+  } else if (row < rdr->index) {
+    memset(rdr, 0, sizeof(row_reader_t));
+  }
+  while (rdr->index < row && row_reader_next_loc(rdr, c));
+}
+
+/**
+ * Position rdr before the first row on chromosome `chrm` with coordinate
+ * >= beg1.  Returns 0 (rdr undefined) when there is no such row.
+ */
+int fmt7_seek_loc(row_reader_t *rdr, const cdata_t *c, const char *chrm, uint64_t beg1) {
+  f7_tab_t t;
+  memset(rdr, 0, sizeof(row_reader_t));
+  if (fmt7_tab(c, &t)) {
+    uint64_t k;
+    for (k=0; k<t.nchr && strcmp((char*) c->s + f7_u64(t.dir, 2*k), chrm); ++k);
+    if (k == t.nchr) return 0;
+    uint64_t first = f7_u64(t.dir, 2*k+1);
+    uint64_t last = (k+1 < t.nchr) ? f7_u64(t.dir, 2*k+3) : UINT64_MAX;
+    if (first) {                // at the 0xff that ends the previous chromosome
+      rdr->loc = f7_u64(t.dir, 2*k) - 1;
+      rdr->index = first;
+    }
+    for (uint64_t j = first/t.step+1; j < t.nck && j*t.step < last; ++j) {
+      if (f7_u64(t.ck + 32*j, 2) >= beg1) break;
+      fmt7_ckpt_restore(c, &t, j, rdr);
+    }
+  }
+  for (;;) {
+    row_reader_t pre = *rdr;
+    if (!row_reader_next_loc(rdr, c)) return 0;
+    if (strcmp(rdr->chrm, chrm) == 0) {
+      if (rdr->value >= beg1) { *rdr = pre; return 1; }
+    } else if (pre.chrm && strcmp(pre.chrm, chrm) == 0) {
+      return 0;                 // walked past the chromosome
+    }
+  }
+}
+
+/**
+ * Return the CpG number, walking from the last checkpoint when there is one
  */
 uint64_t fmt7_data_length(const cdata_t *c) {
   row_reader_t rdr = {0};
-  uint64_t n = 0;
-  while (row_reader_next_loc(&rdr, c)) n++;
-  return n;
+  f7_tab_t t;
+  if (fmt7_tab(c, &t)) fmt7_ckpt_restore(c, &t, t.nck-1, &rdr);
+  uint64_t locs[256];
+  while (row_reader_next_n(&rdr, c, locs, 256));
+  return rdr.index;
 }
 
 /**
@@ -625,16 +902,17 @@ cdata_t fmt7_decompress(const cdata_t c) {
 
   row_reader_t rdr = {0};
   char *chrm = NULL;
-  uint64_t i = 0;
+  uint64_t i = 0, locs[256], k;
 
   char **chrms = NULL;
   int nchrms = 0;
 
   /* ------------------------------------------------------------------
-   * Pass 1: iterate original fmt7 data, collect chromosomes and pack
-   *         (chr_id, coordinate) into chrmlocs[].
+   * Pass 1: iterate original fmt7 data a chromosome batch at a time,
+   *         collect chromosomes and pack (chr_id, coordinate) into
+   *         chrmlocs[].
    * ------------------------------------------------------------------ */
-  while (row_reader_next_loc(&rdr, (cdata_t *)&c)) {
+  while ((k = row_reader_next_n(&rdr, &c, locs, 256))) {
     if (chrm != rdr.chrm) {   /* new chromosome encountered */
       chrm = rdr.chrm;
 
@@ -653,13 +931,13 @@ cdata_t fmt7_decompress(const cdata_t c) {
       nchrms++;
     }
 
-    if (i >= n) {
-      wzfatal("[fmt7_decompress] Internal error: more rows than fmt7_data_length (i=%"PRIu64", n=%"PRIu64")\n", i, n);
+    if (i + k > n) {
+      wzfatal("[fmt7_decompress] Internal error: more rows than fmt7_data_length (i=%"PRIu64", n=%"PRIu64")\n", i + k, n);
     }
 
     uint64_t chr_id = (uint64_t)(nchrms - 1);  /* index of current chromosome */
-    FMT7_SET_LOC(chrmlocs, i, chr_id, rdr.value);
-    i++;
+    for (uint64_t j = 0; j < k; ++j) FMT7_SET_LOC(chrmlocs, i+j, chr_id, locs[j]);
+    i += k;
   }
 
   if (i != n) {
@@ -732,7 +1010,7 @@ cdata_t fmt7_sliceToBlock(cdata_t *cr, uint64_t beg, uint64_t end) {
     exit(1);
   }
   
-  uint64_t n0 = fmt7_data_length(cr);
+  uint64_t n0 = cdata_n(cr);
   if (end > n0-1) end = n0-1; // 0-base
   if (beg > n0-1) {
     fprintf(stderr, "[%s:%d] Begin (%"PRIu64") is bigger than the data vector size (%"PRIu64").\n", __func__, __LINE__, beg, n0);
@@ -742,22 +1020,20 @@ cdata_t fmt7_sliceToBlock(cdata_t *cr, uint64_t beg, uint64_t end) {
 
   row_reader_t rdr = {0};
   uint64_t n = 0;
-  uint64_t i = 0, n_rec = 0;
+  uint64_t n_rec = 0;
   char *chrm = NULL; uint64_t last = 0;
   cdata_t cr2 = {0};
-  while (row_reader_next_loc(&rdr, cr)) {
-    if (i >= beg && i <= end) {
-      if (chrm != rdr.chrm) {
-        if (chrm) fmt7c_append_end(&(cr2.s), &n);
-        chrm = rdr.chrm;
-        fmt7c_append_chrm(chrm, &(cr2.s), &n);
-        last = 0;
-      }
-      fmt7c_append_loc(rdr.value - last, &(cr2.s), &n);
-      n_rec++;
-      last = rdr.value;
+  fmt7_seek(&rdr, cr, beg);
+  while (rdr.index <= end && row_reader_next_loc(&rdr, cr)) {
+    if (chrm != rdr.chrm) {
+      if (chrm) fmt7c_append_end(&(cr2.s), &n);
+      chrm = rdr.chrm;
+      fmt7c_append_chrm(chrm, &(cr2.s), &n);
+      last = 0;
     }
-    i++;
+    fmt7c_append_loc(rdr.value - last, &(cr2.s), &n);
+    n_rec++;
+    last = rdr.value;
   }
   if (n_rec != end - beg + 1) {
     fprintf(stderr, "[%s:%d] row slicing has inconsistent dimension (n: %"PRIu64", expected: %"PRIu64")\n", __func__, __LINE__, n_rec, end - beg + 1);
@@ -810,8 +1086,11 @@ cdata_t fmt7_sliceToMask(cdata_t *cr, cdata_t *c_mask) {
   uint64_t i = 0;
   char *chrm = NULL; uint64_t last = 0;
   cdata_t cr2 = {0};
-  while (row_reader_next_loc(&rdr, cr)) {
-    if (c_mask->s[i>>3]&(1<<(i&0x7))) {
+  fmt0_iter_t it; uint64_t beg = 0, end = 0;
+  fmt0_iter_init(&it, c_mask);
+  int more = fmt0_next_range(&it, &beg, &end); // rows past the last interval are not read
+  while (more && row_reader_next_loc(&rdr, cr)) {
+    if (i >= beg) {
       if (chrm != rdr.chrm) {
         if (chrm) fmt7c_append_end(&(cr2.s), &n);
         chrm = rdr.chrm;
@@ -821,7 +1100,7 @@ cdata_t fmt7_sliceToMask(cdata_t *cr, cdata_t *c_mask) {
       fmt7c_append_loc(rdr.value - last, &(cr2.s), &n);
       last = rdr.value;
     }
-    i++;
+    if (++i >= end) more = fmt0_next_range(&it, &beg, &end);
   }
   cr2.unit = cr->unit;
   cr2.fmt = cr->fmt;
@@ -91,7 +91,8 @@ static int parse_region(const char *reg, char **chrm_out,
 }
 
 /*
- * Scan format 7 to find row range and CpG count for a region.
+ * Find row range and CpG count for a region, starting from the first CpG
+ * at or after beg1 (fmt7_seek_loc() jumps there when the .cr has a table).
  */
 static void get_region_info(cdata_t *cr, const char *chrm,
                              uint64_t beg1, uint64_t end1,
@@ -99,20 +100,20 @@ static void get_region_info(cdata_t *cr, const char *chrm,
                              uint64_t *first_row, uint64_t *last_row,
                              uint64_t *last_cpg) {
   row_reader_t rdr = {0};
-  uint64_t n = 0;
+  uint64_t n = 0, locs[256], k, j;
   *first_row = *last_row = 0;
-
-  while (row_reader_next_loc(&rdr, cr)) {
-    if (strcmp(rdr.chrm, chrm) != 0) {
-      if (n > 0) break;
-      continue;
+  *n_out = 0;
+
+  if (!fmt7_seek_loc(&rdr, cr, chrm, beg1)) return;
+  while ((k = row_reader_next_n(&rdr, cr, locs, 256)) && strcmp(rdr.chrm, chrm) == 0) {
+    for (j=0; j<k && locs[j] <= end1; ++j);
+    if (j) {
+      if (n == 0) *first_row = rdr.index - k + 1;
+      n += j;
+      *last_row = rdr.index - k + j;
+      if (last_cpg) *last_cpg = locs[j-1];
     }
-    if (rdr.value < beg1) continue;
-    if (rdr.value > end1) break;
-    if (n == 0) *first_row = rdr.index;
-    n++;
-    *last_row = rdr.index;
-    if (last_cpg) *last_cpg = rdr.value;
+    if (j < k) break;
   }
   *n_out = n;
 }
@@ -125,22 +126,19 @@ static void get_win_pos(cdata_t *cr, const char *chrm,
                          uint64_t win_size, uint64_t n_cols,
                          uint64_t *win_pos) {
   row_reader_t rdr = {0};
-  uint64_t n = 0;
+  uint64_t n = 0, locs[256], k;
   uint64_t col = 0;
 
-  while (row_reader_next_loc(&rdr, cr)) {
-    if (strcmp(rdr.chrm, chrm) != 0) {
-      if (n > 0) break;
-      continue;
-    }
-    if (rdr.value < beg1) continue;
-    if (rdr.value > end1) break;
-
-    if (n == col * win_size) {
-      win_pos[col++] = rdr.value;
-      if (col == n_cols) break;
+  if (!fmt7_seek_loc(&rdr, cr, chrm, beg1)) return;
+  while ((k = row_reader_next_n(&rdr, cr, locs, 256)) && strcmp(rdr.chrm, chrm) == 0) {
+    for (uint64_t j=0; j<k; ++j) {
+      if (locs[j] > end1) return;
+      if (n == col * win_size) {
+        win_pos[col++] = locs[j];
+        if (col == n_cols) return;
+      }
+      n++;
     }
-    n++;
   }
 }
 
@@ -152,19 +150,20 @@ static chrom_info_t *collect_genome_chroms(cdata_t *cr, int *n_out) {
   row_reader_t  rdr = {0};
   chrom_info_t *ch  = NULL;
   int           n   = 0;
+  uint64_t      locs[256], k;
 
-  while (row_reader_next_loc(&rdr, cr)) {
+  while ((k = row_reader_next_n(&rdr, cr, locs, 256))) { /* one chromosome per batch */
     if (n == 0 || strcmp(rdr.chrm, ch[n - 1].chrm) != 0) {
       ch = realloc(ch, (size_t)(n + 1) * sizeof(chrom_info_t));
       ch[n].chrm      = strdup(rdr.chrm);
-      ch[n].first_row = rdr.index;
+      ch[n].first_row = rdr.index - k + 1;
       ch[n].last_row  = rdr.index;
-      ch[n].n_cpgs    = 1;
+      ch[n].n_cpgs    = k;
       ch[n].n_cols    = 0;
       n++;
     } else {
       ch[n - 1].last_row = rdr.index;
-      ch[n - 1].n_cpgs++;
+      ch[n - 1].n_cpgs += k;
     }
   }
   *n_out = n;
@@ -265,41 +264,31 @@ static void print_beta(double b, int color, int granular) {
   }
 }
 
-/* Decode one fmt3 record at byte *ip in the compressed stream s[].
- * Advances *ip. Returns number of rows covered; sets *M and *U.
- * Zero-runs have M=U=0 and nrows > 1; non-zero records have nrows = 1. */
-static inline uint64_t fmt3_next(const uint8_t *s, uint64_t *ip,
+/* Next run of a fmt3 cursor as (rows, M, U); 0 at the end.  Zero runs
+ * have M=U=0, the cursor is set to unfitted counts by the callers. */
+static inline uint64_t fmt3_next(cdata_cursor_t *cur, uint64_t *row,
                                   uint64_t *M, uint64_t *U) {
-  uint8_t type = s[*ip] & 0x3;
-  if (type == 0) {
-    uint16_t v; memcpy(&v, s + *ip, 2);
-    *ip += 2; *M = 0; *U = 0;
-    return (uint64_t)(v >> 2);
-  }
-  if (type == 1) {
-    *M = s[*ip] >> 5; *U = (s[*ip] >> 2) & 0x7; *ip += 1;
-  } else if (type == 2) {
-    uint16_t v; memcpy(&v, s + *ip, 2);
-    uint64_t mv = (uint64_t)(v >> 2); *U = mv & 0x7f; *M = mv >> 7; *ip += 2;
-  } else {
-    uint64_t v; memcpy(&v, s + *ip, 8);
-    uint64_t mv = v >> 2; *U = mv & 0x7fffffff; *M = mv >> 31; *ip += 8;
-  }
-  return 1;
+  if (!cdata_cursor_next(cur)) return 0;
+  *row = cur->row; *M = cur->v >> 32; *U = cur->v & 0xffffffff;
+  return cur->n;
 }
 
 /* Single-pass fmt3 region printer.
- * Walks the compressed stream once; accumulates windowed averages and emits
- * H/M/L/. directly — zero intermediate allocation. */
+ * Walks the compressed record once from the nearest row checkpoint;
+ * accumulates windowed averages and emits H/M/L/. directly — zero
+ * intermediate allocation. */
 static void stream_fmt3_region(const cdata_t *c,
                                 uint64_t first_row, uint64_t last_row,
                                 uint64_t win_size, uint64_t n_cols, int color, int granular) {
-  uint64_t i = 0, row = 0, pM = 0, pU = 0, prem = 0;
+  uint64_t row = 0, pM = 0, pU = 0, prem = 0;
   double   wsum = 0.0;
   uint64_t wvalid = 0, wpos = 0, wemit = 0;
+  cdata_cursor_t cur;
 
-  while (wemit < n_cols && (prem > 0 || i < c->n)) {
-    if (prem == 0) { if (i >= c->n) break; prem = fmt3_next(c->s, &i, &pM, &pU); }
+  cdata_cursor_init(&cur, c); cur.unit = 8;
+  cdata_cursor_seek(&cur, first_row);
+  while (wemit < n_cols) {
+    if (prem == 0 && !(prem = fmt3_next(&cur, &row, &pM, &pU))) break;
     if (row < first_row) {
       uint64_t skip = first_row - row;
       if (skip >= prem) { row += prem; prem = 0; continue; }
@@ -337,15 +326,17 @@ static void stream_fmt3_region(const cdata_t *c,
 static void stream_fmt3_genome(const cdata_t *c,
                                 const chrom_info_t *ch, int n_chroms,
                                 uint64_t win_size, int color, int granular) {
-  uint64_t i = 0, row = 0, pM = 0, pU = 0, prem = 0;
+  uint64_t row = 0, pM = 0, pU = 0, prem = 0;
+  cdata_cursor_t cur;
 
+  cdata_cursor_init(&cur, c); cur.unit = 8;
   for (int ci = 0; ci < n_chroms; ci++) {
     uint64_t cstart = ch[ci].first_row - 1, cend = ch[ci].last_row - 1;
     double   wsum = 0.0;
     uint64_t wvalid = 0, wpos = 0, wemit = 0;
 
-    while (row <= cend && (prem > 0 || i < c->n)) {
-      if (prem == 0) { if (i >= c->n) break; prem = fmt3_next(c->s, &i, &pM, &pU); }
+    while (row <= cend) {
+      if (prem == 0 && !(prem = fmt3_next(&cur, &row, &pM, &pU))) break;
       if (row < cstart) {
         uint64_t skip = cstart - row;
         if (skip >= prem) { row += prem; prem = 0; continue; }
@@ -410,7 +401,7 @@ static void print_region_sample_windowed(cdata_t *c, uint64_t start_idx, uint64_
       }
     } else if (c->fmt == '4') {
       for (uint64_t i = i0; i < i1; ++i) {
-        float v; memcpy(&v, c->s + i * c->unit, sizeof(float));
+        float v = fmt4_value(c, i);
         if (v >= 0.0f) { sum += (double)v; valid++; }
       }
     } else {
@@ -460,8 +451,7 @@ static void print_region_sample(cdata_t *c, uint64_t start_idx, uint64_t n_sites
       }
 
     } else if (c->fmt == '4') {
-      float v;
-      memcpy(&v, c->s + i * c->unit, sizeof(float));
+      float v = fmt4_value(c, i);
       if (v < 0.0f) {
         if (color) fputs(ANSI_NA, stdout);
         fputs(CH_NA, stdout);
@@ -516,11 +506,12 @@ int main_hprint(int argc, char *argv[]) {
 
     cfile_t cf_cr = open_cfile(fname_cr);
     cdata_t cr = read_cdata1(&cf_cr);
-    bgzf_close(cf_cr.fh);
+    cdata_detach(&cr);
+    cfile_close(&cf_cr);
     if (cr.fmt != '7')
       wzfatal("Reference must be format 7 (.cr), got '%c'.\n", cr.fmt);
 
-    uint64_t cr_n = fmt7_data_length(&cr);
+    uint64_t cr_n = cdata_n(&cr);
 
     uint64_t n_pos = 0, first_row = 0, last_row = 0, last_cpg = 0;
     get_region_info(&cr, chrm, beg1, end1, &n_pos, &first_row, &last_row, &last_cpg);
@@ -538,7 +529,7 @@ int main_hprint(int argc, char *argv[]) {
       cdata_t c_check = read_cdata1(&cf_check);
       uint64_t data_n = cdata_n(&c_check);
       free_cdata(&c_check);
-      bgzf_close(cf_check.fh);
+      cfile_close(&cf_check);
       if (data_n != cr_n)
         wzfatal("[hprint] Dimension mismatch: reference has %"PRIu64" CpGs "
                 "but data in %s has %"PRIu64". "
@@ -576,22 +567,24 @@ int main_hprint(int argc, char *argv[]) {
       if (cin.fmt == '3') {
         stream_fmt3_region(&cin, first_row - 1, last_row - 1, win_size, n_cols, color, granular);
       } else {
-        decompress_in_situ(&cin);
-        if (last_row > cin.n)
+        if (last_row > cdata_n(&cin))
           wzfatal("[hprint] Region rows %"PRIu64"-%"PRIu64" exceed data size "
                   "(%"PRIu64"). This should not happen if dimensions match.\n",
-                  first_row, last_row, cin.n);
+                  first_row, last_row, cdata_n(&cin));
+        /* decode only the region's rows */
+        cdata_t cr2 = decompress_range(&cin, first_row - 1, last_row - 1);
         if (win_size > 1)
-          print_region_sample_windowed(&cin, first_row - 1, n_pos, win_size, n_cols, color, granular);
+          print_region_sample_windowed(&cr2, 0, n_pos, win_size, n_cols, color, granular);
         else
-          print_region_sample(&cin, first_row - 1, n_pos, color, granular);
+          print_region_sample(&cr2, 0, n_pos, color, granular);
+        free_cdata(&cr2);
       }
       fputc('\n', stdout);
       free_cdata(&cin);
       si++;
     }
 
-    bgzf_close(cf.fh);
+    cfile_close(&cf);
     cleanSampleNames2(snames);
     free(chrm); free(fname_cr); free(region);
     return 0;
@@ -601,11 +594,12 @@ int main_hprint(int argc, char *argv[]) {
   if (fname_cr) {
     cfile_t cf_cr = open_cfile(fname_cr);
     cdata_t cr    = read_cdata1(&cf_cr);
-    bgzf_close(cf_cr.fh);
+    cdata_detach(&cr);
+    cfile_close(&cf_cr);
     if (cr.fmt != '7')
       wzfatal("Reference must be format 7 (.cr), got '%c'.\n", cr.fmt);
 
-    uint64_t cr_n = fmt7_data_length(&cr);
+    uint64_t cr_n = cdata_n(&cr);
 
     int           n_chroms = 0;
     chrom_info_t *ch       = collect_genome_chroms(&cr, &n_chroms);
@@ -620,7 +614,7 @@ int main_hprint(int argc, char *argv[]) {
       cdata_t  c_check  = read_cdata1(&cf_check);
       uint64_t data_n   = cdata_n(&c_check);
       free_cdata(&c_check);
-      bgzf_close(cf_check.fh);
+      cfile_close(&cf_check);
       if (data_n != cr_n)
         wzfatal("[hprint] Dimension mismatch: reference has %"PRIu64" CpGs "
                 "but data in %s has %"PRIu64". "
@@ -671,7 +665,7 @@ int main_hprint(int argc, char *argv[]) {
     }
 
 
-    bgzf_close(cf.fh);
+    cfile_close(&cf);
     cleanSampleNames2(snames);
     for (int i = 0; i < n_chroms; i++) free(ch[i].chrm);
     free(ch);
@@ -690,7 +684,7 @@ int main_hprint(int argc, char *argv[]) {
       fprintf(stderr, "[hprint] Only format 6 supported in full-dataset mode "
               "(got '%c'). Use -r/-R for other formats.\n", c2.fmt);
       free_cdata(&c2);
-      bgzf_close(cf.fh);
+      cfile_close(&cf);
       return 1;
     }
 
@@ -712,7 +706,7 @@ int main_hprint(int argc, char *argv[]) {
     free_cdata(&c2);
   }
 
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
   if (fname_cr) free(fname_cr);
   if (region)   free(region);
   return 0;
@@ -21,9 +21,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "kstring.h"
 #include "cfile.h"
 
+#define BIDX_MAGIC "CXBIDX1"
+#define BIDX_BOM 0x0102030405060708ull
+#define BIDX_HDR 48
+
 char *get_fname_index(const char *fname_cx) {
   char *fname_index = NULL;
   fname_index = malloc(strlen(fname_cx) + strlen(".idx") + 1);
@@ -36,6 +44,159 @@ char *get_fname_index(const char *fname_cx) {
   return fname_index;
 }
 
+char *get_fname_bindex(const char *fname_cx) {
+  char *fname_bidx = malloc(strlen(fname_cx) + strlen(".bidx") + 1);
+  if (fname_bidx == NULL) {
+    printf("Failed to allocate memory for index file name\n");
+    return NULL;
+  }
+  strcpy(fname_bidx, fname_cx);
+  strcat(fname_bidx, ".bidx");
+  return fname_bidx;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+  return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* names and ids all point inside the mapping */
+static int bindex_valid(const bindex_t *bidx, uint64_t pool_bytes) {
+  if (bidx->n && (!pool_bytes || bidx->pool[pool_bytes-1] != '\0')) return 0;
+  for (uint64_t i=0; i<bidx->n; ++i)
+    if (bidx->name_off[i] >= pool_bytes || bidx->sorted[i] >= bidx->n) return 0;
+  return 1;
+}
+
+bindex_t *loadBinaryIndex(const char *fname_cx) {
+  char *fname_bidx = get_fname_bindex(fname_cx);
+  char *fname_index = get_fname_index(fname_cx);
+  struct stat st, st_cx, st_txt;
+  int fd = open(fname_bidx, O_RDONLY);
+  int ok = (fd >= 0 && fstat(fd, &st) == 0 && (size_t) st.st_size >= BIDX_HDR && stat(fname_cx, &st_cx) == 0);
+  /* the text index is authoritative; skip a .bidx that predates it */
+  if (ok && stat(fname_index, &st_txt) == 0 && mtime_ns(&st_txt) > mtime_ns(&st)) ok = 0;
+  free(fname_bidx); free(fname_index);
+  if (!ok) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+
+  uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  /* the .cx it was written for, so a rewritten .cx invalidates it */
+  uint64_t bom, n, pool_bytes, cx_size; int64_t cx_mtime;
+  memcpy(&bom, map+8, sizeof(uint64_t));
+  memcpy(&n, map+16, sizeof(uint64_t));
+  memcpy(&pool_bytes, map+24, sizeof(uint64_t));
+  memcpy(&cx_size, map+32, sizeof(uint64_t));
+  memcpy(&cx_mtime, map+40, sizeof(int64_t));
+  uint64_t max_n = ((uint64_t) st.st_size - BIDX_HDR) / (8+8+4);
+  uint64_t off_pool = BIDX_HDR + (n <= max_n ? n : 0)*(8+8+4);
+  off_pool = (off_pool + 7) & ~7ul;
+  if (memcmp(map, BIDX_MAGIC, 8) != 0 || bom != BIDX_BOM || n > max_n || pool_bytes > (uint64_t) st.st_size ||
+      off_pool + pool_bytes != (uint64_t) st.st_size ||
+      cx_size != (uint64_t) st_cx.st_size || cx_mtime != mtime_ns(&st_cx)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  bindex_t *bidx = calloc(1, sizeof(bindex_t));
+  bidx->map = map;
+  bidx->map_size = st.st_size;
+  bidx->n = n;
+  bidx->addr = (const int64_t*) (map + BIDX_HDR);
+  bidx->name_off = (const uint64_t*) (map + BIDX_HDR + n*8);
+  bidx->sorted = (const uint32_t*) (map + BIDX_HDR + n*16);
+  bidx->pool = (const char*) (map + off_pool);
+  if (!bindex_valid(bidx, pool_bytes)) {
+    fprintf(stderr, "[%s:%d] Ignoring corrupted binary index of %s.\n", __func__, __LINE__, fname_cx);
+    freeBinaryIndex(bidx);
+    return NULL;
+  }
+  return bidx;
+}
+
+void freeBinaryIndex(bindex_t *bidx) {
+  if (bidx == NULL) return;
+  munmap(bidx->map, bidx->map_size);
+  free(bidx);
+}
+
+int64_t bindex_get(const bindex_t *bidx, const char *sname) {
+  uint64_t lo = 0, hi = bidx->n;
+  while (lo < hi) {
+    uint64_t mid = lo + ((hi - lo)>>1);
+    int cmp = strcmp(bindex_name(bidx, bidx->sorted[mid]), sname);
+    if (cmp == 0) return bidx->addr[bidx->sorted[mid]];
+    if (cmp < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return -1;
+}
+
+static int compareKeys(const void* a, const void* b) {
+  return strcmp(((const index_pair_t*)a)->key, ((const index_pair_t*)b)->key);
+}
+
+int writeBinaryIndex(const char *fname_cx, index_t *idx) {
+  struct stat st_cx;
+  if (stat(fname_cx, &st_cx) != 0) return -1;
+  int n = 0;
+  index_pair_t *pairs = index_pairs(idx, &n);
+  uint64_t pool_bytes = 0;
+  for (int i=0; i<n; ++i) pool_bytes += strlen(pairs[i].key) + 1;
+
+  uint64_t off_pool = BIDX_HDR + (uint64_t) n*(8+8+4);
+  off_pool = (off_pool + 7) & ~7ul;
+  uint8_t *buf = calloc(off_pool + pool_bytes, 1);
+  int64_t *addr = (int64_t*) (buf + BIDX_HDR);
+  uint64_t *name_off = (uint64_t*) (buf + BIDX_HDR + (uint64_t) n*8);
+  uint32_t *sorted = (uint32_t*) (buf + BIDX_HDR + (uint64_t) n*16);
+  char *pool = (char*) (buf + off_pool);
+
+  memcpy(buf, BIDX_MAGIC, 8);
+  uint64_t bom = BIDX_BOM, n64 = n, cx_size = st_cx.st_size;
+  int64_t cx_mtime = mtime_ns(&st_cx);
+  memcpy(buf+8, &bom, sizeof(uint64_t));
+  memcpy(buf+16, &n64, sizeof(uint64_t));
+  memcpy(buf+24, &pool_bytes, sizeof(uint64_t));
+  memcpy(buf+32, &cx_size, sizeof(uint64_t));
+  memcpy(buf+40, &cx_mtime, sizeof(int64_t));
+  uint64_t p = 0;
+  for (int i=0; i<n; ++i) {
+    addr[i] = pairs[i].value;
+    name_off[i] = p;
+    strcpy(pool + p, pairs[i].key);
+    p += strlen(pairs[i].key) + 1;
+    pairs[i].value = i;         // reuse as record id for the name sort
+  }
+  qsort(pairs, n, sizeof(index_pair_t), compareKeys);
+  for (int i=0; i<n; ++i) sorted[i] = pairs[i].value;
+  clean_index_pairs(pairs, n);
+
+  int ret = 0;
+  char *fname_bidx = get_fname_bindex(fname_cx);
+  FILE *out = fopen(fname_bidx, "wb");
+  if (out == NULL || fwrite(buf, 1, off_pool + pool_bytes, out) != off_pool + pool_bytes) ret = -1;
+  if (out && fclose(out) != 0) ret = -1;
+  free(fname_bidx);
+  free(buf);
+  return ret;
+}
+
+void updateBinaryIndex(const char *fname_cx, index_t *idx, int create) {
+  char *fname_bidx = get_fname_bindex(fname_cx);
+  if ((create || access(fname_bidx, F_OK) == 0) && writeBinaryIndex(fname_cx, idx) != 0) {
+    unlink(fname_bidx);         // a stale one would resolve names to old offsets
+    fprintf(stderr, "[%s:%d] Cannot write binary index %s.\n", __func__, __LINE__, fname_bidx);
+    fflush(stderr);
+    if (create) exit(1);
+  }
+  free(fname_bidx);
+}
+
 index_t* loadIndex(char* fname_index) {
   gzFile file = wzopen(fname_index, 0);
   if (file == NULL) {
@@ -112,11 +273,11 @@ static index_t* append_index(index_t *idx, cfile_t *cf, char* sname_to_append) {
   int64_t addr;
   cdata_t c = {0};
   if (kh_size(idx) == 0) {      /* first item in index */
-    addr = bgzf_tell(cf->fh);
+    addr = cfile_tell(cf);
   } else {
-    assert(bgzf_seek(cf->fh, last_address(idx), SEEK_SET) == 0);
+    assert(cfile_seek(cf, last_address(idx)) == 0);
     read_cdata2(cf, &c);         /* read past the last c data block */
-    addr = bgzf_tell(cf->fh);
+    addr = cfile_tell(cf);
   }
   read_cdata2(cf, &c);      /* make sure we do have one additional data block */
   if (c.n > 0) {
@@ -176,6 +337,16 @@ void clean_index_pairs(index_pair_t *idx_pairs, int n) {
 /* } */
 
 snames_t loadSampleNamesFromIndex(char *fname) {
+  bindex_t *bidx = loadBinaryIndex(fname);
+  if (bidx) {                   // already in record order; names stay in the pool
+    snames_t snames = {0};
+    snames.n = bidx->n;
+    snames.s = calloc(snames.n, sizeof(char*));
+    for (int i=0; i<snames.n; ++i) snames.s[i] = (char*) bindex_name(bidx, i);
+    snames.bidx = bidx;
+    return snames;
+  }
+
   char *fname_index = get_fname_index(fname);
   index_t *idx = loadIndex(fname_index);
   snames_t snames = {0};
@@ -213,6 +384,8 @@ static int usage() {
   fprintf(stderr, "    -s [file path]   tab-delimited sample name list (use first column) \n");
   fprintf(stderr, "    -1 [sample name] add one sample to the end of the index\n");
   fprintf(stderr, "    -c               output index to console\n");
+  fprintf(stderr, "    -b               also write a binary index <in.cx>.bidx (refreshed\n");
+  fprintf(stderr, "                     automatically once it exists)\n");
   fprintf(stderr, "    -h               This help\n");
   fprintf(stderr, "\n");
 
@@ -221,12 +394,13 @@ static int usage() {
 
 int main_index(int argc, char *argv[]) {
 
-  int c0, console = 0;
+  int c0, console = 0, binary = 0;
   char *fname_snames = NULL;
   char *sname_to_append = NULL;
-  while ((c0 = getopt(argc, argv, "cs:1:h"))>=0) {
+  while ((c0 = getopt(argc, argv, "cbs:1:h"))>=0) {
     switch (c0) {
     case 'c': console = 1; break;
+    case 'b': binary = 1; break;
     case 's': fname_snames = strdup(optarg); break;
     case '1': sname_to_append = strdup(optarg); break;
     case 'h': return usage(); break;
@@ -242,6 +416,7 @@ int main_index(int argc, char *argv[]) {
   /* load index */
   char *fname_index = get_fname_index(argv[optind]);
   cfile_t cf = open_cfile(argv[optind]);
+  if (cf.fl) wzfatal("Flat containers are indexed by yame flatten; index the BGZF .cx instead.\n");
   cdata_t c = {0};
   if (sname_to_append) {        /* append new sample to existing index */
     
@@ -257,7 +432,10 @@ int main_index(int argc, char *argv[]) {
     if (console) out = stdout;
     else out = fopen(fname_index, "w");
     writeIndex(out, idx);
-    if (!console) fclose(out);
+    if (!console) {
+      fclose(out);
+      updateBinaryIndex(argv[optind], idx, binary);
+    }
     
   } else {                      /* index all samples */
     
@@ -266,7 +444,7 @@ int main_index(int argc, char *argv[]) {
     index_t* idx = kh_init(index);
 
     if (snames.n >0) {               /* sample names is given */
-      int64_t addr = bgzf_tell(cf.fh);
+      int64_t addr = cfile_tell(&cf);
       for (int i=0; i< snames.n; ++i) {
         if (!read_cdata2(&cf, &c)) {
           fprintf(stderr, "[Error] Data is shorter than the sample name list.\n");
@@ -274,13 +452,13 @@ int main_index(int argc, char *argv[]) {
           exit(1);
         }
         insert_index(idx, snames.s[i], addr);
-        addr = bgzf_tell(cf.fh);
+        addr = cfile_tell(&cf);
       }
       
     } else {                    /* sample names are unknown */
 
       for (n=0; ; ++n) {
-        int64_t addr = bgzf_tell(cf.fh);
+        int64_t addr = cfile_tell(&cf);
         if (!read_cdata2(&cf, &c)) break;
         sname_v = realloc(sname_v, sizeof(kstring_t)*(n+1));
         addr_v = realloc(addr_v, sizeof(int64_t)*(n+1));
@@ -298,7 +476,10 @@ int main_index(int argc, char *argv[]) {
     if (console) out = stdout;
     else out = fopen(fname_index, "w");
     writeIndex(out, idx);
-    if (!console) fclose(out);
+    if (!console) {
+      fclose(out);
+      updateBinaryIndex(argv[optind], idx, binary);
+    }
 
     if (snames.n >0) {
       cleanSampleNames(&snames);
@@ -312,7 +493,7 @@ int main_index(int argc, char *argv[]) {
 
   free(fname_snames);
   free(fname_index);
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
   free(c.s);
   return 0;
 }
@@ -151,4 +151,78 @@ index_t *insert_index(index_t *idx, char *sname, int64_t addr);
 
 snames_t loadSampleNamesFromIndex(char *fname);
 
+/*************************************
+ ** Binary sample index (.bidx)      **
+ *************************************
+ * A read-only, mmap-able alternative to the text index, written next to it
+ * as <in.cx>.bidx by "yame index -b". Integers are in the byte order of
+ * the host that wrote it, so they map as they are:
+ *
+ *     char     magic[8]           "CXBIDX1\0"
+ *     uint64_t bom                0x0102030405060708, as the writer stores it
+ *     uint64_t n                  number of records
+ *     uint64_t pool_bytes         size of the name pool
+ *     uint64_t cx_size            size of <in.cx> when written
+ *     int64_t  cx_mtime           its modification time, in ns
+ *     int64_t  addr[n]            virtual offsets, in record order
+ *     uint64_t name_off[n]        name offsets into pool, in record order
+ *     uint32_t sorted[n]          record ids sorted by name (strcmp)
+ *     (zero padding to 8 bytes)
+ *     char     pool[pool_bytes]   NUL-terminated sample names
+ *
+ * Names resolve by binary search over sorted[], so opening costs one mmap
+ * and no parsing. A .bidx from a host of the other byte order reads back
+ * a different bom and is ignored. The text index stays the source of
+ * truth: a .bidx older than the text index, or written for a different
+ * size or mtime of the .cx, is treated as stale and ignored. Every writer
+ * of a .idx refreshes an existing .bidx through updateBinaryIndex().
+ */
+typedef struct bindex_t {
+  uint8_t *map;                 // mmap'ed file
+  size_t map_size;
+  uint64_t n;                   // number of records
+  const int64_t *addr;          // record order
+  const uint64_t *name_off;     // record order
+  const uint32_t *sorted;       // record ids sorted by name
+  const char *pool;
+} bindex_t;
+
+char *get_fname_bindex(const char *fname_cx);
+
+/**
+ * Maps the binary index of fname_cx.
+ *
+ * @return NULL if there is no binary index, it is stale, or it is invalid.
+ */
+bindex_t *loadBinaryIndex(const char *fname_cx);
+void freeBinaryIndex(bindex_t *bidx);
+
+static inline const char *bindex_name(const bindex_t *bidx, uint64_t i) {
+  return bidx->pool + bidx->name_off[i];
+}
+
+/* virtual offset of sample sname, or -1 if not found */
+int64_t bindex_get(const bindex_t *bidx, const char *sname);
+
+/* resolves sname through bidx when it is loaded, else through idx */
+static inline int64_t index_lookup(const bindex_t *bidx, index_t *idx, char *sname) {
+  return bidx ? bindex_get(bidx, sname) : getIndex(idx, sname);
+}
+
+/**
+ * Writes idx as <fname_cx>.bidx in the binary layout above, stamped with
+ * the current size and mtime of fname_cx. Records are ordered by address,
+ * the same order writeIndex() uses.
+ *
+ * @return 0 on success, -1 on I/O error.
+ */
+int writeBinaryIndex(const char *fname_cx, index_t *idx);
+
+/**
+ * Call after writing the text index of fname_cx: rewrites its .bidx when
+ * create is set or one already exists. A .bidx that cannot be rewritten is
+ * removed; with create set that is also fatal.
+ */
+void updateBinaryIndex(const char *fname_cx, index_t *idx, int create);
+
 #endif
@@ -34,10 +34,12 @@ static int usage() {
 }
 
 static void cdata_length(cdata_t *c, uint64_t *n, uint8_t *u) {
-  cdata_t inflated = decompress(*c);
-  *n = inflated.n;
-  *u = inflated.unit;
-  free(inflated.s);
+  if (c->nrow) { // from the record header
+    *n = c->nrow;
+    *u = c->unit;
+  } else {
+    *n = cdata_dims(c, u);
+  }
 }
 
 int main_info(int argc, char *argv[]) {
@@ -108,7 +110,7 @@ int main_info(int argc, char *argv[]) {
       if (report1) break;
     }
     cleanSampleNames2(snames);
-    bgzf_close(cf.fh);
+    cfile_close(&cf);
   }
   return 0;
 }
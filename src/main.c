@@ -49,6 +49,10 @@ int main_mask(int argc, char *argv[]);
 int main_dsample(int argc, char *argv[]);
 int main_binarize(int argc, char *argv[]);
 int main_perturb(int argc, char *argv[]);
+int main_retile(int argc, char *argv[]);
+int main_cat(int argc, char *argv[]);
+int main_flatten(int argc, char *argv[]);
+int main_unflatten(int argc, char *argv[]);
 
 #define PACKAGE_VERSION "v1.9"
 
@@ -61,7 +65,13 @@ static int usage(void)
   fprintf(stderr, "Contact: Wanding Zhou <wanding.zhou@pennmedicine.upenn.edu>\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Usage:\n");
-  fprintf(stderr, "  yame <command> [options] [args]\n");
+  fprintf(stderr, "  yame [-@ <threads>] [-l <level>] <command> [options] [args]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Global options:\n");
+  fprintf(stderr, "  -@ <int>     Threads for BGZF (de)compression of .cx files (default: 1)\n");
+  fprintf(stderr, "  -l <0-9>     BGZF level of written .cx (default: zlib default, or 0, no\n");
+  fprintf(stderr, "               deflate, when stdout is a pipe or FIFO; output redirected\n");
+  fprintf(stderr, "               to a file is deflated)\n");
   fprintf(stderr, "\n");
 
   fprintf(stderr, "Core I/O:\n");
@@ -74,6 +84,10 @@ static int usage(void)
   fprintf(stderr, "  index        Create/refresh a sample index for a .cx file\n");
   fprintf(stderr, "  split        Split a multi-sample .cx into single-sample files\n");
   fprintf(stderr, "  info         Show basic metadata/parameters of a .cx file\n");
+  fprintf(stderr, "  retile       Store a .cx as row x sample tiles for windowed reads\n");
+  fprintf(stderr, "  cat          Concatenate .cx files without decompressing; merges indices\n");
+  fprintf(stderr, "  flatten      Store a .cx uncompressed and memory-mapped for hot datasets\n");
+  fprintf(stderr, "  unflatten    Convert a flattened .cx back to BGZF\n");
   fprintf(stderr, "\n");
 
   fprintf(stderr, "Subsetting / chunking:\n");
@@ -105,6 +119,22 @@ static int usage(void)
 
 int main(int argc, char *argv[]) {
   int ret;
+  /* global options precede the command */
+  while (argc > 1 && (strncmp(argv[1], "-@", 2) == 0 || strncmp(argv[1], "-l", 2) == 0)) {
+    char *val = argv[1][2] ? argv[1]+2 : (argc > 2 ? argv[2] : NULL);
+    if (argv[1][1] == 'l') {
+      if (!val || val[0] < '0' || val[0] > '9' || val[1]) {
+        fprintf(stderr, "[main] -l expects a BGZF level from 0 to 9\n");
+        return 1;
+      }
+      cfile_level = val[0] - '0';
+    } else if (!val || atoi(val) < 1) {
+      fprintf(stderr, "[main] -@ expects a positive number of threads\n");
+      return 1;
+    } else cfile_n_threads = atoi(val);
+    int shift = argv[1][2] ? 1 : 2;
+    argc -= shift; argv += shift;
+  }
   if (argc < 2) return usage();
   if (strcmp(argv[1], "pack") == 0) ret = main_pack(argc-1, argv+1);
   else if (strcmp(argv[1], "unpack") == 0) ret = main_unpack(argc-1, argv+1);
@@ -123,6 +153,10 @@ int main(int argc, char *argv[]) {
   else if (strcmp(argv[1], "binarize") == 0) ret = main_binarize(argc-1, argv+1);
   else if (strcmp(argv[1], "dsample") == 0) ret = main_dsample(argc-1, argv+1);
   else if (strcmp(argv[1], "perturb") == 0) ret = main_perturb(argc-1, argv+1);
+  else if (strcmp(argv[1], "retile") == 0) ret = main_retile(argc-1, argv+1);
+  else if (strcmp(argv[1], "cat") == 0) ret = main_cat(argc-1, argv+1);
+  else if (strcmp(argv[1], "flatten") == 0) ret = main_flatten(argc-1, argv+1);
+  else if (strcmp(argv[1], "unflatten") == 0) ret = main_unflatten(argc-1, argv+1);
   else {
     fprintf(stderr, "[main] unrecognized command '%s'\n", argv[1]);
     return 1;
@@ -27,7 +27,8 @@ static int usage() {
   fprintf(stderr, "Usage: yame mask [options] <in.cg> <mask.cx>\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Options:\n");
-  fprintf(stderr, "    -o        output cx file name. if missing, output to stdout without index.\n");
+  fprintf(stderr, "    -o        output cx file name, indexed with the input sample names.\n");
+  fprintf(stderr, "              if missing, output to stdout without index.\n");
   fprintf(stderr, "    -c        contextualize binary input to format 6 using '1's in mask.\n");
   fprintf(stderr, "              if format 3 is used as mask, then use M+U>0 (coverage).\n");
   fprintf(stderr, "              implicit for format 6 input (output is always format 6).\n");
@@ -38,35 +39,45 @@ static int usage() {
   return 1;
 }
 
-void mask_fmt3(cdata_t *c, cdata_t c_mask, BGZF *fp_out) {
-  for (uint64_t i=0; i<c->n; ++i) {
-    if (FMT0_IN_SET(c_mask, i)) {
-      f3_set_mu(c, i, 0, 0);
+/* c is compressed: only its non-zero runs are visited, the masked copy is
+   built inflated for fmt3_compress() */
+void mask_fmt3(cdata_t *c, cdata_t c_mask, cfile_writer_t *w, const char *sname) {
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  cdata_t c3 = {.fmt = '3', .n = c_mask.n, .unit = cur.unit};
+  c3.s = calloc(c3.n, c3.unit);
+  while (cdata_cursor_next(&cur)) {
+    if (!cur.v) continue;
+    for (uint64_t i=cur.row; i<cur.row+cur.n; ++i) {
+      if (!FMT0_IN_SET(c_mask, i)) {
+        f3_set_mu(&c3, i, cur.v>>32, cur.v<<32>>32);
+      }
     }
   }
-  cdata_compress(c);
-  cdata_write1(fp_out, c);
+  cdata_compress(&c3);
+  cfile_writer_write(w, &c3, sname);
+  free_cdata(&c3);
 }
 
-void mask_fmt0(cdata_t *c, cdata_t c_mask, BGZF *fp_out) {
+void mask_fmt0(cdata_t *c, cdata_t c_mask, cfile_writer_t *w, const char *sname) {
   for (uint64_t i=0; i<cdata_nbytes(c); ++i) {
     c->s[i] &= ~c_mask.s[i];
   }
   /* cdata_compress(&c); */
-  cdata_write1(fp_out, c);
+  cfile_writer_write(w, c, sname);
 }
 
-void mask_fmt6(cdata_t *c, cdata_t c_mask, BGZF *fp_out) {
+void mask_fmt6(cdata_t *c, cdata_t c_mask, cfile_writer_t *w, const char *sname) {
   for (uint64_t i = 0; i < c->n; ++i) {
     if (!FMT6_IN_UNI(*c, i) || !FMT0_IN_SET(c_mask, i)) {
       FMT6_SET_NA(*c, i);
     }
   }
   cdata_compress(c);
-  cdata_write1(fp_out, c);
+  cfile_writer_write(w, c, sname);
 }
 
-void fmt0ContextualizeFmt6(cdata_t *c, cdata_t c_mask, BGZF *fp_out) {
+void fmt0ContextualizeFmt6(cdata_t *c, cdata_t c_mask, cfile_writer_t *w, const char *sname) {
   cdata_t c6 = {.fmt = '6', .n = c->n};
   c6.s = calloc((c6.n+3)/4, sizeof(uint8_t));
   for (uint64_t i=0; i<c6.n; ++i) {
@@ -76,10 +87,18 @@ void fmt0ContextualizeFmt6(cdata_t *c, cdata_t c_mask, BGZF *fp_out) {
     }
   }
   cdata_compress(&c6);
-  cdata_write1(fp_out, &c6);
+  cfile_writer_write(w, &c6, sname);
   free_cdata(&c6);
 }
 
+// runs on the read-ahead thread: format 1 queries are masked as format 0,
+// format 3 queries are walked compressed
+static void prep_query(cdata_t *raw, cdata_t *out) {
+  if (raw->fmt == '3') { cdata_prep_raw(raw, out); return; }
+  if (raw->fmt == '1') convertToFmt0(raw);
+  decompress_into(raw, out);
+}
+
 int main_mask(int argc, char *argv[]) {
 
   int c, reverse = 0, contextualize_to_fmt6 = 0;
@@ -104,7 +123,7 @@ int main_mask(int argc, char *argv[]) {
 
   cfile_t cf_mask = open_cfile(fname_mask);
   cdata_t c_mask = read_cdata1(&cf_mask);
-  if (c_mask.fmt == '1') convertToFmt0(&c_mask);
+  if (c_mask.fmt <= '1') convertToFmt0(&c_mask); // also unpacks sparse fmt0
   if (c_mask.fmt == '3') convertToFmt0(&c_mask);
   if (c_mask.fmt != '0') wzfatal("Mask format not supported (only format 0 allowed).");
   if (reverse) {
@@ -113,48 +132,42 @@ int main_mask(int argc, char *argv[]) {
     }
   }
 
-  BGZF *fp_out;
-  if (fname_out) fp_out = bgzf_open2(fname_out, "w");
-  else fp_out = bgzf_dopen(fileno(stdout), "w");
-  if (fp_out == NULL) {
-    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
-    exit(1);
-  }
-
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
   cfile_t cf = open_cfile(fname);
-  while (1) {
-    cdata_t c = read_cdata1(&cf);
-    if (c.n == 0) break;
-    if (c.fmt == '1') convertToFmt0(&c);
-    decompress_in_situ(&c);
-    if (c.n != c_mask.n) {
-      fprintf(stderr, "[%s:%d] mask (n=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask.n, c.n);
+  snames_t snames = loadSampleNamesFromIndex(fname);
+  cdata_t *c_in;
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, prep_query, NULL);
+  for (int64_t k = 0; (c_in = cfile_prefetch_next(pf)); ++k) {
+    const char *sname = k < snames.n ? snames.s[k] : NULL;
+    if (cdata_n(c_in) != c_mask.n) {
+      fprintf(stderr, "[%s:%d] mask (n=%"PRIu64") and query (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask.n, cdata_n(c_in));
       fflush(stderr);
       exit(1);
     }
 
-    if (c.fmt == '3') {
-      mask_fmt3(&c, c_mask, fp_out);
-    } else if (c.fmt == '0') {
+    if (c_in->fmt == '3') {
+      mask_fmt3(c_in, c_mask, w, sname);
+    } else if (c_in->fmt == '0') {
       if (contextualize_to_fmt6) {
-        fmt0ContextualizeFmt6(&c, c_mask, fp_out);
+        fmt0ContextualizeFmt6(c_in, c_mask, w, sname);
       } else {
-        mask_fmt0(&c, c_mask, fp_out);
+        mask_fmt0(c_in, c_mask, w, sname);
       }
-    } else if (c.fmt == '6') {
-      mask_fmt6(&c, c_mask, fp_out);
+    } else if (c_in->fmt == '6') {
+      mask_fmt6(c_in, c_mask, w, sname);
     } else {
-      fprintf(stderr, "[%s:%d] Only format %d files are supported.\n", __func__, __LINE__, c.fmt);
+      fprintf(stderr, "[%s:%d] Only format %d files are supported.\n", __func__, __LINE__, c_in->fmt);
       fflush(stderr);
       exit(1);
     }
-    free_cdata(&c);
   }
+  cfile_prefetch_close(pf);
 
+  cfile_writer_close(w);
+  cleanSampleNames(&snames);
   if (fname_out) free(fname_out);
-  bgzf_close(fp_out);
   free_cdata(&c_mask);
-  bgzf_close(cf.fh);
-  bgzf_close(cf_mask.fh);
+  cfile_close(&cf);
+  cfile_close(&cf_mask);
   return 0;
 }
@@ -22,7 +22,10 @@
 #include <string.h>
 #include <zlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "cfile.h"
+#include "kstring.h"
 
 static int usage() {
   fprintf(stderr, "\n");
@@ -32,7 +35,20 @@ static int usage() {
   fprintf(stderr, "dimension and order of the reference CpG BED file.\n\n");
 
   fprintf(stderr, "Options:\n");
-  fprintf(stderr, "    -f [char] Format specification (one of b,c,s,m,d,n,r):\n");
+  fprintf(stderr, "    -f [char] Format specification (one of a,b,c,s,m,d,n,r):\n");
+  fprintf(stderr, "              (a) Auto (default, also -f auto).\n");
+  fprintf(stderr, "                  The kind of data is told from every row:\n");
+  fprintf(stderr, "                  BED → r; two integer columns → d when all are\n");
+  fprintf(stderr, "                  0/1 and no row is \"1 0\", m otherwise; one column\n");
+  fprintf(stderr, "                  of 0/1 → b, of fractions or NA → n, of single\n");
+  fprintf(stderr, "                  characters → c, anything else → s.  On stdin\n");
+  fprintf(stderr, "                  the first 100000 rows decide and a later row\n");
+  fprintf(stderr, "                  that does not fit is an error.  The encoding\n");
+  fprintf(stderr, "                  is then picked per record by trial: binary data\n");
+  fprintf(stderr, "                  as bits (format 0) or runs (format 1), characters\n");
+  fprintf(stderr, "                  as runs (format 1) or states (format 2), fractions\n");
+  fprintf(stderr, "                  as 8/16-bit codes when that is exact (see -u).\n");
+  fprintf(stderr, "\n");
   fprintf(stderr, "              (b) Binary data (format 0).\n");
   fprintf(stderr, "                  Each entry is 0 or 1.\n");
   fprintf(stderr, "                  Example (single-sample, one column):\n");
@@ -93,6 +109,11 @@ static int usage() {
   fprintf(stderr, "    -u [int]  Number of bytes per unit when inflated (1-8).\n");
   fprintf(stderr, "              Lower values are more memory efficient but may be lossier.\n");
   fprintf(stderr, "              0 - infer from data.\n");
+  fprintf(stderr, "              Format 4 (n): 1 or 2 stores betas as 8- or 16-bit codes\n");
+  fprintf(stderr, "              (resolution 1/254 or 1/65534); otherwise 32-bit floats.\n");
+  fprintf(stderr, "    -w [float] Auto mode: weight of decoding cost against size (default 0,\n");
+  fprintf(stderr, "              smallest wins).  Encodings that readers walk run by run\n");
+  fprintf(stderr, "              count (1+w) times their bytes, bit vectors their bytes.\n");
   fprintf(stderr, "    -v        Verbose mode.\n");
   fprintf(stderr, "    -h        Display this help message.\n\n");
 
@@ -103,19 +124,274 @@ cdata_t *fmt0_read_raw(char *fname, int verbose);
 cdata_t *fmt1_read_raw(char *fname, int verbose);
 cdata_t *fmt2_read_raw(char *fname, int verbose);
 cdata_t *fmt3_read_raw(char *fname, uint8_t unit, int verbose);
-cdata_t *fmt4_read_raw(char *fname, int verbose);
+cdata_t *fmt4_read_raw(char *fname, uint8_t unit, int verbose);
 /* cdata_t *fmt5_read_raw(char *fname, int verbose); */
 cdata_t *fmt6_read_raw(char *fname, int verbose);
 cdata_t *fmt7_read_raw(char *fname, int verbose);
 /* void fmta_tryBinary2byteRLE_ifsmaller(cdata_t *c); */
+void fmt0_compress(cdata_t *c);
+void fmt1_compress(cdata_t *c);
+void fmt2_compress(cdata_t *c);
+
+/* ---- auto mode (-f a) ---- */
+
+#define PACK_SNIFF_ROWS   100000    /* stdin rows that decide the kind of data */
+#define PACK_TRIAL_SLICES 16        /* evenly spaced slices trial-encoded ... */
+#define PACK_TRIAL_ROWS   (1<<16)   /* ... of this many rows each */
+
+/* fields past an empty one are NULL, see line_get_fields() */
+static int is_uint(const char *s) {
+  if (!s || !*s) return 0;
+  for (; *s; ++s) if (!isdigit(*s)) return 0;
+  return 1;
+}
+
+/* a fraction in [0,1] */
+static int is_frac(const char *s) {
+  char *e;
+  double v = strtod(s, &e);
+  return e != s && !*e && v >= 0 && v <= 1;
+}
+
+/* what the rows seen so far allow */
+typedef struct pack_sniff_t {
+  int nf0;                      // fields in the first row, -1 before it
+  char kind;                    // 'r' or 's' once rows settle it
+  int mu, all01, allfrac, anyfrac, allchar;
+} pack_sniff_t;
+
+static void sniff_init(pack_sniff_t *st) {
+  memset(st, 0, sizeof(*st));
+  st->nf0 = -1;
+  st->all01 = st->allfrac = st->allchar = 1;
+}
+
+static void sniff_row(pack_sniff_t *st, char *line) {
+  char **fields; int nfields;
+  line_get_fields(line, "\t", &fields, &nfields);
+  if (st->nf0 < 0) st->nf0 = nfields;
+  if (st->nf0 >= 3) {           // BED, as fmt7_read_raw() takes it
+    if (nfields < 3 || is_uint(fields[0]) || !is_uint(fields[1]) || !is_uint(fields[2])) st->kind = 's';
+    else if (!st->kind) st->kind = 'r';
+  } else if (st->nf0 == 2) {
+    if (nfields < 2 || !is_uint(fields[0]) || !is_uint(fields[1])) st->kind = 's';
+    else if (strcmp(fields[0], "0") && strcmp(fields[0], "1")) st->mu = 1;
+    else if (strcmp(fields[1], "0") && strcmp(fields[1], "1")) st->mu = 1;
+    else if (fields[0][0] == '1' && fields[1][0] == '0') st->mu = 1;
+  } else {
+    if (strcmp(line, "0") && strcmp(line, "1")) st->all01 = 0;
+    if (strlen(line) != 1) st->allchar = 0;
+    if (is_frac(line)) st->anyfrac = 1;
+    else if (strcmp(line, "NA") && strcmp(line, ".")) st->allfrac = 0;
+  }
+  free_fields(fields, nfields);
+}
+
+/* the kind as a -f letter, 0 before any row */
+static char sniff_kind(const pack_sniff_t *st) {
+  if (st->kind) return st->kind;
+  if (st->nf0 < 0) return 0;
+  if (st->nf0 == 2) return st->mu ? 'm' : 'd';
+  if (st->all01) return 'b';
+  if (st->allfrac && st->anyfrac) return 'n';
+  return st->allchar ? 'c' : 's';
+}
+
+/* no further row can change the kind */
+static int sniff_settled(const pack_sniff_t *st) {
+  return st->kind == 's' || (st->nf0 == 1 && !st->allchar && !st->allfrac);
+}
+
+/* the kind of data in fname, checked on every row */
+static char pack_sniff(char *fname) {
+  pack_sniff_t st; sniff_init(&st);
+  gzFile fh = wzopen(fname, 1);
+  char *line = NULL;
+  while (!sniff_settled(&st) && gzFile_read_line(fh, &line) > 0) sniff_row(&st, line);
+  free(line);
+  wzclose(fh);
+  char kind = sniff_kind(&st);
+  if (!kind) wzfatal("[%s:%d] Empty input.\n", __func__, __LINE__);
+  return kind;
+}
+
+/**
+ * stdin cannot be read twice: the rows that decide the kind are held in
+ * memory, then a thread passes them and the rest of stdin through a pipe
+ * to the format reader, checking each row against the kind on the way.
+ */
+typedef struct pack_feed_t {
+  gzFile fh;                    // stdin, past the held rows
+  kstring_t held;
+  pack_sniff_t st;
+  char kind;
+  uint64_t n;                   // rows read so far
+  int fd[2];
+  char fname[32];               // the read end, for the reader to open
+  pthread_t tid;
+} pack_feed_t;
+
+static void *pack_feed_run(void *data) {
+  pack_feed_t *f = (pack_feed_t*) data;
+  FILE *out = fdopen(f->fd[1], "w");
+  if (!out) wzfatal("[%s:%d] Cannot pass stdin on.\n", __func__, __LINE__);
+  fwrite(f->held.s, 1, f->held.l, out);
+  char *line = NULL;
+  while (gzFile_read_line(f->fh, &line) > 0) {
+    ++f->n;
+    if (!sniff_settled(&f->st)) {
+      sniff_row(&f->st, line);
+      char kind = sniff_kind(&f->st);
+      if (kind != f->kind)
+        wzfatal("[%s:%d] Row %"PRIu64" of stdin is -f %c data, but the first %d rows were read as -f %c. Please supply -f.\n",
+                __func__, __LINE__, f->n, kind, PACK_SNIFF_ROWS, f->kind);
+    }
+    fputs(line, out); fputc('\n', out);
+  }
+  free(line);
+  if (fclose(out) != 0) wzfatal("[%s:%d] Cannot pass stdin on.\n", __func__, __LINE__);
+  return NULL;
+}
+
+static pack_feed_t *pack_feed_open(void) {
+  pack_feed_t *f = calloc(1, sizeof(pack_feed_t));
+  sniff_init(&f->st);
+  f->fh = wzopen("-", 1);
+  char *line = NULL;
+  while (f->n < PACK_SNIFF_ROWS && gzFile_read_line(f->fh, &line) > 0) {
+    ++f->n;
+    sniff_row(&f->st, line);
+    kputs(line, &f->held); kputc('\n', &f->held);
+  }
+  free(line);
+  f->kind = sniff_kind(&f->st);
+  if (!f->kind) wzfatal("[%s:%d] Empty input.\n", __func__, __LINE__);
+  if (pipe(f->fd) != 0) wzfatal("[%s:%d] Cannot create a pipe for stdin.\n", __func__, __LINE__);
+  snprintf(f->fname, sizeof(f->fname), "/dev/fd/%d", f->fd[0]);
+  pthread_create(&f->tid, NULL, pack_feed_run, f);
+  return f;
+}
+
+static void pack_feed_close(pack_feed_t *f) {
+  pthread_join(f->tid, NULL);
+  close(f->fd[0]);
+  wzclose(f->fh);
+  free(f->held.s);
+  free(f);
+}
+
+/* evenly spaced slices of fmt1 characters */
+static cdata_t trial_sample_chars(const cdata_t *c) {
+  cdata_t t = {.fmt = '1'};
+  uint64_t sn = PACK_TRIAL_ROWS;
+  if (c->n <= (uint64_t) PACK_TRIAL_SLICES*PACK_TRIAL_ROWS) {
+    t.s = malloc(c->n+1); memcpy(t.s, c->s, c->n); t.n = c->n;
+    return t;
+  }
+  t.s = malloc(PACK_TRIAL_SLICES*sn);
+  for (uint64_t k=0; k<PACK_TRIAL_SLICES; ++k)
+    memcpy(t.s + k*sn, c->s + (c->n-sn)/(PACK_TRIAL_SLICES-1)*k, sn);
+  t.n = PACK_TRIAL_SLICES*sn;
+  return t;
+}
+
+/* fmt1 characters as fmt2 states, keyed in order of first appearance like
+   fmt2_read_raw(); an empty row is "NA" there */
+static cdata_t *chars_to_fmt2(const cdata_t *c) {
+  int64_t id[256]; char kbuf[256][2], *keys[256];
+  uint64_t nk = 0, *data = malloc((c->n+1)*sizeof(uint64_t));
+  for (int i=0; i<256; ++i) id[i] = -1;
+  for (uint64_t i=0; i<c->n; ++i) {
+    uint8_t u = c->s[i];
+    if (id[u] < 0) {
+      id[u] = nk;
+      kbuf[nk][0] = u; kbuf[nk][1] = '\0';
+      keys[nk] = u ? kbuf[nk] : "NA";
+      ++nk;
+    }
+    data[i] = id[u];
+  }
+  cdata_t *c2 = fmt2_from_states(keys, nk, data, c->n);
+  free(data);
+  return c2;
+}
+
+/* evenly spaced slices of packed bits, whole bytes each */
+static cdata_t trial_sample_bits(const cdata_t *c) {
+  cdata_t t = {.fmt = '0', .unit = 1};
+  uint64_t nb = (c->n+7)>>3, sb = PACK_TRIAL_ROWS>>3;
+  if (c->n <= (uint64_t) PACK_TRIAL_SLICES*PACK_TRIAL_ROWS) {
+    t.s = malloc(nb); memcpy(t.s, c->s, nb); t.n = c->n;
+    return t;
+  }
+  t.s = malloc(PACK_TRIAL_SLICES*sb);
+  for (uint64_t k=0; k<PACK_TRIAL_SLICES; ++k)
+    memcpy(t.s + k*sb, c->s + (nb-sb)/(PACK_TRIAL_SLICES-1)*k, sb);
+  t.n = PACK_TRIAL_SLICES*PACK_TRIAL_ROWS;
+  return t;
+}
+
+/* binary rows as fmt1 characters '0'/'1' */
+static void bits_to_fmt1(cdata_t *c) {
+  uint8_t *s = malloc(c->n+1);
+  for (uint64_t i=0; i<c->n; ++i) s[i] = FMT0_IN_SET(*c, i) ? '1' : '0';
+  free(c->s);
+  c->s = s;
+  c->fmt = '1';
+  c->unit = 0;
+}
+
+/**
+ * Pick the encoding of an inflated record read in auto mode, compressing
+ * it.  Binary data is trial-encoded as bits and as fmt1 runs over a
+ * sample; the costs are bytes, times (1+w) for encodings walked run by
+ * run.  Characters are trial-encoded as fmt1 runs and as fmt2 states,
+ * both walked run by run, so the smaller wins.  Sparse fmt6 is also
+ * walked, and falls back to packed codes when that costs less.  Float
+ * betas become codes when that is exact.
+ */
+static void pack_choose(cdata_t *c, double w, int verbose) {
+  if (c->fmt == '0') {
+    cdata_t t0 = trial_sample_bits(c), t1 = t0;
+    t1.s = malloc(((t0.n+7)>>3) + 1); memcpy(t1.s, t0.s, (t0.n+7)>>3);
+    bits_to_fmt1(&t1);
+    fmt0_compress(&t0);
+    fmt1_compress(&t1);
+    double cost0 = cdata_nbytes(&t0), cost1 = cdata_nbytes(&t1) * (1+w);
+    if (verbose) fprintf(stderr, "[%s:%d] Trial on %"PRIu64" rows: format 0 %.0f, format 1 %.0f\n", __func__, __LINE__, cdata_n(&t0), cost0, cost1);
+    if (cost1 < cost0) bits_to_fmt1(c);
+    free_cdata(&t0); free_cdata(&t1);
+  } else if (c->fmt == '1') {
+    cdata_t t1 = trial_sample_chars(c);
+    cdata_t *t2 = chars_to_fmt2(&t1);
+    uint64_t n = t1.n;
+    fmt1_compress(&t1);
+    fmt2_compress(t2);
+    double cost1 = cdata_nbytes(&t1), cost2 = cdata_nbytes(t2);
+    if (verbose) fprintf(stderr, "[%s:%d] Trial on %"PRIu64" rows: format 1 %.0f, format 2 %.0f\n", __func__, __LINE__, n, cost1, cost2);
+    if (cost2 < cost1) {
+      cdata_t *c2 = chars_to_fmt2(c);
+      free_cdata(c);
+      *c = *c2;
+      free(c2);
+    }
+    free_cdata(&t1); free_cdata(t2); free(t2);
+  } else if (c->fmt == '4') {
+    uint8_t unit = fmt4_quantize_exact(c);
+    if (verbose && unit) fprintf(stderr, "[%s:%d] Betas are exact as %d-bit codes\n", __func__, __LINE__, unit*8);
+  }
+  if (!c->compressed) cdata_compress(c); // fmt7_read_raw() returns it compressed
+  if (fmt6_is_sparse(c) && cdata_nbytes(c) * (1+w) >= (c->nrow+3)>>2) fmt6_to_bits(c);
+}
 
 int main_pack(int argc, char *argv[]) {
 
-  int c0; int verbose=0; char fmt='a'; uint8_t unit = 8;
-  while ((c0 = getopt(argc, argv, "f:u:vh"))>=0) {
+  int c0; int verbose=0; char fmt='a'; uint8_t unit = 8; double weight = 0;
+  while ((c0 = getopt(argc, argv, "f:u:w:vh"))>=0) {
     switch (c0) {
     case 'f': fmt = optarg[0]; break;
     case 'u': unit = atoi(optarg); break;
+    case 'w': weight = atof(optarg); break;
     case 'v': verbose = 1; break;
     case 'h': return usage(); break;
     default: usage(); wzfatal("Unrecognized option: %c.\n", c0);
@@ -131,71 +407,89 @@ int main_pack(int argc, char *argv[]) {
   if (argc >= optind + 2)
     fname_out = strdup(argv[optind+1]);
 
+  char *fname_in = argv[optind];
+  pack_feed_t *feed = NULL;
+  int is_auto = fmt == 'a';
+  if (is_auto) {
+    if (strcmp(fname_in, "-") == 0) {
+      feed = pack_feed_open();
+      fname_in = feed->fname;
+      fmt = feed->kind;
+    } else fmt = pack_sniff(fname_in);
+    if (fmt == 'm' || fmt == 'n') unit = 8; // lossless reads, codes only when exact
+    if (verbose) {
+      fprintf(stderr, "[%s:%d] Auto: input read as -f %c\n", __func__, __LINE__, fmt);
+      fflush(stderr);
+    }
+  }
+
   cdata_t *c = NULL;
   switch (fmt) {
   case 'b': {
-    c = fmt0_read_raw(argv[optind], verbose);
+    c = fmt0_read_raw(fname_in, verbose);
     /* fmta_tryBinary2byteRLE_ifsmaller(c); */
     break;
   }
   case 'c': {
-    c = fmt1_read_raw(argv[optind], verbose);
+    c = fmt1_read_raw(fname_in, verbose);
     break;
   }
   case 'd': {
-    c = fmt6_read_raw(argv[optind], verbose);
+    c = fmt6_read_raw(fname_in, verbose);
     break;
   }
   case 's': {
-    c = fmt2_read_raw(argv[optind], verbose);
+    c = fmt2_read_raw(fname_in, verbose);
     break;
   }
   case 'm': {
-    c = fmt3_read_raw(argv[optind], unit, verbose);
+    c = fmt3_read_raw(fname_in, unit, verbose);
     break;
   }
   case 'n': {
-    c = fmt4_read_raw(argv[optind], verbose);
+    c = fmt4_read_raw(fname_in, unit, verbose);
     break;
   }
   case 'r': {
-    c = fmt7_read_raw(argv[optind], verbose);
+    c = fmt7_read_raw(fname_in, verbose);
     break;
   }
   case '0': {
-    c = fmt0_read_raw(argv[optind], verbose);
+    c = fmt0_read_raw(fname_in, verbose);
     break;
   }
   case '1': {
-    c = fmt1_read_raw(argv[optind], verbose);
+    c = fmt1_read_raw(fname_in, verbose);
     break;
   }
   case '2': {
-    c = fmt2_read_raw(argv[optind], verbose);
+    c = fmt2_read_raw(fname_in, verbose);
     break;
   }
   case '3': {
-    c = fmt3_read_raw(argv[optind], unit, verbose);
+    c = fmt3_read_raw(fname_in, unit, verbose);
     break;
   }
   case '4': {
-    c = fmt4_read_raw(argv[optind], verbose);
+    c = fmt4_read_raw(fname_in, unit, verbose);
     break;
   }
   /* case '5': { */
-  /*   c = fmt5_read_raw(argv[optind], verbose); */
+  /*   c = fmt5_read_raw(fname_in, verbose); */
   /*   break; */
   /* } */
   case '6': {
-    c = fmt6_read_raw(argv[optind], verbose);
+    c = fmt6_read_raw(fname_in, verbose);
     break;
   }
   case '7': {
-    c = fmt7_read_raw(argv[optind], verbose);
+    c = fmt7_read_raw(fname_in, verbose);
     break;
   }
   default: usage(); wzfatal("Unrecognized format: %c.\n", fmt);
   }
+  if (feed) pack_feed_close(feed);
+  if (is_auto) pack_choose(c, weight, verbose);
   cdata_write(fname_out, c, "w", verbose);
   free_cdata(c); free(c);
 
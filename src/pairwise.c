@@ -95,7 +95,7 @@ static int usage(void) {
   fprintf(stderr, "  Set:      site i is set if it passes the direction rule (-H) and effect threshold (-d).\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Options:\n");
-  fprintf(stderr, "  -o <out.cx>  Write output to file (default: stdout).\n");
+  fprintf(stderr, "  -o <out.cx>  Write output to file and index it (default: stdout).\n");
   fprintf(stderr, "  -c <cov>     Minimum coverage (M+U) in BOTH samples to include site in universe (default: 1).\n");
   fprintf(stderr, "  -d <delta>   Minimum absolute beta difference required to call a site differential (default: 0).\n");
   fprintf(stderr, "  -H <mode>    Direction mode (default: 1):\n");
@@ -132,17 +132,26 @@ int main_pairwise(int argc, char *argv[]) {
     wzfatal("Please supply input file.\n");
   }
 
+  // the output is indexed as <sample1>_vs_<sample2> when the inputs are indexed
+  snames_t sn1 = loadSampleNamesFromIndex(argv[optind]);
+  snames_t sn2 = {0};
   cfile_t cf1 = open_cfile(argv[optind++]);
   cdata_t c1 = read_cdata1(&cf1);
   cdata_t c2 = {0};
+  const char *sname1 = sn1.n > 0 ? sn1.s[0] : NULL, *sname2 = NULL;
   if (optind >= argc) {
     c2 = read_cdata1(&cf1);
+    if (sn1.n > 1) sname2 = sn1.s[1];
   } else {
+    sn2 = loadSampleNamesFromIndex(argv[optind]);
     cfile_t cf2 = open_cfile(argv[optind++]);
     c2 = read_cdata1(&cf2);
-    bgzf_close(cf2.fh);
+    cdata_detach(&c2);
+    cfile_close(&cf2);
+    if (sn2.n > 0) sname2 = sn2.s[0];
   }
-  bgzf_close(cf1.fh);
+  cdata_detach(&c1); cdata_detach(&c2);
+  cfile_close(&cf1);
 
   decompress_in_situ(&c1);
   decompress_in_situ(&c2);
@@ -190,16 +199,20 @@ int main_pairwise(int argc, char *argv[]) {
   free_cdata(&c2);
   
   cdata_compress(&c_out);
-  BGZF *fp_out;
-  if (fname_out) fp_out = bgzf_open2(fname_out, "w");
-  else fp_out = bgzf_dopen(fileno(stdout), "w");
-  if (fp_out == NULL) {
-    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
-    exit(1);
+  char *sname = NULL;
+  if (sname1 && sname2) {
+    int n = snprintf(NULL, 0, "%s_vs_%s", sname1, sname2);
+    sname = malloc(n + 1);
+    snprintf(sname, n + 1, "%s_vs_%s", sname1, sname2);
   }
-  cdata_write1(fp_out, &c_out);
-  bgzf_close(fp_out);
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
+  cfile_writer_write(w, &c_out, sname);
+  cfile_writer_close(w);
   free_cdata(&c_out);
+  free(sname);
+  cleanSampleNames(&sn1);
+  cleanSampleNames(&sn2);
+  if (fname_out) free(fname_out);
   
   return 0;
 }
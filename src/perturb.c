@@ -34,7 +34,8 @@ static int usage(void) {
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "    -s [int]    random seed (default: current time).\n");
   fprintf(stderr, "    -p [float]  fraction of CpGs to flip, in [0,1] (default: 0.05).\n");
-  fprintf(stderr, "    -o [PATH]   output .cx file (default: stdout, no index written).\n");
+  fprintf(stderr, "    -o [PATH]   output .cx file, indexed with the input sample names\n");
+  fprintf(stderr, "                (default: stdout, no index written).\n");
   fprintf(stderr, "    -h          this help.\n");
   fprintf(stderr, "\n");
   return 1;
@@ -81,17 +82,10 @@ int main_perturb(int argc, char *argv[]) {
   char *fname = argv[optind];
   srand(seed);
 
-  BGZF *fp_out;
-  if (fname_out) fp_out = bgzf_open2(fname_out, "wb");
-  else           fp_out = bgzf_dopen(fileno(stdout), "wb");
-  if (!fp_out) {
-    fprintf(stderr, "[%s:%d] Error opening output: %s\n",
-            __func__, __LINE__, fname_out ? fname_out : "<stdout>");
-    exit(1);
-  }
-
+  cfile_writer_t *w = cfile_writer_open(fname_out, "wb");
   cfile_t cf = open_cfile(fname);
-  for (;;) {
+  snames_t snames = loadSampleNamesFromIndex(fname);
+  for (int64_t k = 0; ; ++k) {
     cdata_t cin = read_cdata1(&cf);
     if (cin.n == 0) { free_cdata(&cin); break; }
     decompress_in_situ(&cin);
@@ -104,12 +98,13 @@ int main_perturb(int argc, char *argv[]) {
     }
 
     cdata_compress(&cin);
-    cdata_write1(fp_out, &cin);
+    cfile_writer_write(w, &cin, k < snames.n ? snames.s[k] : NULL);
     free_cdata(&cin);
   }
 
-  bgzf_close(cf.fh);
-  bgzf_close(fp_out);
+  cfile_close(&cf);
+  cfile_writer_close(w);
+  cleanSampleNames(&snames);
   if (fname_out) free(fname_out);
   return 0;
 }
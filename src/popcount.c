@@ -0,0 +1,419 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+/**
+ * This file is part of YAME.
+ *
+ * Copyright (C) 2021-present Wanding Zhou
+ *
+ * YAME is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAME is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "cdata.h"
+
+/**
+ * Popcount kernels for set overlaps
+ * =================================
+ *
+ * Every overlap count in summary comes down to a few reductions over 64-bit
+ * words, fused so nothing is materialized:
+ *
+ *   bits_popcount()        popcount(a)
+ *   bits_and_popcount()    popcount(a & b)
+ *   fmt6_word_counts()     2-bit codes of fmt6 words, optionally only at the
+ *                          rows a packed fmt0 vector or fmt6 code 3 selects
+ *   fmt6_su_overlap()      popcount(U), popcount(U & set_a),
+ *                          popcount(U & set_b), popcount(U & set_a & set_b)
+ *                          with U the universe shared by two fmt6 vectors
+ *
+ * A fmt6 word holds 32 rows, set bits on the even and universe bits on the
+ * odd positions; a packed selector is spread to the even positions so row k
+ * of both lines up.  Words are read unaligned, lengths are in whole words
+ * (callers do the partial word at the end).
+ *
+ * Variants: AVX-512 VPOPCNTDQ, AVX2 (nibble lookup, Mula) and POPCNT on
+ * x86-64, picked at first use; NEON on aarch64; portable C otherwise.
+ */
+
+#define F6_EVEN 0x5555555555555555ull
+
+typedef struct popcnt_kernels_t {
+  uint64_t (*count)(const uint8_t *a, uint64_t nw);
+  uint64_t (*and_count)(const uint8_t *a, const uint8_t *b, uint64_t nw);
+  /* acc: selected rows, set, universe, set and universe */
+  void (*f6_codes)(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]);
+  /* acc: shared universe, with set in a, in b, in both */
+  void (*f6_su)(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]);
+} popcnt_kernels_t;
+
+static inline uint64_t ld64(const uint8_t *p) { uint64_t x; memcpy(&x, p, 8); return x; }
+static inline uint64_t ld32(const uint8_t *p) { uint32_t x; memcpy(&x, p, 4); return x; }
+
+/* the low 32 bits to the even positions */
+static inline uint64_t spread32(uint64_t x) {
+  x = (x | x<<16) & 0x0000ffff0000ffffull;
+  x = (x | x<<8) & 0x00ff00ff00ff00ffull;
+  x = (x | x<<4) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | x<<2) & 0x3333333333333333ull;
+  return (x | x<<1) & F6_EVEN;
+}
+
+/* even-position selector of fmt6 word i: all rows, the set rows of a packed
+   vector, or code 3 of a fmt6 vector */
+static inline uint64_t f6_sel(const uint8_t *sel, int sel_f6, uint64_t i) {
+  if (!sel) return F6_EVEN;
+  if (sel_f6) { uint64_t m = ld64(sel+8*i); return m & (m>>1) & F6_EVEN; }
+  return spread32(ld32(sel+4*i));
+}
+
+/* Portable bodies from word i on. They are inlined into the POPCNT and
+   vector variants, which use them for the last words. */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+ALWAYS_INLINE uint64_t count_from(const uint8_t *a, uint64_t i, uint64_t nw) {
+  uint64_t m = 0;
+  for (; i < nw; ++i) m += __builtin_popcountll(ld64(a+8*i));
+  return m;
+}
+
+ALWAYS_INLINE uint64_t and_count_from(const uint8_t *a, const uint8_t *b, uint64_t i, uint64_t nw) {
+  uint64_t m = 0;
+  for (; i < nw; ++i) m += __builtin_popcountll(ld64(a+8*i) & ld64(b+8*i));
+  return m;
+}
+
+ALWAYS_INLINE void f6_codes_from(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t i, uint64_t nw, uint64_t acc[4]) {
+  for (; i < nw; ++i) {
+    uint64_t w = ld64(s+8*i), m = f6_sel(sel, sel_f6, i);
+    uint64_t lo = w & m, hi = (w>>1) & m;
+    acc[0] += __builtin_popcountll(m);
+    acc[1] += __builtin_popcountll(lo);
+    acc[2] += __builtin_popcountll(hi);
+    acc[3] += __builtin_popcountll(lo & hi);
+  }
+}
+
+ALWAYS_INLINE void f6_su_from(const uint8_t *a, const uint8_t *b, uint64_t i, uint64_t nw, uint64_t acc[4]) {
+  for (; i < nw; ++i) {
+    uint64_t x = ld64(a+8*i), y = ld64(b+8*i), u = (x>>1) & (y>>1) & F6_EVEN;
+    acc[0] += __builtin_popcountll(u);
+    acc[1] += __builtin_popcountll(u & x);
+    acc[2] += __builtin_popcountll(u & y);
+    acc[3] += __builtin_popcountll(u & x & y);
+  }
+}
+
+static uint64_t count_scalar(const uint8_t *a, uint64_t nw) { return count_from(a, 0, nw); }
+static uint64_t and_count_scalar(const uint8_t *a, const uint8_t *b, uint64_t nw) { return and_count_from(a, b, 0, nw); }
+static void f6_codes_scalar(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]) { f6_codes_from(s, sel, sel_f6, 0, nw, acc); }
+static void f6_su_scalar(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]) { f6_su_from(a, b, 0, nw, acc); }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+/* the portable bodies with the POPCNT instruction */
+__attribute__((target("popcnt")))
+static uint64_t count_popcnt(const uint8_t *a, uint64_t nw) { return count_from(a, 0, nw); }
+__attribute__((target("popcnt")))
+static uint64_t and_count_popcnt(const uint8_t *a, const uint8_t *b, uint64_t nw) { return and_count_from(a, b, 0, nw); }
+__attribute__((target("popcnt")))
+static void f6_codes_popcnt(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]) { f6_codes_from(s, sel, sel_f6, 0, nw, acc); }
+__attribute__((target("popcnt")))
+static void f6_su_popcnt(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]) { f6_su_from(a, b, 0, nw, acc); }
+
+/* per 64-bit lane popcount: nibble lookup, bytes summed by vpsadbw */
+__attribute__((target("avx2")))
+static inline __m256i pc256(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i c = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                              _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+  return _mm256_sad_epu8(c, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t hsum256(__m256i v) {
+  uint64_t t[4];
+  _mm256_storeu_si256((__m256i*) t, v);
+  return t[0] + t[1] + t[2] + t[3];
+}
+
+/* 4 words of spread32() at once, from 16 selector bytes */
+__attribute__((target("avx2")))
+static inline __m256i spread256(const uint8_t *p) {
+  __m256i x = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*) p));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 16)), _mm256_set1_epi64x(0x0000ffff0000ffffll));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 8)), _mm256_set1_epi64x(0x00ff00ff00ff00ffll));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 4)), _mm256_set1_epi64x(0x0f0f0f0f0f0f0f0fll));
+  x = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 2)), _mm256_set1_epi64x(0x3333333333333333ll));
+  return _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 1)), _mm256_set1_epi64x((long long) F6_EVEN));
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint64_t count_avx2(const uint8_t *a, uint64_t nw) {
+  __m256i acc = _mm256_setzero_si256();
+  uint64_t i = 0;
+  for (; i + 4 <= nw; i += 4)
+    acc = _mm256_add_epi64(acc, pc256(_mm256_loadu_si256((const __m256i*) (a+8*i))));
+  return hsum256(acc) + count_from(a, i, nw);
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint64_t and_count_avx2(const uint8_t *a, const uint8_t *b, uint64_t nw) {
+  __m256i acc = _mm256_setzero_si256();
+  uint64_t i = 0;
+  for (; i + 4 <= nw; i += 4)
+    acc = _mm256_add_epi64(acc, pc256(_mm256_and_si256(_mm256_loadu_si256((const __m256i*) (a+8*i)),
+                                                       _mm256_loadu_si256((const __m256i*) (b+8*i)))));
+  return hsum256(acc) + and_count_from(a, b, i, nw);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void f6_codes_avx2(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]) {
+  const __m256i even = _mm256_set1_epi64x((long long) F6_EVEN);
+  __m256i n_m = _mm256_setzero_si256(), n_lo = n_m, n_hi = n_m, n_3 = n_m;
+  uint64_t i = 0;
+  for (; i + 4 <= nw; i += 4) {
+    __m256i w = _mm256_loadu_si256((const __m256i*) (s+8*i)), m = even;
+    if (sel && sel_f6) {
+      __m256i x = _mm256_loadu_si256((const __m256i*) (sel+8*i));
+      m = _mm256_and_si256(_mm256_and_si256(x, _mm256_srli_epi64(x, 1)), even);
+    } else if (sel) {
+      m = spread256(sel+4*i);
+    }
+    __m256i lo = _mm256_and_si256(w, m), hi = _mm256_and_si256(_mm256_srli_epi64(w, 1), m);
+    n_m = _mm256_add_epi64(n_m, pc256(m));
+    n_lo = _mm256_add_epi64(n_lo, pc256(lo));
+    n_hi = _mm256_add_epi64(n_hi, pc256(hi));
+    n_3 = _mm256_add_epi64(n_3, pc256(_mm256_and_si256(lo, hi)));
+  }
+  acc[0] += hsum256(n_m); acc[1] += hsum256(n_lo); acc[2] += hsum256(n_hi); acc[3] += hsum256(n_3);
+  f6_codes_from(s, sel, sel_f6, i, nw, acc);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void f6_su_avx2(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]) {
+  const __m256i even = _mm256_set1_epi64x((long long) F6_EVEN);
+  __m256i n_u = _mm256_setzero_si256(), n_a = n_u, n_b = n_u, n_ab = n_u;
+  uint64_t i = 0;
+  for (; i + 4 <= nw; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*) (a+8*i)), y = _mm256_loadu_si256((const __m256i*) (b+8*i));
+    __m256i u = _mm256_and_si256(_mm256_and_si256(_mm256_srli_epi64(x, 1), _mm256_srli_epi64(y, 1)), even);
+    __m256i ux = _mm256_and_si256(u, x);
+    n_u = _mm256_add_epi64(n_u, pc256(u));
+    n_a = _mm256_add_epi64(n_a, pc256(ux));
+    n_b = _mm256_add_epi64(n_b, pc256(_mm256_and_si256(u, y)));
+    n_ab = _mm256_add_epi64(n_ab, pc256(_mm256_and_si256(ux, y)));
+  }
+  acc[0] += hsum256(n_u); acc[1] += hsum256(n_a); acc[2] += hsum256(n_b); acc[3] += hsum256(n_ab);
+  f6_su_from(a, b, i, nw, acc);
+}
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+
+AVX512_TARGET
+static uint64_t count_avx512(const uint8_t *a, uint64_t nw) {
+  __m512i acc = _mm512_setzero_si512();
+  uint64_t i = 0;
+  for (; i + 8 <= nw; i += 8)
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(a+8*i)));
+  return _mm512_reduce_add_epi64(acc) + count_from(a, i, nw);
+}
+
+AVX512_TARGET
+static uint64_t and_count_avx512(const uint8_t *a, const uint8_t *b, uint64_t nw) {
+  __m512i acc = _mm512_setzero_si512();
+  uint64_t i = 0;
+  for (; i + 8 <= nw; i += 8)
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_loadu_si512(a+8*i), _mm512_loadu_si512(b+8*i))));
+  return _mm512_reduce_add_epi64(acc) + and_count_from(a, b, i, nw);
+}
+
+/* 8 words of spread32() at once, from 32 selector bytes */
+AVX512_TARGET
+static inline __m512i spread512(const uint8_t *p) {
+  __m512i x = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*) p));
+  x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 16)), _mm512_set1_epi64(0x0000ffff0000ffffll));
+  x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 8)), _mm512_set1_epi64(0x00ff00ff00ff00ffll));
+  x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 4)), _mm512_set1_epi64(0x0f0f0f0f0f0f0f0fll));
+  x = _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 2)), _mm512_set1_epi64(0x3333333333333333ll));
+  return _mm512_and_si512(_mm512_or_si512(x, _mm512_slli_epi64(x, 1)), _mm512_set1_epi64((long long) F6_EVEN));
+}
+
+AVX512_TARGET
+static void f6_codes_avx512(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]) {
+  const __m512i even = _mm512_set1_epi64((long long) F6_EVEN);
+  __m512i n_m = _mm512_setzero_si512(), n_lo = n_m, n_hi = n_m, n_3 = n_m;
+  uint64_t i = 0;
+  for (; i + 8 <= nw; i += 8) {
+    __m512i w = _mm512_loadu_si512(s+8*i), m = even;
+    if (sel && sel_f6) {
+      __m512i x = _mm512_loadu_si512(sel+8*i);
+      m = _mm512_and_si512(_mm512_and_si512(x, _mm512_srli_epi64(x, 1)), even);
+    } else if (sel) {
+      m = spread512(sel+4*i);
+    }
+    __m512i lo = _mm512_and_si512(w, m), hi = _mm512_and_si512(_mm512_srli_epi64(w, 1), m);
+    n_m = _mm512_add_epi64(n_m, _mm512_popcnt_epi64(m));
+    n_lo = _mm512_add_epi64(n_lo, _mm512_popcnt_epi64(lo));
+    n_hi = _mm512_add_epi64(n_hi, _mm512_popcnt_epi64(hi));
+    n_3 = _mm512_add_epi64(n_3, _mm512_popcnt_epi64(_mm512_and_si512(lo, hi)));
+  }
+  acc[0] += _mm512_reduce_add_epi64(n_m); acc[1] += _mm512_reduce_add_epi64(n_lo);
+  acc[2] += _mm512_reduce_add_epi64(n_hi); acc[3] += _mm512_reduce_add_epi64(n_3);
+  f6_codes_from(s, sel, sel_f6, i, nw, acc);
+}
+
+AVX512_TARGET
+static void f6_su_avx512(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]) {
+  const __m512i even = _mm512_set1_epi64((long long) F6_EVEN);
+  __m512i n_u = _mm512_setzero_si512(), n_a = n_u, n_b = n_u, n_ab = n_u;
+  uint64_t i = 0;
+  for (; i + 8 <= nw; i += 8) {
+    __m512i x = _mm512_loadu_si512(a+8*i), y = _mm512_loadu_si512(b+8*i);
+    __m512i u = _mm512_and_si512(_mm512_and_si512(_mm512_srli_epi64(x, 1), _mm512_srli_epi64(y, 1)), even);
+    __m512i ux = _mm512_and_si512(u, x);
+    n_u = _mm512_add_epi64(n_u, _mm512_popcnt_epi64(u));
+    n_a = _mm512_add_epi64(n_a, _mm512_popcnt_epi64(ux));
+    n_b = _mm512_add_epi64(n_b, _mm512_popcnt_epi64(_mm512_and_si512(u, y)));
+    n_ab = _mm512_add_epi64(n_ab, _mm512_popcnt_epi64(_mm512_and_si512(ux, y)));
+  }
+  acc[0] += _mm512_reduce_add_epi64(n_u); acc[1] += _mm512_reduce_add_epi64(n_a);
+  acc[2] += _mm512_reduce_add_epi64(n_b); acc[3] += _mm512_reduce_add_epi64(n_ab);
+  f6_su_from(a, b, i, nw, acc);
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+/* per 64-bit lane popcount of 16 bytes */
+static inline uint64x2_t pc128(uint8x16_t v) {
+  return vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(v))));
+}
+
+static inline uint64x2_t ld128(const uint8_t *p) { return vreinterpretq_u64_u8(vld1q_u8(p)); }
+
+static inline uint64x2_t spread128(const uint8_t *p) {
+  uint64x2_t x = vmovl_u32(vreinterpret_u32_u8(vld1_u8(p)));
+  x = vandq_u64(vorrq_u64(x, vshlq_n_u64(x, 16)), vdupq_n_u64(0x0000ffff0000ffffull));
+  x = vandq_u64(vorrq_u64(x, vshlq_n_u64(x, 8)), vdupq_n_u64(0x00ff00ff00ff00ffull));
+  x = vandq_u64(vorrq_u64(x, vshlq_n_u64(x, 4)), vdupq_n_u64(0x0f0f0f0f0f0f0f0full));
+  x = vandq_u64(vorrq_u64(x, vshlq_n_u64(x, 2)), vdupq_n_u64(0x3333333333333333ull));
+  return vandq_u64(vorrq_u64(x, vshlq_n_u64(x, 1)), vdupq_n_u64(F6_EVEN));
+}
+
+static inline uint64_t hsum128(uint64x2_t v) { return vgetq_lane_u64(v, 0) + vgetq_lane_u64(v, 1); }
+
+static uint64_t count_neon(const uint8_t *a, uint64_t nw) {
+  uint64x2_t acc = vdupq_n_u64(0);
+  uint64_t i = 0;
+  for (; i + 2 <= nw; i += 2) acc = vaddq_u64(acc, pc128(vld1q_u8(a+8*i)));
+  return hsum128(acc) + count_from(a, i, nw);
+}
+
+static uint64_t and_count_neon(const uint8_t *a, const uint8_t *b, uint64_t nw) {
+  uint64x2_t acc = vdupq_n_u64(0);
+  uint64_t i = 0;
+  for (; i + 2 <= nw; i += 2) acc = vaddq_u64(acc, pc128(vandq_u8(vld1q_u8(a+8*i), vld1q_u8(b+8*i))));
+  return hsum128(acc) + and_count_from(a, b, i, nw);
+}
+
+static void f6_codes_neon(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t acc[4]) {
+  const uint64x2_t even = vdupq_n_u64(F6_EVEN);
+  uint64x2_t n_m = vdupq_n_u64(0), n_lo = n_m, n_hi = n_m, n_3 = n_m;
+  uint64_t i = 0;
+  for (; i + 2 <= nw; i += 2) {
+    uint64x2_t w = ld128(s+8*i), m = even;
+    if (sel && sel_f6) {
+      uint64x2_t x = ld128(sel+8*i);
+      m = vandq_u64(vandq_u64(x, vshrq_n_u64(x, 1)), even);
+    } else if (sel) {
+      m = spread128(sel+4*i);
+    }
+    uint64x2_t lo = vandq_u64(w, m), hi = vandq_u64(vshrq_n_u64(w, 1), m);
+    n_m = vaddq_u64(n_m, pc128(vreinterpretq_u8_u64(m)));
+    n_lo = vaddq_u64(n_lo, pc128(vreinterpretq_u8_u64(lo)));
+    n_hi = vaddq_u64(n_hi, pc128(vreinterpretq_u8_u64(hi)));
+    n_3 = vaddq_u64(n_3, pc128(vreinterpretq_u8_u64(vandq_u64(lo, hi))));
+  }
+  acc[0] += hsum128(n_m); acc[1] += hsum128(n_lo); acc[2] += hsum128(n_hi); acc[3] += hsum128(n_3);
+  f6_codes_from(s, sel, sel_f6, i, nw, acc);
+}
+
+static void f6_su_neon(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t acc[4]) {
+  const uint64x2_t even = vdupq_n_u64(F6_EVEN);
+  uint64x2_t n_u = vdupq_n_u64(0), n_a = n_u, n_b = n_u, n_ab = n_u;
+  uint64_t i = 0;
+  for (; i + 2 <= nw; i += 2) {
+    uint64x2_t x = ld128(a+8*i), y = ld128(b+8*i);
+    uint64x2_t u = vandq_u64(vandq_u64(vshrq_n_u64(x, 1), vshrq_n_u64(y, 1)), even), ux = vandq_u64(u, x);
+    n_u = vaddq_u64(n_u, pc128(vreinterpretq_u8_u64(u)));
+    n_a = vaddq_u64(n_a, pc128(vreinterpretq_u8_u64(ux)));
+    n_b = vaddq_u64(n_b, pc128(vreinterpretq_u8_u64(vandq_u64(u, y))));
+    n_ab = vaddq_u64(n_ab, pc128(vreinterpretq_u8_u64(vandq_u64(ux, y))));
+  }
+  acc[0] += hsum128(n_u); acc[1] += hsum128(n_a); acc[2] += hsum128(n_b); acc[3] += hsum128(n_ab);
+  f6_su_from(a, b, i, nw, acc);
+}
+#endif
+
+static const popcnt_kernels_t *popcnt_k;
+static pthread_once_t popcnt_once = PTHREAD_ONCE_INIT;
+
+static void popcnt_init(void) {
+  static const popcnt_kernels_t scalar = {count_scalar, and_count_scalar, f6_codes_scalar, f6_su_scalar};
+  popcnt_k = &scalar;
+#if defined(__x86_64__) && defined(__GNUC__)
+  static const popcnt_kernels_t popcnt = {count_popcnt, and_count_popcnt, f6_codes_popcnt, f6_su_popcnt};
+  static const popcnt_kernels_t avx2 = {count_avx2, and_count_avx2, f6_codes_avx2, f6_su_avx2};
+  static const popcnt_kernels_t avx512 = {count_avx512, and_count_avx512, f6_codes_avx512, f6_su_avx512};
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("popcnt")) {
+    popcnt_k = &popcnt;
+    if (__builtin_cpu_supports("avx2")) popcnt_k = &avx2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")) popcnt_k = &avx512;
+  }
+#elif defined(__aarch64__)
+  static const popcnt_kernels_t neon = {count_neon, and_count_neon, f6_codes_neon, f6_su_neon};
+  popcnt_k = &neon;
+#endif
+}
+
+static inline const popcnt_kernels_t *popcnt_kernels(void) {
+  pthread_once(&popcnt_once, popcnt_init);
+  return popcnt_k;
+}
+
+uint64_t bits_popcount(const uint8_t *a, uint64_t nw) {
+  return popcnt_kernels()->count(a, nw);
+}
+
+uint64_t bits_and_popcount(const uint8_t *a, const uint8_t *b, uint64_t nw) {
+  return popcnt_kernels()->and_count(a, b, nw);
+}
+
+void fmt6_word_counts(const uint8_t *s, const uint8_t *sel, int sel_f6, uint64_t nw, uint64_t cnts[4]) {
+  uint64_t acc[4] = {0};
+  popcnt_kernels()->f6_codes(s, sel, sel_f6, nw, acc);
+  cnts[0] += acc[0] - acc[1] - acc[2] + acc[3];
+  cnts[1] += acc[1] - acc[3];
+  cnts[2] += acc[2] - acc[3];
+  cnts[3] += acc[3];
+}
+
+void fmt6_su_overlap(const uint8_t *a, const uint8_t *b, uint64_t nw, uint64_t cnt[4]) {
+  popcnt_kernels()->f6_su(a, b, nw, cnt);
+}
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: AGPL-3.0-or-later
+/**
+ * This file is part of YAME.
+ *
+ * Copyright (C) 2021-present Wanding Zhou
+ *
+ * YAME is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * YAME is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with YAME.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cfile.h"
+
+/**
+ * yame retile
+ * ===========
+ *
+ * Rewrites a standard .cx stream (one record per sample, all rows) as a
+ * tiled container (see cfile.h): the matrix is cut into tiles of trow rows
+ * x tsmp samples, each tile holding ordinary cx records, and a directory
+ * of tile offsets is appended.  Queries over a row window across all
+ * samples (e.g. "yame rowsub -B") or over a sample range then inflate only
+ * the tiles they touch.
+ *
+ * The input is read once, tsmp samples at a time; every sample's row
+ * window is cut with decompress_range(), which starts from the record's
+ * row checkpoints, so memory stays at one sample block of compressed data.
+ * A file output gets a .idx mapping the input's sample names to sample
+ * numbers, so samples are still looked up by name.
+ */
+
+static int usage(void) {
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Usage:\n");
+  fprintf(stderr, "  yame retile [options] <in.cx>\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Purpose:\n");
+  fprintf(stderr, "  Store a multi-sample .cx as tiles of rows x samples with a tile directory,\n");
+  fprintf(stderr, "  so row-window and sample-range reads only touch the tiles they need.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -r <rows>    Rows per tile, rounded up to a multiple of 8 (default: 1048576).\n");
+  fprintf(stderr, "  -s <n>       Samples per tile (default: 64).\n");
+  fprintf(stderr, "  -o <out.cx>  Write output to file (default: stdout).\n");
+  fprintf(stderr, "  -h           Show this help message.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Notes:\n");
+  fprintf(stderr, "  * Formats 0-4 and 6 are supported; all samples must have the same rows.\n");
+  fprintf(stderr, "  * Tiled files read like any .cx, one sample at a time; random access\n");
+  fprintf(stderr, "    (e.g. rowsub -B/-I) needs the output to be a file.\n");
+  fprintf(stderr, "  * With -o, the sample names of <in.cx>.idx are indexed in <out.cx>.idx.\n");
+  fprintf(stderr, "\n");
+  return 1;
+}
+
+static void write_u64s(BGZF *fp, const uint64_t *v, uint64_t n) {
+  if (bgzf_write(fp, v, n*sizeof(uint64_t)) < 0)
+    wzfatal("[%s:%d] Error writing tiled container.\n", __func__, __LINE__);
+}
+
+int main_retile(int argc, char *argv[]) {
+
+  int c; uint64_t trow = 1<<20, tsmp = 64;
+  char *fname_out = NULL;
+  while ((c = getopt(argc, argv, "r:s:o:h"))>=0) {
+    switch (c) {
+    case 'r': trow = strtoull(optarg, NULL, 10); break;
+    case 's': tsmp = strtoull(optarg, NULL, 10); break;
+    case 'o': fname_out = strdup(optarg); break;
+    case 'h': return usage(); break;
+    default: usage(); wzfatal("Unrecognized option: %c.\n", c);
+    }
+  }
+
+  if (optind + 1 > argc) {
+    usage();
+    wzfatal("Please supply input file.\n");
+  }
+  if (trow == 0 || tsmp == 0) wzfatal("Tile dimensions must be positive.\n");
+  trow = (trow + 7) / 8 * 8;
+
+  cfile_t cf = open_cfile(argv[optind]);
+  if (cf.tl) wzfatal("Input is already tiled.\n");
+  BGZF *fp_out = open_cfile_write(fname_out, "w");
+  if (fp_out == NULL) {
+    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
+    exit(1);
+  }
+
+  cdata_t *cs = calloc(tsmp, sizeof(cdata_t));
+  int64_t *dir = NULL;
+  uint64_t nrow = 0, nrb = 0, nsb = 0, nsmp = 0;
+  for (;;) {
+    uint64_t k = 0;
+    for (; k < tsmp && read_cdata2(&cf, &cs[k]); ++k) {
+      if (cs[k].fmt == '5' || cs[k].fmt == '7')
+        wzfatal("[%s:%d] Format %c cannot be tiled.\n", __func__, __LINE__, cs[k].fmt);
+      if (nsmp + k == 0) {      /* the first sample fixes the rows */
+        nrow = cdata_n(&cs[k]);
+        nrb = (nrow + trow - 1) / trow;
+        uint64_t hd[4] = {CXTSIG, nrow, trow, tsmp};
+        write_u64s(fp_out, hd, 4);
+      } else if (cdata_n(&cs[k]) != nrow) {
+        fprintf(stderr, "[%s:%d] Sample %"PRIu64" has %"PRIu64" rows, expected %"PRIu64".\n", __func__, __LINE__, nsmp+k+1, cdata_n(&cs[k]), nrow);
+        fflush(stderr);
+        exit(1);
+      }
+    }
+    if (!k) break;
+
+    dir = realloc(dir, (nsb+1)*nrb*sizeof(int64_t));
+    for (uint64_t rb = 0; rb < nrb; ++rb) {
+      bgzf_flush(fp_out);       /* tiles start a block */
+      dir[nsb*nrb+rb] = bgzf_tell(fp_out);
+      uint64_t hd[4] = {CXTILESIG, rb, nsb, k};
+      write_u64s(fp_out, hd, 4);
+      for (uint64_t j = 0; j < k; ++j) {
+        cdata_t t = decompress_range(&cs[j], rb*trow, rb*trow+trow-1);
+        cdata_compress(&t);
+        cdata_write1(fp_out, &t);
+        free_cdata(&t);
+      }
+    }
+    nsb++; nsmp += k;
+  }
+  if (nsmp == 0) {              /* an empty matrix is still a valid container */
+    uint64_t hd[4] = {CXTSIG, 0, trow, tsmp};
+    write_u64s(fp_out, hd, 4);
+  }
+
+  bgzf_flush(fp_out);
+  uint64_t tail[2] = {bgzf_tell(fp_out), CXTSIG};
+  uint64_t hd[4] = {CXTDIRSIG, nsmp, nrb, nsb};
+  write_u64s(fp_out, hd, 4);
+  if (nsb && nrb) write_u64s(fp_out, (uint64_t*) dir, nsb*nrb);
+
+  /* the tail goes alone into a stored block, see cfile.h */
+  bgzf_flush(fp_out);
+  fp_out->compress_level = 0;
+  write_u64s(fp_out, tail, 2);
+  bgzf_close(fp_out);
+
+  if (fname_out) {               /* names map to sample numbers, see cfile.h */
+    snames_t snames = loadSampleNamesFromIndex(argv[optind]);
+    index_t *idx = kh_init(index);
+    for (uint64_t i = 0; i < nsmp; ++i) {
+      char buf[32]; const char *sname = buf;
+      if (i < (uint64_t) snames.n) sname = snames.s[i];
+      else snprintf(buf, sizeof(buf), "Unnamed_%"PRIu64, i+1);
+      insert_index(idx, strdup(sname), i);
+    }
+    char *fname_index = get_fname_index(fname_out);
+    FILE *fi = fopen(fname_index, "w");
+    if (!fi) wzfatal("[%s:%d] Cannot open index file %s.\n", __func__, __LINE__, fname_index);
+    writeIndex(fi, idx);
+    fclose(fi);
+    free(fname_index);
+    updateBinaryIndex(fname_out, idx, 0);
+    cleanIndex(idx);
+    cleanSampleNames(&snames);
+  }
+
+  for (uint64_t j = 0; j < tsmp; ++j) free_cdata(&cs[j]);
+  free(cs); free(dir);
+  cfile_close(&cf);
+  if (fname_out) free(fname_out);
+  return 0;
+}
@@ -27,7 +27,10 @@ row_finder_t init_finder(cdata_t *cr) {
   row_reader_t rdr = {0};
   char *chrm = NULL;
   chromosome_t *chrmt = NULL;
-  while (row_reader_next_loc(&rdr, cr)) {
+  uint64_t locs[64], k;
+  for (;;) {
+    row_reader_t pre = rdr;
+    if (!(k = row_reader_next_n(&rdr, cr, locs, 64))) break;
     if (rdr.chrm != chrm) { // a new chromosome
       chrm = rdr.chrm;
       if (kh_get(str2int, fdr.h, chrm) == kh_end(fdr.h)) { // key doesn't exist
@@ -49,14 +52,19 @@ row_finder_t init_finder(cdata_t *cr) {
         exit(1);
       }
     }
-    while ((rdr.value>>17) >= chrmt->n) {
-      chrmt->locs = realloc(chrmt->locs, (chrmt->n+1)*sizeof(uint64_t));
-      chrmt->vals = realloc(chrmt->vals, (chrmt->n+1)*sizeof(uint64_t));
-      chrmt->inds = realloc(chrmt->inds, (chrmt->n+1)*sizeof(uint64_t));
-      chrmt->locs[chrmt->n] = rdr.loc;
-      chrmt->vals[chrmt->n] = rdr.value;
-      chrmt->inds[chrmt->n] = rdr.index;
-      chrmt->n++;
+    if ((locs[k-1]>>17) < chrmt->n) continue; // no new 128kb bin in this batch
+    rdr = pre;                  // replay it row by row for the bin starts
+    for (uint64_t j=0; j<k; ++j) {
+      row_reader_next_loc(&rdr, cr);
+      while ((rdr.value>>17) >= chrmt->n) {
+        chrmt->locs = realloc(chrmt->locs, (chrmt->n+1)*sizeof(uint64_t));
+        chrmt->vals = realloc(chrmt->vals, (chrmt->n+1)*sizeof(uint64_t));
+        chrmt->inds = realloc(chrmt->inds, (chrmt->n+1)*sizeof(uint64_t));
+        chrmt->locs[chrmt->n] = rdr.loc;
+        chrmt->vals[chrmt->n] = rdr.value;
+        chrmt->inds[chrmt->n] = rdr.index;
+        chrmt->n++;
+      }
     }
   }
   return fdr;
@@ -170,10 +170,11 @@ static int usage(void) {
   return 1;
 }
 
-static void binasumFmt0(cdata_t *cout, cdata_t *c) {
-  for (uint64_t i=0; i<c->n; ++i) {
+/* the inputs below stay compressed and are walked run by run */
+static void binasum_run(cdata_t *cout, cdata_cursor_t *cur, int meth) {
+  for (uint64_t i=cur->row; i<cur->row+cur->n; ++i) {
     uint64_t mu = f3_get_mu(cout, i);
-    if (FMT0_IN_SET(*c, i)) {
+    if (meth) {
       f3_set_mu(cout, i, ((mu>>32)+1), (mu<<32>>32));
     } else {
       f3_set_mu(cout, i, (mu>>32), ((mu<<32>>32)+1));
@@ -181,119 +182,116 @@ static void binasumFmt0(cdata_t *cout, cdata_t *c) {
   }
 }
 
+static void binasumFmt0(cdata_t *cout, cdata_t *c) {
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) binasum_run(cout, &cur, cur.v != 0);
+}
+
 static void binasumFmt1(cdata_t *cout, cdata_t *c) {
-  for (uint64_t i=0; i<c->n; ++i) {
-    uint64_t mu = f3_get_mu(cout, i);
-    if (c->s[i]-'0') {
-      f3_set_mu(cout, i, ((mu>>32)+1), (mu<<32>>32));
-    } else {
-      f3_set_mu(cout, i, (mu>>32), ((mu<<32>>32)+1));
-    }
-  }
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) binasum_run(cout, &cur, cur.v != '0');
 }
 
 static void binasumFmt3(cdata_t *cout, cdata_t *c, config_rowop_t *cfg) {
-  for (uint64_t i=0; i<c->n; ++i) {
-    uint64_t mu = f3_get_mu(c, i);
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) {
+    uint64_t mu = cur.v;
     if (!mu) continue; // 0-0 is skipped
     if (MU2cov(mu) < cfg->mincov) continue;
 
     double beta = MU2beta(mu);
-    uint64_t mu_out = f3_get_mu(cout, i);
-    if (beta > cfg->beta1) {
-      f3_set_mu(cout, i, ((mu_out>>32)+1), (mu_out<<32>>32));
-    } else if (beta < cfg->beta0) {
-      f3_set_mu(cout, i, (mu_out>>32), ((mu_out<<32>>32)+1));
-    }
+    if (beta > cfg->beta1) binasum_run(cout, &cur, 1);
+    else if (beta < cfg->beta0) binasum_run(cout, &cur, 0);
   }
 }
 
 static cdata_t rowop_binasum(cfile_t cf, config_rowop_t *cfg) {
-  cdata_t c = read_cdata1(&cf);
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, cdata_prep_raw, NULL);
+  cdata_t *c2 = cfile_prefetch_next(pf); // compressed records, read ahead
   cdata_t cout = {0};
-  if (c.n == 0) return cout;    // nothing in cfile
-  char fmt = c.fmt;
-  cout.n = cdata_n(&c);
+  if (!c2) { cfile_prefetch_close(pf); return cout; } // nothing in cfile
+  char fmt = c2->fmt;
+  cout.n = cdata_n(c2);
   cout.compressed = 0;
   cout.fmt = '3';
   cout.unit = 8;                // max-size result
   cout.s = calloc(cout.n, sizeof(uint64_t));
   
-  for (uint64_t k=0; ; ++k) {
-    if (k) c = read_cdata1(&cf); // skip 1st cdata
-    if (c.n == 0) break;
-    if (fmt != c.fmt) {
-      fprintf(stderr, "[%s:%d] File formats are inconsistent: %c vs %c.\n", __func__, __LINE__, fmt, c.fmt);
+  for (uint64_t k=0; c2; ++k, c2 = cfile_prefetch_next(pf)) {
+    if (fmt != c2->fmt) {
+      fprintf(stderr, "[%s:%d] File formats are inconsistent: %c vs %c.\n", __func__, __LINE__, fmt, c2->fmt);
       fflush(stderr);
       exit(1);
     }
-    cdata_t c2 = decompress(c);
-    if (c2.n != cout.n) {
-      fprintf(stderr, "[%s:%d] Data dimensions are inconsistent: %"PRIu64" vs %"PRIu64"\n", __func__, __LINE__, cout.n, c2.n);
+    if (cdata_n(c2) != cout.n) {
+      fprintf(stderr, "[%s:%d] Data dimensions are inconsistent: %"PRIu64" vs %"PRIu64"\n", __func__, __LINE__, cout.n, cdata_n(c2));
       fflush(stderr);
       exit(1);
     }
     
     switch (fmt) {
-    case '0': binasumFmt0(&cout, &c2); break;
-    case '1': binasumFmt1(&cout, &c2); break;
-    case '3': binasumFmt3(&cout, &c2, cfg); break;
+    case '0': binasumFmt0(&cout, c2); break;
+    case '1': binasumFmt1(&cout, c2); break;
+    case '3': binasumFmt3(&cout, c2, cfg); break;
     default: {
-      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c.fmt);
+      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c2->fmt);
       fflush(stderr);
       exit(1);
     }}
-
-    free(c.s); free(c2.s);
   }
+  cfile_prefetch_close(pf);
   return cout;
 }
 
 static void musumFmt3(cdata_t *cout, cdata_t *c) {
-  for (uint64_t i=0; i<c->n; ++i) {
-    uint64_t mu0 = f3_get_mu(c, i);
+  cdata_cursor_t cur;
+  cdata_cursor_init(&cur, c);
+  while (cdata_cursor_next(&cur)) {
+    uint64_t mu0 = cur.v;
     if (!mu0) continue; // 0-0 is skipped
-    uint64_t mu = f3_get_mu(cout, i);
-    f3_set_mu(cout, i, ((mu>>32)+(mu0>>32)), ((mu<<32>>32)+(mu0<<32>>32)));
+    for (uint64_t i=cur.row; i<cur.row+cur.n; ++i) {
+      uint64_t mu = f3_get_mu(cout, i);
+      f3_set_mu(cout, i, ((mu>>32)+(mu0>>32)), ((mu<<32>>32)+(mu0<<32>>32)));
+    }
   }
 }
 
 static cdata_t rowop_musum(cfile_t cf) {
-  cdata_t c = read_cdata1(&cf);
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, cdata_prep_raw, NULL);
+  cdata_t *c2 = cfile_prefetch_next(pf); // compressed records, read ahead
   cdata_t cout = {0};
-  if (c.n == 0) return cout;    // nothing in cfile
-  char fmt = c.fmt;
-  cout.n = cdata_n(&c);
+  if (!c2) { cfile_prefetch_close(pf); return cout; } // nothing in cfile
+  char fmt = c2->fmt;
+  cout.n = cdata_n(c2);
   cout.compressed = 0;
   cout.fmt = '3';
   cout.unit = 8;                // max-size result
   cout.s = calloc(cout.n, sizeof(uint64_t));
   
-  for (uint64_t k=0; ; ++k) {
-    if (k) c = read_cdata1(&cf); // skip 1st cdata
-    if (c.n == 0) break;
-    if (fmt != c.fmt) {
-      fprintf(stderr, "[%s:%d] File formats are inconsistent: %c vs %c.\n", __func__, __LINE__, fmt, c.fmt);
+  for (uint64_t k=0; c2; ++k, c2 = cfile_prefetch_next(pf)) {
+    if (fmt != c2->fmt) {
+      fprintf(stderr, "[%s:%d] File formats are inconsistent: %c vs %c.\n", __func__, __LINE__, fmt, c2->fmt);
       fflush(stderr);
       exit(1);
     }
-    cdata_t c2 = decompress(c);
-    if (c2.n != cout.n) {
-      fprintf(stderr, "[%s:%d] Data dimensions are inconsistent: %"PRIu64" vs %"PRIu64"\n", __func__, __LINE__, cout.n, c2.n);
+    if (cdata_n(c2) != cout.n) {
+      fprintf(stderr, "[%s:%d] Data dimensions are inconsistent: %"PRIu64" vs %"PRIu64"\n", __func__, __LINE__, cout.n, cdata_n(c2));
       fflush(stderr);
       exit(1);
     }
     
     switch (fmt) {
-    case '3': musumFmt3(&cout, &c2); break;
+    case '3': musumFmt3(&cout, c2); break;
     default: {
-      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c.fmt);
+      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c2->fmt);
       fflush(stderr);
       exit(1);
     }}
-
-    free(c.s); free(c2.s);
   }
+  cfile_prefetch_close(pf);
   return cout;
 }
 
@@ -328,9 +326,10 @@ static void collect_stat_fmt3(uint32_t *cnts, double *sum, double *sum_sq, doubl
 // see https://www.strchr.com/standard_deviation_in_one_pass
 static void rowop_stat(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
 
-  cdata_t c = read_cdata1(&cf);
-  if (c.n == 0) return; // nothing in cfile, output nothing
-  uint64_t n = cdata_n(&c);
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, NULL, NULL);
+  cdata_t *c2 = cfile_prefetch_next(pf); // decoded records, read ahead
+  if (!c2) { cfile_prefetch_close(pf); return; } // nothing in cfile, output nothing
+  uint64_t n = c2->n;
   uint32_t *cnts = calloc(n, sizeof(uint32_t));
   double *sum = calloc(n, sizeof(double));
   double *sum_sq = calloc(n, sizeof(double));
@@ -342,21 +341,17 @@ static void rowop_stat(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
   srand(cfg->seed);
   for (uint64_t i = 0; i < n; ++i) b1min[i] = 1.0;
   
-  for (uint64_t k = 0; ; ++k) {
-    if (k) c = read_cdata1(&cf); // skip 1st cdata
-    if (c.n == 0) break;
-    cdata_t c2 = decompress(c);
+  for (uint64_t k = 0; c2; ++k, c2 = cfile_prefetch_next(pf)) {
 
-    switch (c.fmt) {
-    case '3': collect_stat_fmt3(cnts, sum, sum_sq, b0max, b1min, b0n, b1n, &c2, cfg); break;
+    switch (c2->fmt) {
+    case '3': collect_stat_fmt3(cnts, sum, sum_sq, b0max, b1min, b0n, b1n, c2, cfg); break;
     default: {
-      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c.fmt);
+      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c2->fmt);
       fflush(stderr);
       exit(1);
     }}
-
-    free(c.s); free(c2.s);
   }
+  cfile_prefetch_close(pf);
 
   FILE *out;
   if (fname_out) {
@@ -400,27 +395,25 @@ static double random_zero_to_one() {
 }
 
 static void rowop_binstring(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
-  cdata_t c = read_cdata1(&cf);
-  if (c.n == 0) return;    // nothing in cfile
-  uint64_t n = cdata_n(&c);
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, NULL, NULL);
+  cdata_t *c2 = cfile_prefetch_next(pf); // decoded records, read ahead
+  if (!c2) { cfile_prefetch_close(pf); return; } // nothing in cfile
+  uint64_t n = c2->n;
   uint64_t binstring_bytes = 0;
   uint8_t *binstring = NULL;
   uint64_t k=0;
-  for (k=0; ; ++k) {
-    if (k) c = read_cdata1(&cf); // skip 1st cdata
-    if (c.n == 0) break;
-    cdata_t c2 = decompress(c);
+  for (k=0; c2; ++k, c2 = cfile_prefetch_next(pf)) {
 
     if (binstring_bytes*8 <= k) {
       binstring_bytes++;
       binstring = realloc(binstring, (binstring_bytes*n));
-      memset(binstring + (binstring_bytes-1)*n, 0, sizeof(n));
+      memset(binstring + (binstring_bytes-1)*n, 0, n);
     }
     
-    switch (c.fmt) {
+    switch (c2->fmt) {
     case '3': {
-      for (uint64_t i=0; i<c2.n; ++i) {
-        uint64_t mu = f3_get_mu(&c2, i);
+      for (uint64_t i=0; i<c2->n; ++i) {
+        uint64_t mu = f3_get_mu(c2, i);
         /* if ((mu>>32) > (mu<<32>>32)) { */
         if (mu) {
           
@@ -435,13 +428,12 @@ static void rowop_binstring(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
       break;
     }
     default: {
-      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c.fmt);
+      fprintf(stderr, "[%s:%d] File format: %c unsupported.\n", __func__, __LINE__, c2->fmt);
       fflush(stderr);
       exit(1);
     }}
-
-    free(c.s); free(c2.s);
   }
+  cfile_prefetch_close(pf);
 
   FILE *out;
   if (fname_out) { out = fopen(fname_out, "w");
@@ -460,20 +452,20 @@ void rowop_cometh(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
 
   uint64_t *cnts = NULL; uint64_t ncnts = 0;
   int cometh_window = cfg->cometh_window;
+  cfile_prefetch_t *pf = cfile_prefetch_open(&cf, 0, NULL, NULL);
   for (uint64_t k=0; ;++k) {
-    cdata_t c0 = read_cdata1(&cf);
-    if (c0.n == 0) break;
-    cdata_t c = decompress(c0);
+    cdata_t *c = cfile_prefetch_next(pf); // decoded, read ahead
+    if (!c) break;
     if (!k) {                   /* first data, initialize */
-      cnts = calloc(c.n*cometh_window, sizeof(uint64_t));
-      ncnts = c.n;
+      cnts = calloc(c->n*cometh_window, sizeof(uint64_t));
+      ncnts = c->n;
     }
-    assert(c.fmt == '3');
+    assert(c->fmt == '3');
     for (uint64_t i=0; i<ncnts-cometh_window; ++i) {
       for (uint64_t j=i+1; j<=min(ncnts-1, i+cometh_window); ++j) {
-        uint64_t mu = f3_get_mu(&c, i);
+        uint64_t mu = f3_get_mu(c, i);
         uint64_t M = mu>>32; uint64_t U = (mu<<32>>32);
-        uint64_t mu1 = f3_get_mu(&c, j);
+        uint64_t mu1 = f3_get_mu(c, j);
         uint64_t M1 = mu1>>32; uint64_t U1 = (mu1<<32>>32);
         if (M+U >= cfg->mincov && M1+U1 >= cfg->mincov) {
           // also skip intermediate values too close to 0.5
@@ -485,8 +477,8 @@ void rowop_cometh(cfile_t cf, char *fname_out, config_rowop_t *cfg) {
         }
       }
     }
-    free(c0.s); free(c.s);
   }
+  cfile_prefetch_close(pf);
 
   FILE *out;
   if (fname_out) out = fopen(fname_out, "w");
@@ -568,7 +560,7 @@ int main_rowop(int argc, char *argv[]) {
     fflush(stderr);
     exit(1);
   }
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
   if (fname_out) free(fname_out);
   free(op);
   
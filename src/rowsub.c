@@ -99,10 +99,11 @@ static int usage(config_t *config) {
   fprintf(stderr, "\n");
   fprintf(stderr, "Usage:\n");
   fprintf(stderr, "  yame rowsub [options] in.cx >out.cx\n");
+  fprintf(stderr, "  yame rowsub [options] -o out.cx in.cx\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Purpose:\n");
   fprintf(stderr, "  Subset (slice) rows from each dataset (record) in a CX stream.\n");
-  fprintf(stderr, "  Output is always written to stdout.\n");
+  fprintf(stderr, "  Output is written to stdout unless -o is given.\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Row selection modes (choose one):\n");
   fprintf(stderr, "  (A) Explicit row indices (1-based list):\n");
@@ -130,6 +131,7 @@ static int usage(config_t *config) {
   fprintf(stderr, "         If <blockSize> is omitted, default blockSize=%"PRIu64".\n", (uint64_t)config->isize);
   fprintf(stderr, "\n");
   fprintf(stderr, "Other options:\n");
+  fprintf(stderr, "  -o <out.cx>      Write to a file and index it (.idx) with the input sample names.\n");
   fprintf(stderr, "  -h               Show this help message.\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Index conventions:\n");
@@ -379,15 +381,16 @@ static cdata_t sliceToBlock(cdata_t *c, uint64_t beg, uint64_t end) {
 
 /* } */
 
+/* the mask may be sparse; kept rows are copied an interval at a time */
 static cdata_t sliceToMask(cdata_t *c, cdata_t *c_mask) {
   assert(!c->compressed);
-  if (c->n != c_mask->n)
-    wzfatal("[%s:%d] Mask (N=%"PRIu64") and data (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, c_mask->n, c->n);
+  if (c->n != cdata_n(c_mask))
+    wzfatal("[%s:%d] Mask (N=%"PRIu64") and data (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), c->n);
 
   /* Count how many rows will be kept */
-  uint64_t n = 0;
-  for (uint64_t i = 0; i < c->n; ++i)
-    if (FMT0_IN_SET(*c_mask, i)) n++;
+  uint64_t n = fmt0_popcount(c_mask), beg, end, k = 0;
+  fmt0_iter_t it;
+  fmt0_iter_init(&it, c_mask);
 
   cdata_t c_out = (cdata_t){0};
   c_out.unit = c->unit;
@@ -401,31 +404,30 @@ static cdata_t sliceToMask(cdata_t *c, cdata_t *c_mask) {
     memcpy(c_out.s, c->s, keys_nb + 1); // copy key section + '\0'
     uint8_t *dst      = c_out.s + keys_nb + 1;
     uint8_t *src_data = fmt2_get_data(c);  /* start of original data section */
-    for (uint64_t i = 0; i < c->n; ++i) {
-      if (FMT0_IN_SET(*c_mask, i)) {
-        memcpy(dst, src_data + i * c->unit, c->unit);
-        dst += c->unit;
-      }
+    while (fmt0_next_range(&it, &beg, &end)) {
+      memcpy(dst, src_data + beg * c->unit, (end - beg) * c->unit);
+      dst += (end - beg) * c->unit;
     }
-  } else if (c_out.fmt == '6') {
-    // Format 6: 2 bits per position, packed 4 positions per byte
+  } else if (c_out.fmt == '6' || c_out.fmt == '0') {
+    // Format 6: 2 bits per position, packed 4 positions per byte; format 0: 1 bit
+    int bits = c_out.fmt == '6' ? 2 : 1, per = 8 / bits;
+    uint8_t mask = (1u << bits) - 1;
     if (n > 0) {
-      uint64_t out_nbytes = (n + 3) >> 2;  // ceiling(n / 4)
-      c_out.s = calloc(1, out_nbytes);
-      for (uint64_t i = 0, k = 0; i < c->n; ++i) {
-        if (FMT0_IN_SET(*c_mask, i)) {
-          uint8_t val = (c->s[i >> 2] >> ((i & 0x3) * 2)) & 0x3;
-          c_out.s[k >> 2] |= val << ((k & 0x3) * 2);
-          k++;
+      c_out.s = calloc(1, (n + per - 1) / per);
+      while (fmt0_next_range(&it, &beg, &end)) {
+        for (uint64_t i = beg; i < end; ++i, ++k) {
+          uint8_t val = (c->s[i / per] >> ((i % per) * bits)) & mask;
+          c_out.s[k / per] |= val << ((k % per) * bits);
         }
       }
     }
   } else { // all other formats
     if (n > 0) {
       c_out.s = malloc(n * c_out.unit);
-      for (uint64_t i = 0, k = 0; i < c->n; ++i)
-        if (FMT0_IN_SET(*c_mask, i))
-          memcpy(c_out.s + (k++) * c->unit, c->s + i * c->unit, c->unit);
+      while (fmt0_next_range(&it, &beg, &end)) {
+        memcpy(c_out.s + k * c->unit, c->s + beg * c->unit, (end - beg) * c->unit);
+        k += end - beg;
+      }
     }
   }
   
@@ -433,6 +435,37 @@ static cdata_t sliceToMask(cdata_t *c, cdata_t *c_mask) {
 }
 
 
+/* blocked fmt2 (see format2.c): the kept rows are read in place, by mask
+   or by 1-based row indices */
+static cdata_t fmt2_sliceRows(cdata_t *c, cdata_t *c_mask, int64_t *row_indices, int64_t n_indices) {
+  uint8_t unit;
+  uint64_t N = cdata_dims(c, &unit), keys_nb = fmt2_get_keys_nbytes(c), beg, end, k = 0;
+  if (!row_indices && N != cdata_n(c_mask))
+    wzfatal("[%s:%d] Mask (N=%"PRIu64") and data (N=%"PRIu64") are of different lengths.\n", __func__, __LINE__, cdata_n(c_mask), N);
+
+  cdata_t c_out = {.fmt = '2', .unit = unit, .compressed = 0};
+  c_out.n = row_indices ? (uint64_t) n_indices : fmt0_popcount(c_mask);
+  c_out.s = calloc(1, keys_nb + 1 + c_out.n * unit);
+  memcpy(c_out.s, c->s, keys_nb + 1); // keys + separator
+  uint8_t *dst = c_out.s + keys_nb + 1;
+  if (row_indices) {
+    for (int64_t i = 0; i < n_indices; ++i, dst += unit) {
+      uint64_t value = f2_get_uint64(c, row_indices[i]-1);
+      memcpy(dst, &value, unit);
+    }
+  } else {
+    fmt0_iter_t it;
+    fmt0_iter_init(&it, c_mask);
+    while (fmt0_next_range(&it, &beg, &end)) {
+      for (k = beg; k < end; ++k, dst += unit) {
+        uint64_t value = f2_get_uint64(c, k);
+        memcpy(dst, &value, unit);
+      }
+    }
+  }
+  return c_out;
+}
+
 int main_rowsub(int argc, char *argv[]) {
 
   config_t config = {
@@ -440,9 +473,10 @@ int main_rowsub(int argc, char *argv[]) {
     .index = -1, .isize = 1000000, .beg = 0, .end = 1};
   int c; char *fname_row = NULL; char *fname_mask = NULL;
   char *fname_rnindex = NULL; int add_row_coordinates = 0;
-  char *B_option = NULL, *I_option = NULL;
-  while ((c = getopt(argc, argv, "1R:m:l:L:B:I:h"))>=0) {
+  char *B_option = NULL, *I_option = NULL; char *fname_out = NULL;
+  while ((c = getopt(argc, argv, "1R:m:l:L:B:I:o:h"))>=0) {
     switch (c) {
+    case 'o': fname_out = strdup(optarg); break;
     case '1': add_row_coordinates = 1; break;
     case 'R': fname_row = strdup(optarg); break;
     case 'm': fname_mask = strdup(optarg); break;
@@ -503,17 +537,14 @@ int main_rowsub(int argc, char *argv[]) {
       fflush(stderr);
       exit(1);
     }
-    convertToFmt0(&c_mask);
-    bgzf_close(cf_mask.fh);
+    if (!fmt0_is_sparse(&c_mask)) convertToFmt0(&c_mask); // sparse masks are sliced by interval
+    cdata_detach(&c_mask);
+    cfile_close(&cf_mask);
   }
 
   cfile_t cf = open_cfile(fname);
-  BGZF *fp_out = bgzf_dopen(fileno(stdout), "w");
-  if (fp_out == NULL) {
-    fprintf(stderr, "[%s:%d] Cannot open output stream.\n", __func__, __LINE__);
-    fflush(stderr);
-    exit(1);
-  }
+  snames_t snames = loadSampleNamesFromIndex(fname);
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
 
   if (fname_rnindex && !fname_row) {
     fprintf(stderr, "[%s:%d] Missing -R for BED coordinates.\n", __func__, __LINE__);
@@ -532,37 +563,67 @@ int main_rowsub(int argc, char *argv[]) {
       if (row_indices) cr2 = fmt7_sliceToIndices(&cr, row_indices, n_indices);
       else if (c_mask.n) cr2 = fmt7_sliceToMask(&cr, &c_mask);
       else cr2 = fmt7_sliceToBlock(&cr, config.beg, config.end);
-      cdata_write1(fp_out, &cr2);
+      cfile_writer_write(w, &cr2, NULL);
       free_cdata(&cr2);
     }
     free_cdata(&cr);
-    bgzf_close(cf_row.fh);
+    cfile_close(&cf_row);
   }
   
-  while (1) {
-    cdata_t c = read_cdata1(&cf);
-    if (c.n == 0) break;
-    if (c.fmt == '7') {
-      cdata_t c2;
-      if (row_indices) c2 = fmt7_sliceToIndices(&c, row_indices, n_indices);
-      else if (c_mask.n) c2 = fmt7_sliceToMask(&c, &c_mask);
-      else c2 = fmt7_sliceToBlock(&c, config.beg, config.end);
-      cdata_write1(fp_out, &c2);
-      free_cdata(&c2);
-    } else {
-      cdata_t c2 = decompress(c);
-      cdata_t c3 = {0};
-      if (row_indices) c3 = sliceToIndices(&c2, row_indices, n_indices);
-      else if (c_mask.n) c3 = sliceToMask(&c2, &c_mask);
-      else c3 = sliceToBlock(&c2, config.beg, config.end);
-      cdata_compress(&c3);
-      cdata_write1(fp_out, &c3);
-      free(c3.s); free(c2.s);
+  if (cf.tl && !row_indices && !c_mask.n) {
+    // tiled input: a row block only reads the tiles that overlap it
+    for (uint64_t s = 0; ; s += cf.tl->tsmp) {
+      cdata_v *cs = read_cdata_tiles(&cf, config.beg, config.end, s, s + cf.tl->tsmp - 1);
+      for (uint64_t k = 0; k < cs->size; ++k) {
+        cdata_t *c3 = ref_cdata_v(cs, k);
+        cdata_compress(c3);
+        cfile_writer_write(w, c3, s+k < (uint64_t) snames.n ? snames.s[s+k] : NULL);
+        free_cdata(c3);
+      }
+      int done = (cs->size == 0);
+      free_cdata_v(cs);
+      if (done) break;
+    }
+  } else {
+    for (int64_t k = 0; ; ++k) {
+      const char *sname = k < snames.n ? snames.s[k] : NULL;
+      cdata_t c = read_cdata1(&cf);
+      if (c.n == 0) break;
+      if (c.fmt == '7') {
+        cdata_t c2;
+        if (row_indices) c2 = fmt7_sliceToIndices(&c, row_indices, n_indices);
+        else if (c_mask.n) c2 = fmt7_sliceToMask(&c, &c_mask);
+        else c2 = fmt7_sliceToBlock(&c, config.beg, config.end);
+        cfile_writer_write(w, &c2, sname);
+        free_cdata(&c2);
+      } else if (!row_indices && !c_mask.n) {
+        // block: decode only the rows we keep (also slices fmt0 by bit)
+        cdata_t c3 = decompress_range(&c, config.beg, config.end);
+        cdata_compress(&c3);
+        cfile_writer_write(w, &c3, sname);
+        free(c3.s);
+      } else if (c.fmt == '2' && fmt2_is_blocked(&c)) {
+        cdata_t c3 = fmt2_sliceRows(&c, &c_mask, row_indices, n_indices);
+        cdata_compress(&c3);
+        cfile_writer_write(w, &c3, sname);
+        free(c3.s);
+      } else {
+        cdata_t c2 = decompress(c);
+        cdata_t c3 = {0};
+        if (row_indices) c3 = sliceToIndices(&c2, row_indices, n_indices);
+        else if (c_mask.n) c3 = sliceToMask(&c2, &c_mask);
+        else c3 = sliceToBlock(&c2, config.beg, config.end);
+        cdata_compress(&c3);
+        cfile_writer_write(w, &c3, sname);
+        free(c3.s); free(c2.s);
+      }
+      free_cdata(&c);
     }
-    free_cdata(&c);
   }
-  bgzf_close(cf.fh);
-  bgzf_close(fp_out);
+  cfile_close(&cf);
+  cfile_writer_close(w);
+  cleanSampleNames(&snames);
+  if (fname_out) free(fname_out);
 
   if (n_indices) free(row_indices);
   if (fname_row) free(fname_row);
@@ -24,9 +24,13 @@
 #include <zlib.h>
 #include "wzio.h"
 
+struct bindex_t;
+void freeBinaryIndex(struct bindex_t *bidx);
+
 typedef struct {
   int n;
   char **s;
+  struct bindex_t *bidx;        /* when set, s[] point into this mapped .bidx (index.h) */
 } snames_t;
 
 /**
@@ -81,6 +85,11 @@ static inline snames_t loadSampleNames(char* fname_snames, int fatal) {
 }
 
 static inline void cleanSampleNames2(snames_t snames) {
+  if (snames.bidx) {
+    freeBinaryIndex(snames.bidx);
+    free(snames.s);
+    return;
+  }
   if (snames.n)
     for (int i=0; i< snames.n; ++i) {
       free(snames.s[i]);
@@ -89,7 +98,10 @@ static inline void cleanSampleNames2(snames_t snames) {
 }
 
 static inline void cleanSampleNames(snames_t *snames) {
-  if (snames) {
+  if (snames && snames->bidx) {
+    freeBinaryIndex(snames->bidx);
+    free(snames->s);
+  } else if (snames) {
     if (snames->n)
       for (int i=0; i< snames->n; ++i) {
         free(snames->s[i]);
@@ -97,7 +97,7 @@ int main_split(int argc, char *argv[]) {
     }
     cdata_write(tmp, &c, "wb", verbose);
     free(tmp);
-    free(c.s);
+    free_cdata(&c);
   }
   
   return 0;
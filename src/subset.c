@@ -55,15 +55,15 @@
  *
  * Extraction:
  *   For each requested sample name:
- *     - lookup offset = getIndex(idx, name)
- *     - bgzf_seek(cf.fh, offset, SEEK_SET)
+ *     - lookup offset = index_lookup(bidx, idx, name)
+ *     - cfile_seek(&cf, offset)
  *     - read_cdata2(&cf, &c)
- *     - cdata_write1(fp_out, &c)
+ *     - cfile_writer_write(w, &c, name)
  *
  * Output indexing:
- *   If -o is provided (writing to a file), we generate an output index by
- *   re-reading the output file sequentially and recording bgzf_tell() offsets
- *   for each emitted record, keyed by the corresponding sample name.
+ *   If -o is provided (writing to a file), the cfile_writer_t records the
+ *   bgzf_tell() offset of each emitted record as it is written, keyed by the
+ *   corresponding sample name, and writes the index on close.
  *   If output is stdout, no index is written.
  *
  *
@@ -92,7 +92,7 @@
  *
  * Output indexing:
  *   If -o is used, an output index is written mapping term name -> record offset,
- *   using the same “re-read output file and bgzf_tell() offsets” approach.
+ *   recorded by the same cfile_writer_t as the records are written.
  *
  *
  * Practical notes / gotchas
@@ -111,14 +111,8 @@ void subset_fmt2_states(cfile_t cf, snames_t snames, char *fname_out) {
     wzfatal("To subset states, please provide a format 2 input. Give %c", c.fmt);
   }
 
-  // output
-  BGZF *fp;
-  if (fname_out) fp = bgzf_open2(fname_out, "w");
-  else fp = bgzf_dopen(fileno(stdout), "w");
-  if (fp == NULL) {
-    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
-    exit(1);
-  }
+  // output, indexed by term as it is written
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
 
   if (!c.aux) fmt2_set_aux(&c);
   f2_aux_t *aux = (f2_aux_t*) c.aux;
@@ -139,50 +133,37 @@ void subset_fmt2_states(cfile_t cf, snames_t snames, char *fname_out) {
     for (uint64_t ii = 0; ii < c.n; ++ii) {
       if (f2_get_uint64(&c, ii) == i_term) FMT0_SET(c0, ii);
     }
-    cdata_write1(fp, &c0);
+    cfile_writer_write(w, &c0, snames.s[i]);
   }
   free_cdata(&c);
   free_cdata(&c0);
-  bgzf_close(fp);
-  
-  if (fname_out) {              // output index
-    cfile_t cf2 = open_cfile(fname_out);
-    index_t *idx2 = kh_init(index);
-    int64_t addr = bgzf_tell(cf2.fh);
-    cdata_t c_tmp = {0};
-    for (int i=0; i< snames.n; ++i) {
-      if (!read_cdata2(&cf2, &c_tmp)) {
-        fprintf(stderr, "[Error] Data is shorter than the sample name list.\n");
-        fflush(stderr);
-        exit(1);
-      }
-      insert_index(idx2, snames.s[i], addr);
-      addr = bgzf_tell(cf2.fh);
-    }
-    free_cdata(&c_tmp);
-
-    char *fname_index2 = get_fname_index(fname_out);
-    FILE *out = fopen(fname_index2, "w");
-    writeIndex(out, idx2);
-    fclose(out);
-    free(fname_index2);
-    free(fname_out);
-    bgzf_close(cf2.fh);
-    freeIndex(idx2);
-  }
+  cfile_writer_close(w);
+  if (fname_out) free(fname_out);
 }
 
-void subset_samples(cfile_t cf, index_t *idx, snames_t snames, char *fname_out, int head, int tail) {
+void subset_samples(cfile_t cf, const bindex_t *bidx, index_t *idx, snames_t snames, char *fname_out, int head, int tail) {
 
   // check if we have index
-  if (!idx) {
+  if (!idx && !bidx) {
     fprintf(stderr, "Error, the cx file needs indexing for subsetting.\n");
     fflush(stderr);
     exit(1);
   }
 
   // if sample names are not explicitly given, use head and tails
-  if (snames.n == 0) {
+  int own_names = (snames.n == 0);
+  if (snames.n == 0 && bidx) {  // record order; the names stay in the pool
+    int n0 = bidx->n, beg = 0;
+    if (tail > 0) {
+      if (tail > n0) tail = n0;
+      snames.n = tail; beg = n0 - tail;
+    } else {
+      if (head < 1) head = 1;   // default to head 1
+      snames.n = head > n0 ? n0 : head;
+    }
+    snames.s = calloc(snames.n, sizeof(char*));
+    for (int i=0; i<snames.n; ++i) snames.s[i] = (char*) bindex_name(bidx, beg+i);
+  } else if (snames.n == 0) {
     int npairs = 0;
     index_pair_t *pairs = index_pairs(idx, &npairs);
     if (tail > 0) {
@@ -202,53 +183,26 @@ void subset_samples(cfile_t cf, index_t *idx, snames_t snames, char *fname_out,
     clean_index_pairs(pairs, npairs);
   }
 
-  // output
-  BGZF *fp;
-  if (fname_out) fp = bgzf_open2(fname_out, "w");
-  else fp = bgzf_dopen(fileno(stdout), "w");
-  if (fp == NULL) {
-    fprintf(stderr, "Error opening file for writing: %s\n", fname_out);
-    exit(1);
-  }
+  // output, indexed by sample name as it is written
+  cfile_writer_t *w = cfile_writer_open(fname_out, "w");
   cdata_t c = {0};              // output data
   for (int i=0; i<snames.n; ++i) {
-    int64_t index = getIndex(idx, snames.s[i]);
-    assert(index >= 0);
-    assert(bgzf_seek(cf.fh, index, SEEK_SET) == 0);
+    int64_t index = index_lookup(bidx, idx, snames.s[i]);
+    if (index < 0) wzfatal("[%s:%d] Cannot find sample %s in index.\n", __func__, __LINE__, snames.s[i]);
+    assert(cfile_seek(&cf, index) == 0);
     read_cdata2(&cf, &c);
     if (c.n <= 0) {
       fprintf(stderr, "[%s:%d] Error, cannot find %s.\n", __func__, __LINE__, snames.s[i]);
       fflush(stderr);
       exit(1);
     }
-    cdata_write1(fp, &c);
-  }
-  bgzf_close(fp);
-
-  if (fname_out) {              // output index
-    cfile_t cf2 = open_cfile(fname_out);
-    index_t *idx2 = kh_init(index);
-    int64_t addr = bgzf_tell(cf2.fh);
-    for (int i=0; i< snames.n; ++i) {
-      if (!read_cdata2(&cf2, &c)) {
-        fprintf(stderr, "[Error] Data is shorter than the sample name list.\n");
-        fflush(stderr);
-        exit(1);
-      }
-      insert_index(idx2, snames.s[i], addr);
-      addr = bgzf_tell(cf2.fh);
-    }
-    free(c.s);
-
-    char *fname_index2 = get_fname_index(fname_out);
-    FILE *out = fopen(fname_index2, "w");
-    writeIndex(out, idx2);
-    fclose(out);
-    free(fname_index2);
-    free(fname_out);
-    bgzf_close(cf2.fh);
-    freeIndex(idx2);
+    cfile_writer_write(w, &c, snames.s[i]);
   }
+  free_cdata(&c);
+  if (own_names && bidx) free(snames.s);
+  else if (own_names) cleanSampleNames(&snames);
+  cfile_writer_close(w);
+  if (fname_out) free(fname_out);
 }
 
 static int usage(void) {
@@ -319,9 +273,13 @@ int main_subset(int argc, char *argv[]) {
 
   // input
   cfile_t cf = open_cfile(argv[optind]);
-  char *fname_index = get_fname_index(argv[optind]);
-  index_t *idx = loadIndex(fname_index);
-  free(fname_index);
+  bindex_t *bidx = loadBinaryIndex(argv[optind]); // names resolve through the mapping
+  index_t *idx = NULL;
+  if (!bidx) {
+    char *fname_index = get_fname_index(argv[optind]);
+    idx = loadIndex(fname_index);
+    free(fname_index);
+  }
   optind++;
 
   // get sample names
@@ -338,12 +296,13 @@ int main_subset(int argc, char *argv[]) {
   if (filter_fmt2_states) {
     subset_fmt2_states(cf, snames, fname_out);
   } else {
-    subset_samples(cf, idx, snames, fname_out, head, tail);
+    subset_samples(cf, bidx, idx, snames, fname_out, head, tail);
   }
   
   // clean up
-  bgzf_close(cf.fh);
-  cleanIndex(idx);
+  cfile_close(&cf);
+  if (idx) cleanIndex(idx);
+  freeBinaryIndex(bidx);
   cleanSampleNames(&snames);
   
   return 0;
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <zlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "wzmisc.h"
 #include "wzbed.h"
 #include "cfile.h"
@@ -57,11 +58,16 @@
  * If the mask BGZF stream is seekable, we re-seek to the beginning for each
  * query sample (lowest memory). If it is unseekable, or if -M is requested,
  * all mask records are read and prepared once into RAM. :contentReference[oaicite:2]{index=2}
+ * With -t <threads> masks are always held in RAM and the query x mask
+ * product runs on a worker pool (see summary_pool_t below).
  *
  * Preparation of query/mask records
  * ---------------------------------
  * prepare_mask() normalizes “mask-like operations”:
- *   - fmt 0/1 are converted to fmt 0 bitset (convertToFmt0)
+ *   - fmt 0/1 are converted to fmt 0 bitset (convertToFmt0); sparse fmt0
+ *     stays as stored for the kernels of summarize1_queryfmt0()
+ *   - fmt2 stays compressed and is turned into (state, end) runs once
+ *     (fmt2_mask_runs); the summarize1_* handlers aggregate whole runs
  *   - fmt >= 2 are decompressed in-place (decompress2)
  * This ensures summarize1_* can assume consistent in-memory representation.
  *
@@ -134,6 +140,8 @@ static int usage(void) {
   fprintf(stderr, "  -q <name>      Backup query file name used only when <query.cx> is '-'.\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Other:\n");
+  fprintf(stderr, "  -t <int>       Threads over the query x mask product (default: 1). Masks are\n");
+  fprintf(stderr, "                 then held in memory as with -M; row order is unchanged.\n");
   fprintf(stderr, "  -6             Treat format-6 query as 2bit quaternary than set/universe.\n");
   fprintf(stderr, "  -h             Show this help message.\n");
   fprintf(stderr, "\n");
@@ -158,6 +166,12 @@ stats_t* summarize1_queryfmt7(cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char
 
 static stats_t* summarize1(cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm, char *sq, config_t *config) {
 
+  if (fmt0_is_sparse(c_mask) && c->fmt > '1') { // other queries test the mask bit by bit
+    cdata_t bits = decompress(*c_mask);
+    stats_t *st = summarize1(c, &bits, n_st, sm, sq, config);
+    free_cdata(&bits);
+    return st;
+  }
   switch (c->fmt) {
   case '0': return summarize1_queryfmt0(c, c_mask, n_st, sm, sq, config);
   case '1': return summarize1_queryfmt0(c, c_mask, n_st, sm, sq, config);
@@ -172,7 +186,7 @@ static stats_t* summarize1(cdata_t *c, cdata_t *c_mask, uint64_t *n_st, char *sm
   return st;
 }
 
-static void format_stats_and_clean(stats_t *st, uint64_t n_st, const char *fname_qry, config_t *config) {
+static void format_stats_and_clean(stats_t *st, uint64_t n_st, const char *fname_qry, config_t *config, kstring_t *out) {
   const char *fmask = "NA";
   if (!config->full_name) fname_qry = get_basename(fname_qry);
   for (uint64_t i=0; i<n_st; ++i) {
@@ -193,24 +207,24 @@ static void format_stats_and_clean(stats_t *st, uint64_t n_st, const char *fname
       odds_ratio = tmp.s;
       fmask = "NA";
     }
-    fprintf(stdout,
-            "%s\t%s\t%s\t%s\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%s",
-            fname_qry, s.sq, fmask, s.sm, s.n_u, s.n_q, s.n_m, s.n_o, odds_ratio);
+    ksprintf(out,
+             "%s\t%s\t%s\t%s\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%"PRIu64"\t%s",
+             fname_qry, s.sq, fmask, s.sm, s.n_u, s.n_q, s.n_m, s.n_o, odds_ratio);
     if (s.beta >=0) {
-      fprintf(stdout, "\t%1.3f", s.beta);
+      ksprintf(out, "\t%1.3f", s.beta);
     } else {
-      fputs("\tNA", stdout);
+      kputs("\tNA", out);
     }
     if (s.sum_depth) {
       if (s.n_m) {
-        fprintf(stdout, "\t%1.3f", (double) s.sum_depth / s.n_m);
+        ksprintf(out, "\t%1.3f", (double) s.sum_depth / s.n_m);
       } else {
-        fprintf(stdout, "\t%1.3f", (double) s.sum_depth / s.n_u);
+        ksprintf(out, "\t%1.3f", (double) s.sum_depth / s.n_u);
       }
     } else {
-      fputs("\tNA", stdout);
+      kputs("\tNA", out);
     }
-    fputc('\n', stdout);
+    kputc('\n', out);
     free(odds_ratio);
   }
 
@@ -223,19 +237,220 @@ static void format_stats_and_clean(stats_t *st, uint64_t n_st, const char *fname
   }
 }
 
+/* summary rows of one query against one mask, appended to out */
+static void summarize_into(cdata_t *c_qry, cdata_t *c_mask, char *sm, char *sq, const char *fname_qry, config_t *config, kstring_t *out) {
+  uint64_t n_st = 0;
+  stats_t *st = summarize1(c_qry, c_mask, &n_st, sm, sq, config);
+  format_stats_and_clean(st, n_st, fname_qry, config, out);
+}
+
+static void flush_rows(kstring_t *out) {
+  if (out->l) fwrite(out->s, 1, out->l, stdout);
+  out->l = 0;
+}
+
+/**
+ * -t: the query x mask product on a worker pool
+ * ---------------------------------------------
+ * Masks are held in memory (as with -M) and shared read-only. A round takes
+ * up to n_threads queries off the stream; each query is cut into jobs of
+ * `blk` consecutive masks, so a single query still keeps every thread busy.
+ * Jobs are claimed in any order, but their rows are written in job order
+ * after the round, which is the order of the serial loop. Lazily built
+ * state (fmt2 aux and mask runs) is built before a round starts.
+ */
+typedef struct summary_job_t {
+  cdata_t *c_qry;
+  char *sq;
+  const char *fname_qry;
+  uint64_t km0, km1;            /* masks [km0, km1); unused without -m */
+  kstring_t out;
+} summary_job_t;
+
+typedef struct summary_pool_t {
+  config_t *config;
+  cdata_t *c_masks;
+  char **sm;
+  uint64_t c_masks_n, blk;
+  cdata_t *qry;                 /* queries held by the round */
+  char **sq;
+  int n_qry;
+  const char *fname_qry;
+  summary_job_t *jobs;
+  uint64_t n_jobs, m_jobs, next, n_done;
+  int n_threads, round, stop;
+  pthread_t *tid;
+  pthread_mutex_t lock;
+  pthread_cond_t go, done;
+} summary_pool_t;
+
+static void pool_run_job(summary_pool_t *p, summary_job_t *j) {
+  if (!p->config->fname_mask) {
+    char sm[] = "global"; cdata_t c_mask = {0};
+    summarize_into(j->c_qry, &c_mask, sm, j->sq, j->fname_qry, p->config, &j->out);
+    return;
+  }
+  for (uint64_t km = j->km0; km < j->km1; ++km)
+    summarize_into(j->c_qry, &p->c_masks[km], p->sm[km], j->sq, j->fname_qry, p->config, &j->out);
+}
+
+/* claim and run jobs of the current round until none is left */
+static void pool_work(summary_pool_t *p) {
+  for (;;) {
+    pthread_mutex_lock(&p->lock);
+    summary_job_t *j = p->next < p->n_jobs ? &p->jobs[p->next++] : NULL;
+    pthread_mutex_unlock(&p->lock);
+    if (!j) return;
+    pool_run_job(p, j);
+    pthread_mutex_lock(&p->lock);
+    if (++p->n_done == p->n_jobs) pthread_cond_signal(&p->done);
+    pthread_mutex_unlock(&p->lock);
+  }
+}
+
+static void *pool_worker(void *data) {
+  summary_pool_t *p = (summary_pool_t*) data;
+  for (int round = 0;;) {
+    pthread_mutex_lock(&p->lock);
+    while (p->round == round && !p->stop) pthread_cond_wait(&p->go, &p->lock);
+    round = p->round;
+    int stop = p->stop;
+    pthread_mutex_unlock(&p->lock);
+    if (stop) return NULL;
+    pool_work(p);
+  }
+}
+
+static summary_pool_t *pool_init(config_t *config, cdata_t *c_masks, char **sm, uint64_t c_masks_n) {
+  summary_pool_t *p = calloc(1, sizeof(summary_pool_t));
+  p->config = config;
+  p->c_masks = c_masks;
+  p->sm = sm;
+  p->c_masks_n = c_masks_n;
+  p->n_threads = config->n_threads;
+  p->blk = (c_masks_n + 4*p->n_threads - 1) / (4*p->n_threads);
+  if (!p->blk) p->blk = 1;
+  p->qry = calloc(p->n_threads, sizeof(cdata_t));
+  p->sq = calloc(p->n_threads, sizeof(char*));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->go, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->tid = calloc(p->n_threads-1, sizeof(pthread_t));
+  for (int i=0; i<p->n_threads-1; ++i)
+    if (pthread_create(&p->tid[i], NULL, pool_worker, p) != 0)
+      wzfatal("[%s:%d] Cannot start summary threads.\n", __func__, __LINE__);
+  return p;
+}
+
+/* run the held queries through the workers, write their rows in order */
+static void pool_flush(summary_pool_t *p) {
+  if (!p->n_qry) return;
+  p->n_jobs = 0;
+  for (int k=0; k<p->n_qry; ++k) {
+    uint64_t km0 = 0;
+    do {
+      if (p->config->fname_mask && km0 >= p->c_masks_n) break;
+      if (p->n_jobs == p->m_jobs) {
+        p->m_jobs = p->m_jobs ? p->m_jobs<<1 : 64;
+        p->jobs = realloc(p->jobs, p->m_jobs * sizeof(summary_job_t));
+        memset(p->jobs + p->n_jobs, 0, (p->m_jobs - p->n_jobs) * sizeof(summary_job_t));
+      }
+      summary_job_t *j = &p->jobs[p->n_jobs++];
+      j->c_qry = &p->qry[k];
+      j->sq = p->sq[k];
+      j->fname_qry = p->fname_qry;
+      j->km0 = km0;
+      j->km1 = km0 + p->blk < p->c_masks_n ? km0 + p->blk : p->c_masks_n;
+      km0 += p->blk;
+    } while (p->config->fname_mask);
+  }
+  pthread_mutex_lock(&p->lock);
+  p->next = p->n_done = 0;
+  ++p->round;
+  pthread_cond_broadcast(&p->go);
+  pthread_mutex_unlock(&p->lock);
+  pool_work(p);
+  pthread_mutex_lock(&p->lock);
+  while (p->n_done < p->n_jobs) pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+  for (uint64_t i=0; i<p->n_jobs; ++i) flush_rows(&p->jobs[i].out);
+  for (int k=0; k<p->n_qry; ++k) {
+    free_cdata(&p->qry[k]);
+    memset(&p->qry[k], 0, sizeof(cdata_t));
+    free(p->sq[k]);
+  }
+  p->n_qry = 0;
+}
+
+/* take over a query record (and its name) for the current round */
+static void pool_add(summary_pool_t *p, cdata_t *c_qry, char *sq, const char *fname_qry) {
+  p->fname_qry = fname_qry;
+  cdata_t *q = &p->qry[p->n_qry];
+  *q = *c_qry;
+  memset(c_qry, 0, sizeof(cdata_t)); /* the reader grows a fresh buffer */
+  if (q->fmt == '2' && !q->aux) fmt2_set_aux(q);
+  p->sq[p->n_qry++] = sq;
+  if (p->n_qry == p->n_threads) pool_flush(p);
+}
+
+static void pool_close(summary_pool_t *p) {
+  pool_flush(p);
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  pthread_cond_broadcast(&p->go);
+  pthread_mutex_unlock(&p->lock);
+  for (int i=0; i<p->n_threads-1; ++i) pthread_join(p->tid[i], NULL);
+  for (uint64_t i=0; i<p->m_jobs; ++i) free(p->jobs[i].out.s);
+  free(p->jobs); free(p->tid); free(p->qry); free(p->sq);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->go);
+  pthread_cond_destroy(&p->done);
+  free(p);
+}
+
 static void prepare_mask(cdata_t *c) {
-  if (c->fmt < '2') {
+  if (fmt0_is_sparse(c)) {
+    return;
+  } else if (c->fmt == '2') {
+    fmt2_mask_runs(c);
+  } else if (c->fmt < '2') {
     convertToFmt0(c);
   } else {
     decompress_in_situ(c);
   }
 }
 
+/* records other than masks: blocked fmt2 is read in place by
+   f2_get_uint64(), other fmt2 is inflated */
+static void prepare_record_into(cdata_t *c, cdata_t *out) {
+  if (fmt0_is_sparse(c) || (c->fmt == '2' && fmt2_is_blocked(c))) { cdata_prep_raw(c, out); return; }
+  if (c->fmt < '2') convertToFmt0(c);
+  decompress_into(c, out);
+}
+
+/* prepare_mask() for streamed records: decode into out, reusing its buffer */
+static void prepare_mask_into(cdata_t *c, cdata_t *out) {
+  if (c->fmt == '2') {
+    cdata_prep_raw(c, out);
+    fmt2_mask_runs(out);
+  } else {
+    prepare_record_into(c, out);
+  }
+}
+
+/* queries: fmt3 stays compressed for the cursor in summarize1_queryfmt3(),
+   sparse fmt0 for summarize1_queryfmt0(), sparse fmt6 for
+   summarize1_queryfmt6() */
+static void prepare_query_into(cdata_t *c, cdata_t *out) {
+  if (c->fmt == '3' || fmt6_is_sparse(c)) cdata_prep_raw(c, out);
+  else prepare_record_into(c, out);
+}
+
 /* The design, first 10 bytes are uint64_t (length) + uint16_t (0=vec; 1=rle) */
 int main_summary(int argc, char *argv[]) {
   int c;
   config_t config = {0};
-  while ((c = getopt(argc, argv, "m:u:MHFTs:6q:h"))>=0) {
+  while ((c = getopt(argc, argv, "m:u:MHFTs:6q:t:h"))>=0) {
     switch (c) {
     case 'm': config.fname_mask = strdup(optarg); break;
     case 'M': config.in_memory = 1; break;
@@ -245,6 +460,7 @@ int main_summary(int argc, char *argv[]) {
     case 'T': config.section_name = 1; break;
     case 's': config.fname_snames = strdup(optarg); break;
     case 'q': config.fname_qry_stdin = optarg; break;
+    case 't': config.n_threads = atoi(optarg); break;
     case 'h': return usage(); break;
     default: usage(); wzfatal("Unrecognized option: %c.\n", c);
     }
@@ -260,11 +476,12 @@ int main_summary(int argc, char *argv[]) {
   cdata_t *c_masks = NULL; uint64_t c_masks_n = 0;
   if (config.fname_mask) {
     cf_mask = open_cfile(config.fname_mask);
-    unseekable = bgzf_seek(cf_mask.fh, 0, SEEK_SET);
+    unseekable = cfile_seek(&cf_mask, 0);
     snames_mask = loadSampleNamesFromIndex(config.fname_mask);
   }
   
-  if (config.in_memory || unseekable) { /* load in-memory masks */
+  char **sm_masks = NULL;
+  if (config.fname_mask && (config.in_memory || unseekable || config.n_threads > 1)) { /* load in-memory masks */
     c_masks = calloc(1, sizeof(cdata_t));
     c_masks_n = 0;
     for (;;++c_masks_n) {
@@ -274,8 +491,21 @@ int main_summary(int argc, char *argv[]) {
       c_masks = realloc(c_masks, (c_masks_n+1)*sizeof(cdata_t));
       c_masks[c_masks_n] = c_mask;
     }
+    sm_masks = calloc(c_masks_n, sizeof(char*));
+    for (uint64_t km=0; km<c_masks_n; ++km) {
+      kstring_t sm = {0};
+      if (snames_mask.n) kputs(snames_mask.s[km], &sm);
+      else ksprintf(&sm, "%"PRIu64"", km+1);
+      sm_masks[km] = sm.s;
+    }
   }
   
+  /* record buffers reused across all queries and mask passes */
+  cdata_pool_t pool = {0};
+  kstring_t rows = {0};
+  summary_pool_t *workers = NULL;
+  if (config.n_threads > 1) workers = pool_init(&config, c_masks, sm_masks, c_masks_n);
+
   if (!config.no_header) {
     fputs("QFile\tQuery\tMFile\tMask\tN_univ\tN_query\tN_mask\tN_overlap\tLog2OddsRatio\tBeta\tDepth\n", stdout);
   }
@@ -291,9 +521,10 @@ int main_summary(int argc, char *argv[]) {
     if (strcmp(fname_qry, "-")==0 && config.fname_qry_stdin)
       fname_qry = config.fname_qry_stdin;
 
+    cfile_prefetch_t *pf_qry = cfile_prefetch_open(&cf_qry, 0, prepare_query_into, &pool);
     for (uint64_t kq=0;;++kq) {
-      cdata_t c_qry = read_cdata1(&cf_qry);
-      if (c_qry.n == 0) break;
+      cdata_t *c_qry = cfile_prefetch_next(pf_qry);
+      if (!c_qry) break;
       if (snames_qry.n && kq >= (unsigned) snames_qry.n) {
         fprintf(stderr, "[%s:%d] More data (N=%"PRIu64") found than specified in the index file (N=%d).\n", __func__, __LINE__, kq+1, snames_qry.n);
         fflush(stderr);
@@ -306,61 +537,63 @@ int main_summary(int argc, char *argv[]) {
       kstring_t sq = {0};
       if (snames_qry.n) kputs(snames_qry.s[kq], &sq);
       else ksprintf(&sq, "%"PRIu64"", kq+1);
-      prepare_mask(&c_qry);
 
+      if (workers) {            /* rows come out when the round is done */
+        pool_add(workers, c_qry, sq.s, fname_qry);
+        continue;
+      }
       if (config.fname_mask) {   /* apply any mask? */
-        if (c_masks_n) {        /* in memory or unseekable */
+        if (sm_masks) {         /* in memory or unseekable */
           for (uint64_t km=0;km<c_masks_n;++km) {
-            cdata_t c_mask = c_masks[km];
-            kstring_t sm = {0};
-            if (snames_mask.n) kputs(snames_mask.s[km], &sm);
-            else ksprintf(&sm, "%"PRIu64"", km+1);
-            uint64_t n_st = 0;
-            stats_t *st = summarize1(&c_qry, &c_mask, &n_st, sm.s, sq.s, &config);
-            format_stats_and_clean(st, n_st, fname_qry, &config);
-            free(sm.s);
+            summarize_into(c_qry, &c_masks[km], sm_masks[km], sq.s, fname_qry, &config, &rows); // fmt2 aux is kept across queries
+            flush_rows(&rows);
           }
         } else {                /* mask is seekable */
-          if (bgzf_seek(cf_mask.fh, 0, SEEK_SET)!=0) {
+          if (cfile_seek(&cf_mask, 0)!=0) {
             fprintf(stderr, "[%s:%d] Cannot seek mask.\n", __func__, __LINE__);
             fflush(stderr);
             exit(1);
           }
+          cfile_prefetch_t *pf_mask = cfile_prefetch_open(&cf_mask, 0, prepare_mask_into, &pool);
           for (uint64_t km=0;;++km) {
-            cdata_t c_mask = read_cdata1(&cf_mask);
-            if (c_mask.n == 0) break;
-            prepare_mask(&c_mask);
-
+            cdata_t *c_mask_dec = cfile_prefetch_next(pf_mask);
+            if (!c_mask_dec) break;
             kstring_t sm = {0};
             if (snames_mask.n) kputs(snames_mask.s[km], &sm);
             else ksprintf(&sm, "%"PRIu64"", km+1);
-            uint64_t n_st = 0;
-            stats_t *st = summarize1(&c_qry, &c_mask, &n_st, sm.s, sq.s, &config);
-            format_stats_and_clean(st, n_st, fname_qry, &config);
+            summarize_into(c_qry, c_mask_dec, sm.s, sq.s, fname_qry, &config, &rows);
+            flush_rows(&rows);
             free(sm.s);
-            free_cdata(&c_mask);
           }
+          cfile_prefetch_close(pf_mask);
         }
       } else {                  /* whole dataset summary if missing mask */
         kstring_t sm = {0}; cdata_t c_mask = {0};
         kputs("global", &sm);
-        uint64_t n_st = 0;
-        stats_t *st = summarize1(&c_qry, &c_mask, &n_st, sm.s, sq.s, &config);
-        format_stats_and_clean(st, n_st, fname_qry, &config);
+        summarize_into(c_qry, &c_mask, sm.s, sq.s, fname_qry, &config, &rows);
+        flush_rows(&rows);
         free(sm.s);
       }
       free(sq.s);
-      free_cdata(&c_qry); c_qry.s = NULL;
     }
-    if (c_masks_n) {
-      for (uint64_t i=0; i<c_masks_n; ++i) free_cdata(&c_masks[i]);
-      free(c_masks);
-    }
-    bgzf_close(cf_qry.fh);
+    if (workers) pool_flush(workers);
+    cfile_prefetch_close(pf_qry);
+    cfile_close(&cf_qry);
     cleanSampleNames2(snames_qry);
   }
+  if (workers) pool_close(workers);
+  if (c_masks) {                /* kept for every query file */
+    for (uint64_t i=0; i<c_masks_n; ++i) free_cdata(&c_masks[i]);
+    free(c_masks);
+  }
+  if (sm_masks) {
+    for (uint64_t i=0; i<c_masks_n; ++i) free(sm_masks[i]);
+    free(sm_masks);
+  }
+  free(rows.s);
+  cdata_pool_free(&pool);
   if (config.fname_snames) free(config.fname_snames);
-  if (config.fname_mask) bgzf_close(cf_mask.fh);
+  if (config.fname_mask) cfile_close(&cf_mask);
   if (config.fname_mask) free(config.fname_mask);
   cleanSampleNames2(snames_mask);
   
@@ -43,13 +43,13 @@
  * The tool loads a vector of records (cdata_v *cs) using the following priority:
  *
  *   1) If an index exists and snames.n > 0:
- *        cs = read_cdata_with_snames(&cf, idx, &snames)
+ *        cs = read_cdata_with_snames(&cf, bidx, idx, &snames)
  *   2) Else if -a:
  *        cs = read_cdata_all(&cf)
  *   3) Else if -H N:
  *        cs = read_cdata_from_head(&cf, N)
  *   4) Else if -T N (requires index):
- *        cs = read_cdata_from_tail(&cf, idx, N)
+ *        cs = read_cdata_from_tail(&cf, bidx, idx, N)
  *   5) Else:
  *        cs = read_cdata_from_head(&cf, 1)
  *
@@ -61,7 +61,7 @@
  * Coordinates / left column (-R / format 7)
  * -----------------------------------------
  * - If -R is provided, a separate CX record is read as cr and printed as the first
- *   column(s) for every row i (print_cdata1(&cr, i, pfmt)).
+ *   column(s) for every row i.
  * - If the first selected dataset is format 7, unpack treats column 1 as coordinates
  *   (col1_is_row_index) and prints coordinates from that dataset.
  * - Coordinate formatting is controlled by pfmt.ref (-r):
@@ -69,12 +69,14 @@
  *     1: chrm beg0 end0
  *     else: chrm_beg1
  *
- * Value printing (print_cdata1)
- * -----------------------------
- * Printing is format-specific:
+ * Value printing (print_value)
+ * ----------------------------
+ * Records are not inflated: each column is walked by a cdata_cursor_t and
+ * the value of the run covering row i is printed (fmt5 is the exception and
+ * is decompressed first). Printing is format-specific:
  * - fmt0: bit (0/1)
  * - fmt1: raw byte/ASCII value
- * - fmt2: state label string (f2_get_string)
+ * - fmt2: state label string (the key the state index points to)
  * - fmt3: controlled by pfmt.data (-f):
  *     0 : print packed MU uint64
  *    <0 : print "M<TAB>U"
@@ -85,13 +87,14 @@
  *    <0 : print "value<TAB>universe" (e.g., 1<tab>1 / 0<tab>1 / NA<tab>0)
  *     0 : print 0/1, NA coded as '2'
  *    >0 : print raw 2-bit code (FMT6_2BIT)
- * - fmt7: prints coordinates via row_reader_t (fmt7_next_bed), not a scalar value.
+ * - fmt7: prints coordinates (the cursor's chromosome and position), not a scalar value.
  *
  * Chunked printing (-c / -s)
  * --------------------------
- * In chunk mode, unpack repeatedly decompresses each selected record, slices a contiguous
- * row block of size s, and prints it. This reduces peak memory compared to inflating the
- * full vector. Format 7 chunking is not supported (explicitly rejected).
+ * In chunk mode, unpack decodes a contiguous row block of size s from each selected record
+ * (decompress_range(), starting at the nearest row checkpoint) and prints it. This reduces
+ * peak memory compared to inflating the full vector. Format 7 chunking is not supported
+ * (explicitly rejected).
  *
  * Header printing (-C)
  * --------------------
@@ -162,23 +165,30 @@ typedef struct cdata_pfmt_t {
   int ref;
 } cdata_pfmt_t;
 
-int fmt7_next_bed(cdata_t *c);
-static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
+/* print one value as the cursor reports it (see cdata_cursor_t); fmt2 needs
+   c->aux for its keys, fmt7 takes the chromosome name separately */
+static void print_value(const cdata_t *c, uint64_t v, const char *chrm, cdata_pfmt_t pfmt) {
   switch (c->fmt) {
   case '0': {
-      fputc(((c->s[i>>3]>>(i&0x7))&0x1)+'0', stdout);
+      fputc(v+'0', stdout);
       break;
   }
   case '1': {
-    fputc(c->s[i], stdout);
+    fputc(v, stdout);
     break;
   }
   case '2': {
-    fprintf(stdout, "%s", f2_get_string(c, i));
+    f2_aux_t *aux = (f2_aux_t*) c->aux;
+    if (v >= aux->nk) {
+      fprintf(stderr, "[%s:%d] State data is corrupted.\n", __func__, __LINE__);
+      fflush(stderr);
+      exit(1);
+    }
+    fputs(aux->keys[v], stdout);
     break;
   }
   case '3': {
-    uint64_t mu = f3_get_mu(c, i);
+    uint64_t mu = v;
     if (pfmt.data == 0)
       fprintf(stdout, "%"PRIu64"", mu);
     else if (pfmt.data < 0)
@@ -192,25 +202,26 @@ static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
     break;
   }
   case '4': {
-    if (((float_t*) (c->s))[i]<0) {
+    uint32_t w = v; float f; memcpy(&f, &w, sizeof(float));
+    if (f<0) {
       fputs("NA", stdout);
     } else {
-      fprintf(stdout, "%1.3f", ((float_t*) (c->s))[i]);
+      fprintf(stdout, "%1.3f", f);
     }
     break;
   }
   case '5': {
-    if (c->s[i] == 2) {
+    if (v == 2) {
       fputs("NA", stdout);
     } else {
-      fputc(c->s[i]+'0', stdout);
+      fputc(v+'0', stdout);
     }
     break;
   }
   case '6': {
     if (pfmt.data < 0) {
-      if (FMT6_IN_UNI(*c, i)) {
-        if (FMT6_IN_SET(*c, i)) {
+      if (v & 0x2) {
+        if (v & 0x1) {
           fputs("1\t1", stdout);
         } else {
           fputs("0\t1", stdout);
@@ -219,8 +230,8 @@ static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
         fputs("NA\t0", stdout);
       }
     } else if (pfmt.data == 0) {
-      if (FMT6_IN_UNI(*c, i)) {
-        if (FMT6_IN_SET(*c, i)) {
+      if (v & 0x2) {
+        if (v & 0x1) {
           fputc('1', stdout);
         } else {
           fputc('0', stdout);
@@ -229,29 +240,17 @@ static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
         fputc('2', stdout);
       }
     } else {
-      fputc('0'+FMT6_2BIT(*c, i), stdout);
+      fputc('0'+v, stdout);
     }
     break;
   }
   case '7': {
-    if (!fmt7_next_bed(c)) {
-      fprintf(stderr, "[%s:%d] next BED record unfound.\n", __func__, __LINE__);
-      fflush(stderr);
-      exit(1);
-    }
-    row_reader_t *rdr = (row_reader_t*) c->aux;
-    if (rdr->index != i+1) {
-      fprintf(stderr, "[%s:%d] row reader index mismatch (i=%"PRIu64", rdr.index=%"PRIu64").\n",
-              __func__, __LINE__, i, rdr->index);
-      fflush(stderr);
-      exit(1);
-    }
     if (pfmt.ref == 0) {
-      fprintf(stdout, "%s\t%"PRIu64"\t%"PRIu64"", rdr->chrm, rdr->value-1, rdr->value+1);
+      fprintf(stdout, "%s\t%"PRIu64"\t%"PRIu64"", chrm, v-1, v+1);
     } else if (pfmt.ref == 1) {
-      fprintf(stdout, "%s\t%"PRIu64"\t%"PRIu64"", rdr->chrm, rdr->value-1, rdr->value);
+      fprintf(stdout, "%s\t%"PRIu64"\t%"PRIu64"", chrm, v-1, v);
     } else {
-      fprintf(stdout, "%s_%"PRIu64"", rdr->chrm, rdr->value);
+      fprintf(stdout, "%s_%"PRIu64"", chrm, v);
     }
     break;
   }
@@ -259,6 +258,21 @@ static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
   }
 }
 
+/* row i of an inflated record */
+static void print_cdata1(cdata_t *c, uint64_t i, cdata_pfmt_t pfmt) {
+  uint64_t v = 0;
+  switch (c->fmt) {
+  case '0': v = (c->s[i>>3]>>(i&0x7))&0x1; break;
+  case '1': case '5': v = c->s[i]; break;
+  case '2': v = f2_get_uint64(c, i); break;
+  case '3': v = f3_get_mu(c, i); break;
+  case '4': { float b = fmt4_value(c, i); uint32_t w; memcpy(&w, &b, 4); v = w; break; }
+  case '6': v = FMT6_2BIT(*c, i); break;
+  default: usage(); wzfatal("Unrecognized format: %c.\n", c->fmt);
+  }
+  print_value(c, v, NULL, pfmt);
+}
+
 static void print_cdata_chunk(cdata_v *cs, uint64_t s, cdata_pfmt_t pfmt) {
 
   if (ref_cdata_v(cs, 0)->fmt == '7') {
@@ -268,13 +282,12 @@ static void print_cdata_chunk(cdata_v *cs, uint64_t s, cdata_pfmt_t pfmt) {
   }
   
   uint64_t i,m, k, kn = cs->size;
-  cdata_t expanded = decompress(*ref_cdata_v(cs, 0));
-  uint64_t n = expanded.n;
+  uint64_t n = cdata_n(ref_cdata_v(cs, 0));
   cdata_t *sliced = calloc(kn, sizeof(cdata_t));
-  for (m=0; m <= n/s; ++m) {
-    for (k=0; k<kn; ++k) {
-      expanded = decompress(*ref_cdata_v(cs, k));
-      slice(&expanded, m*s, (m+1)*s-1, &sliced[k]);
+  for (m=0; m*s < n; ++m) {
+    for (k=0; k<kn; ++k) { // decode only this chunk, from the nearest checkpoint
+      free_cdata(&sliced[k]);
+      sliced[k] = decompress_range(ref_cdata_v(cs, k), m*s, (m+1)*s-1);
     }
     for (i=0; i<sliced[0].n; ++i) {
       for (k=0; k<kn; ++k) {
@@ -285,47 +298,61 @@ static void print_cdata_chunk(cdata_v *cs, uint64_t s, cdata_pfmt_t pfmt) {
     }
   }
 
-  for (k=0; k<kn; ++k) free(sliced[k].s);
-  free(expanded.s); free(sliced);
+  for (k=0; k<kn; ++k) free_cdata(&sliced[k]);
+  free(sliced);
 }
 
+/* the records stay compressed: one cursor per column walks its runs along
+   the rows (fmt5 has no cursor over its packed form and is inflated) */
 static void print_cdata(cdata_v *cs, cdata_pfmt_t pfmt, char *fname_row) {
-  uint64_t i, k, kn = cs->size;
-  cdata_t *inflated = calloc(kn, sizeof(cdata_t));
-  for (k=0; k<kn; ++k) {
-    cdata_t *c = ref_cdata_v(cs,k);
-    if (c->fmt == '7') { // inflating format 7 is expensive
-      memcpy(inflated+k, c, sizeof(cdata_t));
-      inflated[k].s = malloc(c->n);
-      memcpy(inflated[k].s, c->s, c->n);
+  uint64_t i, k, kn = cs->size + 1;   // column 0 is the -R coordinates, if any
+  cdata_t *cols = calloc(kn, sizeof(cdata_t));
+  cdata_cursor_t *curs = calloc(kn, sizeof(cdata_cursor_t));
+  int *own = calloc(kn, sizeof(int));
+
+  if (fname_row) {
+    cfile_t cf_row = open_cfile(fname_row);
+    cols[0] = read_cdata1(&cf_row);
+    cdata_detach(&cols[0]);
+    cfile_close(&cf_row);
+    own[0] = 1;
+  }
+  for (k=1; k<kn; ++k) {
+    cdata_t *c = ref_cdata_v(cs,k-1);
+    if (c->fmt == '5') {
+      cols[k] = decompress(*c);
+      own[k] = 1;
     } else {
-      inflated[k] = decompress(*c);
+      cols[k] = *c;
     }
   }
-
-  uint64_t n = 0;
-  if (inflated[0].fmt == '7') {
-    n = fmt7_data_length(&inflated[0]);
-  } else {
-    n = inflated[0].n;
+  for (k=0; k<kn; ++k) {
+    if (!cols[k].s) continue;
+    if (cols[k].fmt == '2' && !cols[k].aux) fmt2_set_aux(&cols[k]);
+    cdata_cursor_init(&curs[k], &cols[k]);
   }
 
-  cdata_t cr = {0};
-  if (fname_row) {
-    cfile_t cf_row = open_cfile(fname_row);
-    cr = read_cdata1(&cf_row);
-  }
+  uint64_t n = kn > 1 ? cdata_n(&cols[1]) : 0;
+
   for (i=0; i<n; ++i) {
-    if (cr.s) print_cdata1(&cr, i, pfmt);
     for (k=0; k<kn; ++k) {
-      if(k || cr.s) fputc('\t', stdout);
-      print_cdata1(inflated+k, i, pfmt);
+      if (!cols[k].s) continue;
+      cdata_cursor_t *cur = &curs[k];
+      if (i >= cur->row + cur->n && !cdata_cursor_next(cur)) {
+        fprintf(stderr, "[%s:%d] Record %"PRIu64" ends before row %"PRIu64".\n", __func__, __LINE__, k, i+1);
+        fflush(stderr);
+        exit(1);
+      }
+      if (k > 1 || (k == 1 && cols[0].s)) fputc('\t', stdout);
+      print_value(&cols[k], cur->v, cur->chrm, pfmt);
     }
     fputc('\n', stdout);
   }
-  if (cr.s) free_cdata(&cr);
-  for (k=0; k<kn; ++k) free_cdata(&inflated[k]);
-  free(inflated);
+  for (k=0; k<kn; ++k) {
+    if (own[k]) free_cdata(&cols[k]);
+    else if (k) ref_cdata_v(cs,k-1)->aux = cols[k].aux; // fmt2 keys, freed with cs
+  }
+  free(cols); free(curs); free(own);
 }
 
 int main_unpack(int argc, char *argv[]) {
@@ -362,14 +389,19 @@ int main_unpack(int argc, char *argv[]) {
 
   char *fname_in = strdup(argv[optind]);
   cfile_t cf = open_cfile(fname_in);
-  char *fname_index = get_fname_index(fname_in);
-  index_t *idx = loadIndex(fname_index);
-  if (fname_index) free(fname_index);
+  // names resolve through the mapped .bidx when it is fresh
+  bindex_t *bidx = strcmp(fname_in, "-") ? loadBinaryIndex(fname_in) : NULL;
+  index_t *idx = NULL;
+  if (!bidx) {
+    char *fname_index = get_fname_index(fname_in);
+    idx = loadIndex(fname_index);
+    if (fname_index) free(fname_index);
+  }
 
   snames_t snames = {0};
   if (optind + 1 < argc) {      // The requested sample names from command line
     for(int i = optind + 1; i < argc; ++i) {
-      snames.s = realloc(snames.s, (snames.n+1));
+      snames.s = realloc(snames.s, (snames.n+1)*sizeof(char*));
       snames.s[snames.n++] = strdup(argv[i]);
     }
   } else {                      // from a file list
@@ -377,7 +409,7 @@ int main_unpack(int argc, char *argv[]) {
   }
 
   // check if we have index
-  if ((tail > 0 && !idx) || (snames.n > 0 && strcmp(fname_in, "-") != 0 && !idx)) {
+  if ((tail > 0 && !idx && !bidx) || (snames.n > 0 && strcmp(fname_in, "-") != 0 && !idx && !bidx)) {
     fprintf(stderr, "Error, the cx file needs indexing for random sample access.\n");
     fflush(stderr);
     exit(1);
@@ -385,14 +417,14 @@ int main_unpack(int argc, char *argv[]) {
 
   // read in the cdata
   cdata_v *cs = NULL;
-  if (idx && snames.n > 0) {
-    cs = read_cdata_with_snames(&cf, idx, &snames);
+  if ((idx || bidx) && snames.n > 0) {
+    cs = read_cdata_with_snames(&cf, bidx, idx, &snames);
   } else if (read_all) {
     cs = read_cdata_all(&cf);
   } else if (head > 0) {
     cs = read_cdata_from_head(&cf, head);
   } else if (tail > 0) {
-    cs = read_cdata_from_tail(&cf, idx, tail);
+    cs = read_cdata_from_tail(&cf, bidx, idx, tail);
   } else {
     cs = read_cdata_from_head(&cf, 1);
   }
@@ -411,7 +443,17 @@ int main_unpack(int argc, char *argv[]) {
   // output headers
   if (print_column_names) {
     if (!snames.n) {
-      if (idx) {
+      if (bidx) {                 // names point into the pool; snames takes bidx over
+        int n0 = bidx->n, beg = 0;
+        if (read_all) snames.n = n0;
+        else if (head > 0) snames.n = head < n0 ? head : n0;
+        else if (tail > 0) { snames.n = tail < n0 ? tail : n0; beg = n0 - snames.n; }
+        else snames.n = 1;
+        snames.s = calloc(snames.n, sizeof(char*));
+        for (int i=0; i<snames.n; ++i) snames.s[i] = (char*) bindex_name(bidx, beg+i);
+        snames.bidx = bidx;
+        bidx = NULL;
+      } else if (idx) {
         int n0 = 0;
         index_pair_t *idx_pairs = index_pairs(idx, &n0);
         if (read_all) {
@@ -456,9 +498,10 @@ int main_unpack(int argc, char *argv[]) {
   // clean up
   for (uint64_t i=0; i<cs->size; ++i) free_cdata(ref_cdata_v(cs,i));
   free_cdata_v(cs);
-  bgzf_close(cf.fh);
+  cfile_close(&cf);
   free(fname_in);
   if (idx) cleanIndex(idx);
+  freeBinaryIndex(bidx);
   cleanSampleNames(&snames);
   
   return 0;
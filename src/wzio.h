@@ -184,12 +184,12 @@ static inline void line_get_fields(const char *line, const char *sep, char ***fi
   *fields = calloc(*nfields, sizeof(char *));
   char *working = calloc(strlen(line) + 1, sizeof(char));
   strcpy(working, line);
-  char *tok; int i;
+  char *tok, *save; int i;
 
-  tok = strtok(working, sep);
+  tok = strtok_r(working, sep, &save);
   for (i=0; tok != NULL; ++i) {
     (*fields)[i] = strdup(tok);
-    tok = strtok(NULL, sep);
+    tok = strtok_r(NULL, sep, &save);
   }
   free(working);
 }